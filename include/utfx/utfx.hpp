@@ -1,8 +1,72 @@
 #ifndef __UTFX_UTFX_HPP__
 #define __UTFX_UTFX_HPP__
+#include <array>
 #include <cstdint>
+#include <cstring>
 #include <iterator>
+#include <memory>
+#if defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+#endif
+#include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <vector>
+#if !defined(UTFX_NO_IOSTREAMS)
+#include <istream>
+#include <ostream>
+#include <streambuf>
+#endif
+#if !defined(UTFX_NO_THREADS)
+#include <system_error>
+#include <thread>
+#endif
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+// SIMD fast paths are compiled for x86-64 and selected at runtime from the
+// CPU features reported by cpuid.  Define UTFX_NO_SIMD to build the scalar
+// paths only.
+#if !defined(UTFX_NO_SIMD) && (defined(__x86_64__) || defined(_M_X64))
+#define UTFX_SIMD_X86_64 1
+#include <immintrin.h>
+#if !defined(_MSC_VER) || defined(__clang__)
+#include <cpuid.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define UTFX_TARGET(features) __attribute__((target(features)))
+#else
+#define UTFX_TARGET(features)
+#endif
+#define UTFX_TARGET_SSE42 UTFX_TARGET("sse4.2,popcnt")
+#define UTFX_TARGET_AVX2 UTFX_TARGET("avx2,bmi,bmi2,popcnt")
+#define UTFX_TARGET_AVX512                                             \
+  UTFX_TARGET("avx512f,avx512bw,avx512vl,avx512vbmi,avx512vbmi2,bmi," \
+              "bmi2,popcnt")
+
+// The multi-threaded validators need <thread>; define UTFX_NO_THREADS to
+// leave them out.  Likewise the transcoding streams need the iostream
+// headers; define UTFX_NO_IOSTREAMS to leave them out.
+
+// Lets constexpr functions take the SIMD paths only at runtime.
+#if defined(__cpp_lib_is_constant_evaluated)
+#define UTFX_IS_CONSTANT_EVALUATED() std::is_constant_evaluated()
+#elif (defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 9) || \
+    (defined(_MSC_VER) && _MSC_VER >= 1925)
+#define UTFX_IS_CONSTANT_EVALUATED() __builtin_is_constant_evaluated()
+#elif defined(__has_builtin)
+#if __has_builtin(__builtin_is_constant_evaluated)
+#define UTFX_IS_CONSTANT_EVALUATED() __builtin_is_constant_evaluated()
+#endif
+#endif
+#if !defined(UTFX_IS_CONSTANT_EVALUATED)
+#define UTFX_IS_CONSTANT_EVALUATED() false
+#endif
 
 namespace utfx {
 
@@ -17,6 +81,118 @@ enum class endian {
   native = __BYTE_ORDER__
 #endif
 };
+
+/// Why validate_utf8/validate_utf16/validate_utf32 rejected the input.
+enum class utf_error : unsigned char {
+  none,
+  /// A sequence is cut short by the end of the input or by a unit that
+  /// cannot continue it (UTF-16: a high surrogate at the end).
+  truncated,
+  /// UTF-8 encoding longer than needed (C0, C1, E0 80..9F, F0 80..8F).
+  overlong,
+  /// An encoded U+D800..U+DFFF, or an unpaired UTF-16 surrogate.
+  surrogate,
+  /// Above U+10FFFF, including the UTF-8 lead bytes F5..FF.
+  out_of_range,
+  /// A UTF-8 continuation byte where a lead byte is expected.
+  stray_continuation,
+  /// A UTF-16/UTF-32 byte order mark that contradicts the requested endian.
+  byte_order_mark,
+  /// A valid code point the output cannot hold: above U+00FF for Latin-1.
+  unrepresentable,
+};
+
+/// Result of the validate_* functions.  offset is in code units (bytes for
+/// UTF-8) from the start of the data: the start of the first invalid
+/// sequence, or the whole length when valid.
+struct validation_result {
+  bool valid;
+  size_t offset;
+  utf_error error;
+
+  constexpr explicit operator bool() const noexcept { return valid; }
+};
+
+/// Why a bounded transcode stopped.
+enum class transcode_status : unsigned char {
+  /// All of the input was consumed.
+  ok,
+  /// The next code point does not fit in what is left of the output.
+  output_full,
+  /// The input is ill-formed at consumed (on_error::stop only).
+  invalid_input,
+};
+
+/// Result of the bounded transcode overloads.  consumed counts input units
+/// and always ends on a code point boundary, so converting the rest of the
+/// input later continues exactly where this call stopped; written counts
+/// output units.  error says why the input is ill-formed when status is
+/// invalid_input.
+struct transcode_result {
+  size_t consumed;
+  size_t written;
+  transcode_status status;
+  utf_error error;
+
+  constexpr explicit operator bool() const noexcept {
+    return status == transcode_status::ok;
+  }
+};
+
+/// Result of the allocating transcode_batch overloads: the converted
+/// strings back to back in data, string i at [offsets[i], offsets[i + 1]).
+template <typename CharOut, typename Offset>
+struct transcoded_batch {
+  std::basic_string<CharOut> data;
+  std::vector<Offset> offsets;
+};
+
+/// What transcode does with ill-formed input, chosen by passing one of
+/// these tags as its last argument.  The policy only comes into play once
+/// the input turns out to be ill-formed, so valid input is converted at
+/// the same speed under all of them.
+namespace on_error {
+/// Drop ill-formed sequences (the default).
+struct skip_t {
+  explicit constexpr skip_t() = default;
+};
+/// Write U+FFFD for each maximal subpart of an ill-formed sequence, as the
+/// Unicode Standard (section 3.9) recommends.
+struct replace_t {
+  explicit constexpr replace_t() = default;
+};
+/// End the conversion before the first ill-formed sequence.
+struct stop_t {
+  explicit constexpr stop_t() = default;
+};
+/// Throw conversion_error at the first ill-formed sequence.
+struct throw_exception_t {
+  explicit constexpr throw_exception_t() = default;
+};
+
+inline constexpr skip_t skip{};
+inline constexpr replace_t replace{};
+inline constexpr stop_t stop{};
+inline constexpr throw_exception_t throw_exception{};
+}  // namespace on_error
+
+/// Thrown by transcode under on_error::throw_exception.  offset counts
+/// input units from the start of the input.
+class conversion_error : public std::runtime_error {
+ public:
+  conversion_error(utf_error error, size_t offset)
+      : std::runtime_error("utfx: ill-formed input"),
+        error_(error),
+        offset_(offset) {}
+
+  utf_error error() const noexcept { return error_; }
+  size_t offset() const noexcept { return offset_; }
+
+ private:
+  utf_error error_;
+  size_t offset_;
+};
+
 namespace detail {
 using codepoint = uint32_t;
 constexpr inline codepoint illegal = 0xFFFFFFFFu;
@@ -78,6 +254,49 @@ constexpr T swap_bytes(T x) noexcept {
   }
 }
 
+inline int countl_zero(uint64_t x) noexcept {
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long i;
+  return _BitScanReverse64(&i, x) ? 63 - static_cast<int>(i) : 64;
+#else
+  return x == 0 ? 64 : __builtin_clzll(x);
+#endif
+}
+
+inline int countr_zero(uint64_t x) noexcept {
+#if defined(_MSC_VER) && !defined(__clang__)
+  unsigned long i;
+  return _BitScanForward64(&i, x) ? static_cast<int>(i) : 64;
+#else
+  return x == 0 ? 64 : __builtin_ctzll(x);
+#endif
+}
+
+// Returns the first byte in [p, e) that is not ASCII, or e.  At runtime the
+// bytes are tested eight at a time; constant evaluation takes the plain loop.
+template <typename CharT>
+constexpr const CharT* skip_ascii(const CharT* p, const CharT* e) noexcept {
+  static_assert(sizeof(CharT) == 1, "skip_ascii works on UTF-8 code units");
+  if (!UTFX_IS_CONSTANT_EVALUATED()) {
+    constexpr uint64_t high_bits = UINT64_C(0x8080808080808080);
+    while (e - p >= 8) {
+      uint64_t word = 0;
+      std::memcpy(&word, p, sizeof(word));
+      word &= high_bits;
+      if (word != 0) {
+        const int bit = endian::native == endian::little ? countr_zero(word)
+                                                         : countl_zero(word);
+        return p + bit / 8;
+      }
+      p += 8;
+    }
+  }
+  while (p != e && static_cast<unsigned char>(*p) < 0x80) {
+    ++p;
+  }
+  return p;
+}
+
 template <typename CharT, size_t = sizeof(CharT)>
 struct utf_traits;
 
@@ -161,7 +380,7 @@ struct utf_traits<CharT, 1> {
           return incomplete;
         }
         tmp = *p++;
-        if (!trail_length(tmp)) {
+        if (!is_trail(tmp)) {
           return illegal;
         }
         c = ((c << 6) | (tmp & 0x3F));
@@ -171,7 +390,7 @@ struct utf_traits<CharT, 1> {
           return incomplete;
         }
         tmp = *p++;
-        if (!trail_length(tmp)) {
+        if (!is_trail(tmp)) {
           return illegal;
         }
         c = ((c << 6) | (tmp & 0x3F));
@@ -181,7 +400,7 @@ struct utf_traits<CharT, 1> {
           return incomplete;
         }
         tmp = *p++;
-        if (!trail_length(tmp)) {
+        if (!is_trail(tmp)) {
           return illegal;
         }
         c = ((c << 6) | (tmp & 0x3F));
@@ -320,6 +539,9 @@ struct utf_traits<CharT, 2> {
       return w1;
     }
     uint16_t w2 = *current++;
+    if (e != endian::native) {
+      w2 = swap_bytes(w2);
+    }
     return combine_surrogate(w1, w2);
   }
   constexpr static int width(codepoint u) noexcept {
@@ -397,518 +619,6436 @@ struct utf_traits<CharT, 4> {
   }
 };  // utf32
 
-}  // namespace detail
+// Scalar reference validator, also used for the tails of the SIMD kernels.
+inline bool is_utf8_scalar(const unsigned char* begin,
+                           const unsigned char* end) noexcept {
+  while (begin != end) {
+    begin = skip_ascii(begin, end);
+    if (begin == end) {
+      break;
+    }
+    const codepoint c = utf_traits<char>::decode(begin, end);
+    if (c == incomplete || c == illegal) {
+      return false;
+    }
+  }
+  return true;
+}
 
-// ============================================================================
-// utf8_char — A single UTF-8 code point (1–4 bytes) within a larger string.
-// ============================================================================
-class utf8_char {
- public:
-  using value_type = char;
-  using pointer = const char*;
-  using const_pointer = const char*;
-  using iterator = const char*;
-  using const_iterator = const char*;
-  using size_type = size_t;
+// Checks the UTF-8 sequence at p, which must be before e.  Returns its
+// length, or 0 with the reason in error.
+inline size_t check_utf8_sequence(const unsigned char* p,
+                                  const unsigned char* e,
+                                  utf_error& error) noexcept {
+  const unsigned char lead = p[0];
+  if (lead < 0x80) {
+    return 1;
+  }
+  if (lead < 0xC0) {
+    error = utf_error::stray_continuation;
+    return 0;
+  }
+  if (lead < 0xC2) {
+    error = utf_error::overlong;
+    return 0;
+  }
+  if (lead > 0xF4) {
+    error = utf_error::out_of_range;
+    return 0;
+  }
+  const size_t len = lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+  if (e - p < 2 || !utf_traits<char>::is_trail(p[1])) {
+    error = utf_error::truncated;
+    return 0;
+  }
+  // The second byte range decides overlong, surrogate and > U+10FFFF.
+  const unsigned char second = p[1];
+  if ((lead == 0xE0 && second < 0xA0) || (lead == 0xF0 && second < 0x90)) {
+    error = utf_error::overlong;
+    return 0;
+  }
+  if (lead == 0xED && second > 0x9F) {
+    error = utf_error::surrogate;
+    return 0;
+  }
+  if (lead == 0xF4 && second > 0x8F) {
+    error = utf_error::out_of_range;
+    return 0;
+  }
+  for (size_t i = 2; i < len; ++i) {
+    if (static_cast<size_t>(e - p) <= i ||
+        !utf_traits<char>::is_trail(p[i])) {
+      error = utf_error::truncated;
+      return 0;
+    }
+  }
+  return len;
+}
 
-  constexpr utf8_char() noexcept : data_(nullptr), len_(0) {}
-  constexpr utf8_char(const char* data, size_type len) noexcept
-      : data_(data), len_(len) {}
+// Validates [p, end); offsets are reported from base.
+inline validation_result validate_utf8_scalar(
+    const unsigned char* base, const unsigned char* p,
+    const unsigned char* end) noexcept {
+  while (p != end) {
+    p = skip_ascii(p, end);
+    if (p == end) {
+      break;
+    }
+    utf_error error = utf_error::none;
+    const size_t len = check_utf8_sequence(p, end, error);
+    if (len == 0) {
+      return validation_result{false, static_cast<size_t>(p - base), error};
+    }
+    p += len;
+  }
+  return validation_result{true, static_cast<size_t>(end - base),
+                           utf_error::none};
+}
 
-  /// Pointer to the raw UTF-8 bytes of this character.
-  constexpr const char* data() const noexcept { return data_; }
-  /// Number of bytes (1–4).
-  constexpr size_type size() const noexcept { return len_; }
-  /// Number of bytes (1–4).
-  constexpr size_type length() const noexcept { return len_; }
-  /// Number of bytes (1–4).
-  constexpr size_type byte_size() const noexcept { return len_; }
+// ============================================================================
+// simd — vectorized kernels and runtime CPU dispatch.
+//
+// Kernels are plain functions tagged with UTFX_TARGET_* so that the rest of
+// the header can be compiled without any -m flags; active_isa() decides at
+// runtime which of them may be called.
+// ============================================================================
+namespace simd {
 
-  constexpr const char* begin() const noexcept { return data_; }
-  constexpr const char* end() const noexcept { return data_ + len_; }
-  constexpr const char* cbegin() const noexcept { return data_; }
-  constexpr const char* cend() const noexcept { return data_ + len_; }
+// avx512 stands for the Ice Lake feature set: F, BW, VL, VBMI and VBMI2.
+enum class isa : unsigned { scalar = 0, sse42 = 1, avx2 = 2, avx512 = 3 };
 
-  /// The decoded Unicode code point (char32_t).
-  constexpr detail::codepoint code_point() const noexcept {
-    if (len_ == 0) {
-      return detail::illegal;
-    }
-    const char* p = data_;
-    return detail::utf_traits<char>::decode_valid(p);
+#if defined(UTFX_SIMD_X86_64)
+inline void cpuid(unsigned leaf, unsigned subleaf, unsigned regs[4]) noexcept {
+#if defined(_MSC_VER) && !defined(__clang__)
+  int r[4];
+  __cpuidex(r, static_cast<int>(leaf), static_cast<int>(subleaf));
+  for (int i = 0; i < 4; ++i) {
+    regs[i] = static_cast<unsigned>(r[i]);
   }
+#else
+  __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
 
-  constexpr char operator[](size_type i) const noexcept { return data_[i]; }
-  constexpr bool empty() const noexcept { return len_ == 0; }
+inline uint64_t xgetbv0() noexcept {
+#if defined(_MSC_VER) && !defined(__clang__)
+  return _xgetbv(0);
+#else
+  unsigned lo, hi;
+  __asm__ __volatile__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+  return (static_cast<uint64_t>(hi) << 32) | lo;
+#endif
+}
 
-  friend constexpr bool operator==(utf8_char a, utf8_char b) noexcept {
-    return a.code_point() == b.code_point();
-  }
-  friend constexpr bool operator!=(utf8_char a, utf8_char b) noexcept {
-    return !(a == b);
+inline isa detect_isa() noexcept {
+  unsigned regs[4];
+  cpuid(0, 0, regs);
+  const unsigned max_leaf = regs[0];
+  cpuid(1, 0, regs);
+  const bool ssse3 = (regs[2] >> 9) & 1;
+  const bool sse42 = (regs[2] >> 20) & 1;
+  const bool popcnt = (regs[2] >> 23) & 1;
+  const bool osxsave = (regs[2] >> 27) & 1;
+  const bool avx = (regs[2] >> 28) & 1;
+  if (!ssse3 || !sse42 || !popcnt) {
+    return isa::scalar;
   }
-  friend constexpr bool operator<(utf8_char a, utf8_char b) noexcept {
-    return a.code_point() < b.code_point();
+  // The OS must save the YMM state before AVX registers can be used.
+  if (!osxsave || !avx || max_leaf < 7) {
+    return isa::sse42;
   }
-  friend constexpr bool operator<=(utf8_char a, utf8_char b) noexcept {
-    return a.code_point() <= b.code_point();
+  const uint64_t xcr0 = xgetbv0();
+  if ((xcr0 & 0x6) != 0x6) {
+    return isa::sse42;
   }
-  friend constexpr bool operator>(utf8_char a, utf8_char b) noexcept {
-    return a.code_point() > b.code_point();
+  cpuid(7, 0, regs);
+  const bool bmi1 = (regs[1] >> 3) & 1;
+  const bool avx2 = (regs[1] >> 5) & 1;
+  const bool bmi2 = (regs[1] >> 8) & 1;
+  if (!avx2 || !bmi1 || !bmi2) {
+    return isa::sse42;
   }
-  friend constexpr bool operator>=(utf8_char a, utf8_char b) noexcept {
-    return a.code_point() >= b.code_point();
+  const bool avx512f = (regs[1] >> 16) & 1;
+  const bool avx512bw = (regs[1] >> 30) & 1;
+  const bool avx512vl = (regs[1] >> 31) & 1;
+  const bool avx512vbmi = (regs[2] >> 1) & 1;
+  const bool avx512vbmi2 = (regs[2] >> 6) & 1;
+  // ... and the opmask and ZMM state for AVX-512.
+  if (!avx512f || !avx512bw || !avx512vl || !avx512vbmi || !avx512vbmi2 ||
+      (xcr0 & 0xE6) != 0xE6) {
+    return isa::avx2;
   }
+  return isa::avx512;
+}
+#else
+inline isa detect_isa() noexcept { return isa::scalar; }
+#endif
 
- private:
-  const char* data_;
-  size_type len_;
+/// The widest instruction set usable on this CPU, detected once.
+inline isa active_isa() noexcept {
+  static const isa level = detect_isa();
+  return level;
+}
+
+inline bool cpu_supports(isa level) noexcept {
+  return static_cast<unsigned>(active_isa()) >= static_cast<unsigned>(level);
+}
+
+/// Progress of a transcoding kernel, in code units.  Kernels stop on a code
+/// point boundary at the first block they cannot handle (invalid input, or
+/// a case the kernel leaves to the scalar loop).
+struct kernel_result {
+  size_t read;
+  size_t written;
 };
 
-// ============================================================================
-// utf8_view — A lightweight, read-only view over UTF-8 encoded text.
-//
-// Provides an interface similar to std::string_view, but iterates over
-// Unicode code points (utf8_char) rather than raw bytes.
-//
-// Complexity notes:
-//   size(), operator[], substr(), and remove_prefix/remove_suffix are O(n)
-//   in the number of code points (they must scan UTF-8 boundaries).
-//   byte_size(), data(), empty(), begin(), end() are O(1).
-// ============================================================================
-class utf8_view {
- public:
-  // --- Member types ---
-  using value_type = utf8_char;
-  using size_type = size_t;
-  using difference_type = ptrdiff_t;
-  using reference = utf8_char;
-  using const_reference = utf8_char;
+#if defined(UTFX_SIMD_X86_64)
+// UTF-8 validation after Keiser & Lemire, "Validating UTF-8 In Less Than One
+// Instruction Per Byte".  Every pair of adjacent bytes is classified through
+// three 16-entry tables (high nibble of the first byte, low nibble of the
+// first byte, high nibble of the second byte); a non-zero AND of the three
+// lookups is an error.  The remaining checks cover 3- and 4-byte sequences
+// and sequences truncated at the end of the input.
+namespace utf8_check {
+constexpr uint8_t too_short = 1 << 0;
+constexpr uint8_t too_long = 1 << 1;
+constexpr uint8_t overlong_3 = 1 << 2;
+constexpr uint8_t too_large = 1 << 3;
+constexpr uint8_t surrogate = 1 << 4;
+constexpr uint8_t overlong_2 = 1 << 5;
+constexpr uint8_t too_large_1000 = 1 << 6;
+constexpr uint8_t overlong_4 = 1 << 6;
+constexpr uint8_t two_conts = 1 << 7;
+constexpr uint8_t carry = too_short | too_long | two_conts;
 
-  /// Forward iterator that decodes UTF-8 on the fly.
-  class iterator {
-   public:
-    using iterator_category = std::forward_iterator_tag;
-    using value_type = utf8_char;
-    using difference_type = ptrdiff_t;
-    using pointer = void;
-    using reference = utf8_char;
+// Indexed by the high nibble of the first byte.
+constexpr uint8_t byte_1_high[16] = {
+    // 0_______ ________ <ASCII in byte 1>
+    too_long, too_long, too_long, too_long, too_long, too_long, too_long,
+    too_long,
+    // 10______ ________ <continuation in byte 1>
+    two_conts, two_conts, two_conts, two_conts,
+    // 1100____ ________ <two byte lead in byte 1>
+    too_short | overlong_2,
+    // 1101____ ________ <two byte lead in byte 1>
+    too_short,
+    // 1110____ ________ <three byte lead in byte 1>
+    too_short | overlong_3 | surrogate,
+    // 1111____ ________ <four+ byte lead in byte 1>
+    too_short | too_large | too_large_1000 | overlong_4};
 
-    constexpr iterator() noexcept : pos_(nullptr) {}
+// Indexed by the low nibble of the first byte.
+constexpr uint8_t byte_1_low[16] = {
+    // ____0000 ________
+    carry | overlong_3 | overlong_2 | overlong_4,
+    // ____0001 ________
+    carry | overlong_2,
+    // ____001_ ________
+    carry, carry,
+    // ____0100 ________
+    carry | too_large,
+    // ____0101 ________
+    carry | too_large | too_large_1000,
+    // ____011_ ________
+    carry | too_large | too_large_1000, carry | too_large | too_large_1000,
+    // ____1___ ________
+    carry | too_large | too_large_1000, carry | too_large | too_large_1000,
+    carry | too_large | too_large_1000, carry | too_large | too_large_1000,
+    carry | too_large | too_large_1000,
+    // ____1101 ________
+    carry | too_large | too_large_1000 | surrogate,
+    carry | too_large | too_large_1000, carry | too_large | too_large_1000};
 
-    constexpr reference operator*() const noexcept {
-      int trail = detail::utf_traits<char>::trail_length(*pos_);
-      size_type len = trail < 0 ? 1 : static_cast<size_type>(trail + 1);
-      return utf8_char(pos_, len);
-    }
+// Indexed by the high nibble of the second byte.
+constexpr uint8_t byte_2_high[16] = {
+    // ________ 0_______ <ASCII in byte 2>
+    too_short, too_short, too_short, too_short, too_short, too_short,
+    too_short, too_short,
+    // ________ 1000____
+    too_long | overlong_2 | two_conts | overlong_3 | too_large_1000 |
+        overlong_4,
+    // ________ 1001____
+    too_long | overlong_2 | two_conts | overlong_3 | too_large,
+    // ________ 101_____
+    too_long | overlong_2 | two_conts | surrogate | too_large,
+    too_long | overlong_2 | two_conts | surrogate | too_large,
+    // ________ 11______
+    too_short, too_short, too_short, too_short};
 
-    constexpr iterator& operator++() noexcept {
-      int trail = detail::utf_traits<char>::trail_length(*pos_);
-      pos_ += trail < 0 ? 1 : static_cast<size_type>(trail + 1);
-      return *this;
-    }
+// A lead byte in one of the last three positions of a block that needs more
+// bytes than the block has left.
+constexpr uint8_t incomplete_max[64] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xF0 - 1, 0xE0 - 1, 0xC0 - 1};
+}  // namespace utf8_check
 
-    constexpr iterator operator++(int) noexcept {
-      iterator tmp = *this;
-      ++(*this);
-      return tmp;
-    }
+// --- SSE4.2: 16 bytes per register, 64 bytes per step ---
 
-    constexpr bool operator==(const iterator& other) const noexcept {
-      return pos_ == other.pos_;
+struct utf8_checker_sse42 {
+  __m128i error;
+  __m128i prev_input;
+  __m128i prev_incomplete;
+};
+
+template <int N>
+UTFX_TARGET_SSE42 inline __m128i prev_sse42(__m128i input, __m128i prev) {
+  return _mm_alignr_epi8(input, prev, 16 - N);
+}
+
+UTFX_TARGET_SSE42 inline __m128i lookup_sse42(const uint8_t* table,
+                                              __m128i index) {
+  return _mm_shuffle_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(table)), index);
+}
+
+UTFX_TARGET_SSE42 inline __m128i check_utf8_bytes_sse42(__m128i input,
+                                                        __m128i prev_input) {
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+  const __m128i prev1 = prev_sse42<1>(input, prev_input);
+  const __m128i b1h = lookup_sse42(
+      utf8_check::byte_1_high,
+      _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble));
+  const __m128i b1l =
+      lookup_sse42(utf8_check::byte_1_low, _mm_and_si128(prev1, nibble));
+  const __m128i b2h = lookup_sse42(
+      utf8_check::byte_2_high,
+      _mm_and_si128(_mm_srli_epi16(input, 4), nibble));
+  const __m128i special = _mm_and_si128(_mm_and_si128(b1h, b1l), b2h);
+
+  const __m128i prev2 = prev_sse42<2>(input, prev_input);
+  const __m128i prev3 = prev_sse42<3>(input, prev_input);
+  const __m128i is_third = _mm_subs_epu8(prev2, _mm_set1_epi8(0xE0 - 0x80));
+  const __m128i is_fourth = _mm_subs_epu8(prev3, _mm_set1_epi8(0xF0 - 0x80));
+  const __m128i must23_80 = _mm_and_si128(_mm_or_si128(is_third, is_fourth),
+                                          _mm_set1_epi8(char(0x80)));
+  return _mm_xor_si128(must23_80, special);
+}
+
+UTFX_TARGET_SSE42 inline void check_utf8_block_sse42(utf8_checker_sse42& st,
+                                                     const uint8_t* p) {
+  const __m128i in0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  const __m128i in1 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 16));
+  const __m128i in2 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 32));
+  const __m128i in3 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 48));
+  const __m128i any =
+      _mm_or_si128(_mm_or_si128(in0, in1), _mm_or_si128(in2, in3));
+  if (_mm_movemask_epi8(any) == 0) {
+    st.error = _mm_or_si128(st.error, st.prev_incomplete);
+    return;
+  }
+  st.error = _mm_or_si128(st.error, check_utf8_bytes_sse42(in0, st.prev_input));
+  st.error = _mm_or_si128(st.error, check_utf8_bytes_sse42(in1, in0));
+  st.error = _mm_or_si128(st.error, check_utf8_bytes_sse42(in2, in1));
+  st.error = _mm_or_si128(st.error, check_utf8_bytes_sse42(in3, in2));
+  st.prev_incomplete = _mm_subs_epu8(
+      in3, _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+               utf8_check::incomplete_max + 48)));
+  st.prev_input = in3;
+}
+
+// The kernels return the offset of the 64-byte block in which the first
+// error shows up (len for a sequence cut by the end of the input), or
+// no_error_block.  The error itself starts in that block or in the last
+// three bytes before it; utf8_error_after_block() pinpoints it.
+constexpr size_t no_error_block = ~size_t(0);
+
+UTFX_TARGET_SSE42 inline size_t utf8_error_block_sse42(const char* data,
+                                                       size_t len) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+  utf8_checker_sse42 st{_mm_setzero_si128(), _mm_setzero_si128(),
+                        _mm_setzero_si128()};
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    check_utf8_block_sse42(st, p + i);
+    if (_mm_testz_si128(st.error, st.error) == 0) {
+      return i;
     }
-    constexpr bool operator!=(const iterator& other) const noexcept {
-      return !(*this == other);
+  }
+  if (i < len) {
+    // Zero padding is ASCII, so a sequence cut by the end of the input is
+    // reported as too short.
+    uint8_t tail[64] = {};
+    std::memcpy(tail, p + i, len - i);
+    check_utf8_block_sse42(st, tail);
+    if (_mm_testz_si128(st.error, st.error) == 0) {
+      return i;
     }
+  }
+  return _mm_testz_si128(st.prev_incomplete, st.prev_incomplete) == 0
+             ? len
+             : no_error_block;
+}
 
-   private:
-    friend class utf8_view;
-    constexpr explicit iterator(const char* pos) noexcept : pos_(pos) {}
-    const char* pos_;
-  };
+UTFX_TARGET_SSE42 inline bool validate_utf8_sse42(const char* data,
+                                                  size_t len) {
+  return utf8_error_block_sse42(data, len) == no_error_block;
+}
 
-  using const_iterator = iterator;
+// --- AVX2: 32 bytes per register, 64 bytes per step ---
 
-  // --- Construction ---
-  constexpr utf8_view() noexcept : data_(nullptr), byte_size_(0) {}
+struct utf8_checker_avx2 {
+  __m256i error;
+  __m256i prev_input;
+  __m256i prev_incomplete;
+};
 
-  /// Construct from a null-terminated C-string.
-  /*implicit*/ constexpr utf8_view(const char* str) noexcept
-      : data_(str), byte_size_(str ? std::char_traits<char>::length(str) : 0) {}
+template <int N>
+UTFX_TARGET_AVX2 inline __m256i prev_avx2(__m256i input, __m256i prev) {
+  return _mm256_alignr_epi8(
+      input, _mm256_permute2x128_si256(prev, input, 0x21), 16 - N);
+}
 
-  /// Construct from a pointer and byte length.
-  constexpr utf8_view(const char* str, size_type len) noexcept
-      : data_(str), byte_size_(len) {}
+UTFX_TARGET_AVX2 inline __m256i lookup_avx2(const uint8_t* table,
+                                            __m256i index) {
+  return _mm256_shuffle_epi8(
+      _mm256_broadcastsi128_si256(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(table))),
+      index);
+}
 
-  /// Construct from std::string.
-  /*implicit*/ utf8_view(const std::string& str) noexcept
-      : data_(str.data()), byte_size_(str.size()) {}
+UTFX_TARGET_AVX2 inline __m256i check_utf8_bytes_avx2(__m256i input,
+                                                      __m256i prev_input) {
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  const __m256i prev1 = prev_avx2<1>(input, prev_input);
+  const __m256i b1h = lookup_avx2(
+      utf8_check::byte_1_high,
+      _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+  const __m256i b1l =
+      lookup_avx2(utf8_check::byte_1_low, _mm256_and_si256(prev1, nibble));
+  const __m256i b2h = lookup_avx2(
+      utf8_check::byte_2_high,
+      _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+  const __m256i special = _mm256_and_si256(_mm256_and_si256(b1h, b1l), b2h);
 
-  /// Construct from std::string_view.
-  /*implicit*/ constexpr utf8_view(std::string_view sv) noexcept
-      : data_(sv.data()), byte_size_(sv.size()) {}
+  const __m256i prev2 = prev_avx2<2>(input, prev_input);
+  const __m256i prev3 = prev_avx2<3>(input, prev_input);
+  const __m256i is_third =
+      _mm256_subs_epu8(prev2, _mm256_set1_epi8(0xE0 - 0x80));
+  const __m256i is_fourth =
+      _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xF0 - 0x80));
+  const __m256i must23_80 = _mm256_and_si256(
+      _mm256_or_si256(is_third, is_fourth), _mm256_set1_epi8(char(0x80)));
+  return _mm256_xor_si256(must23_80, special);
+}
 
-  // --- Iterators ---
-  constexpr iterator begin() const noexcept { return iterator(data_); }
-  constexpr iterator end() const noexcept {
-    return iterator(data_ + byte_size_);
+UTFX_TARGET_AVX2 inline void check_utf8_block_avx2(utf8_checker_avx2& st,
+                                                   const uint8_t* p) {
+  const __m256i in0 = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+  const __m256i in1 =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 32));
+  if (_mm256_movemask_epi8(_mm256_or_si256(in0, in1)) == 0) {
+    st.error = _mm256_or_si256(st.error, st.prev_incomplete);
+    return;
   }
-  constexpr const_iterator cbegin() const noexcept { return begin(); }
-  constexpr const_iterator cend() const noexcept { return end(); }
+  st.error =
+      _mm256_or_si256(st.error, check_utf8_bytes_avx2(in0, st.prev_input));
+  st.error = _mm256_or_si256(st.error, check_utf8_bytes_avx2(in1, in0));
+  st.prev_incomplete = _mm256_subs_epu8(
+      in1, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+               utf8_check::incomplete_max + 32)));
+  st.prev_input = in1;
+}
 
-  // --- Size / capacity ---
-  /// Number of code points. O(n) — scans the entire view.
-  constexpr size_type size() const noexcept {
-    size_type count = 0;
-    for (auto it = begin(); it != end(); ++it) {
-      ++count;
+UTFX_TARGET_AVX2 inline size_t utf8_error_block_avx2(const char* data,
+                                                     size_t len) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+  utf8_checker_avx2 st{_mm256_setzero_si256(), _mm256_setzero_si256(),
+                       _mm256_setzero_si256()};
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    check_utf8_block_avx2(st, p + i);
+    if (_mm256_testz_si256(st.error, st.error) == 0) {
+      return i;
     }
-    return count;
   }
-  /// Number of code points. O(n).
-  constexpr size_type length() const noexcept { return size(); }
-  /// Number of raw bytes. O(1).
-  constexpr size_type byte_size() const noexcept { return byte_size_; }
-  /// True if the view contains no bytes. O(1).
-  constexpr bool empty() const noexcept { return byte_size_ == 0; }
-  /// Maximum possible size.
-  static constexpr size_type npos = ~size_type(0);
-  constexpr size_type max_size() const noexcept { return npos - 1; }
+  if (i < len) {
+    uint8_t tail[64] = {};
+    std::memcpy(tail, p + i, len - i);
+    check_utf8_block_avx2(st, tail);
+    if (_mm256_testz_si256(st.error, st.error) == 0) {
+      return i;
+    }
+  }
+  return _mm256_testz_si256(st.prev_incomplete, st.prev_incomplete) == 0
+             ? len
+             : no_error_block;
+}
 
-  // --- Element access ---
-  /// Pointer to the raw underlying bytes. O(1).
-  constexpr const char* data() const noexcept { return data_; }
+UTFX_TARGET_AVX2 inline bool validate_utf8_avx2(const char* data, size_t len) {
+  return utf8_error_block_avx2(data, len) == no_error_block;
+}
 
-  /// First code point. O(1). UB if empty.
-  constexpr utf8_char front() const noexcept {
-    int trail = detail::utf_traits<char>::trail_length(*data_);
-    size_type len = trail < 0 ? 1 : static_cast<size_type>(trail + 1);
-    return utf8_char(data_, len);
+// --- AVX-512: one 64-byte register per step, masked loads for the tail ---
+
+template <int N>
+UTFX_TARGET_AVX512 inline __m512i prev_avx512(__m512i input, __m512i prev) {
+  // Lane k of the inner alignr is lane k-1 of input (lane 3 of prev for
+  // k == 0), which turns the per-lane alignr into a whole-register shift.
+  return _mm512_alignr_epi8(input, _mm512_alignr_epi32(input, prev, 12),
+                            16 - N);
+}
+
+UTFX_TARGET_AVX512 inline __m512i lookup_avx512(const uint8_t* table,
+                                                __m512i index) {
+  return _mm512_shuffle_epi8(
+      _mm512_broadcast_i32x4(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(table))),
+      index);
+}
+
+UTFX_TARGET_AVX512 inline __m512i check_utf8_bytes_avx512(__m512i input,
+                                                          __m512i prev_input) {
+  const __m512i nibble = _mm512_set1_epi8(0x0F);
+  const __m512i prev1 = prev_avx512<1>(input, prev_input);
+  const __m512i b1h = lookup_avx512(
+      utf8_check::byte_1_high,
+      _mm512_and_si512(_mm512_srli_epi16(prev1, 4), nibble));
+  const __m512i b1l =
+      lookup_avx512(utf8_check::byte_1_low, _mm512_and_si512(prev1, nibble));
+  const __m512i b2h = lookup_avx512(
+      utf8_check::byte_2_high,
+      _mm512_and_si512(_mm512_srli_epi16(input, 4), nibble));
+  const __m512i special = _mm512_and_si512(_mm512_and_si512(b1h, b1l), b2h);
+
+  const __m512i prev2 = prev_avx512<2>(input, prev_input);
+  const __m512i prev3 = prev_avx512<3>(input, prev_input);
+  const __m512i is_third =
+      _mm512_subs_epu8(prev2, _mm512_set1_epi8(0xE0 - 0x80));
+  const __m512i is_fourth =
+      _mm512_subs_epu8(prev3, _mm512_set1_epi8(0xF0 - 0x80));
+  const __m512i must23_80 = _mm512_and_si512(
+      _mm512_or_si512(is_third, is_fourth), _mm512_set1_epi8(char(0x80)));
+  return _mm512_xor_si512(must23_80, special);
+}
+
+// The low n bits set.  bzhi only reads the low byte of the index, so n is
+// clamped first.
+UTFX_TARGET_AVX512 inline __mmask64 load_mask_avx512(size_t n) {
+  return _bzhi_u64(~uint64_t(0), static_cast<unsigned>(n < 64 ? n : 64));
+}
+
+UTFX_TARGET_AVX512 inline size_t utf8_error_block_avx512(const char* data,
+                                                         size_t len) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+  const __m512i incomplete_max = _mm512_loadu_si512(utf8_check::incomplete_max);
+  __m512i prev_input = _mm512_setzero_si512();
+  __m512i prev_incomplete = _mm512_setzero_si512();
+  for (size_t i = 0; i < len; i += 64) {
+    // Masked-off bytes read as zero (ASCII), as with the padded tail above.
+    const __m512i input =
+        _mm512_maskz_loadu_epi8(load_mask_avx512(len - i), p + i);
+    __m512i error = prev_incomplete;
+    if (_mm512_movepi8_mask(input) != 0) {
+      error = check_utf8_bytes_avx512(input, prev_input);
+      prev_incomplete = _mm512_subs_epu8(input, incomplete_max);
+      prev_input = input;
+    }
+    if (_mm512_test_epi8_mask(error, error) != 0) {
+      return i;
+    }
   }
+  return _mm512_test_epi8_mask(prev_incomplete, prev_incomplete) != 0
+             ? len
+             : no_error_block;
+}
 
-  /// Last code point. O(last-character-length). UB if empty.
-  constexpr utf8_char back() const noexcept {
-    const char* p = data_ + byte_size_;
-    while (p > data_ && detail::utf_traits<char>::is_trail(*(p - 1))) {
-      --p;
+UTFX_TARGET_AVX512 inline bool validate_utf8_avx512(const char* data,
+                                                    size_t len) {
+  return utf8_error_block_avx512(data, len) == no_error_block;
+}
+
+// UTF-32 validation: each lane is byte-swapped in-register when needed
+// (pshufb with a per-call index vector, the identity for native input),
+// then checked for > U+10FFFF and for U+D800..U+DFFF.  UTF-32 has no
+// multi-unit sequences, so the kernels return the start of the first block
+// holding an error (or the end of the last whole block) and the scalar
+// loop pinpoints the error from there.
+
+UTFX_TARGET_SSE42 inline __m128i utf32_byte_order_sse42(bool swap) {
+  return swap ? _mm_setr_epi8(3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14,
+                              13, 12)
+              : _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13,
+                              14, 15);
+}
+
+UTFX_TARGET_SSE42 inline __m128i utf32_errors_sse42(const char32_t* p,
+                                                    __m128i order) {
+  const __m128i v = _mm_shuffle_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)), order);
+  // Biasing by 0x80000000 turns the signed compare into an unsigned one.
+  const __m128i too_large =
+      _mm_cmpgt_epi32(_mm_xor_si128(v, _mm_set1_epi32(INT32_MIN)),
+                      _mm_set1_epi32(INT32_MIN + 0x10FFFF));
+  const __m128i surrogate =
+      _mm_cmpeq_epi32(_mm_and_si128(v, _mm_set1_epi32(~0x7FF)),
+                      _mm_set1_epi32(0xD800));
+  return _mm_or_si128(too_large, surrogate);
+}
+
+UTFX_TARGET_SSE42 inline size_t utf32_valid_prefix_sse42(const char32_t* in,
+                                                         size_t len,
+                                                         bool swap) {
+  const __m128i order = utf32_byte_order_sse42(swap);
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    const __m128i error = _mm_or_si128(
+        _mm_or_si128(utf32_errors_sse42(in + i, order),
+                     utf32_errors_sse42(in + i + 4, order)),
+        _mm_or_si128(utf32_errors_sse42(in + i + 8, order),
+                     utf32_errors_sse42(in + i + 12, order)));
+    if (_mm_testz_si128(error, error) == 0) {
+      break;
     }
-    --p;
-    return utf8_char(p, static_cast<size_type>(data_ + byte_size_ - p));
   }
+  return i;
+}
 
-  /// Nth code point. O(n). UB if n >= size().
-  constexpr utf8_char operator[](size_type n) const noexcept {
-    auto it = begin();
-    while (n-- > 0) {
-      ++it;
+UTFX_TARGET_AVX2 inline __m256i utf32_errors_avx2(const char32_t* p,
+                                                  __m256i order) {
+  const __m256i v = _mm256_shuffle_epi8(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), order);
+  const __m256i max = _mm256_set1_epi32(0x10FFFF);
+  const __m256i too_large =
+      _mm256_xor_si256(_mm256_cmpeq_epi32(_mm256_min_epu32(v, max), v),
+                       _mm256_set1_epi32(-1));
+  const __m256i surrogate =
+      _mm256_cmpeq_epi32(_mm256_and_si256(v, _mm256_set1_epi32(~0x7FF)),
+                         _mm256_set1_epi32(0xD800));
+  return _mm256_or_si256(too_large, surrogate);
+}
+
+UTFX_TARGET_AVX2 inline size_t utf32_valid_prefix_avx2(const char32_t* in,
+                                                       size_t len, bool swap) {
+  const __m256i order =
+      _mm256_broadcastsi128_si256(utf32_byte_order_sse42(swap));
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    const __m256i error = _mm256_or_si256(
+        _mm256_or_si256(utf32_errors_avx2(in + i, order),
+                        utf32_errors_avx2(in + i + 8, order)),
+        _mm256_or_si256(utf32_errors_avx2(in + i + 16, order),
+                        utf32_errors_avx2(in + i + 24, order)));
+    if (_mm256_testz_si256(error, error) == 0) {
+      break;
     }
-    return *it;
   }
+  return i;
+}
 
-  // --- Modifiers (view-level) ---
-  /// Remove the first n code points from the view. O(n).
-  constexpr void remove_prefix(size_type n) noexcept {
-    while (n-- > 0 && byte_size_ > 0) {
-      int trail = detail::utf_traits<char>::trail_length(*data_);
-      size_type len = trail < 0 ? 1 : static_cast<size_type>(trail + 1);
-      data_ += len;
-      byte_size_ -= len;
+// Masked-off lanes read as zero, which is valid, so the tail needs no
+// special case.
+UTFX_TARGET_AVX512 inline __mmask16 utf32_errors_avx512(const char32_t* p,
+                                                        size_t n,
+                                                        __m512i order) {
+  const __m512i v = _mm512_shuffle_epi8(
+      _mm512_maskz_loadu_epi32(
+          static_cast<__mmask16>(load_mask_avx512(n)), p),
+      order);
+  return _mm512_cmpgt_epu32_mask(v, _mm512_set1_epi32(0x10FFFF)) |
+         _mm512_cmpeq_epi32_mask(
+             _mm512_and_si512(v, _mm512_set1_epi32(~0x7FF)),
+             _mm512_set1_epi32(0xD800));
+}
+
+UTFX_TARGET_AVX512 inline size_t utf32_valid_prefix_avx512(const char32_t* in,
+                                                           size_t len,
+                                                           bool swap) {
+  const __m512i order =
+      _mm512_broadcast_i32x4(utf32_byte_order_sse42(swap));
+  size_t i = 0;
+  for (; i < len; i += 64) {
+    const size_t n = len - i;
+    const __mmask16 error =
+        utf32_errors_avx512(in + i, n, order) |
+        utf32_errors_avx512(in + i + 16, n < 16 ? 0 : n - 16, order) |
+        utf32_errors_avx512(in + i + 32, n < 32 ? 0 : n - 32, order) |
+        utf32_errors_avx512(in + i + 48, n < 48 ? 0 : n - 48, order);
+    if (error != 0) {
+      return i;
     }
   }
+  return len;
+}
 
-  /// Remove the last n code points from the view. O(n).
-  constexpr void remove_suffix(size_type n) noexcept {
-    while (n-- > 0 && byte_size_ > 0) {
-      const char* p = data_ + byte_size_;
-      while (p > data_ && detail::utf_traits<char>::is_trail(*(p - 1))) {
-        --p;
+UTFX_TARGET_AVX512 inline __m512i swap_bytes16_avx512(__m512i v) {
+  return _mm512_or_si512(_mm512_slli_epi16(v, 8), _mm512_srli_epi16(v, 8));
+}
+
+constexpr uint8_t byte_index[64] = {
+    0,  1,  2,  3,  4,  5,  6,  7,  8,  9,  10, 11, 12, 13, 14, 15,
+    16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31,
+    32, 33, 34, 35, 36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47,
+    48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58, 59, 60, 61, 62, 63};
+
+// UTF-16 validation.  The high byte of every unit is gathered by a byte
+// shuffle -- taking the even bytes instead of the odd ones is the whole
+// cost of byte-swapped input -- and compared against D8..DB (high
+// surrogate) and DC..DF (low surrogate) to give one bit per unit.  The
+// input is valid iff every low surrogate directly follows a high one:
+// low == (high << 1 | carry), where carry is a high surrogate ending the
+// previous block.  The kernels return how many units from the start are
+// known valid, stopping on a code point boundary before the first error
+// (or short of the end); the scalar loop checks the rest.
+
+// pshufb indices gathering the high byte of 8 units into the low half.
+UTFX_TARGET_SSE42 inline __m128i utf16_high_bytes_sse42(bool swap) {
+  return swap ? _mm_setr_epi8(0, 2, 4, 6, 8, 10, 12, 14, -1, -1, -1, -1, -1,
+                              -1, -1, -1)
+              : _mm_setr_epi8(1, 3, 5, 7, 9, 11, 13, 15, -1, -1, -1, -1, -1,
+                              -1, -1, -1);
+}
+
+UTFX_TARGET_SSE42 inline size_t utf16_valid_prefix_sse42(const char16_t* in,
+                                                         size_t len,
+                                                         bool swap) {
+  const __m128i gather = utf16_high_bytes_sse42(swap);
+  const __m128i surrogate_bits = _mm_set1_epi8(char(0xFC));
+  const __m128i high = _mm_set1_epi8(char(0xD8));
+  const __m128i low = _mm_set1_epi8(char(0xDC));
+  uint64_t carry = 0;
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    const __m128i* p = reinterpret_cast<const __m128i*>(in + i);
+    const __m128i hi0 = _mm_and_si128(
+        _mm_unpacklo_epi64(_mm_shuffle_epi8(_mm_loadu_si128(p), gather),
+                           _mm_shuffle_epi8(_mm_loadu_si128(p + 1), gather)),
+        surrogate_bits);
+    const __m128i hi1 = _mm_and_si128(
+        _mm_unpacklo_epi64(_mm_shuffle_epi8(_mm_loadu_si128(p + 2), gather),
+                           _mm_shuffle_epi8(_mm_loadu_si128(p + 3), gather)),
+        surrogate_bits);
+    const uint64_t h =
+        static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(hi0, high))) |
+        (static_cast<uint64_t>(static_cast<uint32_t>(
+             _mm_movemask_epi8(_mm_cmpeq_epi8(hi1, high))))
+         << 16);
+    const uint64_t l =
+        static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(hi0, low))) |
+        (static_cast<uint64_t>(static_cast<uint32_t>(
+             _mm_movemask_epi8(_mm_cmpeq_epi8(hi1, low))))
+         << 16);
+    if (l != (((h << 1) | carry) & 0xFFFFFFFFu)) {
+      return i - carry;
+    }
+    carry = h >> 31;
+  }
+  return i - carry;
+}
+
+UTFX_TARGET_AVX2 inline uint64_t utf16_mask_avx2(__m256i hi, __m256i value) {
+  return static_cast<uint32_t>(
+      _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, value)));
+}
+
+// The high bytes of 32 units at p, in order.  pshufb works within 128-bit
+// lanes, so the two halves come out interleaved and are put back in order
+// by a 64-bit permute.
+UTFX_TARGET_AVX2 inline __m256i utf16_high_bytes_avx2(const char16_t* p,
+                                                      __m256i gather) {
+  const __m256i a = _mm256_shuffle_epi8(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)), gather);
+  const __m256i b = _mm256_shuffle_epi8(
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + 16)), gather);
+  return _mm256_permute4x64_epi64(_mm256_unpacklo_epi64(a, b), 0xD8);
+}
+
+UTFX_TARGET_AVX2 inline size_t utf16_valid_prefix_avx2(const char16_t* in,
+                                                       size_t len, bool swap) {
+  const __m256i gather =
+      _mm256_broadcastsi128_si256(utf16_high_bytes_sse42(swap));
+  const __m256i surrogate_bits = _mm256_set1_epi8(char(0xFC));
+  const __m256i high = _mm256_set1_epi8(char(0xD8));
+  const __m256i low = _mm256_set1_epi8(char(0xDC));
+  uint64_t carry = 0;
+  size_t i = 0;
+  for (; i + 64 <= len; i += 64) {
+    const __m256i hi0 = _mm256_and_si256(utf16_high_bytes_avx2(in + i, gather),
+                                         surrogate_bits);
+    const __m256i hi1 = _mm256_and_si256(
+        utf16_high_bytes_avx2(in + i + 32, gather), surrogate_bits);
+    const uint64_t h =
+        utf16_mask_avx2(hi0, high) | (utf16_mask_avx2(hi1, high) << 32);
+    const uint64_t l =
+        utf16_mask_avx2(hi0, low) | (utf16_mask_avx2(hi1, low) << 32);
+    if (l != ((h << 1) | carry)) {
+      return i - carry;
+    }
+    carry = h >> 63;
+  }
+  return i - carry;
+}
+
+// AVX-512 gathers the high bytes of 64 units from two registers with a
+// single two-source byte permute and handles the tail with masked loads;
+// units past the end read as zero, so a high surrogate before them fails
+// the pairing check and is left to the scalar loop.
+UTFX_TARGET_AVX512 inline size_t utf16_valid_prefix_avx512(const char16_t* in,
+                                                           size_t len,
+                                                           bool swap) {
+  const __m512i gather = _mm512_add_epi8(
+      _mm512_add_epi8(_mm512_loadu_si512(byte_index),
+                      _mm512_loadu_si512(byte_index)),
+      _mm512_set1_epi8(swap ? 0 : 1));
+  const __m512i surrogate_bits = _mm512_set1_epi8(char(0xFC));
+  const __m512i high = _mm512_set1_epi8(char(0xD8));
+  const __m512i low = _mm512_set1_epi8(char(0xDC));
+  uint64_t carry = 0;
+  size_t i = 0;
+  for (; i < len; i += 64) {
+    const size_t n = len - i;
+    const __m512i a = _mm512_maskz_loadu_epi16(
+        static_cast<__mmask32>(load_mask_avx512(n)), in + i);
+    const __m512i b = _mm512_maskz_loadu_epi16(
+        static_cast<__mmask32>(load_mask_avx512(n < 32 ? 0 : n - 32)),
+        in + i + 32);
+    const __m512i hi = _mm512_and_si512(
+        _mm512_permutex2var_epi8(a, gather, b), surrogate_bits);
+    const uint64_t h = _mm512_cmpeq_epi8_mask(hi, high);
+    const uint64_t l = _mm512_cmpeq_epi8_mask(hi, low);
+    if (l != ((h << 1) | carry)) {
+      return i - carry;
+    }
+    carry = h >> 63;
+  }
+  return len - carry;
+}
+
+// UTF-8 -> UTF-16.  Each 64-byte block is validated as if it started a new
+// text (the kernel only ever stops on a code point boundary), the lead
+// bytes are compressed into a list of positions, and 16 code points at a
+// time are gathered into 32-bit lanes, decoded, split into surrogate pairs
+// and compressed into the output.
+UTFX_TARGET_AVX512 inline kernel_result utf8_to_utf16_avx512(const char* in,
+                                                             size_t len,
+                                                             char16_t* out,
+                                                             bool swap) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(in);
+  const __m512i iota = _mm512_loadu_si512(byte_index);
+  size_t i = 0;
+  size_t o = 0;
+  while (i < len) {
+    const size_t n = len - i < 64 ? len - i : 64;
+    const __mmask64 loaded = load_mask_avx512(n);
+    const __m512i input = _mm512_maskz_loadu_epi8(loaded, p + i);
+    if (_mm512_movepi8_mask(input) == 0) {
+      __m512i lo = _mm512_cvtepu8_epi16(_mm512_castsi512_si256(input));
+      __m512i hi = _mm512_cvtepu8_epi16(_mm512_extracti64x4_epi64(input, 1));
+      if (swap) {
+        lo = swap_bytes16_avx512(lo);
+        hi = swap_bytes16_avx512(hi);
+      }
+      _mm512_mask_storeu_epi16(out + o, static_cast<__mmask32>(loaded), lo);
+      if (n > 32) {
+        _mm512_mask_storeu_epi16(out + o + 32,
+                                 static_cast<__mmask32>(loaded >> 32), hi);
+      }
+      i += n;
+      o += n;
+      continue;
+    }
+
+    const __m512i error =
+        check_utf8_bytes_avx512(input, _mm512_setzero_si512());
+    const __mmask64 continuation = _mm512_cmpeq_epi8_mask(
+        _mm512_and_si512(input, _mm512_set1_epi8(char(0xC0))),
+        _mm512_set1_epi8(char(0x80)));
+    uint64_t leads = ~continuation & loaded;
+    if (leads == 0) {
+      break;
+    }
+    // Only the last sequence can run past the block; leave it for the
+    // next iteration.
+    const unsigned last = 63 - static_cast<unsigned>(countl_zero(leads));
+    const uint8_t last_lead = p[i + last];
+    const unsigned last_len =
+        last_lead < 0xC0 ? 1 : last_lead < 0xE0 ? 2 : last_lead < 0xF0 ? 3 : 4;
+    size_t end = n;
+    if (last + last_len > n) {
+      leads &= ~(uint64_t(1) << last);
+      end = last;
+    }
+    // A sequence that is cut short by the next lead byte reports its error
+    // on that byte, so the check includes position |end|.
+    if (end == 0 || (_mm512_test_epi8_mask(error, error) &
+                     load_mask_avx512(end + 1)) != 0) {
+      break;
+    }
+
+    __m512i positions = _mm512_maskz_compress_epi8(leads, iota);
+    const unsigned count = static_cast<unsigned>(_mm_popcnt_u64(leads));
+    for (unsigned g = 0; g < count; g += 16) {
+      const unsigned k = count - g < 16 ? count - g : 16;
+      const __mmask16 lanes = static_cast<__mmask16>(_bzhi_u32(0xFFFF, k));
+      // Gather bytes pos..pos+3 of every code point into one 32-bit lane.
+      __m512i index = _mm512_cvtepu8_epi32(_mm512_castsi512_si128(positions));
+      index = _mm512_add_epi32(
+          _mm512_mullo_epi32(index, _mm512_set1_epi32(0x01010101)),
+          _mm512_set1_epi32(0x03020100));
+      const __m512i w = _mm512_permutexvar_epi8(index, input);
+      positions = _mm512_alignr_epi32(_mm512_setzero_si512(), positions, 4);
+
+      const __m512i low6 = _mm512_set1_epi32(0x3F);
+      const __m512i b0 = _mm512_and_si512(w, _mm512_set1_epi32(0xFF));
+      const __m512i c1 = _mm512_and_si512(_mm512_srli_epi32(w, 8), low6);
+      const __m512i c2 = _mm512_and_si512(_mm512_srli_epi32(w, 16), low6);
+      const __m512i c3 = _mm512_srli_epi32(_mm512_slli_epi32(w, 2), 26);
+      const __mmask16 m2 = _mm512_cmpge_epu32_mask(b0, _mm512_set1_epi32(0xC0));
+      const __mmask16 m3 = _mm512_cmpge_epu32_mask(b0, _mm512_set1_epi32(0xE0));
+      const __mmask16 m4 =
+          _mm512_cmpge_epu32_mask(b0, _mm512_set1_epi32(0xF0)) & lanes;
+      __m512i cp = b0;
+      cp = _mm512_mask_mov_epi32(
+          cp, m2,
+          _mm512_or_si512(
+              _mm512_slli_epi32(_mm512_and_si512(b0, _mm512_set1_epi32(0x1F)),
+                                6),
+              c1));
+      cp = _mm512_mask_mov_epi32(
+          cp, m3,
+          _mm512_or_si512(
+              _mm512_or_si512(
+                  _mm512_slli_epi32(
+                      _mm512_and_si512(b0, _mm512_set1_epi32(0x0F)), 12),
+                  _mm512_slli_epi32(c1, 6)),
+              c2));
+      cp = _mm512_mask_mov_epi32(
+          cp, m4,
+          _mm512_or_si512(
+              _mm512_or_si512(
+                  _mm512_slli_epi32(
+                      _mm512_and_si512(b0, _mm512_set1_epi32(0x07)), 18),
+                  _mm512_slli_epi32(c1, 12)),
+              _mm512_or_si512(_mm512_slli_epi32(c2, 6), c3)));
+
+      // Supplementary code points become a high/low surrogate pair in the
+      // two halves of their lane.
+      const __m512i v = _mm512_sub_epi32(cp, _mm512_set1_epi32(0x10000));
+      const __m512i pair = _mm512_or_si512(
+          _mm512_or_si512(_mm512_set1_epi32(0xD800), _mm512_srli_epi32(v, 10)),
+          _mm512_slli_epi32(
+              _mm512_or_si512(_mm512_set1_epi32(0xDC00),
+                              _mm512_and_si512(v, _mm512_set1_epi32(0x3FF))),
+              16));
+      __m512i units = _mm512_mask_mov_epi32(cp, m4, pair);
+      if (swap) {
+        units = swap_bytes16_avx512(units);
+      }
+      const uint32_t keep =
+          _pdep_u32(lanes, 0x55555555u) | _pdep_u32(m4, 0xAAAAAAAAu);
+      const unsigned written = static_cast<unsigned>(_mm_popcnt_u32(keep));
+      _mm512_mask_storeu_epi16(out + o, _bzhi_u32(~0u, written),
+                               _mm512_maskz_compress_epi16(keep, units));
+      o += written;
+    }
+    i += end;
+  }
+  return kernel_result{i, o};
+}
+
+// UTF-16 -> UTF-8.  All-ASCII blocks of 32 units are narrowed directly.
+// Otherwise 16 units are widened to 32-bit lanes, surrogate pairs are
+// checked and combined using the next unit, each code point is encoded into
+// its lane and the 1-4 used bytes of every lane are compressed together.
+UTFX_TARGET_AVX512 inline kernel_result utf16_to_utf8_avx512(
+    const char16_t* in, size_t len, char* out, bool swap) {
+  const __m512i next_index = _mm512_set_epi16(
+      0, 31, 30, 29, 28, 27, 26, 25, 24, 23, 22, 21, 20, 19, 18, 17, 16, 15,
+      14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1);
+  size_t i = 0;
+  size_t o = 0;
+  while (i < len) {
+    const size_t n = len - i < 32 ? len - i : 32;
+    __m512i input = _mm512_maskz_loadu_epi16(
+        static_cast<__mmask32>(load_mask_avx512(n)), in + i);
+    if (swap) {
+      input = swap_bytes16_avx512(input);
+    }
+    if (_mm512_cmpge_epu16_mask(input, _mm512_set1_epi16(0x80)) == 0) {
+      _mm256_mask_storeu_epi8(out + o,
+                              static_cast<__mmask32>(load_mask_avx512(n)),
+                              _mm512_cvtepi16_epi8(input));
+      i += n;
+      o += n;
+      continue;
+    }
+
+    const unsigned m = n < 16 ? static_cast<unsigned>(n) : 16;
+    const __m512i w = _mm512_cvtepu16_epi32(_mm512_castsi512_si256(input));
+    const __m512i next = _mm512_cvtepu16_epi32(
+        _mm512_castsi512_si256(_mm512_permutexvar_epi16(next_index, input)));
+    const __m512i tag_mask = _mm512_set1_epi32(0xFC00);
+    __mmask16 lanes = static_cast<__mmask16>(_bzhi_u32(0xFFFF, m));
+    __mmask16 high = _mm512_cmpeq_epi32_mask(_mm512_and_si512(w, tag_mask),
+                                             _mm512_set1_epi32(0xD800)) &
+                     lanes;
+    const __mmask16 low = _mm512_cmpeq_epi32_mask(
+                              _mm512_and_si512(w, tag_mask),
+                              _mm512_set1_epi32(0xDC00)) &
+                          lanes;
+    const __mmask16 next_low = _mm512_cmpeq_epi32_mask(
+        _mm512_and_si512(next, tag_mask), _mm512_set1_epi32(0xDC00));
+    size_t read = m;
+    if ((high >> (m - 1)) & 1) {
+      if (m == n) {
+        // High surrogate at the very end: leave it to the scalar loop.
+        high &= ~(1u << (m - 1));
+        lanes &= ~(1u << (m - 1));
+        read = m - 1;
+      } else if ((next_low >> (m - 1)) & 1) {
+        read = m + 1;
+      }
+    }
+    const unsigned unpaired =
+        (high & ~next_low) | (low & ~static_cast<unsigned>(high << 1));
+    if (unpaired != 0 || read == 0) {
+      break;
+    }
+
+    const __m512i low10 = _mm512_set1_epi32(0x3FF);
+    const __m512i combined = _mm512_add_epi32(
+        _mm512_or_si512(_mm512_slli_epi32(_mm512_and_si512(w, low10), 10),
+                        _mm512_and_si512(next, low10)),
+        _mm512_set1_epi32(0x10000));
+    const __m512i cp = _mm512_mask_mov_epi32(w, high, combined);
+
+    const __mmask16 m2 = _mm512_cmpge_epu32_mask(cp, _mm512_set1_epi32(0x80));
+    const __mmask16 m3 = _mm512_cmpge_epu32_mask(cp, _mm512_set1_epi32(0x800));
+    const __mmask16 m4 = high;
+    __m512i length = _mm512_set1_epi32(1);
+    length = _mm512_mask_mov_epi32(length, m2, _mm512_set1_epi32(2));
+    length = _mm512_mask_mov_epi32(length, m3, _mm512_set1_epi32(3));
+    length = _mm512_mask_mov_epi32(length, m4, _mm512_set1_epi32(4));
+    length = _mm512_maskz_mov_epi32(lanes & ~low, length);
+
+    const __m512i cont = _mm512_set1_epi32(0x80);
+    const __m512i low6 = _mm512_set1_epi32(0x3F);
+    const __m512i t0 = _mm512_or_si512(cont, _mm512_and_si512(cp, low6));
+    const __m512i t1 = _mm512_or_si512(
+        cont, _mm512_and_si512(_mm512_srli_epi32(cp, 6), low6));
+    const __m512i t2 = _mm512_or_si512(
+        cont, _mm512_and_si512(_mm512_srli_epi32(cp, 12), low6));
+    __m512i bytes = cp;
+    bytes = _mm512_mask_mov_epi32(
+        bytes, m2,
+        _mm512_or_si512(_mm512_or_si512(_mm512_set1_epi32(0xC0),
+                                        _mm512_srli_epi32(cp, 6)),
+                        _mm512_slli_epi32(t0, 8)));
+    bytes = _mm512_mask_mov_epi32(
+        bytes, m3,
+        _mm512_or_si512(_mm512_or_si512(_mm512_set1_epi32(0xE0),
+                                        _mm512_srli_epi32(cp, 12)),
+                        _mm512_or_si512(_mm512_slli_epi32(t1, 8),
+                                        _mm512_slli_epi32(t0, 16))));
+    bytes = _mm512_mask_mov_epi32(
+        bytes, m4,
+        _mm512_or_si512(
+            _mm512_or_si512(_mm512_set1_epi32(0xF0), _mm512_srli_epi32(cp, 18)),
+            _mm512_or_si512(
+                _mm512_slli_epi32(t2, 8),
+                _mm512_or_si512(_mm512_slli_epi32(t1, 16),
+                                _mm512_slli_epi32(t0, 24)))));
+
+    const __mmask64 keep = _mm512_cmplt_epu8_mask(
+        _mm512_set1_epi32(0x03020100),
+        _mm512_mullo_epi32(length, _mm512_set1_epi32(0x01010101)));
+    const size_t written = static_cast<size_t>(_mm_popcnt_u64(keep));
+    _mm512_mask_storeu_epi8(out + o, load_mask_avx512(written),
+                            _mm512_maskz_compress_epi8(keep, bytes));
+    i += read;
+    o += written;
+  }
+  return kernel_result{i, o};
+}
+
+// UTF-8 -> UTF-16 with SSE4.2 and AVX2.  Input is converted in blocks of up
+// to 64 bytes that start on a code point boundary; a sequence cut by the end
+// of a block is left for the next one.  A block is converted by moving a
+// 12-byte window over it: the end-of-code-point bits under the window select
+// a pshufb pattern that places either six 1-2 byte code points in 16-bit
+// lanes or four 1-3 byte code points in 32-bit lanes, where a few masks and
+// shifts decode them.  ASCII runs are widened directly and 4-byte sequences
+// are decoded one at a time in scalar code.
+struct utf8_to_utf16_step {
+  uint16_t shuffle;  // index into utf8_to_utf16_table::shuffles
+  uint8_t consumed;  // input bytes
+  uint8_t count;     // code points; 0 for a leading 4-byte sequence
+};
+
+// Patterns [0, 729) use 16-bit lanes and are keyed by the sequence lengths
+// as base-3 digits; patterns [729, 985) use 32-bit lanes with base-4 keys.
+constexpr unsigned utf8_to_utf16_wide = 729;
+
+struct utf8_to_utf16_table {
+  utf8_to_utf16_step steps[4096];
+  uint8_t shuffles[utf8_to_utf16_wide + 256][16];
+};
+
+inline utf8_to_utf16_table make_utf8_to_utf16_table() {
+  utf8_to_utf16_table t{};
+  for (unsigned m = 0; m < 4096; ++m) {
+    unsigned lens[12] = {};
+    unsigned n = 0;
+    unsigned start = 0;
+    for (unsigned j = 0; j < 12; ++j) {
+      if ((m >> j) & 1) {
+        lens[n++] = j + 1 - start;
+        start = j + 1;
+      }
+    }
+    unsigned narrow = 0;
+    while (narrow < n && narrow < 6 && lens[narrow] <= 2) {
+      ++narrow;
+    }
+    unsigned wide = 0;
+    while (wide < n && wide < 4 && lens[wide] <= 3) {
+      ++wide;
+    }
+    if (narrow == 0 && wide == 0) {
+      continue;
+    }
+    const bool use_wide = wide > narrow;
+    const unsigned count = use_wide ? wide : narrow;
+    const unsigned lane = use_wide ? 4 : 2;
+    unsigned key = 0;
+    for (unsigned k = count; k-- > 0;) {
+      key = key * (use_wide ? 4 : 3) + lens[k];
+    }
+    const unsigned index = use_wide ? utf8_to_utf16_wide + key : key;
+    uint8_t* shuffle = t.shuffles[index];
+    for (unsigned k = 0; k < 16; ++k) {
+      shuffle[k] = 0x80;
+    }
+    // Lane k holds its code point's bytes last to first.
+    unsigned pos = 0;
+    for (unsigned k = 0; k < count; ++k) {
+      for (unsigned b = 0; b < lens[k]; ++b) {
+        shuffle[k * lane + b] = static_cast<uint8_t>(pos + lens[k] - 1 - b);
+      }
+      pos += lens[k];
+    }
+    t.steps[m] = utf8_to_utf16_step{static_cast<uint16_t>(index),
+                                    static_cast<uint8_t>(pos),
+                                    static_cast<uint8_t>(count)};
+  }
+  return t;
+}
+
+// Built on first use; as a constant expression it would add noticeably to
+// the compile time of every file including this header.
+inline const utf8_to_utf16_table& utf8_to_utf16_steps() {
+  static const utf8_to_utf16_table table = make_utf8_to_utf16_table();
+  return table;
+}
+
+inline uint64_t low_bits(size_t n) {
+  return n >= 64 ? ~uint64_t(0) : (uint64_t(1) << n) - 1;
+}
+
+// End of the last code point that is complete in the first n bytes of q,
+// given the lead (non-continuation) bytes among them.
+inline size_t utf8_complete_end(const uint8_t* q, size_t n, uint64_t leads) {
+  const unsigned last = 63 - static_cast<unsigned>(countl_zero(leads));
+  const uint8_t lead = q[last];
+  const unsigned len =
+      lead < 0xC0 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+  return last + len > n ? last : n;
+}
+
+// Bit masks over a block of up to 64 bytes.
+struct utf8_block_masks {
+  uint64_t non_ascii;
+  uint64_t leads;   // bytes that are not continuation bytes
+  uint64_t four;    // lead bytes of 4-byte sequences
+  uint64_t errors;  // bytes flagged when the block is checked on its own
+};
+
+// The pshufb pattern that puts units of Out in byte order.
+template <typename Out>
+UTFX_TARGET_SSE42 inline __m128i unit_byte_order_sse42(bool swap) {
+  if constexpr (sizeof(Out) == 4) {
+    return utf32_byte_order_sse42(swap);
+  }
+  return swap ? _mm_setr_epi8(1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15,
+                              14)
+              : _mm_setr_epi8(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14,
+                              15);
+}
+
+// Stores n registers of units at out, or only the first count units through
+// a staging buffer when the whole registers do not fit.
+template <typename Out, int N>
+UTFX_TARGET_SSE42 inline void store_units_sse42(Out* out, const __m128i (&v)[N],
+                                                size_t count, bool fits) {
+  constexpr size_t lanes = 16 / sizeof(Out);
+  if (fits) {
+    for (int k = 0; k < N; ++k) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + k * lanes), v[k]);
+    }
+  } else {
+    alignas(16) Out staged[N * lanes];
+    for (int k = 0; k < N; ++k) {
+      _mm_store_si128(reinterpret_cast<__m128i*>(staged + k * lanes), v[k]);
+    }
+    std::memcpy(out, staged, count * sizeof(Out));
+  }
+}
+
+// Widens the first Bytes (8 or 16) ASCII bytes of in to units at out.
+template <typename Out, int Bytes>
+UTFX_TARGET_SSE42 inline void widen_ascii_sse42(__m128i in, Out* out,
+                                                bool swap) {
+  if constexpr (sizeof(Out) == 2) {
+    const __m128i zero = _mm_setzero_si128();
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                     swap ? _mm_unpacklo_epi8(zero, in)
+                          : _mm_unpacklo_epi8(in, zero));
+    if constexpr (Bytes == 16) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8),
+                       swap ? _mm_unpackhi_epi8(zero, in)
+                            : _mm_unpackhi_epi8(in, zero));
+    }
+    return;
+  }
+  const __m128i expand =
+      swap ? _mm_setr_epi8(-1, -1, -1, 0, -1, -1, -1, 1, -1, -1, -1, 2, -1,
+                           -1, -1, 3)
+           : _mm_setr_epi8(0, -1, -1, -1, 1, -1, -1, -1, 2, -1, -1, -1, 3,
+                           -1, -1, -1);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out),
+                   _mm_shuffle_epi8(in, expand));
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4),
+                   _mm_shuffle_epi8(_mm_srli_si128(in, 4), expand));
+  if constexpr (Bytes == 16) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8),
+                     _mm_shuffle_epi8(_mm_srli_si128(in, 8), expand));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 12),
+                     _mm_shuffle_epi8(_mm_srli_si128(in, 12), expand));
+  }
+}
+
+// Converts q[0, end), which is valid UTF-8, to UTF-16 or UTF-32 and returns
+// the number of units written.  A step may store up to eight units past its
+// own output, as long as they stay below out + room; q must be readable up
+// to end + 16.
+template <typename Out>
+UTFX_TARGET_SSE42 inline size_t utf8_block_to_sse42(const uint8_t* q,
+                                                    size_t end,
+                                                    const utf8_block_masks& m,
+                                                    Out* out, bool swap,
+                                                    size_t room) {
+  const uint64_t ends =
+      ((m.leads >> 1) | (uint64_t(1) << (end - 1))) & low_bits(end);
+  const __m128i order = unit_byte_order_sse42<Out>(swap);
+  const utf8_to_utf16_table& table = utf8_to_utf16_steps();
+  size_t pos = 0;
+  size_t o = 0;
+  while (pos < end) {
+    const __m128i in =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(q + pos));
+    if (((m.non_ascii >> pos) & 0xFFFF) == 0 && pos + 16 <= end) {
+      widen_ascii_sse42<Out, 16>(in, out + o, swap);
+      pos += 16;
+      o += 16;
+      continue;
+    }
+    if (((m.non_ascii >> pos) & 0xFF) == 0 && pos + 8 <= end) {
+      widen_ascii_sse42<Out, 8>(in, out + o, swap);
+      pos += 8;
+      o += 8;
+      continue;
+    }
+    const utf8_to_utf16_step step = table.steps[(ends >> pos) & 0xFFF];
+    if (step.count == 0) {
+      const uint8_t* s = q + pos;
+      const uint32_t v = (uint32_t(s[0]) & 0x07) << 18 |
+                         (uint32_t(s[1]) & 0x3F) << 12 |
+                         (uint32_t(s[2]) & 0x3F) << 6 | (uint32_t(s[3]) & 0x3F);
+      pos += 4;
+      if constexpr (sizeof(Out) == 4) {
+        out[o++] = static_cast<Out>(swap ? swap_bytes(v) : v);
+        continue;
+      }
+      uint16_t high = static_cast<uint16_t>(0xD800 | ((v - 0x10000) >> 10));
+      uint16_t low = static_cast<uint16_t>(0xDC00 | (v & 0x3FF));
+      if (swap) {
+        high = swap_bytes(high);
+        low = swap_bytes(low);
+      }
+      out[o] = static_cast<Out>(high);
+      out[o + 1] = static_cast<Out>(low);
+      o += 2;
+      continue;
+    }
+    const __m128i perm = _mm_shuffle_epi8(
+        in, _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                table.shuffles[step.shuffle])));
+    const bool fits = o + 8 <= room;
+    if (step.shuffle < utf8_to_utf16_wide) {
+      // [last, first] -> 00000yyy yyxxxxxx
+      const __m128i ascii = _mm_and_si128(perm, _mm_set1_epi16(0x7F));
+      const __m128i high = _mm_and_si128(perm, _mm_set1_epi16(0x1F00));
+      const __m128i units = _mm_or_si128(ascii, _mm_srli_epi16(high, 2));
+      if constexpr (sizeof(Out) == 2) {
+        const __m128i v[1] = {_mm_shuffle_epi8(units, order)};
+        store_units_sse42(out + o, v, step.count, fits);
+      } else {
+        const __m128i v[2] = {
+            _mm_shuffle_epi8(_mm_cvtepu16_epi32(units), order),
+            _mm_shuffle_epi8(_mm_cvtepu16_epi32(_mm_srli_si128(units, 8)),
+                             order)};
+        store_units_sse42(out + o, v, step.count, fits);
+      }
+    } else {
+      // [last, middle, first, 0] -> zzzzyyyy yyxxxxxx
+      const __m128i ascii = _mm_and_si128(perm, _mm_set1_epi32(0x7F));
+      const __m128i middle = _mm_and_si128(perm, _mm_set1_epi32(0x3F00));
+      const __m128i high = _mm_and_si128(perm, _mm_set1_epi32(0x0F0000));
+      __m128i units = _mm_or_si128(
+          ascii, _mm_or_si128(_mm_srli_epi32(middle, 2),
+                              _mm_srli_epi32(high, 4)));
+      if constexpr (sizeof(Out) == 2) {
+        units = _mm_packus_epi32(units, units);
+      }
+      const __m128i v[1] = {_mm_shuffle_epi8(units, order)};
+      store_units_sse42(out + o, v, step.count, fits);
+    }
+    pos += step.consumed;
+    o += step.count;
+  }
+  return o;
+}
+
+UTFX_TARGET_SSE42 inline uint64_t movemask64_sse42(__m128i a, __m128i b,
+                                                   __m128i c, __m128i d) {
+  return uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(a))) |
+         uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(b))) << 16 |
+         uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(c))) << 32 |
+         uint64_t(static_cast<uint16_t>(_mm_movemask_epi8(d))) << 48;
+}
+
+UTFX_TARGET_SSE42 inline utf8_block_masks utf8_masks_sse42(const uint8_t* q,
+                                                          bool check) {
+  const __m128i in0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(q));
+  const __m128i in1 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(q + 16));
+  const __m128i in2 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(q + 32));
+  const __m128i in3 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(q + 48));
+  utf8_block_masks m;
+  m.non_ascii = movemask64_sse42(in0, in1, in2, in3);
+  // Continuation bytes are the signed values below -64.
+  const __m128i c = _mm_set1_epi8(char(0xC0));
+  m.leads = ~movemask64_sse42(_mm_cmplt_epi8(in0, c), _mm_cmplt_epi8(in1, c),
+                              _mm_cmplt_epi8(in2, c), _mm_cmplt_epi8(in3, c));
+  const __m128i f = _mm_set1_epi8(char(0xF0));
+  m.four = movemask64_sse42(_mm_cmpeq_epi8(_mm_max_epu8(in0, f), in0),
+                            _mm_cmpeq_epi8(_mm_max_epu8(in1, f), in1),
+                            _mm_cmpeq_epi8(_mm_max_epu8(in2, f), in2),
+                            _mm_cmpeq_epi8(_mm_max_epu8(in3, f), in3));
+  m.errors = 0;
+  if (check && m.non_ascii != 0) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i e0 = check_utf8_bytes_sse42(in0, zero);
+    const __m128i e1 = check_utf8_bytes_sse42(in1, in0);
+    const __m128i e2 = check_utf8_bytes_sse42(in2, in1);
+    const __m128i e3 = check_utf8_bytes_sse42(in3, in2);
+    m.errors =
+        ~movemask64_sse42(_mm_cmpeq_epi8(e0, zero), _mm_cmpeq_epi8(e1, zero),
+                          _mm_cmpeq_epi8(e2, zero), _mm_cmpeq_epi8(e3, zero));
+  }
+  return m;
+}
+
+template <typename Out>
+UTFX_TARGET_SSE42 inline void widen_ascii64_sse42(const uint8_t* q, Out* out,
+                                                  bool swap) {
+  for (int k = 0; k < 64; k += 16) {
+    widen_ascii_sse42<Out, 16>(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(q + k)), out + k,
+        swap);
+  }
+}
+
+// The end of the input, and whatever follows an error the bulk loop found:
+// every block is validated on its own and the stores of its last steps go
+// through a staging buffer, so nothing is written past its exact output.
+// Valid input, as the _valid transcoders take it, is not checked.
+template <typename Out, bool Valid = false>
+UTFX_TARGET_SSE42 inline kernel_result utf8_blocks_sse42(const uint8_t* p,
+                                                         size_t len, Out* out,
+                                                         bool swap) {
+  size_t i = 0;
+  size_t o = 0;
+  while (i < len) {
+    const size_t n = len - i < 64 ? len - i : 64;
+    // The steps read up to 16 bytes past the block; near the end of the
+    // input they read a zero-padded copy instead.
+    const uint8_t* q = p + i;
+    uint8_t tail[80];
+    if (len - i < 80) {
+      std::memset(tail, 0, sizeof(tail));
+      std::memcpy(tail, q, n);
+      q = tail;
+    }
+    utf8_block_masks m = utf8_masks_sse42(q, !Valid);
+    if (n == 64 && m.non_ascii == 0) {
+      widen_ascii64_sse42(q, out + o, swap);
+      i += 64;
+      o += 64;
+      continue;
+    }
+    m.leads &= low_bits(n);
+    if (m.leads == 0) {
+      break;
+    }
+    // As in the AVX-512 kernel, an error shows up at most one byte after
+    // the sequence it belongs to.
+    const size_t end = utf8_complete_end(q, n, m.leads);
+    if (end == 0 || (m.errors & low_bits(end + 1)) != 0) {
+      break;
+    }
+    size_t units = static_cast<size_t>(_mm_popcnt_u64(m.leads & low_bits(end)));
+    if constexpr (sizeof(Out) == 2) {
+      units += static_cast<size_t>(_mm_popcnt_u64(m.four & low_bits(end)));
+    }
+    o += utf8_block_to_sse42(q, end, m, out + o, swap, units);
+    i += end;
+  }
+  return kernel_result{i, o};
+}
+
+// The bulk loop validates 64-byte blocks ahead of the conversion, so the
+// block being converted is always followed by at least 32 valid bytes --
+// at least eight more code points -- and its stores may run ahead.
+template <typename Out, bool Valid = false>
+UTFX_TARGET_SSE42 inline kernel_result utf8_to_units_sse42(const char* in,
+                                                           size_t len,
+                                                           Out* out,
+                                                           bool swap) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(in);
+  utf8_checker_sse42 st{_mm_setzero_si128(), _mm_setzero_si128(),
+                        _mm_setzero_si128()};
+  size_t checked = 0;
+  size_t i = 0;
+  size_t o = 0;
+  for (;;) {
+    if (checked < i + 96) {
+      if (len - checked < 64) {
+        break;
+      }
+      if constexpr (!Valid) {
+        check_utf8_block_sse42(st, p + checked);
+        if (_mm_testz_si128(st.error, st.error) == 0) {
+          break;
+        }
+      }
+      checked += 64;
+      continue;
+    }
+    const utf8_block_masks m = utf8_masks_sse42(p + i, false);
+    if (m.non_ascii == 0) {
+      widen_ascii64_sse42(p + i, out + o, swap);
+      i += 64;
+      o += 64;
+      continue;
+    }
+    const size_t end = utf8_complete_end(p + i, 64, m.leads);
+    o += utf8_block_to_sse42(p + i, end, m, out + o, swap, ~size_t(0));
+    i += end;
+  }
+  const kernel_result r =
+      utf8_blocks_sse42<Out, Valid>(p + i, len - i, out + o, swap);
+  return kernel_result{i + r.read, o + r.written};
+}
+
+UTFX_TARGET_SSE42 inline kernel_result utf8_to_utf16_sse42(const char* in,
+                                                           size_t len,
+                                                           char16_t* out,
+                                                           bool swap) {
+  return utf8_to_units_sse42(in, len, out, swap);
+}
+
+UTFX_TARGET_SSE42 inline kernel_result utf8_to_utf32_sse42(const char* in,
+                                                           size_t len,
+                                                           char32_t* out,
+                                                           bool swap) {
+  return utf8_to_units_sse42(in, len, out, swap);
+}
+
+UTFX_TARGET_AVX2 inline uint64_t movemask64_avx2(__m256i a, __m256i b) {
+  return uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(a))) |
+         uint64_t(static_cast<uint32_t>(_mm256_movemask_epi8(b))) << 32;
+}
+
+// Widens 64 ASCII bytes to units at out.
+template <typename Out>
+UTFX_TARGET_AVX2 inline void widen_ascii64_avx2(__m256i in0, __m256i in1,
+                                                Out* out, bool swap) {
+  const __m256i v[2] = {in0, in1};
+  for (int k = 0; k < 2; ++k) {
+    const __m128i lo = _mm256_castsi256_si128(v[k]);
+    const __m128i hi = _mm256_extracti128_si256(v[k], 1);
+    if constexpr (sizeof(Out) == 2) {
+      __m256i a = _mm256_cvtepu8_epi16(lo);
+      __m256i b = _mm256_cvtepu8_epi16(hi);
+      if (swap) {
+        a = _mm256_slli_epi16(a, 8);
+        b = _mm256_slli_epi16(b, 8);
+      }
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 32 * k), a);
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 32 * k + 16), b);
+    } else {
+      const __m128i quarters[4] = {lo, _mm_srli_si128(lo, 8), hi,
+                                   _mm_srli_si128(hi, 8)};
+      for (int h = 0; h < 4; ++h) {
+        __m256i a = _mm256_cvtepu8_epi32(quarters[h]);
+        if (swap) {
+          a = _mm256_slli_epi32(a, 24);
+        }
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i*>(out + 32 * k + 8 * h), a);
+      }
+    }
+  }
+}
+
+// Same as the SSE4.2 kernel, with 32-byte validation, masks and ASCII
+// widening; the steps themselves stay 16 bytes wide.
+template <typename Out, bool Valid = false>
+UTFX_TARGET_AVX2 inline kernel_result utf8_to_units_avx2(const char* in,
+                                                         size_t len, Out* out,
+                                                         bool swap) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(in);
+  utf8_checker_avx2 st{_mm256_setzero_si256(), _mm256_setzero_si256(),
+                       _mm256_setzero_si256()};
+  const __m256i c = _mm256_set1_epi8(char(0xC0));
+  const __m256i f = _mm256_set1_epi8(char(0xF0));
+  size_t checked = 0;
+  size_t i = 0;
+  size_t o = 0;
+  for (;;) {
+    if (checked < i + 96) {
+      if (len - checked < 64) {
+        break;
+      }
+      if constexpr (!Valid) {
+        check_utf8_block_avx2(st, p + checked);
+        if (_mm256_testz_si256(st.error, st.error) == 0) {
+          break;
+        }
+      }
+      checked += 64;
+      continue;
+    }
+    const __m256i in0 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+    const __m256i in1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 32));
+    utf8_block_masks m;
+    m.non_ascii = movemask64_avx2(in0, in1);
+    if (m.non_ascii == 0) {
+      widen_ascii64_avx2(in0, in1, out + o, swap);
+      i += 64;
+      o += 64;
+      continue;
+    }
+    m.leads = ~movemask64_avx2(_mm256_cmpgt_epi8(c, in0),
+                               _mm256_cmpgt_epi8(c, in1));
+    m.four = movemask64_avx2(_mm256_cmpeq_epi8(_mm256_max_epu8(in0, f), in0),
+                             _mm256_cmpeq_epi8(_mm256_max_epu8(in1, f), in1));
+    m.errors = 0;
+    const size_t end = utf8_complete_end(p + i, 64, m.leads);
+    o += utf8_block_to_sse42(p + i, end, m, out + o, swap, ~size_t(0));
+    i += end;
+  }
+  const kernel_result r =
+      utf8_blocks_sse42<Out, Valid>(p + i, len - i, out + o, swap);
+  return kernel_result{i + r.read, o + r.written};
+}
+
+UTFX_TARGET_AVX2 inline kernel_result utf8_to_utf16_avx2(const char* in,
+                                                         size_t len,
+                                                         char16_t* out,
+                                                         bool swap) {
+  return utf8_to_units_avx2(in, len, out, swap);
+}
+
+UTFX_TARGET_AVX2 inline kernel_result utf8_to_utf32_avx2(const char* in,
+                                                         size_t len,
+                                                         char32_t* out,
+                                                         bool swap) {
+  return utf8_to_units_avx2(in, len, out, swap);
+}
+
+// UTF-16 -> UTF-8 with SSE4.2 and AVX2.  The input is validated ahead of the
+// conversion, 1024 units at a time.  ASCII is narrowed with a saturating
+// pack.  Eight units below U+0800 are encoded as 1-2 bytes in their 16-bit
+// lanes, and a pshufb pattern chosen by the 2-byte lanes packs the used
+// bytes.  Otherwise the code points are encoded in 32-bit lanes, and the 1-3
+// used bytes of four lanes are packed by a pattern indexed by their
+// lengths: bit k is set when lane k needs two bytes, and bit 4 + k when it
+// needs three.  A step that contains surrogates is encoded in scalar code.
+struct utf16_to_utf8_table {
+  uint8_t narrow_shuffles[256][16];
+  uint8_t narrow_lengths[256];
+  uint8_t shuffles[256][16];
+  uint8_t lengths[256];
+};
+
+inline utf16_to_utf8_table make_utf16_to_utf8_table() {
+  utf16_to_utf8_table t{};
+  for (unsigned m = 0; m < 256; ++m) {
+    unsigned o = 0;
+    for (unsigned k = 0; k < 8; ++k) {
+      t.narrow_shuffles[m][o++] = static_cast<uint8_t>(2 * k);
+      if ((m >> k) & 1) {
+        t.narrow_shuffles[m][o++] = static_cast<uint8_t>(2 * k + 1);
+      }
+    }
+    t.narrow_lengths[m] = static_cast<uint8_t>(o);
+    for (; o < 16; ++o) {
+      t.narrow_shuffles[m][o] = 0x80;
+    }
+    o = 0;
+    for (unsigned k = 0; k < 4; ++k) {
+      const unsigned len = 1 + ((m >> k) & 1) + ((m >> (4 + k)) & 1);
+      for (unsigned b = 0; b < len; ++b) {
+        t.shuffles[m][o++] = static_cast<uint8_t>(4 * k + b);
+      }
+    }
+    t.lengths[m] = static_cast<uint8_t>(o);
+    for (; o < 16; ++o) {
+      t.shuffles[m][o] = 0x80;
+    }
+  }
+  return t;
+}
+
+inline const utf16_to_utf8_table& utf16_to_utf8_patterns() {
+  static const utf16_to_utf8_table table = make_utf16_to_utf8_table();
+  return table;
+}
+
+// Encodes four code points below 0x10000, one per 32-bit lane, as 1-3 bytes
+// each, lead byte first, and returns the pattern index of their lengths.
+UTFX_TARGET_SSE42 inline __m128i utf8_encode4_sse42(__m128i cp,
+                                                   unsigned& pattern) {
+  const __m128i low6 = _mm_set1_epi32(0x3F);
+  const __m128i cont = _mm_set1_epi32(0x80);
+  const __m128i two = _mm_cmpgt_epi32(cp, _mm_set1_epi32(0x7F));
+  const __m128i three = _mm_cmpgt_epi32(cp, _mm_set1_epi32(0x7FF));
+  const __m128i t0 = _mm_or_si128(cont, _mm_and_si128(cp, low6));
+  const __m128i t1 =
+      _mm_or_si128(cont, _mm_and_si128(_mm_srli_epi32(cp, 6), low6));
+  const __m128i bytes2 = _mm_or_si128(
+      _mm_or_si128(_mm_set1_epi32(0xC0), _mm_srli_epi32(cp, 6)),
+      _mm_slli_epi32(t0, 8));
+  const __m128i bytes3 = _mm_or_si128(
+      _mm_or_si128(_mm_set1_epi32(0xE0), _mm_srli_epi32(cp, 12)),
+      _mm_or_si128(_mm_slli_epi32(t1, 8), _mm_slli_epi32(t0, 16)));
+  pattern = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(two)) |
+                                  _mm_movemask_ps(_mm_castsi128_ps(three))
+                                      << 4);
+  return _mm_blendv_epi8(_mm_blendv_epi8(cp, bytes2, two), bytes3, three);
+}
+
+// Encodes eight code points below U+0800, one per 16-bit lane, as 1-2 bytes
+// each, lead byte first, and returns the pattern index of the 2-byte lanes.
+UTFX_TARGET_SSE42 inline __m128i utf8_encode8_sse42(__m128i cp,
+                                                   unsigned& pattern) {
+  const __m128i two = _mm_cmpgt_epi16(cp, _mm_set1_epi16(0x7F));
+  const __m128i bytes2 = _mm_or_si128(
+      _mm_or_si128(_mm_set1_epi16(short(0x80C0)), _mm_srli_epi16(cp, 6)),
+      _mm_slli_epi16(_mm_and_si128(cp, _mm_set1_epi16(0x3F)), 8));
+  pattern = static_cast<unsigned>(
+      _mm_movemask_epi8(_mm_packs_epi16(two, _mm_setzero_si128())));
+  return _mm_blendv_epi8(cp, bytes2, two);
+}
+
+// Stores n bytes of v at out, all 16 when room allows.
+UTFX_TARGET_SSE42 inline void store_utf8_sse42(char* out, __m128i v,
+                                               size_t n, bool room) {
+  if (room) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), v);
+  } else {
+    alignas(16) char staged[16];
+    _mm_store_si128(reinterpret_cast<__m128i*>(staged), v);
+    std::memcpy(out, staged, n);
+  }
+}
+
+// Stores the 1-2 byte encodings of eight code points below U+0800, one per
+// 16-bit lane, at o.
+UTFX_TARGET_SSE42 inline void store_utf8_narrow_sse42(
+    __m128i cp, char*& o, const utf16_to_utf8_table& table, bool room) {
+  unsigned pattern = 0;
+  const __m128i bytes = utf8_encode8_sse42(cp, pattern);
+  const __m128i shuffle = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(table.narrow_shuffles[pattern]));
+  store_utf8_sse42(o, _mm_shuffle_epi8(bytes, shuffle),
+                   table.narrow_lengths[pattern], room);
+  o += table.narrow_lengths[pattern];
+}
+
+// Stores the 1-3 byte encodings of four code points below 0x10000, one per
+// 32-bit lane, at o.
+UTFX_TARGET_SSE42 inline void store_utf8_wide_sse42(
+    __m128i cp, char*& o, const utf16_to_utf8_table& table, bool room) {
+  unsigned pattern = 0;
+  const __m128i bytes = utf8_encode4_sse42(cp, pattern);
+  const __m128i shuffle = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(table.shuffles[pattern]));
+  store_utf8_sse42(o, _mm_shuffle_epi8(bytes, shuffle), table.lengths[pattern],
+                   room);
+  o += table.lengths[pattern];
+}
+
+// Encodes in[i, end), which is valid and may hold surrogate pairs, in
+// scalar code; a pair that starts before end is finished.
+inline size_t utf16_to_utf8_units(const char16_t* in, size_t i, size_t end,
+                                  char*& out, bool swap) {
+  while (i < end) {
+    codepoint c = swap ? swap_bytes(in[i]) : in[i];
+    ++i;
+    if ((c & 0xFC00) == 0xD800) {
+      const codepoint low = swap ? swap_bytes(in[i]) : in[i];
+      c = 0x10000 + ((c & 0x3FF) << 10) + (low & 0x3FF);
+      ++i;
+    }
+    out = utf_traits<char>::encode(c, out);
+  }
+  return i;
+}
+
+// The prefix of in[0, n), known to be valid, that ends on a code point
+// boundary: all of it, unless it ends in a high surrogate.
+template <typename CharT>
+inline size_t assumed_valid_prefix(const CharT* in, size_t n, bool swap) {
+  if constexpr (sizeof(CharT) == 2) {
+    if (n != 0 && ((swap ? swap_bytes(in[n - 1]) : in[n - 1]) & 0xFC00) ==
+                      0xD800) {
+      return n - 1;
+    }
+  }
+  return n;
+}
+
+// Extends the validated prefix [0, valid) by up to 1024 units.  Returns
+// false once nothing more can be validated.  Valid input, as the _valid
+// transcoders take it, is accepted without looking at it.
+template <typename CharT, size_t (*Prefix)(const CharT*, size_t, bool),
+          bool Valid = false>
+inline bool extend_valid_prefix(const CharT* in, size_t len, size_t& valid,
+                                bool swap) {
+  const size_t n = len - valid < 1024 ? len - valid : 1024;
+  const size_t v = Valid ? assumed_valid_prefix(in + valid, n, swap)
+                         : Prefix(in + valid, n, swap);
+  valid += v;
+  return v != 0;
+}
+
+// Both kernels step while the validated input runs at least 16 units past
+// the step; those units give at least 16 more bytes of output, so the
+// step's stores may run ahead.  Closer to the end they are staged.
+template <bool Valid = false>
+UTFX_TARGET_SSE42 inline kernel_result utf16_to_utf8_sse42(const char16_t* in,
+                                                           size_t len,
+                                                           char* out,
+                                                           bool swap) {
+  const utf16_to_utf8_table& table = utf16_to_utf8_patterns();
+  const __m128i order = unit_byte_order_sse42<char16_t>(swap);
+  const __m128i non_ascii = _mm_set1_epi16(short(0xFF80));
+  size_t valid = 0;
+  bool more = true;
+  size_t i = 0;
+  char* o = out;
+  for (;;) {
+    if (more && valid < i + 32) {
+      more = extend_valid_prefix<char16_t, utf16_valid_prefix_sse42, Valid>(
+          in, len, valid, swap);
+      continue;
+    }
+    if (i + 8 > valid) {
+      break;
+    }
+    const __m128i v = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)), order);
+    if (i + 16 <= valid) {
+      const __m128i w = _mm_shuffle_epi8(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8)),
+          order);
+      if (_mm_testz_si128(_mm_or_si128(v, w), non_ascii)) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(o),
+                         _mm_packus_epi16(v, w));
+        i += 16;
+        o += 16;
+        continue;
+      }
+    }
+    if (_mm_testz_si128(v, non_ascii)) {
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(o), _mm_packus_epi16(v, v));
+      i += 8;
+      o += 8;
+      continue;
+    }
+    const __m128i surrogates =
+        _mm_cmpeq_epi16(_mm_and_si128(v, _mm_set1_epi16(short(0xF800))),
+                        _mm_set1_epi16(short(0xD800)));
+    if (!_mm_testz_si128(surrogates, surrogates)) {
+      i = utf16_to_utf8_units(in, i, i + 8, o, swap);
+      continue;
+    }
+    const bool room = i + 8 + 16 <= valid;
+    if (_mm_testz_si128(v, _mm_set1_epi16(short(0xF800)))) {
+      store_utf8_narrow_sse42(v, o, table, room);
+    } else {
+      store_utf8_wide_sse42(_mm_cvtepu16_epi32(v), o, table, room);
+      store_utf8_wide_sse42(_mm_cvtepu16_epi32(_mm_srli_si128(v, 8)), o, table,
+                            room);
+    }
+    i += 8;
+  }
+  return kernel_result{i, static_cast<size_t>(o - out)};
+}
+
+// Stores the 1-2 byte encodings of sixteen code points below U+0800, one
+// per 16-bit lane, at o.
+UTFX_TARGET_AVX2 inline void store_utf8_narrow_avx2(
+    __m256i v, char*& o, const utf16_to_utf8_table& table, bool room) {
+  const __m256i two = _mm256_cmpgt_epi16(v, _mm256_set1_epi16(0x7F));
+  const __m256i bytes2 = _mm256_or_si256(
+      _mm256_or_si256(_mm256_set1_epi16(short(0x80C0)),
+                      _mm256_srli_epi16(v, 6)),
+      _mm256_slli_epi16(_mm256_and_si256(v, _mm256_set1_epi16(0x3F)), 8));
+  const __m256i bytes = _mm256_blendv_epi8(v, bytes2, two);
+  const unsigned m2 = static_cast<unsigned>(_mm256_movemask_epi8(
+      _mm256_packs_epi16(two, _mm256_setzero_si256())));
+  const unsigned p0 = m2 & 0xFF;
+  const unsigned p1 = (m2 >> 16) & 0xFF;
+  const __m256i packed = _mm256_shuffle_epi8(
+      bytes,
+      _mm256_inserti128_si256(
+          _mm256_castsi128_si256(_mm_loadu_si128(
+              reinterpret_cast<const __m128i*>(table.narrow_shuffles[p0]))),
+          _mm_loadu_si128(
+              reinterpret_cast<const __m128i*>(table.narrow_shuffles[p1])),
+          1));
+  store_utf8_sse42(o, _mm256_castsi256_si128(packed),
+                   table.narrow_lengths[p0], room);
+  o += table.narrow_lengths[p0];
+  store_utf8_sse42(o, _mm256_extracti128_si256(packed, 1),
+                   table.narrow_lengths[p1], room);
+  o += table.narrow_lengths[p1];
+}
+
+// Stores the 1-3 byte encodings of eight code points below 0x10000, one
+// per 32-bit lane, at o.
+UTFX_TARGET_AVX2 inline void store_utf8_wide_avx2(
+    __m256i cp, char*& o, const utf16_to_utf8_table& table, bool room) {
+  const __m256i low6 = _mm256_set1_epi32(0x3F);
+  const __m256i cont = _mm256_set1_epi32(0x80);
+  const __m256i two = _mm256_cmpgt_epi32(cp, _mm256_set1_epi32(0x7F));
+  const __m256i three = _mm256_cmpgt_epi32(cp, _mm256_set1_epi32(0x7FF));
+  const __m256i t0 = _mm256_or_si256(cont, _mm256_and_si256(cp, low6));
+  const __m256i t1 =
+      _mm256_or_si256(cont, _mm256_and_si256(_mm256_srli_epi32(cp, 6), low6));
+  const __m256i bytes2 = _mm256_or_si256(
+      _mm256_or_si256(_mm256_set1_epi32(0xC0), _mm256_srli_epi32(cp, 6)),
+      _mm256_slli_epi32(t0, 8));
+  const __m256i bytes3 = _mm256_or_si256(
+      _mm256_or_si256(_mm256_set1_epi32(0xE0), _mm256_srli_epi32(cp, 12)),
+      _mm256_or_si256(_mm256_slli_epi32(t1, 8), _mm256_slli_epi32(t0, 16)));
+  const __m256i bytes =
+      _mm256_blendv_epi8(_mm256_blendv_epi8(cp, bytes2, two), bytes3, three);
+  const unsigned m2 =
+      static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(two)));
+  const unsigned m3 =
+      static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(three)));
+  const unsigned p0 = (m2 & 0xF) | (m3 & 0xF) << 4;
+  const unsigned p1 = (m2 >> 4) | (m3 >> 4) << 4;
+  const __m256i packed = _mm256_shuffle_epi8(
+      bytes, _mm256_inserti128_si256(
+                 _mm256_castsi128_si256(_mm_loadu_si128(
+                     reinterpret_cast<const __m128i*>(table.shuffles[p0]))),
+                 _mm_loadu_si128(
+                     reinterpret_cast<const __m128i*>(table.shuffles[p1])),
+                 1));
+  store_utf8_sse42(o, _mm256_castsi256_si128(packed), table.lengths[p0],
+                   room);
+  o += table.lengths[p0];
+  store_utf8_sse42(o, _mm256_extracti128_si256(packed, 1), table.lengths[p1],
+                   room);
+  o += table.lengths[p1];
+}
+
+template <bool Valid = false>
+UTFX_TARGET_AVX2 inline kernel_result utf16_to_utf8_avx2(const char16_t* in,
+                                                         size_t len, char* out,
+                                                         bool swap) {
+  const utf16_to_utf8_table& table = utf16_to_utf8_patterns();
+  const __m256i order =
+      _mm256_broadcastsi128_si256(unit_byte_order_sse42<char16_t>(swap));
+  const __m256i non_ascii = _mm256_set1_epi16(short(0xFF80));
+  size_t valid = 0;
+  bool more = true;
+  size_t i = 0;
+  char* o = out;
+  for (;;) {
+    if (more && valid < i + 48) {
+      more = extend_valid_prefix<char16_t, utf16_valid_prefix_avx2, Valid>(
+          in, len, valid, swap);
+      continue;
+    }
+    if (i + 16 > valid) {
+      break;
+    }
+    const __m256i v = _mm256_shuffle_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i)), order);
+    if (i + 32 <= valid) {
+      const __m256i w = _mm256_shuffle_epi8(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 16)),
+          order);
+      if (_mm256_testz_si256(_mm256_or_si256(v, w), non_ascii)) {
+        _mm256_storeu_si256(
+            reinterpret_cast<__m256i*>(o),
+            _mm256_permute4x64_epi64(_mm256_packus_epi16(v, w), 0xD8));
+        i += 32;
+        o += 32;
+        continue;
+      }
+    }
+    if (_mm256_testz_si256(v, non_ascii)) {
+      const __m128i lo = _mm256_castsi256_si128(v);
+      const __m128i hi = _mm256_extracti128_si256(v, 1);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(o),
+                       _mm_packus_epi16(lo, hi));
+      i += 16;
+      o += 16;
+      continue;
+    }
+    const __m256i surrogates = _mm256_cmpeq_epi16(
+        _mm256_and_si256(v, _mm256_set1_epi16(short(0xF800))),
+        _mm256_set1_epi16(short(0xD800)));
+    if (!_mm256_testz_si256(surrogates, surrogates)) {
+      i = utf16_to_utf8_units(in, i, i + 16, o, swap);
+      continue;
+    }
+    const bool room = i + 16 + 16 <= valid;
+    if (_mm256_testz_si256(v, _mm256_set1_epi16(short(0xF800)))) {
+      store_utf8_narrow_avx2(v, o, table, room);
+    } else {
+      store_utf8_wide_avx2(_mm256_cvtepu16_epi32(_mm256_castsi256_si128(v)), o,
+                           table, room);
+      store_utf8_wide_avx2(
+          _mm256_cvtepu16_epi32(_mm256_extracti128_si256(v, 1)), o, table,
+          room);
+    }
+    i += 16;
+  }
+  return kernel_result{i, static_cast<size_t>(o - out)};
+}
+
+// UTF-32 -> UTF-8 with SSE4.2 and AVX2, on the encoders of the UTF-16
+// kernels: eight code points per step, ASCII sixteen at a time.  Input is
+// validated ahead in the same way, and a step holding a code point above
+// U+FFFF is encoded in scalar code.
+inline void utf32_to_utf8_units(const char32_t* in, size_t n, char*& out,
+                                bool swap) {
+  for (size_t k = 0; k < n; ++k) {
+    const codepoint c = swap ? swap_bytes(in[k]) : in[k];
+    out = utf_traits<char>::encode(c, out);
+  }
+}
+
+template <bool Valid = false>
+UTFX_TARGET_SSE42 inline kernel_result utf32_to_utf8_sse42(const char32_t* in,
+                                                           size_t len,
+                                                           char* out,
+                                                           bool swap) {
+  const utf16_to_utf8_table& table = utf16_to_utf8_patterns();
+  const __m128i order = utf32_byte_order_sse42(swap);
+  size_t valid = 0;
+  bool more = true;
+  size_t i = 0;
+  char* o = out;
+  for (;;) {
+    if (more && valid < i + 32) {
+      more = extend_valid_prefix<char32_t, utf32_valid_prefix_sse42, Valid>(
+          in, len, valid, swap);
+      continue;
+    }
+    if (i + 8 > valid) {
+      break;
+    }
+    const __m128i a = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)), order);
+    const __m128i b = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 4)), order);
+    const __m128i ab = _mm_or_si128(a, b);
+    if (i + 16 <= valid) {
+      const __m128i c = _mm_shuffle_epi8(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8)),
+          order);
+      const __m128i d = _mm_shuffle_epi8(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 12)),
+          order);
+      if (_mm_testz_si128(_mm_or_si128(ab, _mm_or_si128(c, d)),
+                          _mm_set1_epi32(~0x7F))) {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(o),
+                         _mm_packus_epi16(_mm_packus_epi32(a, b),
+                                          _mm_packus_epi32(c, d)));
+        i += 16;
+        o += 16;
+        continue;
+      }
+    }
+    const __m128i units = _mm_packus_epi32(a, b);
+    if (_mm_testz_si128(ab, _mm_set1_epi32(~0x7F))) {
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(o),
+                       _mm_packus_epi16(units, units));
+      i += 8;
+      o += 8;
+      continue;
+    }
+    const bool room = i + 8 + 16 <= valid;
+    if (_mm_testz_si128(ab, _mm_set1_epi32(~0x7FF))) {
+      store_utf8_narrow_sse42(units, o, table, room);
+    } else if (_mm_testz_si128(ab, _mm_set1_epi32(~0xFFFF))) {
+      store_utf8_wide_sse42(a, o, table, room);
+      store_utf8_wide_sse42(b, o, table, room);
+    } else {
+      utf32_to_utf8_units(in + i, 8, o, swap);
+    }
+    i += 8;
+  }
+  return kernel_result{i, static_cast<size_t>(o - out)};
+}
+
+template <bool Valid = false>
+UTFX_TARGET_AVX2 inline kernel_result utf32_to_utf8_avx2(const char32_t* in,
+                                                         size_t len, char* out,
+                                                         bool swap) {
+  const utf16_to_utf8_table& table = utf16_to_utf8_patterns();
+  const __m256i order =
+      _mm256_broadcastsi128_si256(utf32_byte_order_sse42(swap));
+  const __m256i non_ascii = _mm256_set1_epi32(~0x7F);
+  size_t valid = 0;
+  bool more = true;
+  size_t i = 0;
+  char* o = out;
+  for (;;) {
+    if (more && valid < i + 48) {
+      more = extend_valid_prefix<char32_t, utf32_valid_prefix_avx2, Valid>(
+          in, len, valid, swap);
+      continue;
+    }
+    if (i + 8 > valid) {
+      break;
+    }
+    const __m256i v = _mm256_shuffle_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i)), order);
+    if (i + 16 <= valid) {
+      const __m256i w = _mm256_shuffle_epi8(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 8)),
+          order);
+      if (_mm256_testz_si256(_mm256_or_si256(v, w), non_ascii)) {
+        const __m256i units =
+            _mm256_permute4x64_epi64(_mm256_packus_epi32(v, w), 0xD8);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(o),
+                         _mm_packus_epi16(_mm256_castsi256_si128(units),
+                                          _mm256_extracti128_si256(units, 1)));
+        i += 16;
+        o += 16;
+        continue;
+      }
+    }
+    const __m128i units = _mm_packus_epi32(_mm256_castsi256_si128(v),
+                                           _mm256_extracti128_si256(v, 1));
+    if (_mm256_testz_si256(v, non_ascii)) {
+      _mm_storel_epi64(reinterpret_cast<__m128i*>(o),
+                       _mm_packus_epi16(units, units));
+      i += 8;
+      o += 8;
+      continue;
+    }
+    const bool room = i + 8 + 16 <= valid;
+    if (_mm256_testz_si256(v, _mm256_set1_epi32(~0x7FF))) {
+      store_utf8_narrow_sse42(units, o, table, room);
+    } else if (_mm256_testz_si256(v, _mm256_set1_epi32(~0xFFFF))) {
+      store_utf8_wide_avx2(v, o, table, room);
+    } else {
+      utf32_to_utf8_units(in + i, 8, o, swap);
+    }
+    i += 8;
+  }
+  return kernel_result{i, static_cast<size_t>(o - out)};
+}
+
+// UTF-16 <-> UTF-32 with SSE4.2 and AVX2.  Input is validated ahead as in
+// the UTF-8 kernels.  Steps without surrogates (or, from UTF-32, without
+// code points above U+FFFF) widen or narrow the units with one pshufb per
+// register that also applies both byte orders.  Other steps combine or
+// split surrogate pairs in 32-bit lanes and pack the lanes with a pattern
+// indexed by the lanes that are dropped or split.
+struct utf16_utf32_table {
+  uint8_t drop_lanes[16][16];   // packs the 32-bit lanes not in the index
+  uint8_t split_lanes[16][16];  // keeps the low half of every 32-bit lane
+                                // and the high half of lanes in the index
+};
+
+inline utf16_utf32_table make_utf16_utf32_table() {
+  utf16_utf32_table t{};
+  for (unsigned m = 0; m < 16; ++m) {
+    unsigned o = 0;
+    unsigned s = 0;
+    for (unsigned k = 0; k < 4; ++k) {
+      for (unsigned b = 0; b < 4; ++b) {
+        if (((m >> k) & 1) == 0) {
+          t.drop_lanes[m][o++] = static_cast<uint8_t>(4 * k + b);
+        }
+        if (b < 2 || ((m >> k) & 1) != 0) {
+          t.split_lanes[m][s++] = static_cast<uint8_t>(4 * k + b);
+        }
+      }
+    }
+    for (; o < 16; ++o) {
+      t.drop_lanes[m][o] = 0x80;
+    }
+    for (; s < 16; ++s) {
+      t.split_lanes[m][s] = 0x80;
+    }
+  }
+  return t;
+}
+
+inline const utf16_utf32_table& utf16_utf32_patterns() {
+  static const utf16_utf32_table table = make_utf16_utf32_table();
+  return table;
+}
+
+// The pshufb pattern that turns four input units, zero-extended to 32-bit
+// lanes, into UTF-32 of the output byte order.
+UTFX_TARGET_SSE42 inline __m128i utf16_to_utf32_order_sse42(bool swap_in,
+                                                            bool swap_out) {
+  const int lo = swap_in ? 1 : 0;
+  const int hi = swap_in ? 0 : 1;
+  alignas(16) int8_t pattern[16];
+  for (int k = 0; k < 16; k += 4) {
+    pattern[k] = static_cast<int8_t>(k + (swap_out ? 2 : lo));
+    pattern[k + 1] = static_cast<int8_t>(k + (swap_out ? 3 : hi));
+    pattern[k + 2] = static_cast<int8_t>(k + (swap_out ? hi : 2));
+    pattern[k + 3] = static_cast<int8_t>(k + (swap_out ? lo : 3));
+  }
+  return _mm_load_si128(reinterpret_cast<const __m128i*>(pattern));
+}
+
+// The pshufb pattern that moves the low halves of four UTF-32 lanes below
+// U+10000 to UTF-16 of the output byte order, in the low or upper eight
+// bytes of the register.
+UTFX_TARGET_SSE42 inline __m128i utf32_to_utf16_order_sse42(bool swap_in,
+                                                            bool swap_out,
+                                                            bool upper) {
+  const int lo = swap_in ? 3 : 0;
+  const int hi = swap_in ? 2 : 1;
+  alignas(16) int8_t pattern[16];
+  for (int k = 0; k < 16; ++k) {
+    pattern[k] = -1;
+  }
+  for (int k = 0; k < 4; ++k) {
+    const int at = 2 * k + (upper ? 8 : 0);
+    pattern[at] = static_cast<int8_t>(4 * k + (swap_out ? hi : lo));
+    pattern[at + 1] = static_cast<int8_t>(4 * k + (swap_out ? lo : hi));
+  }
+  return _mm_load_si128(reinterpret_cast<const __m128i*>(pattern));
+}
+
+// One step over eight valid units at in that contain surrogates.  A high
+// surrogate in the last lane is left for the next step; has_next tells
+// whether in[8] may be read.  Stores may run up to three units ahead when
+// fits.  Returns the number of units read.
+UTFX_TARGET_SSE42 inline size_t utf16_pairs_to_utf32_sse42(
+    const char16_t* in, bool has_next, char32_t* out, size_t& o,
+    __m128i order16, __m128i order32, const utf16_utf32_table& table,
+    bool fits) {
+  const __m128i u = _mm_shuffle_epi8(
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(in)), order16);
+  const __m128i n =
+      has_next ? _mm_shuffle_epi8(
+                     _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 1)),
+                     order16)
+               : _mm_srli_si128(u, 2);
+  // (high - 0xD800) << 10 + (low - 0xDC00) + 0x10000 in one addition.
+  const __m128i bias = _mm_set1_epi32(0x10000 - (0xD800 << 10) - 0xDC00);
+  const __m128i top_bits = _mm_set1_epi32(0xFC00);
+  unsigned drop[2];
+  __m128i cp[2];
+  for (int h = 0; h < 2; ++h) {
+    const __m128i uh = _mm_cvtepu16_epi32(h == 0 ? u : _mm_srli_si128(u, 8));
+    const __m128i nh = _mm_cvtepu16_epi32(h == 0 ? n : _mm_srli_si128(n, 8));
+    const __m128i top = _mm_and_si128(uh, top_bits);
+    const __m128i high = _mm_cmpeq_epi32(top, _mm_set1_epi32(0xD800));
+    const __m128i low = _mm_cmpeq_epi32(top, _mm_set1_epi32(0xDC00));
+    const __m128i pair =
+        _mm_add_epi32(_mm_add_epi32(_mm_slli_epi32(uh, 10), nh), bias);
+    cp[h] = _mm_blendv_epi8(uh, pair, high);
+    drop[h] = static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(low)));
+  }
+  size_t read = 8;
+  if ((_mm_extract_epi16(u, 7) & 0xFC00) == 0xD800) {
+    drop[1] |= 8;
+    read = 7;
+  }
+  for (int h = 0; h < 2; ++h) {
+    const __m128i shuffle = _mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(table.drop_lanes[drop[h]]));
+    const __m128i v[1] = {
+        _mm_shuffle_epi8(_mm_shuffle_epi8(cp[h], shuffle), order32)};
+    const size_t count = 4 - static_cast<size_t>(_mm_popcnt_u32(drop[h]));
+    store_units_sse42(out + o, v, count, fits);
+    o += count;
+  }
+  return read;
+}
+
+// Splits the code points above U+FFFF among four valid UTF-32 units into
+// surrogate pairs and stores the UTF-16 at out + o, running up to four
+// units ahead when fits.
+UTFX_TARGET_SSE42 inline void utf32_pairs_to_utf16_sse42(
+    __m128i raw, char16_t* out, size_t& o, __m128i order32, __m128i order16,
+    const utf16_utf32_table& table, bool fits) {
+  const __m128i cp = _mm_shuffle_epi8(raw, order32);
+  const __m128i big = _mm_cmpgt_epi32(cp, _mm_set1_epi32(0xFFFF));
+  const __m128i v = _mm_sub_epi32(cp, _mm_set1_epi32(0x10000));
+  const __m128i high =
+      _mm_or_si128(_mm_srli_epi32(v, 10), _mm_set1_epi32(0xD800));
+  const __m128i low = _mm_or_si128(_mm_and_si128(v, _mm_set1_epi32(0x3FF)),
+                                   _mm_set1_epi32(0xDC00));
+  const __m128i units =
+      _mm_blendv_epi8(cp, _mm_or_si128(high, _mm_slli_epi32(low, 16)), big);
+  const unsigned split =
+      static_cast<unsigned>(_mm_movemask_ps(_mm_castsi128_ps(big)));
+  const __m128i shuffle = _mm_loadu_si128(
+      reinterpret_cast<const __m128i*>(table.split_lanes[split]));
+  const __m128i packed[1] = {
+      _mm_shuffle_epi8(_mm_shuffle_epi8(units, shuffle), order16)};
+  const size_t count = 4 + static_cast<size_t>(_mm_popcnt_u32(split));
+  store_units_sse42(out + o, packed, count, fits);
+  o += count;
+}
+
+template <bool Valid = false>
+UTFX_TARGET_SSE42 inline kernel_result utf16_to_utf32_sse42(
+    const char16_t* in, size_t len, char32_t* out, bool swap_in,
+    bool swap_out) {
+  const utf16_utf32_table& table = utf16_utf32_patterns();
+  const __m128i widen = utf16_to_utf32_order_sse42(swap_in, swap_out);
+  const __m128i order16 = unit_byte_order_sse42<char16_t>(swap_in);
+  const __m128i order32 = utf32_byte_order_sse42(swap_out);
+  // Surrogates as they appear in the input byte order.
+  const __m128i surrogate_bits =
+      _mm_set1_epi16(swap_in ? short(0x00F8) : short(0xF800));
+  const __m128i surrogate =
+      _mm_set1_epi16(swap_in ? short(0x00D8) : short(0xD800));
+  size_t valid = 0;
+  bool more = true;
+  size_t i = 0;
+  size_t o = 0;
+  for (;;) {
+    if (more && valid < i + 32) {
+      more = extend_valid_prefix<char16_t, utf16_valid_prefix_sse42, Valid>(
+          in, len, valid, swap_in);
+      continue;
+    }
+    if (i + 8 > valid) {
+      break;
+    }
+    const __m128i raw =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    const __m128i s =
+        _mm_cmpeq_epi16(_mm_and_si128(raw, surrogate_bits), surrogate);
+    if (_mm_testz_si128(s, s)) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + o),
+                       _mm_shuffle_epi8(_mm_cvtepu16_epi32(raw), widen));
+      _mm_storeu_si128(
+          reinterpret_cast<__m128i*>(out + o + 4),
+          _mm_shuffle_epi8(_mm_cvtepu16_epi32(_mm_srli_si128(raw, 8)), widen));
+      i += 8;
+      o += 8;
+      continue;
+    }
+    i += utf16_pairs_to_utf32_sse42(in + i, i + 9 <= valid, out, o, order16,
+                                    order32, table, i + 8 + 16 <= valid);
+  }
+  return kernel_result{i, o};
+}
+
+template <bool Valid = false>
+UTFX_TARGET_SSE42 inline kernel_result utf32_to_utf16_sse42(
+    const char32_t* in, size_t len, char16_t* out, bool swap_in,
+    bool swap_out) {
+  const utf16_utf32_table& table = utf16_utf32_patterns();
+  const __m128i narrow_lo = utf32_to_utf16_order_sse42(swap_in, swap_out,
+                                                       false);
+  const __m128i narrow_hi = utf32_to_utf16_order_sse42(swap_in, swap_out,
+                                                       true);
+  const __m128i order32 = utf32_byte_order_sse42(swap_in);
+  const __m128i order16 = unit_byte_order_sse42<char16_t>(swap_out);
+  // The upper halves of the units, as they appear in the input byte order.
+  const __m128i above_bmp = _mm_set1_epi32(swap_in ? 0x0000FFFF : ~0xFFFF);
+  size_t valid = 0;
+  bool more = true;
+  size_t i = 0;
+  size_t o = 0;
+  for (;;) {
+    if (more && valid < i + 32) {
+      more = extend_valid_prefix<char32_t, utf32_valid_prefix_sse42, Valid>(
+          in, len, valid, swap_in);
+      continue;
+    }
+    if (i + 8 > valid) {
+      break;
+    }
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 4));
+    if (_mm_testz_si128(_mm_or_si128(a, b), above_bmp)) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + o),
+                       _mm_or_si128(_mm_shuffle_epi8(a, narrow_lo),
+                                    _mm_shuffle_epi8(b, narrow_hi)));
+      i += 8;
+      o += 8;
+      continue;
+    }
+    const bool fits = i + 8 + 16 <= valid;
+    utf32_pairs_to_utf16_sse42(a, out, o, order32, order16, table, fits);
+    utf32_pairs_to_utf16_sse42(b, out, o, order32, order16, table, fits);
+    i += 8;
+  }
+  return kernel_result{i, o};
+}
+
+// The AVX2 kernels take sixteen units per step and hand steps with
+// surrogates or supplementary code points to the SSE4.2 helpers.
+template <bool Valid = false>
+UTFX_TARGET_AVX2 inline kernel_result utf16_to_utf32_avx2(const char16_t* in,
+                                                          size_t len,
+                                                          char32_t* out,
+                                                          bool swap_in,
+                                                          bool swap_out) {
+  const utf16_utf32_table& table = utf16_utf32_patterns();
+  const __m256i widen = _mm256_broadcastsi128_si256(
+      utf16_to_utf32_order_sse42(swap_in, swap_out));
+  const __m128i order16 = unit_byte_order_sse42<char16_t>(swap_in);
+  const __m128i order32 = utf32_byte_order_sse42(swap_out);
+  const __m256i surrogate_bits =
+      _mm256_set1_epi16(swap_in ? short(0x00F8) : short(0xF800));
+  const __m256i surrogate =
+      _mm256_set1_epi16(swap_in ? short(0x00D8) : short(0xD800));
+  size_t valid = 0;
+  bool more = true;
+  size_t i = 0;
+  size_t o = 0;
+  for (;;) {
+    if (more && valid < i + 48) {
+      more = extend_valid_prefix<char16_t, utf16_valid_prefix_avx2, Valid>(
+          in, len, valid, swap_in);
+      continue;
+    }
+    if (i + 16 > valid) {
+      break;
+    }
+    const __m256i raw =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    const __m256i s = _mm256_cmpeq_epi16(
+        _mm256_and_si256(raw, surrogate_bits), surrogate);
+    if (_mm256_testz_si256(s, s)) {
+      _mm256_storeu_si256(
+          reinterpret_cast<__m256i*>(out + o),
+          _mm256_shuffle_epi8(
+              _mm256_cvtepu16_epi32(_mm256_castsi256_si128(raw)), widen));
+      _mm256_storeu_si256(
+          reinterpret_cast<__m256i*>(out + o + 8),
+          _mm256_shuffle_epi8(
+              _mm256_cvtepu16_epi32(_mm256_extracti128_si256(raw, 1)), widen));
+      i += 16;
+      o += 16;
+      continue;
+    }
+    for (int k = 0; k < 2; ++k) {
+      i += utf16_pairs_to_utf32_sse42(in + i, i + 9 <= valid, out, o, order16,
+                                      order32, table, i + 8 + 16 <= valid);
+    }
+  }
+  return kernel_result{i, o};
+}
+
+template <bool Valid = false>
+UTFX_TARGET_AVX2 inline kernel_result utf32_to_utf16_avx2(const char32_t* in,
+                                                          size_t len,
+                                                          char16_t* out,
+                                                          bool swap_in,
+                                                          bool swap_out) {
+  const utf16_utf32_table& table = utf16_utf32_patterns();
+  const __m256i narrow_lo = _mm256_broadcastsi128_si256(
+      utf32_to_utf16_order_sse42(swap_in, swap_out, false));
+  const __m256i narrow_hi = _mm256_broadcastsi128_si256(
+      utf32_to_utf16_order_sse42(swap_in, swap_out, true));
+  const __m128i order32 = utf32_byte_order_sse42(swap_in);
+  const __m128i order16 = unit_byte_order_sse42<char16_t>(swap_out);
+  const __m256i above_bmp =
+      _mm256_set1_epi32(swap_in ? 0x0000FFFF : ~0xFFFF);
+  size_t valid = 0;
+  bool more = true;
+  size_t i = 0;
+  size_t o = 0;
+  for (;;) {
+    if (more && valid < i + 48) {
+      more = extend_valid_prefix<char32_t, utf32_valid_prefix_avx2, Valid>(
+          in, len, valid, swap_in);
+      continue;
+    }
+    if (i + 16 > valid) {
+      break;
+    }
+    const __m256i a =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    const __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 8));
+    if (_mm256_testz_si256(_mm256_or_si256(a, b), above_bmp)) {
+      // Each 128-bit half now holds four units of a, then four of b.
+      const __m256i units = _mm256_or_si256(_mm256_shuffle_epi8(a, narrow_lo),
+                                            _mm256_shuffle_epi8(b, narrow_hi));
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + o),
+                          _mm256_permute4x64_epi64(units, 0xD8));
+      i += 16;
+      o += 16;
+      continue;
+    }
+    const bool fits = i + 16 + 16 <= valid;
+    const __m128i quarters[4] = {
+        _mm256_castsi256_si128(a), _mm256_extracti128_si256(a, 1),
+        _mm256_castsi256_si128(b), _mm256_extracti128_si256(b, 1)};
+    for (int k = 0; k < 4; ++k) {
+      utf32_pairs_to_utf16_sse42(quarters[k], out, o, order32, order16, table,
+                                 fits);
+    }
+    i += 16;
+  }
+  return kernel_result{i, o};
+}
+
+// Output lengths.  Like the transcoding kernels, the counting kernels
+// return how much of the input they took -- only input they have validated
+// -- and how many units its conversion produces.  A UTF-8 block is counted
+// once the block after it is checked as well, which tells that the sequence
+// running into that block is complete and valid.  Under Valid, as the
+// _valid transcoders take their input, nothing is checked and the kernels
+// count everything up to the last partial block.
+template <typename Out, bool Valid = false>
+UTFX_TARGET_SSE42 inline kernel_result utf8_output_length_sse42(
+    const char* in, size_t len) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(in);
+  utf8_checker_sse42 st{_mm_setzero_si128(), _mm_setzero_si128(),
+                        _mm_setzero_si128()};
+  size_t checked = 0;
+  size_t i = 0;
+  size_t n = 0;
+  for (;;) {
+    if (checked < i + 128) {
+      if (len - checked < 64) {
+        break;
+      }
+      if constexpr (!Valid) {
+        check_utf8_block_sse42(st, p + checked);
+        if (_mm_testz_si128(st.error, st.error) == 0) {
+          break;
+        }
+      }
+      checked += 64;
+      continue;
+    }
+    const utf8_block_masks m = utf8_masks_sse42(p + i, false);
+    n += static_cast<size_t>(_mm_popcnt_u64(m.leads));
+    if constexpr (sizeof(Out) == 2) {
+      n += static_cast<size_t>(_mm_popcnt_u64(m.four));
+    }
+    i += 64;
+  }
+  // Take the end of the last sequence counted.
+  while (i != 0 && (p[i] & 0xC0) == 0x80) {
+    ++i;
+  }
+  return kernel_result{i, n};
+}
+
+// Length of the units of a valid UTF-16 string in UTF-8 or UTF-32; a
+// surrogate counts for half of its pair.
+template <typename Out>
+constexpr size_t utf16_unit_length(uint16_t u) noexcept {
+  if constexpr (sizeof(Out) == 1) {
+    return u < 0x80 ? 1 : u < 0x800 || (u & 0xF800) == 0xD800 ? 2 : 3;
+  } else {
+    return (u & 0xFC00) == 0xDC00 ? 0 : 1;
+  }
+}
+
+template <typename Out>
+constexpr size_t utf32_unit_length(uint32_t u) noexcept {
+  if constexpr (sizeof(Out) == 1) {
+    return u < 0x80 ? 1 : u < 0x800 ? 2 : u < 0x10000 ? 3 : 4;
+  } else {
+    return u < 0x10000 ? 1 : 2;
+  }
+}
+
+// Eight valid UTF-16 units in 16-bit lanes.
+template <typename Out>
+UTFX_TARGET_SSE42 inline size_t utf16_output_length8_sse42(__m128i u) {
+  const __m128i zero = _mm_setzero_si128();
+  if constexpr (sizeof(Out) == 1) {
+    const __m128i below80 =
+        _mm_cmpeq_epi16(_mm_subs_epu16(u, _mm_set1_epi16(0x7F)), zero);
+    const __m128i below800 =
+        _mm_cmpeq_epi16(_mm_subs_epu16(u, _mm_set1_epi16(0x7FF)), zero);
+    const __m128i surrogates =
+        _mm_cmpeq_epi16(_mm_and_si128(u, _mm_set1_epi16(short(0xF800))),
+                        _mm_set1_epi16(short(0xD800)));
+    return 24 -
+           static_cast<size_t>(_mm_popcnt_u32(static_cast<unsigned>(
+               _mm_movemask_epi8(_mm_packs_epi16(below80, below800))))) -
+           static_cast<size_t>(_mm_popcnt_u32(static_cast<unsigned>(
+               _mm_movemask_epi8(_mm_packs_epi16(surrogates, zero)))));
+  } else {
+    const __m128i lows =
+        _mm_cmpeq_epi16(_mm_and_si128(u, _mm_set1_epi16(short(0xFC00))),
+                        _mm_set1_epi16(short(0xDC00)));
+    return 8 - static_cast<size_t>(_mm_popcnt_u32(static_cast<unsigned>(
+                   _mm_movemask_epi8(_mm_packs_epi16(lows, zero)))));
+  }
+}
+
+template <typename Out, bool Valid = false>
+UTFX_TARGET_SSE42 inline kernel_result utf16_output_length_sse42(
+    const char16_t* in, size_t len, bool swap) {
+  const __m128i order = unit_byte_order_sse42<char16_t>(swap);
+  size_t i = 0;
+  size_t n = 0;
+  for (;;) {
+    const size_t chunk = len - i < 1024 ? len - i : 1024;
+    const size_t v = Valid ? assumed_valid_prefix(in + i, chunk, swap)
+                           : utf16_valid_prefix_sse42(in + i, chunk, swap);
+    if (v == 0) {
+      break;
+    }
+    size_t k = 0;
+    for (; k + 8 <= v; k += 8) {
+      n += utf16_output_length8_sse42<Out>(_mm_shuffle_epi8(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + k)),
+          order));
+    }
+    for (; k < v; ++k) {
+      const uint16_t u = static_cast<uint16_t>(in[i + k]);
+      n += utf16_unit_length<Out>(swap ? swap_bytes(u) : u);
+    }
+    i += v;
+  }
+  return kernel_result{i, n};
+}
+
+// Four valid UTF-32 units in 32-bit lanes.
+template <typename Out>
+UTFX_TARGET_SSE42 inline size_t utf32_output_length4_sse42(__m128i u) {
+  unsigned more = static_cast<unsigned>(_mm_movemask_ps(
+      _mm_castsi128_ps(_mm_cmpgt_epi32(u, _mm_set1_epi32(0xFFFF)))));
+  if constexpr (sizeof(Out) == 1) {
+    more |= static_cast<unsigned>(_mm_movemask_ps(
+                _mm_castsi128_ps(_mm_cmpgt_epi32(u, _mm_set1_epi32(0x7F)))))
+            << 4;
+    more |= static_cast<unsigned>(_mm_movemask_ps(
+                _mm_castsi128_ps(_mm_cmpgt_epi32(u, _mm_set1_epi32(0x7FF)))))
+            << 8;
+  }
+  return 4 + static_cast<size_t>(_mm_popcnt_u32(more));
+}
+
+template <typename Out, bool Valid = false>
+UTFX_TARGET_SSE42 inline kernel_result utf32_output_length_sse42(
+    const char32_t* in, size_t len, bool swap) {
+  const __m128i order = utf32_byte_order_sse42(swap);
+  size_t i = 0;
+  size_t n = 0;
+  for (;;) {
+    const size_t chunk = len - i < 1024 ? len - i : 1024;
+    const size_t v = Valid ? assumed_valid_prefix(in + i, chunk, swap)
+                           : utf32_valid_prefix_sse42(in + i, chunk, swap);
+    if (v == 0) {
+      break;
+    }
+    size_t k = 0;
+    for (; k + 4 <= v; k += 4) {
+      n += utf32_output_length4_sse42<Out>(_mm_shuffle_epi8(
+          _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + k)),
+          order));
+    }
+    for (; k < v; ++k) {
+      const uint32_t u = static_cast<uint32_t>(in[i + k]);
+      n += utf32_unit_length<Out>(swap ? swap_bytes(u) : u);
+    }
+    i += v;
+  }
+  return kernel_result{i, n};
+}
+
+template <typename Out, bool Valid = false>
+UTFX_TARGET_AVX2 inline kernel_result utf8_output_length_avx2(const char* in,
+                                                              size_t len) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(in);
+  utf8_checker_avx2 st{_mm256_setzero_si256(), _mm256_setzero_si256(),
+                       _mm256_setzero_si256()};
+  const __m256i c = _mm256_set1_epi8(char(0xC0));
+  const __m256i f = _mm256_set1_epi8(char(0xF0));
+  size_t checked = 0;
+  size_t i = 0;
+  size_t n = 0;
+  for (;;) {
+    if (checked < i + 128) {
+      if (len - checked < 64) {
+        break;
+      }
+      if constexpr (!Valid) {
+        check_utf8_block_avx2(st, p + checked);
+        if (_mm256_testz_si256(st.error, st.error) == 0) {
+          break;
+        }
+      }
+      checked += 64;
+      continue;
+    }
+    const __m256i in0 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+    const __m256i in1 =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i + 32));
+    n += 64 - static_cast<size_t>(_mm_popcnt_u64(movemask64_avx2(
+                  _mm256_cmpgt_epi8(c, in0), _mm256_cmpgt_epi8(c, in1))));
+    if constexpr (sizeof(Out) == 2) {
+      n += static_cast<size_t>(_mm_popcnt_u64(movemask64_avx2(
+          _mm256_cmpeq_epi8(_mm256_max_epu8(in0, f), in0),
+          _mm256_cmpeq_epi8(_mm256_max_epu8(in1, f), in1))));
+    }
+    i += 64;
+  }
+  while (i != 0 && (p[i] & 0xC0) == 0x80) {
+    ++i;
+  }
+  return kernel_result{i, n};
+}
+
+template <typename Out, bool Valid = false>
+UTFX_TARGET_AVX2 inline kernel_result utf16_output_length_avx2(
+    const char16_t* in, size_t len, bool swap) {
+  const __m256i order =
+      _mm256_broadcastsi128_si256(unit_byte_order_sse42<char16_t>(swap));
+  const __m256i zero = _mm256_setzero_si256();
+  size_t i = 0;
+  size_t n = 0;
+  for (;;) {
+    const size_t chunk = len - i < 1024 ? len - i : 1024;
+    const size_t v = Valid ? assumed_valid_prefix(in + i, chunk, swap)
+                           : utf16_valid_prefix_avx2(in + i, chunk, swap);
+    if (v == 0) {
+      break;
+    }
+    size_t k = 0;
+    for (; k + 16 <= v; k += 16) {
+      const __m256i u = _mm256_shuffle_epi8(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + k)),
+          order);
+      if constexpr (sizeof(Out) == 1) {
+        const __m256i below80 = _mm256_cmpeq_epi16(
+            _mm256_subs_epu16(u, _mm256_set1_epi16(0x7F)), zero);
+        const __m256i below800 = _mm256_cmpeq_epi16(
+            _mm256_subs_epu16(u, _mm256_set1_epi16(0x7FF)), zero);
+        const __m256i surrogates = _mm256_cmpeq_epi16(
+            _mm256_and_si256(u, _mm256_set1_epi16(short(0xF800))),
+            _mm256_set1_epi16(short(0xD800)));
+        const __m256i below = _mm256_packs_epi16(below80, below800);
+        n += 48 -
+             static_cast<size_t>(_mm_popcnt_u32(
+                 static_cast<unsigned>(_mm256_movemask_epi8(below)))) -
+             static_cast<size_t>(_mm_popcnt_u32(static_cast<unsigned>(
+                 _mm256_movemask_epi8(_mm256_packs_epi16(surrogates, zero)))));
+      } else {
+        const __m256i lows = _mm256_cmpeq_epi16(
+            _mm256_and_si256(u, _mm256_set1_epi16(short(0xFC00))),
+            _mm256_set1_epi16(short(0xDC00)));
+        n += 16 - static_cast<size_t>(_mm_popcnt_u32(static_cast<unsigned>(
+                      _mm256_movemask_epi8(_mm256_packs_epi16(lows, zero)))));
+      }
+    }
+    for (; k < v; ++k) {
+      const uint16_t u = static_cast<uint16_t>(in[i + k]);
+      n += utf16_unit_length<Out>(swap ? swap_bytes(u) : u);
+    }
+    i += v;
+  }
+  return kernel_result{i, n};
+}
+
+template <typename Out, bool Valid = false>
+UTFX_TARGET_AVX2 inline kernel_result utf32_output_length_avx2(
+    const char32_t* in, size_t len, bool swap) {
+  const __m256i order =
+      _mm256_broadcastsi128_si256(utf32_byte_order_sse42(swap));
+  size_t i = 0;
+  size_t n = 0;
+  for (;;) {
+    const size_t chunk = len - i < 1024 ? len - i : 1024;
+    const size_t v = Valid ? assumed_valid_prefix(in + i, chunk, swap)
+                           : utf32_valid_prefix_avx2(in + i, chunk, swap);
+    if (v == 0) {
+      break;
+    }
+    size_t k = 0;
+    for (; k + 8 <= v; k += 8) {
+      const __m256i u = _mm256_shuffle_epi8(
+          _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + k)),
+          order);
+      const __m256i above_bmp =
+          _mm256_cmpgt_epi32(u, _mm256_set1_epi32(0xFFFF));
+      unsigned more = static_cast<unsigned>(
+          _mm256_movemask_ps(_mm256_castsi256_ps(above_bmp)));
+      if constexpr (sizeof(Out) == 1) {
+        more |= static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(
+                    _mm256_cmpgt_epi32(u, _mm256_set1_epi32(0x7F)))))
+                << 8;
+        more |= static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(
+                    _mm256_cmpgt_epi32(u, _mm256_set1_epi32(0x7FF)))))
+                << 16;
+      }
+      n += 8 + static_cast<size_t>(_mm_popcnt_u32(more));
+    }
+    for (; k < v; ++k) {
+      const uint32_t u = static_cast<uint32_t>(in[i + k]);
+      n += utf32_unit_length<Out>(swap ? swap_bytes(u) : u);
+    }
+    i += v;
+  }
+  return kernel_result{i, n};
+}
+
+// Latin-1 <-> UTF-8/UTF-16 with SSE4.2 and AVX2.  Latin-1 is widened to
+// UTF-16 and encoded to UTF-8 with the narrow patterns of the UTF-16
+// kernels.  The other way the kernels take only what Latin-1 can hold --
+// UTF-16 units below 0x100, and UTF-8 made of ASCII and C2/C3 lead bytes
+// each followed by one continuation byte -- and stop at anything else,
+// which the scalar code then reports.  All of them leave the last partial
+// block to scalar code.
+
+// Packing patterns for utf8_to_latin1: pshufb indices of the set bits of
+// an 8-bit mask, in order.
+struct byte_pack_table {
+  uint8_t shuffles[256][8];
+};
+
+inline byte_pack_table make_byte_pack_table() {
+  byte_pack_table t{};
+  for (unsigned m = 0; m < 256; ++m) {
+    unsigned o = 0;
+    for (unsigned k = 0; k < 8; ++k) {
+      if ((m >> k) & 1) {
+        t.shuffles[m][o++] = static_cast<uint8_t>(k);
+      }
+    }
+    for (; o < 8; ++o) {
+      t.shuffles[m][o] = 0x80;
+    }
+  }
+  return t;
+}
+
+inline const byte_pack_table& byte_pack_patterns() {
+  static const byte_pack_table table = make_byte_pack_table();
+  return table;
+}
+
+// Each input byte left after a step adds at least one byte of output, so
+// the narrow encoder may store whole registers while 16 bytes follow.
+UTFX_TARGET_SSE42 inline kernel_result latin1_to_utf8_sse42(const char* in,
+                                                            size_t len,
+                                                            char* out) {
+  const utf16_to_utf8_table& table = utf16_to_utf8_patterns();
+  size_t i = 0;
+  char* o = out;
+  for (; i + 16 <= len; i += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    if (_mm_movemask_epi8(v) == 0) {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(o), v);
+      o += 16;
+      continue;
+    }
+    const bool room = i + 32 <= len;
+    store_utf8_narrow_sse42(_mm_cvtepu8_epi16(v), o, table, room);
+    store_utf8_narrow_sse42(_mm_cvtepu8_epi16(_mm_srli_si128(v, 8)), o, table,
+                            room);
+  }
+  return kernel_result{i, static_cast<size_t>(o - out)};
+}
+
+UTFX_TARGET_SSE42 inline kernel_result latin1_to_utf16_sse42(const char* in,
+                                                             size_t len,
+                                                             char16_t* out,
+                                                             bool swap) {
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    widen_ascii_sse42<char16_t, 16>(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)), out + i,
+        swap);
+  }
+  return kernel_result{i, i};
+}
+
+UTFX_TARGET_SSE42 inline kernel_result utf16_to_latin1_sse42(
+    const char16_t* in, size_t len, char* out, bool swap) {
+  const __m128i order = unit_byte_order_sse42<char16_t>(swap);
+  const __m128i high = _mm_set1_epi16(short(0xFF00));
+  size_t i = 0;
+  for (; i + 16 <= len; i += 16) {
+    const __m128i v = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i)), order);
+    const __m128i w = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 8)), order);
+    if (!_mm_testz_si128(_mm_or_si128(v, w), high)) {
+      break;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm_packus_epi16(v, w));
+  }
+  return kernel_result{i, i};
+}
+
+// Masks of the C2/C3 lead bytes and the continuation bytes of a block, or
+// false when they do not pair up as 2-byte sequences below U+0100.  A lead
+// in the last byte is left for the next block.
+inline bool latin1_block_masks(uint64_t non_ascii, uint64_t leads,
+                               uint64_t conts, uint64_t all,
+                               uint64_t& keep) {
+  if ((leads | conts) != non_ascii || conts != ((leads << 1) & all)) {
+    return false;
+  }
+  const uint64_t last = (all >> 1) + 1;
+  keep = ~conts & ((leads & last) ? all >> 1 : all);
+  return true;
+}
+
+// Decodes the 2-byte sequences of a block in place at their lead bytes:
+// the code point is the continuation byte, plus 0x40 after C3.
+UTFX_TARGET_SSE42 inline __m128i latin1_decode_sse42(__m128i v, __m128i next) {
+  const __m128i leads = _mm_cmpeq_epi8(
+      _mm_and_si128(v, _mm_set1_epi8(char(0xFE))), _mm_set1_epi8(char(0xC2)));
+  const __m128i plus = _mm_and_si128(
+      _mm_cmpeq_epi8(v, _mm_set1_epi8(char(0xC3))), _mm_set1_epi8(0x40));
+  return _mm_blendv_epi8(v, _mm_or_si128(next, plus), leads);
+}
+
+// Stores the bytes of v selected by the low 16 bits of keep at o.
+UTFX_TARGET_SSE42 inline void pack_bytes_sse42(__m128i v, uint64_t keep,
+                                               char*& o,
+                                               const byte_pack_table& table) {
+  const unsigned lo = static_cast<unsigned>(keep & 0xFF);
+  const unsigned hi = static_cast<unsigned>((keep >> 8) & 0xFF);
+  _mm_storel_epi64(
+      reinterpret_cast<__m128i*>(o),
+      _mm_shuffle_epi8(v, _mm_loadl_epi64(reinterpret_cast<const __m128i*>(
+                              table.shuffles[lo]))));
+  o += _mm_popcnt_u32(lo);
+  _mm_storel_epi64(reinterpret_cast<__m128i*>(o),
+                   _mm_shuffle_epi8(_mm_srli_si128(v, 8),
+                                    _mm_loadl_epi64(
+                                        reinterpret_cast<const __m128i*>(
+                                            table.shuffles[hi]))));
+  o += _mm_popcnt_u32(hi);
+}
+
+// pack_bytes_sse42 without writing past the bytes it keeps.
+UTFX_TARGET_SSE42 inline void pack_bytes_exact_sse42(
+    __m128i v, uint64_t keep, char*& o, const byte_pack_table& table) {
+  char staged[16];
+  char* s = staged;
+  pack_bytes_sse42(v, keep, s, table);
+  std::memcpy(o, staged, static_cast<size_t>(s - staged));
+  o += s - staged;
+}
+
+// The output never runs ahead of the input read, so its 8-byte stores end
+// within out + i + 16, and out has room for len bytes.  Those stores run
+// up to 8 bytes past the bytes they keep, which only the block after them
+// is sure to overwrite: a block of Latin-1 gives at least 8 bytes.  So
+// each block is stored once the next one is known to convert, and the
+// last one exactly, leaving nothing past the output touched.
+UTFX_TARGET_SSE42 inline kernel_result utf8_to_latin1_sse42(const char* in,
+                                                            size_t len,
+                                                            char* out) {
+  const byte_pack_table& table = byte_pack_patterns();
+  size_t i = 0;
+  char* o = out;
+  __m128i pending = _mm_setzero_si128();
+  uint64_t pending_keep = 0;
+  bool has_pending = false;
+  while (i + 16 <= len) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    const uint64_t non_ascii = static_cast<unsigned>(_mm_movemask_epi8(v));
+    if (non_ascii == 0) {
+      if (has_pending) {
+        pack_bytes_sse42(pending, pending_keep, o, table);
+        has_pending = false;
+      }
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(o), v);
+      i += 16;
+      o += 16;
+      continue;
+    }
+    const uint64_t leads = static_cast<unsigned>(_mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_and_si128(v, _mm_set1_epi8(char(0xFE))),
+                       _mm_set1_epi8(char(0xC2)))));
+    const uint64_t conts = static_cast<unsigned>(_mm_movemask_epi8(
+        _mm_cmpeq_epi8(_mm_and_si128(v, _mm_set1_epi8(char(0xC0))),
+                       _mm_set1_epi8(char(0x80)))));
+    uint64_t keep = 0;
+    if (!latin1_block_masks(non_ascii, leads, conts, 0xFFFF, keep)) {
+      break;
+    }
+    if (has_pending) {
+      pack_bytes_sse42(pending, pending_keep, o, table);
+    }
+    pending = latin1_decode_sse42(v, _mm_srli_si128(v, 1));
+    pending_keep = keep;
+    has_pending = true;
+    i += (leads & 0x8000) ? 15 : 16;
+  }
+  if (has_pending) {
+    pack_bytes_exact_sse42(pending, pending_keep, o, table);
+  }
+  return kernel_result{i, static_cast<size_t>(o - out)};
+}
+
+UTFX_TARGET_AVX2 inline kernel_result latin1_to_utf8_avx2(const char* in,
+                                                          size_t len,
+                                                          char* out) {
+  const utf16_to_utf8_table& table = utf16_to_utf8_patterns();
+  size_t i = 0;
+  char* o = out;
+  for (; i + 32 <= len; i += 32) {
+    const __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    if (_mm256_movemask_epi8(v) == 0) {
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(o), v);
+      o += 32;
+      continue;
+    }
+    const bool room = i + 48 <= len;
+    store_utf8_narrow_avx2(_mm256_cvtepu8_epi16(_mm256_castsi256_si128(v)), o,
+                           table, room);
+    store_utf8_narrow_avx2(
+        _mm256_cvtepu8_epi16(_mm256_extracti128_si256(v, 1)), o, table, room);
+  }
+  return kernel_result{i, static_cast<size_t>(o - out)};
+}
+
+UTFX_TARGET_AVX2 inline kernel_result latin1_to_utf16_avx2(const char* in,
+                                                           size_t len,
+                                                           char16_t* out,
+                                                           bool swap) {
+  const __m256i order =
+      _mm256_broadcastsi128_si256(unit_byte_order_sse42<char16_t>(swap));
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + 16));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                        _mm256_shuffle_epi8(_mm256_cvtepu8_epi16(a), order));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 16),
+                        _mm256_shuffle_epi8(_mm256_cvtepu8_epi16(b), order));
+  }
+  return kernel_result{i, i};
+}
+
+UTFX_TARGET_AVX2 inline kernel_result utf16_to_latin1_avx2(const char16_t* in,
+                                                           size_t len,
+                                                           char* out,
+                                                           bool swap) {
+  const __m256i order =
+      _mm256_broadcastsi128_si256(unit_byte_order_sse42<char16_t>(swap));
+  const __m256i high = _mm256_set1_epi16(short(0xFF00));
+  size_t i = 0;
+  for (; i + 32 <= len; i += 32) {
+    const __m256i v = _mm256_shuffle_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i)), order);
+    const __m256i w = _mm256_shuffle_epi8(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + 16)),
+        order);
+    if (!_mm256_testz_si256(_mm256_or_si256(v, w), high)) {
+      break;
+    }
+    _mm256_storeu_si256(
+        reinterpret_cast<__m256i*>(out + i),
+        _mm256_permute4x64_epi64(_mm256_packus_epi16(v, w), 0xD8));
+  }
+  return kernel_result{i, i};
+}
+
+// Stores each block once the next one is known to convert, like the SSE4.2
+// kernel.
+UTFX_TARGET_AVX2 inline kernel_result utf8_to_latin1_avx2(const char* in,
+                                                          size_t len,
+                                                          char* out) {
+  const byte_pack_table& table = byte_pack_patterns();
+  size_t i = 0;
+  char* o = out;
+  __m128i pending_lo = _mm_setzero_si128();
+  __m128i pending_hi = _mm_setzero_si128();
+  uint64_t pending_keep = 0;
+  bool has_pending = false;
+  while (i + 32 <= len) {
+    const __m256i v =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    const uint64_t non_ascii =
+        static_cast<uint32_t>(_mm256_movemask_epi8(v));
+    if (non_ascii == 0) {
+      if (has_pending) {
+        pack_bytes_sse42(pending_lo, pending_keep, o, table);
+        pack_bytes_sse42(pending_hi, pending_keep >> 16, o, table);
+        has_pending = false;
+      }
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(o), v);
+      i += 32;
+      o += 32;
+      continue;
+    }
+    const uint64_t leads = static_cast<uint32_t>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_and_si256(v, _mm256_set1_epi8(char(0xFE))),
+                          _mm256_set1_epi8(char(0xC2)))));
+    const uint64_t conts = static_cast<uint32_t>(_mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_and_si256(v, _mm256_set1_epi8(char(0xC0))),
+                          _mm256_set1_epi8(char(0x80)))));
+    uint64_t keep = 0;
+    if (!latin1_block_masks(non_ascii, leads, conts, 0xFFFFFFFF, keep)) {
+      break;
+    }
+    // v shifted down by one byte across the lanes.
+    const __m256i next =
+        _mm256_alignr_epi8(_mm256_permute2x128_si256(v, v, 0x81), v, 1);
+    if (has_pending) {
+      pack_bytes_sse42(pending_lo, pending_keep, o, table);
+      pack_bytes_sse42(pending_hi, pending_keep >> 16, o, table);
+    }
+    pending_lo = latin1_decode_sse42(_mm256_castsi256_si128(v),
+                                     _mm256_castsi256_si128(next));
+    pending_hi = latin1_decode_sse42(_mm256_extracti128_si256(v, 1),
+                                     _mm256_extracti128_si256(next, 1));
+    pending_keep = keep;
+    has_pending = true;
+    i += (leads & 0x80000000u) ? 31 : 32;
+  }
+  if (has_pending) {
+    pack_bytes_sse42(pending_lo, pending_keep, o, table);
+    pack_bytes_exact_sse42(pending_hi, pending_keep >> 16, o, table);
+  }
+  return kernel_result{i, static_cast<size_t>(o - out)};
+}
+
+// Dispatchers used by transcode(): run the best kernel for this CPU over as
+// much of the input as it accepts.  Pairs without a kernel read nothing.
+template <typename In, typename Out>
+inline kernel_result transcode(const In* /*in*/, size_t /*len*/, Out* /*out*/,
+                               endian /*from*/, endian /*to*/) noexcept {
+  return kernel_result{0, 0};
+}
+
+inline kernel_result transcode(const char* in, size_t len, char16_t* out,
+                               endian /*from*/, endian to) noexcept {
+  switch (active_isa()) {
+    case isa::avx512:
+      return utf8_to_utf16_avx512(in, len, out, to != endian::native);
+    case isa::avx2:
+      return utf8_to_utf16_avx2(in, len, out, to != endian::native);
+    case isa::sse42:
+      return utf8_to_utf16_sse42(in, len, out, to != endian::native);
+    default:
+      return kernel_result{0, 0};
+  }
+}
+
+inline kernel_result transcode(const char16_t* in, size_t len, char* out,
+                               endian from, endian /*to*/) noexcept {
+  switch (active_isa()) {
+    case isa::avx512:
+      return utf16_to_utf8_avx512(in, len, out, from != endian::native);
+    case isa::avx2:
+      return utf16_to_utf8_avx2(in, len, out, from != endian::native);
+    case isa::sse42:
+      return utf16_to_utf8_sse42(in, len, out, from != endian::native);
+    default:
+      return kernel_result{0, 0};
+  }
+}
+
+inline kernel_result transcode(const char* in, size_t len, char32_t* out,
+                               endian /*from*/, endian to) noexcept {
+  switch (active_isa()) {
+    case isa::avx512:
+    case isa::avx2:
+      return utf8_to_utf32_avx2(in, len, out, to != endian::native);
+    case isa::sse42:
+      return utf8_to_utf32_sse42(in, len, out, to != endian::native);
+    default:
+      return kernel_result{0, 0};
+  }
+}
+
+inline kernel_result transcode(const char32_t* in, size_t len, char* out,
+                               endian from, endian /*to*/) noexcept {
+  switch (active_isa()) {
+    case isa::avx512:
+    case isa::avx2:
+      return utf32_to_utf8_avx2(in, len, out, from != endian::native);
+    case isa::sse42:
+      return utf32_to_utf8_sse42(in, len, out, from != endian::native);
+    default:
+      return kernel_result{0, 0};
+  }
+}
+
+inline kernel_result transcode(const char16_t* in, size_t len, char32_t* out,
+                               endian from, endian to) noexcept {
+  switch (active_isa()) {
+    case isa::avx512:
+    case isa::avx2:
+      return utf16_to_utf32_avx2(in, len, out, from != endian::native,
+                                 to != endian::native);
+    case isa::sse42:
+      return utf16_to_utf32_sse42(in, len, out, from != endian::native,
+                                  to != endian::native);
+    default:
+      return kernel_result{0, 0};
+  }
+}
+
+inline kernel_result transcode(const char32_t* in, size_t len, char16_t* out,
+                               endian from, endian to) noexcept {
+  switch (active_isa()) {
+    case isa::avx512:
+    case isa::avx2:
+      return utf32_to_utf16_avx2(in, len, out, from != endian::native,
+                                 to != endian::native);
+    case isa::sse42:
+      return utf32_to_utf16_sse42(in, len, out, from != endian::native,
+                                  to != endian::native);
+    default:
+      return kernel_result{0, 0};
+  }
+}
+
+// Dispatchers for the _valid transcoders: the kernels above without their
+// validation.  The AVX-512 kernels check each block as part of decoding it,
+// so AVX-512 hosts keep them.
+inline kernel_result transcode_valid(const char* in, size_t len,
+                                     char16_t* out, endian /*from*/,
+                                     endian to) noexcept {
+  switch (active_isa()) {
+    case isa::avx512:
+      return utf8_to_utf16_avx512(in, len, out, to != endian::native);
+    case isa::avx2:
+      return utf8_to_units_avx2<char16_t, true>(in, len, out,
+                                                to != endian::native);
+    case isa::sse42:
+      return utf8_to_units_sse42<char16_t, true>(in, len, out,
+                                                 to != endian::native);
+    default:
+      return kernel_result{0, 0};
+  }
+}
+
+inline kernel_result transcode_valid(const char16_t* in, size_t len,
+                                     char* out, endian from,
+                                     endian /*to*/) noexcept {
+  switch (active_isa()) {
+    case isa::avx512:
+      return utf16_to_utf8_avx512(in, len, out, from != endian::native);
+    case isa::avx2:
+      return utf16_to_utf8_avx2<true>(in, len, out, from != endian::native);
+    case isa::sse42:
+      return utf16_to_utf8_sse42<true>(in, len, out, from != endian::native);
+    default:
+      return kernel_result{0, 0};
+  }
+}
+
+inline kernel_result transcode_valid(const char* in, size_t len,
+                                     char32_t* out, endian /*from*/,
+                                     endian to) noexcept {
+  switch (active_isa()) {
+    case isa::avx512:
+    case isa::avx2:
+      return utf8_to_units_avx2<char32_t, true>(in, len, out,
+                                                to != endian::native);
+    case isa::sse42:
+      return utf8_to_units_sse42<char32_t, true>(in, len, out,
+                                                 to != endian::native);
+    default:
+      return kernel_result{0, 0};
+  }
+}
+
+inline kernel_result transcode_valid(const char32_t* in, size_t len,
+                                     char* out, endian from,
+                                     endian /*to*/) noexcept {
+  switch (active_isa()) {
+    case isa::avx512:
+    case isa::avx2:
+      return utf32_to_utf8_avx2<true>(in, len, out, from != endian::native);
+    case isa::sse42:
+      return utf32_to_utf8_sse42<true>(in, len, out, from != endian::native);
+    default:
+      return kernel_result{0, 0};
+  }
+}
+
+inline kernel_result transcode_valid(const char16_t* in, size_t len,
+                                     char32_t* out, endian from,
+                                     endian to) noexcept {
+  switch (active_isa()) {
+    case isa::avx512:
+    case isa::avx2:
+      return utf16_to_utf32_avx2<true>(in, len, out, from != endian::native,
+                                       to != endian::native);
+    case isa::sse42:
+      return utf16_to_utf32_sse42<true>(in, len, out, from != endian::native,
+                                        to != endian::native);
+    default:
+      return kernel_result{0, 0};
+  }
+}
+
+inline kernel_result transcode_valid(const char32_t* in, size_t len,
+                                     char16_t* out, endian from,
+                                     endian to) noexcept {
+  switch (active_isa()) {
+    case isa::avx512:
+    case isa::avx2:
+      return utf32_to_utf16_avx2<true>(in, len, out, from != endian::native,
+                                       to != endian::native);
+    case isa::sse42:
+      return utf32_to_utf16_sse42<true>(in, len, out, from != endian::native,
+                                        to != endian::native);
+    default:
+      return kernel_result{0, 0};
+  }
+}
+
+// Dispatchers used by the output-length functions: count the units of Out
+// that the best kernel for this CPU produces from as much of the input as
+// it accepts, or under Valid from input taken to be valid.  Pairs without
+// a kernel read nothing.
+template <typename Out, bool Valid = false, typename In>
+inline kernel_result output_length(const In* /*in*/, size_t /*len*/,
+                                   endian /*from*/) noexcept {
+  return kernel_result{0, 0};
+}
+
+template <typename Out, bool Valid = false>
+inline kernel_result output_length(const char* in, size_t len,
+                                   endian /*from*/) noexcept {
+  if constexpr (sizeof(Out) == 1) {
+    return kernel_result{0, 0};
+  } else {
+    switch (active_isa()) {
+      case isa::avx512:
+      case isa::avx2:
+        return utf8_output_length_avx2<Out, Valid>(in, len);
+      case isa::sse42:
+        return utf8_output_length_sse42<Out, Valid>(in, len);
+      default:
+        return kernel_result{0, 0};
+    }
+  }
+}
+
+template <typename Out, bool Valid = false>
+inline kernel_result output_length(const char16_t* in, size_t len,
+                                   endian from) noexcept {
+  if constexpr (sizeof(Out) == 2) {
+    return kernel_result{0, 0};
+  } else {
+    switch (active_isa()) {
+      case isa::avx512:
+      case isa::avx2:
+        return utf16_output_length_avx2<Out, Valid>(in, len,
+                                                     from != endian::native);
+      case isa::sse42:
+        return utf16_output_length_sse42<Out, Valid>(in, len,
+                                                      from != endian::native);
+      default:
+        return kernel_result{0, 0};
+    }
+  }
+}
+
+template <typename Out, bool Valid = false>
+inline kernel_result output_length(const char32_t* in, size_t len,
+                                   endian from) noexcept {
+  if constexpr (sizeof(Out) == 4) {
+    return kernel_result{0, 0};
+  } else {
+    switch (active_isa()) {
+      case isa::avx512:
+      case isa::avx2:
+        return utf32_output_length_avx2<Out, Valid>(in, len,
+                                                     from != endian::native);
+      case isa::sse42:
+        return utf32_output_length_sse42<Out, Valid>(in, len,
+                                                      from != endian::native);
+      default:
+        return kernel_result{0, 0};
+    }
+  }
+}
+
+// Dispatchers for the Latin-1 functions.
+inline kernel_result latin1_to_utf8(const char* in, size_t len,
+                                    char* out) noexcept {
+  switch (active_isa()) {
+    case isa::avx512:
+    case isa::avx2:
+      return latin1_to_utf8_avx2(in, len, out);
+    case isa::sse42:
+      return latin1_to_utf8_sse42(in, len, out);
+    default:
+      return kernel_result{0, 0};
+  }
+}
+
+inline kernel_result utf8_to_latin1(const char* in, size_t len,
+                                    char* out) noexcept {
+  switch (active_isa()) {
+    case isa::avx512:
+    case isa::avx2:
+      return utf8_to_latin1_avx2(in, len, out);
+    case isa::sse42:
+      return utf8_to_latin1_sse42(in, len, out);
+    default:
+      return kernel_result{0, 0};
+  }
+}
+
+inline kernel_result latin1_to_utf16(const char* in, size_t len,
+                                     char16_t* out, endian to) noexcept {
+  switch (active_isa()) {
+    case isa::avx512:
+    case isa::avx2:
+      return latin1_to_utf16_avx2(in, len, out, to != endian::native);
+    case isa::sse42:
+      return latin1_to_utf16_sse42(in, len, out, to != endian::native);
+    default:
+      return kernel_result{0, 0};
+  }
+}
+
+inline kernel_result utf16_to_latin1(const char16_t* in, size_t len,
+                                     char* out, endian from) noexcept {
+  switch (active_isa()) {
+    case isa::avx512:
+    case isa::avx2:
+      return utf16_to_latin1_avx2(in, len, out, from != endian::native);
+    case isa::sse42:
+      return utf16_to_latin1_sse42(in, len, out, from != endian::native);
+    default:
+      return kernel_result{0, 0};
+  }
+}
+
+// Byte order changes, one pshufb per register.  Every register is loaded
+// before it is stored, so out may be in itself.  The SSE4.2 and AVX2
+// kernels return how many units they swapped and leave the last partial
+// register to scalar code; AVX-512 finishes with a masked load and store.
+template <typename CharT>
+UTFX_TARGET_SSE42 inline size_t swap_units_sse42(const CharT* in, size_t len,
+                                                 CharT* out) {
+  constexpr size_t n = 16 / sizeof(CharT);
+  const __m128i order = unit_byte_order_sse42<CharT>(true);
+  size_t i = 0;
+  for (; i + 2 * n <= len; i += 2 * n) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    const __m128i b =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i + n));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm_shuffle_epi8(a, order));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i + n),
+                     _mm_shuffle_epi8(b, order));
+  }
+  if (i + n <= len) {
+    const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + i));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                     _mm_shuffle_epi8(a, order));
+    i += n;
+  }
+  return i;
+}
+
+template <typename CharT>
+UTFX_TARGET_AVX2 inline size_t swap_units_avx2(const CharT* in, size_t len,
+                                               CharT* out) {
+  constexpr size_t n = 32 / sizeof(CharT);
+  const __m256i order =
+      _mm256_broadcastsi128_si256(unit_byte_order_sse42<CharT>(true));
+  size_t i = 0;
+  for (; i + 2 * n <= len; i += 2 * n) {
+    const __m256i a =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    const __m256i b =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i + n));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                        _mm256_shuffle_epi8(a, order));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + n),
+                        _mm256_shuffle_epi8(b, order));
+  }
+  if (i + n <= len) {
+    const __m256i a =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(in + i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i),
+                        _mm256_shuffle_epi8(a, order));
+    i += n;
+  }
+  return i;
+}
+
+template <typename CharT>
+UTFX_TARGET_AVX512 inline size_t swap_units_avx512(const CharT* in,
+                                                   size_t len, CharT* out) {
+  constexpr size_t n = 64 / sizeof(CharT);
+  const __m512i order =
+      _mm512_broadcast_i32x4(unit_byte_order_sse42<CharT>(true));
+  size_t i = 0;
+  for (; i + n <= len; i += n) {
+    const __m512i a = _mm512_loadu_si512(in + i);
+    _mm512_storeu_si512(out + i, _mm512_shuffle_epi8(a, order));
+  }
+  if (i < len) {
+    const __mmask64 m = load_mask_avx512((len - i) * sizeof(CharT));
+    const __m512i a = _mm512_maskz_loadu_epi8(m, in + i);
+    _mm512_mask_storeu_epi8(out + i, m, _mm512_shuffle_epi8(a, order));
+  }
+  return len;
+}
+
+template <typename CharT>
+inline size_t swap_units(const CharT* in, size_t len, CharT* out) noexcept {
+  switch (active_isa()) {
+    case isa::avx512:
+      return swap_units_avx512(in, len, out);
+    case isa::avx2:
+      return swap_units_avx2(in, len, out);
+    case isa::sse42:
+      return swap_units_sse42(in, len, out);
+    default:
+      return 0;
+  }
+}
+#endif  // UTFX_SIMD_X86_64
+
+}  // namespace simd
+
+// Pinpoints the first error from the block a SIMD kernel flagged.  A
+// sequence cut by a block boundary is only flagged in the next block, so
+// the scalar scan resumes up to three bytes earlier, on a lead byte.
+inline validation_result utf8_error_after_block(const char* data, size_t len,
+                                                size_t block) noexcept {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+#if defined(UTFX_SIMD_X86_64)
+  if (block == simd::no_error_block) {
+    return validation_result{true, len, utf_error::none};
+  }
+#endif
+  size_t from = block < 3 ? 0 : block - 3;
+  for (int i = 0; i < 3 && from > 0 && utf_traits<char>::is_trail(p[from]);
+       ++i) {
+    --from;
+  }
+  return validate_utf8_scalar(p, p + from, p + len);
+}
+
+inline validation_result validate_utf8_fast(const char* data,
+                                            size_t len) noexcept {
+  size_t block = 0;
+#if defined(UTFX_SIMD_X86_64)
+  switch (simd::active_isa()) {
+    case simd::isa::avx512:
+      block = simd::utf8_error_block_avx512(data, len);
+      break;
+    case simd::isa::avx2:
+      block = simd::utf8_error_block_avx2(data, len);
+      break;
+    case simd::isa::sse42:
+      block = simd::utf8_error_block_sse42(data, len);
+      break;
+    default:
+      break;
+  }
+#endif
+  return utf8_error_after_block(data, len, block);
+}
+
+// Validates [p, end) as UTF-16 in byte order e; offsets are reported from
+// base.
+inline validation_result validate_utf16_scalar(const char16_t* base,
+                                               const char16_t* p,
+                                               const char16_t* end,
+                                               endian e) noexcept {
+  const bool swap = e != endian::native;
+  while (p != end) {
+    uint16_t w1 = static_cast<uint16_t>(*p);
+    if (swap) {
+      w1 = swap_bytes(w1);
+    }
+    if (!utf_traits<char16_t>::is_first_surrogate(w1)) {
+      if (utf_traits<char16_t>::is_second_surrogate(w1)) {
+        return validation_result{false, static_cast<size_t>(p - base),
+                                 utf_error::surrogate};
+      }
+      ++p;
+      continue;
+    }
+    if (end - p < 2) {
+      return validation_result{false, static_cast<size_t>(p - base),
+                               utf_error::truncated};
+    }
+    uint16_t w2 = static_cast<uint16_t>(p[1]);
+    if (swap) {
+      w2 = swap_bytes(w2);
+    }
+    if (!utf_traits<char16_t>::is_second_surrogate(w2)) {
+      return validation_result{false, static_cast<size_t>(p - base),
+                               utf_error::surrogate};
+    }
+    p += 2;
+  }
+  return validation_result{true, static_cast<size_t>(end - base),
+                           utf_error::none};
+}
+
+inline validation_result validate_utf16_fast(const char16_t* base,
+                                             const char16_t* p,
+                                             const char16_t* end,
+                                             endian e) noexcept {
+#if defined(UTFX_SIMD_X86_64)
+  const size_t len = static_cast<size_t>(end - p);
+  const bool swap = e != endian::native;
+  switch (simd::active_isa()) {
+    case simd::isa::avx512:
+      p += simd::utf16_valid_prefix_avx512(p, len, swap);
+      break;
+    case simd::isa::avx2:
+      p += simd::utf16_valid_prefix_avx2(p, len, swap);
+      break;
+    case simd::isa::sse42:
+      p += simd::utf16_valid_prefix_sse42(p, len, swap);
+      break;
+    default:
+      break;
+  }
+#endif
+  return validate_utf16_scalar(base, p, end, e);
+}
+
+// Validates [p, end) as UTF-32 in byte order e; offsets are reported from
+// base.
+inline validation_result validate_utf32_scalar(const char32_t* base,
+                                               const char32_t* p,
+                                               const char32_t* end,
+                                               endian e) noexcept {
+  const bool swap = e != endian::native;
+  for (; p != end; ++p) {
+    codepoint c = static_cast<codepoint>(*p);
+    if (swap) {
+      c = swap_bytes(c);
+    }
+    if (c > 0x10FFFF) {
+      return validation_result{false, static_cast<size_t>(p - base),
+                               utf_error::out_of_range};
+    }
+    if (0xD800 <= c && c <= 0xDFFF) {
+      return validation_result{false, static_cast<size_t>(p - base),
+                               utf_error::surrogate};
+    }
+  }
+  return validation_result{true, static_cast<size_t>(end - base),
+                           utf_error::none};
+}
+
+inline validation_result validate_utf32_fast(const char32_t* base,
+                                             const char32_t* p,
+                                             const char32_t* end,
+                                             endian e) noexcept {
+#if defined(UTFX_SIMD_X86_64)
+  const size_t len = static_cast<size_t>(end - p);
+  const bool swap = e != endian::native;
+  switch (simd::active_isa()) {
+    case simd::isa::avx512:
+      p += simd::utf32_valid_prefix_avx512(p, len, swap);
+      break;
+    case simd::isa::avx2:
+      p += simd::utf32_valid_prefix_avx2(p, len, swap);
+      break;
+    case simd::isa::sse42:
+      p += simd::utf32_valid_prefix_sse42(p, len, swap);
+      break;
+    default:
+      break;
+  }
+#endif
+  return validate_utf32_scalar(base, p, end, e);
+}
+
+// Reverses the bytes of every unit of in[0, len) into out, which may be in.
+template <typename CharT>
+inline void swap_units(const CharT* in, size_t len, CharT* out) noexcept {
+  size_t i = 0;
+#if defined(UTFX_SIMD_X86_64)
+  i = simd::swap_units(in, len, out);
+#endif
+  for (; i < len; ++i) {
+    out[i] = swap_bytes(in[i]);
+  }
+}
+
+// swap_units, validating in as UTF-16 or UTF-32 in byte order from on the
+// way.  Each chunk is validated just before it is swapped, while it is
+// still in cache, so the input is read from memory once; after the first
+// error the rest is only swapped.
+template <typename CharT>
+inline validation_result swap_units_checked(const CharT* in, size_t len,
+                                            CharT* out,
+                                            endian from) noexcept {
+  validation_result r{true, 0, utf_error::none};
+  size_t i = 0;
+  while (i < len) {
+    size_t j = len - i > 4096 ? i + 4096 : len;
+    if (r.valid) {
+      if constexpr (sizeof(CharT) == 2) {
+        // Keep a surrogate pair within one chunk.
+        const char16_t last = in[j - 1];
+        if (j != len && utf_traits<char16_t>::is_first_surrogate(
+                            from != endian::native ? swap_bytes(last) : last)) {
+          ++j;
+        }
+        r = validate_utf16_fast(in, in + i, in + j, from);
+      } else {
+        r = validate_utf32_fast(in, in + i, in + j, from);
+      }
+    }
+    swap_units(in + i, j - i, out + i);
+    i = j;
+  }
+  return r;
+}
+
+// Length of the sequence a UTF-8 lead byte announces; 1 for ASCII and for
+// bytes that cannot start a sequence.
+constexpr size_t utf8_sequence_length(unsigned char lead) noexcept {
+  if (lead < 0xC2 || lead > 0xF4) {
+    return 1;
+  }
+  return lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+}
+
+// Checks the n bytes at p, all of them before the end of a chunk, as the
+// start of a sequence that continues in the next chunk: true if they are
+// a valid prefix, otherwise false with the reason in error.
+inline bool is_utf8_prefix(const unsigned char* p, size_t n,
+                           utf_error& error) noexcept {
+  if (check_utf8_sequence(p, p + n, error) != 0 ||
+      error != utf_error::truncated) {
+    return false;
+  }
+  for (size_t i = 1; i < n; ++i) {
+    if (!utf_traits<char>::is_trail(p[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+#if !defined(UTFX_NO_THREADS)
+// Inputs are not split into chunks smaller than this.
+constexpr size_t parallel_min_chunk = size_t(1) << 20;
+
+// Moves a chunk boundary back to the lead byte of the sequence it falls
+// in.  With no lead byte among the three bytes before it there is a stray
+// continuation at or before the boundary, which whichever chunk holds it
+// reports at its exact offset, so the boundary stays put.
+inline size_t utf8_chunk_boundary(const unsigned char* p, size_t b) noexcept {
+  for (size_t back = 0; back <= 3 && back <= b; ++back) {
+    if (!utf_traits<char>::is_trail(p[b - back])) {
+      return b - back;
+    }
+  }
+  return b;
+}
+
+// Validates chunks split at lead bytes concurrently; the first chunk with
+// an error has the first error of the whole input.
+inline validation_result validate_utf8_parallel(const char* data, size_t len,
+                                                unsigned threads,
+                                                size_t min_chunk) {
+  if (threads == 0) {
+    threads = std::thread::hardware_concurrency();
+  }
+  const size_t max_chunks = min_chunk == 0 ? len : len / min_chunk;
+  const size_t chunks = threads < max_chunks ? threads : max_chunks;
+  if (chunks <= 1) {
+    return validate_utf8_fast(data, len);
+  }
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+  std::vector<size_t> bounds(chunks + 1, len);
+  bounds[0] = 0;
+  for (size_t i = 1; i < chunks; ++i) {
+    const size_t b = utf8_chunk_boundary(p, len / chunks * i);
+    bounds[i] = b < bounds[i - 1] ? bounds[i - 1] : b;
+  }
+  std::vector<validation_result> results(chunks);
+  auto work = [&](size_t i) {
+    results[i] =
+        validate_utf8_fast(data + bounds[i], bounds[i + 1] - bounds[i]);
+  };
+  std::vector<std::thread> workers;
+  workers.reserve(chunks - 1);
+  for (size_t i = 1; i < chunks; ++i) {
+    try {
+      workers.emplace_back(work, i);
+    } catch (const std::system_error&) {
+      // Out of threads: this one runs on the calling thread instead.
+      work(i);
+    }
+  }
+  work(0);
+  for (std::thread& t : workers) {
+    t.join();
+  }
+  for (size_t i = 0; i < chunks; ++i) {
+    if (!results[i].valid) {
+      return validation_result{false, bounds[i] + results[i].offset,
+                               results[i].error};
+    }
+  }
+  return validation_result{true, len, utf_error::none};
+}
+#endif
+
+inline bool is_utf8_fast(const char* data, size_t len) noexcept {
+#if defined(UTFX_SIMD_X86_64)
+  switch (simd::active_isa()) {
+    case simd::isa::avx512:
+      return simd::validate_utf8_avx512(data, len);
+    case simd::isa::avx2:
+      return simd::validate_utf8_avx2(data, len);
+    case simd::isa::sse42:
+      return simd::validate_utf8_sse42(data, len);
+    default:
+      break;
+  }
+#endif
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(data);
+  return is_utf8_scalar(p, p + len);
+}
+
+template <typename Policy>
+constexpr bool is_error_policy =
+    std::is_same<Policy, on_error::skip_t>::value ||
+    std::is_same<Policy, on_error::replace_t>::value ||
+    std::is_same<Policy, on_error::stop_t>::value ||
+    std::is_same<Policy, on_error::throw_exception_t>::value;
+
+// Policies under which the conversion ends at the first error.
+template <typename Policy>
+constexpr bool stops_on_error =
+    std::is_same<Policy, on_error::stop_t>::value ||
+    std::is_same<Policy, on_error::throw_exception_t>::value;
+
+template <typename Policy>
+constexpr bool throws_on_error =
+    std::is_same<Policy, on_error::throw_exception_t>::value;
+
+// Whether Alloc is an allocator of CharT, for the overloads that return
+// strings with a caller-supplied allocator.
+template <typename Alloc, typename CharT, typename = void>
+struct is_allocator_of : std::false_type {};
+
+template <typename Alloc, typename CharT>
+struct is_allocator_of<Alloc, CharT,
+                       decltype(void(std::declval<Alloc&>().allocate(1)))>
+    : std::is_same<typename Alloc::value_type, CharT> {};
+
+template <typename Alloc, typename CharT>
+constexpr bool is_allocator_of_v = is_allocator_of<Alloc, CharT>::value;
+
+template <typename Policy>
+constexpr void throw_on_error(utf_error error, size_t offset) {
+  if constexpr (throws_on_error<Policy>) {
+    if (error != utf_error::none) {
+      throw conversion_error(error, offset);
+    }
+  } else {
+    (void)error;
+    (void)offset;
+  }
+}
+
+template <typename CharOut, typename OutputIt>
+constexpr OutputIt encode_codepoint(codepoint c, OutputIt out,
+                                    endian to) noexcept {
+  if constexpr (sizeof(CharOut) != 1) {
+    return utf_traits<CharOut>::encode(c, out, to);
+  } else {
+    (void)to;
+    return utf_traits<CharOut>::encode(c, out);
+  }
+}
+
+// Decodes the code point at begin, which must be before end.  On ill-formed
+// input sets error and advances begin past the maximal subpart only: the
+// longest prefix of a well-formed sequence, or one unit.  Errors are
+// classified as by the validate_* functions.
+template <typename CharIn>
+constexpr codepoint decode_subpart(const CharIn*& begin, const CharIn* end,
+                                   endian from, utf_error& error) noexcept {
+  if constexpr (sizeof(CharIn) == 1) {
+    (void)from;
+    const unsigned char lead = static_cast<unsigned char>(*begin++);
+    if (lead < 0x80) {
+      return lead;
+    }
+    if (lead < 0xC2 || lead > 0xF4) {
+      error = lead < 0xC0   ? utf_error::stray_continuation
+              : lead < 0xC2 ? utf_error::overlong
+                            : utf_error::out_of_range;
+      return illegal;
+    }
+    const int len = lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+    // The second byte range rules out overlong forms, surrogates and code
+    // points above U+10FFFF.
+    unsigned char low = lead == 0xE0 ? 0xA0 : lead == 0xF0 ? 0x90 : 0x80;
+    unsigned char high = lead == 0xED ? 0x9F : lead == 0xF4 ? 0x8F : 0xBF;
+    codepoint c = lead & (0x7Fu >> len);
+    for (int i = 1; i < len; ++i) {
+      if (begin == end) {
+        error = utf_error::truncated;
+        return illegal;
+      }
+      const unsigned char b = static_cast<unsigned char>(*begin);
+      if (b < low || b > high) {
+        if (i > 1 || !utf_traits<char>::is_trail(b)) {
+          error = utf_error::truncated;
+        } else if (lead == 0xED) {
+          error = utf_error::surrogate;
+        } else if (lead == 0xF4) {
+          error = utf_error::out_of_range;
+        } else {
+          error = utf_error::overlong;
+        }
+        return illegal;
+      }
+      c = (c << 6) | (b & 0x3Fu);
+      low = 0x80;
+      high = 0xBF;
+      ++begin;
+    }
+    return c;
+  } else if constexpr (sizeof(CharIn) == 2) {
+    uint16_t w1 = static_cast<uint16_t>(*begin++);
+    if (from != endian::native) {
+      w1 = swap_bytes(w1);
+    }
+    if (!utf_traits<CharIn>::is_first_surrogate(w1)) {
+      if (utf_traits<CharIn>::is_second_surrogate(w1)) {
+        error = utf_error::surrogate;
+        return illegal;
+      }
+      return w1;
+    }
+    if (begin == end) {
+      error = utf_error::truncated;
+      return illegal;
+    }
+    uint16_t w2 = static_cast<uint16_t>(*begin);
+    if (from != endian::native) {
+      w2 = swap_bytes(w2);
+    }
+    if (!utf_traits<CharIn>::is_second_surrogate(w2)) {
+      error = utf_error::surrogate;
+      return illegal;
+    }
+    ++begin;
+    return utf_traits<CharIn>::combine_surrogate(w1, w2);
+  } else {
+    (void)end;
+    codepoint c = static_cast<codepoint>(*begin++);
+    if (from != endian::native) {
+      c = swap_bytes(c);
+    }
+    if (!is_valid_codepoint(c)) {
+      error = c > 0x10FFFF ? utf_error::out_of_range : utf_error::surrogate;
+      return illegal;
+    }
+    return c;
+  }
+}
+
+// Decodes one code point from [begin, end) and encodes it to out; illegal
+// and incomplete sequences are skipped.  The endian of a UTF-8 side is
+// ignored.
+template <typename CharOut, typename CharIn, typename OutputIt>
+constexpr OutputIt transcode_one(const CharIn*& begin, const CharIn* end,
+                                 OutputIt out, endian from,
+                                 endian to) noexcept {
+  codepoint c{0};
+  if constexpr (sizeof(CharIn) != 1) {
+    c = utf_traits<CharIn>::decode(begin, end, from);
+  } else {
+    c = utf_traits<CharIn>::decode(begin, end);
+  }
+  if (c == illegal || c == incomplete) {
+    return out;
+  }
+  return encode_codepoint<CharOut>(c, out, to);
+}
+
+// transcode_one under an error policy.  on_error::skip is the overload
+// above; replace writes U+FFFD for each maximal subpart, and stop and
+// throw_exception leave begin at the ill-formed sequence and set error.
+template <typename CharOut, typename Policy, typename CharIn,
+          typename OutputIt>
+constexpr OutputIt transcode_one(const CharIn*& begin, const CharIn* end,
+                                 OutputIt out, endian from, endian to,
+                                 utf_error& error) noexcept {
+  if constexpr (std::is_same<Policy, on_error::skip_t>::value) {
+    return transcode_one<CharOut>(begin, end, out, from, to);
+  } else {
+    const CharIn* next = begin;
+    utf_error why = utf_error::none;
+    codepoint c = decode_subpart(next, end, from, why);
+    if (why != utf_error::none) {
+      if constexpr (stops_on_error<Policy>) {
+        error = why;
+        return out;
+      }
+      c = 0xFFFD;
+    }
+    begin = next;
+    return encode_codepoint<CharOut>(c, out, to);
+  }
+}
+
+// The scalar transcoding loop over [begin, stop); the last sequence may run
+// on up to end.  ASCII runs in UTF-8 input are found with skip_ascii and
+// widened without going through decode/encode, and ASCII runs in UTF-16
+// input narrowed to UTF-8 in the same way; a code point that is not
+// ASCII goes straight to the decoder.  Under a stopping policy
+// the loop ends with begin at the first error, reported in error.
+template <typename CharOut, typename Policy, typename CharIn,
+          typename OutputIt>
+constexpr OutputIt transcode_scalar(const CharIn*& begin, const CharIn* stop,
+                                    const CharIn* end, OutputIt out,
+                                    endian from, endian to,
+                                    utf_error& error) noexcept {
+  // A local copy, which stores to out cannot alias.
+  const CharIn* p = begin;
+  while (p < stop) {
+    if constexpr (sizeof(CharIn) == 1 && sizeof(CharOut) != 1) {
+      if (static_cast<unsigned char>(*p) < 0x80) {
+        const CharIn* ascii_end = skip_ascii(p, stop);
+        const bool swap = to != endian::native;
+        for (; p != ascii_end; ++p) {
+          const CharOut u = static_cast<CharOut>(
+              static_cast<unsigned char>(*p));
+          *out++ = swap ? swap_bytes(u) : u;
+        }
+        if (p == stop) {
+          break;
+        }
+      }
+    } else if constexpr (sizeof(CharIn) == 2 && sizeof(CharOut) == 1) {
+      const bool swap = from != endian::native;
+      for (; p != stop; ++p) {
+        const uint16_t u = swap ? swap_bytes(static_cast<uint16_t>(*p))
+                                : static_cast<uint16_t>(*p);
+        if (u >= 0x80) {
+          break;
+        }
+        *out++ = static_cast<CharOut>(u);
+      }
+      if (p == stop) {
+        break;
+      }
+    }
+    if constexpr (sizeof(CharIn) == 1) {
+      // Well-formed sequences are decoded here: two- and three-byte ones
+      // whose lead byte rules out overlongs and surrogates need only their
+      // trail bytes checked, four-byte ones the range of the result too.
+      const unsigned char b0 = static_cast<unsigned char>(*p);
+      const ptrdiff_t left = end - p;
+      if (b0 >= 0xC2 && b0 < 0xE0 && left >= 2) {
+        const unsigned char b1 = static_cast<unsigned char>(p[1]);
+        if ((b1 & 0xC0) == 0x80) {
+          out = encode_codepoint<CharOut>(
+              (static_cast<codepoint>(b0 & 0x1F) << 6) | (b1 & 0x3F), out,
+              to);
+          p += 2;
+          continue;
+        }
+      } else if (b0 >= 0xE1 && b0 < 0xF0 && b0 != 0xED && left >= 3) {
+        const unsigned char b1 = static_cast<unsigned char>(p[1]);
+        const unsigned char b2 = static_cast<unsigned char>(p[2]);
+        if ((b1 & 0xC0) == 0x80 && (b2 & 0xC0) == 0x80) {
+          out = encode_codepoint<CharOut>(
+              (static_cast<codepoint>(b0 & 0x0F) << 12) |
+                  (static_cast<codepoint>(b1 & 0x3F) << 6) | (b2 & 0x3F),
+              out, to);
+          p += 3;
+          continue;
+        }
+      } else if (b0 >= 0xF0 && b0 < 0xF5 && left >= 4) {
+        const unsigned char b1 = static_cast<unsigned char>(p[1]);
+        const unsigned char b2 = static_cast<unsigned char>(p[2]);
+        const unsigned char b3 = static_cast<unsigned char>(p[3]);
+        const codepoint c = (static_cast<codepoint>(b0 & 0x07) << 18) |
+                            (static_cast<codepoint>(b1 & 0x3F) << 12) |
+                            (static_cast<codepoint>(b2 & 0x3F) << 6) |
+                            (b3 & 0x3F);
+        if ((b1 & 0xC0) == 0x80 && (b2 & 0xC0) == 0x80 &&
+            (b3 & 0xC0) == 0x80 && c >= 0x10000 && c <= 0x10FFFF) {
+          out = encode_codepoint<CharOut>(c, out, to);
+          p += 4;
+          continue;
+        }
+      }
+    }
+    out = transcode_one<CharOut, Policy>(p, end, out, from, to, error);
+    if constexpr (stops_on_error<Policy>) {
+      if (error != utf_error::none) {
+        break;
+      }
+    }
+  }
+  begin = p;
+  return out;
+}
+
+template <typename CharOut, typename CharIn, typename OutputIt>
+constexpr OutputIt transcode_scalar(const CharIn*& begin, const CharIn* stop,
+                                    const CharIn* end, OutputIt out,
+                                    endian from, endian to) noexcept {
+  utf_error error = utf_error::none;
+  return transcode_scalar<CharOut, on_error::skip_t>(begin, stop, end, out,
+                                                     from, to, error);
+}
+
+#if defined(UTFX_SIMD_X86_64)
+// The code unit type the kernels work on for each width.
+template <typename CharT, size_t = sizeof(CharT)>
+struct kernel_unit;
+template <typename CharT>
+struct kernel_unit<CharT, 1> {
+  using type = char;
+};
+template <typename CharT>
+struct kernel_unit<CharT, 2> {
+  using type = char16_t;
+};
+template <typename CharT>
+struct kernel_unit<CharT, 4> {
+  using type = char32_t;
+};
+
+// Alternates between the SIMD kernel, which handles the valid bulk of the
+// input, and the scalar loop, which takes over wherever the kernel stops.
+// Like transcode_scalar it converts the code points that start before stop
+// and produces exactly what the scalar loop alone would, under any error
+// policy: the kernels only convert well-formed input.
+template <typename CharOut, typename Policy, typename CharIn>
+CharOut* transcode_accelerated(const CharIn*& begin, const CharIn* stop,
+                               const CharIn* end, CharOut* out, endian from,
+                               endian to, utf_error& error) noexcept {
+  using in_unit = typename kernel_unit<CharIn>::type;
+  using out_unit = typename kernel_unit<CharOut>::type;
+  while (begin < stop) {
+    const simd::kernel_result r =
+        simd::transcode(reinterpret_cast<const in_unit*>(begin),
+                        static_cast<size_t>(stop - begin),
+                        reinterpret_cast<out_unit*>(out), from, to);
+    begin += r.read;
+    out += r.written;
+    // Step over at least one block in scalar code before trying the kernel
+    // again, so that bad input cannot make it restart on every code point.
+    const CharIn* run = stop - begin > 64 ? begin + 64 : stop;
+    out = transcode_scalar<CharOut, Policy>(begin, run, end, out, from, to,
+                                            error);
+    if constexpr (stops_on_error<Policy>) {
+      if (error != utf_error::none) {
+        break;
+      }
+    }
+  }
+  return out;
+}
+#endif
+
+// An output iterator that counts the units written through it.
+struct counting_iterator {
+  size_t count = 0;
+
+  constexpr counting_iterator& operator*() noexcept { return *this; }
+  constexpr counting_iterator& operator++() noexcept {
+    ++count;
+    return *this;
+  }
+  constexpr counting_iterator operator++(int) noexcept {
+    counting_iterator before = *this;
+    ++count;
+    return before;
+  }
+  template <typename Unit>
+  constexpr counting_iterator& operator=(Unit /*unit*/) noexcept {
+    return *this;
+  }
+};
+
+// Number of units transcode() writes for [begin, end), found the same way
+// as transcode_accelerated finds the units themselves: the counting
+// kernels take the valid bulk of the input and the scalar loop, writing
+// into a counting_iterator, the rest.  Under a stopping policy the count
+// ends at the first error, where begin is left.
+template <typename CharOut, typename Policy, typename CharIn>
+constexpr size_t count_transcoded(const CharIn*& begin, const CharIn* end,
+                                  endian from, utf_error& error) noexcept {
+  size_t n = 0;
+#if defined(UTFX_SIMD_X86_64)
+  if (!UTFX_IS_CONSTANT_EVALUATED()) {
+    using in_unit = typename kernel_unit<CharIn>::type;
+    using out_unit = typename kernel_unit<CharOut>::type;
+    while (begin != end) {
+      const simd::kernel_result r = simd::output_length<out_unit>(
+          reinterpret_cast<const in_unit*>(begin),
+          static_cast<size_t>(end - begin), from);
+      begin += r.read;
+      n += r.written;
+      const CharIn* stop = end - begin > 64 ? begin + 64 : end;
+      n += transcode_scalar<CharOut, Policy>(begin, stop, end,
+                                             counting_iterator{}, from, from,
+                                             error)
+               .count;
+      if constexpr (stops_on_error<Policy>) {
+        if (error != utf_error::none) {
+          break;
+        }
+      }
+    }
+    return n;
+  }
+#endif
+  n += transcode_scalar<CharOut, Policy>(begin, end, end, counting_iterator{},
+                                         from, from, error)
+           .count;
+  return n;
+}
+
+template <typename CharOut, typename Policy = on_error::skip_t,
+          typename CharIn>
+constexpr size_t transcoded_length(const CharIn* begin, const CharIn* end,
+                                   endian from) noexcept {
+  utf_error error = utf_error::none;
+  return count_transcoded<CharOut, Policy>(begin, end, from, error);
+}
+
+// transcode_scalar, with the SIMD kernels where the CPU has them.
+template <typename CharOut, typename Policy, typename CharIn>
+constexpr CharOut* transcode_to(const CharIn*& begin, const CharIn* stop,
+                                const CharIn* end, CharOut* out, endian from,
+                                endian to, utf_error& error) noexcept {
+#if defined(UTFX_SIMD_X86_64)
+  if (!UTFX_IS_CONSTANT_EVALUATED() &&
+      simd::active_isa() != simd::isa::scalar) {
+    return transcode_accelerated<CharOut, Policy>(begin, stop, end, out, from,
+                                                  to, error);
+  }
+#endif
+  return transcode_scalar<CharOut, Policy>(begin, stop, end, out, from, to,
+                                           error);
+}
+
+// The pointer overloads of transcode(): converts [begin, end) to out, or
+// counts the units that would be written when out is null.
+template <typename CharOut, typename Policy, typename CharIn>
+constexpr size_t transcode_into(const CharIn* begin, const CharIn* end,
+                                CharOut* out, endian from, endian to) {
+  const CharIn* const first = begin;
+  utf_error error = utf_error::none;
+  size_t n = 0;
+  if (out == nullptr) {
+    n = count_transcoded<CharOut, Policy>(begin, end, from, error);
+  } else {
+    n = static_cast<size_t>(
+        transcode_to<CharOut, Policy>(begin, end, end, out, from, to, error) -
+        out);
+  }
+  throw_on_error<Policy>(error, static_cast<size_t>(begin - first));
+  return n;
+}
+
+// Fills s with the n units that write(p) stores at p, without appending
+// them one by one; resize_and_overwrite also saves zero-filling them first.
+template <typename String, typename Write>
+void overwrite_string(String& s, size_t n, Write write) {
+  using unit = typename String::value_type;
+#if defined(__cpp_lib_string_resize_and_overwrite)
+  s.resize_and_overwrite(n, [&](unit* p, size_t /*n*/) {
+    return static_cast<size_t>(write(p) - p);
+  });
+#else
+  s.resize(n);
+  unit* p = &s[0];
+  s.resize(static_cast<size_t>(write(p) - p));
+#endif
+}
+
+// The most CharOut units a single CharIn unit can turn into: 3 UTF-8 bytes
+// for a BMP UTF-16 unit, 4 for a UTF-32 unit, 2 UTF-16 units for a UTF-32
+// unit, and 1 whenever the output units are at least as wide.
+template <typename CharOut, typename CharIn>
+constexpr size_t max_growth() noexcept {
+  if (sizeof(CharOut) >= sizeof(CharIn)) {
+    return 1;
+  }
+  if (sizeof(CharOut) == 1) {
+    return sizeof(CharIn) == 2 ? 3 : 4;
+  }
+  return 2;
+}
+
+// Converts the code points that start in [begin, stop), the last of them
+// running on up to end, into at most capacity units at out, stopping
+// before the first code point that does not fit.  While the output has
+// room for whatever the next stretch of input can turn into, that stretch
+// goes through transcode_to in one piece; the last few code points are
+// staged one at a time.
+template <typename CharOut, typename Policy, typename CharIn>
+constexpr transcode_result transcode_bounded(const CharIn* begin,
+                                             const CharIn* stop,
+                                             const CharIn* end, CharOut* out,
+                                             size_t capacity, endian from,
+                                             endian to) noexcept {
+  constexpr size_t growth = max_growth<CharOut, CharIn>();
+  constexpr size_t width = static_cast<size_t>(utf_traits<CharOut>::max_width);
+  const CharIn* const first = begin;
+  CharOut* const out_first = out;
+  CharOut* const out_end = out + capacity;
+  utf_error error = utf_error::none;
+  while (begin < stop) {
+    // One code point started in [begin, stop) may end past stop, so keep
+    // room for its full width.
+    const size_t room = static_cast<size_t>(out_end - out);
+    size_t n = room > width ? (room - width) / growth : 0;
+    if (n > static_cast<size_t>(stop - begin)) {
+      n = static_cast<size_t>(stop - begin);
+    }
+    if (n == 0) {
+      break;
+    }
+    out = transcode_to<CharOut, Policy>(begin, begin + n, end, out, from, to,
+                                        error);
+    if (error != utf_error::none) {
+      break;
+    }
+  }
+  while (begin < stop && error == utf_error::none) {
+    CharOut staged[4] = {};
+    const CharIn* next = begin;
+    const CharOut* staged_end = transcode_one<CharOut, Policy>(
+        next, end, staged, from, to, error);
+    const size_t k = static_cast<size_t>(staged_end - staged);
+    if (k > static_cast<size_t>(out_end - out)) {
+      return transcode_result{static_cast<size_t>(begin - first),
+                              static_cast<size_t>(out - out_first),
+                              transcode_status::output_full, utf_error::none};
+    }
+    for (size_t i = 0; i < k; ++i) {
+      *out++ = staged[i];
+    }
+    begin = next;
+  }
+  return transcode_result{static_cast<size_t>(begin - first),
+                          static_cast<size_t>(out - out_first),
+                          error == utf_error::none
+                              ? transcode_status::ok
+                              : transcode_status::invalid_input,
+                          error};
+}
+
+template <typename CharOut, typename Policy, typename CharIn>
+constexpr transcode_result transcode_bounded(const CharIn* begin,
+                                             const CharIn* end, CharOut* out,
+                                             size_t capacity, endian from,
+                                             endian to) noexcept {
+  return transcode_bounded<CharOut, Policy>(begin, end, end, out, capacity,
+                                            from, to);
+}
+
+// Number of units transcode_valid writes for the unit u of valid input.
+template <typename CharOut, typename CharIn>
+constexpr size_t valid_unit_length(CharIn u, bool swap) noexcept {
+  if constexpr (sizeof(CharIn) == 1) {
+    const unsigned char b = static_cast<unsigned char>(u);
+    if constexpr (sizeof(CharOut) == 2) {
+      return ((b & 0xC0) != 0x80) + (b >= 0xF0);
+    } else {
+      return (b & 0xC0) != 0x80;
+    }
+  } else if constexpr (sizeof(CharIn) == 2) {
+    const uint16_t v = swap ? swap_bytes(static_cast<uint16_t>(u))
+                            : static_cast<uint16_t>(u);
+    if constexpr (sizeof(CharOut) == 1) {
+      // Each half of a surrogate pair counts two of its four bytes.
+      return 1 + (v >= 0x80) + (v >= 0x800) - ((v & 0xF800) == 0xD800);
+    } else {
+      return (v & 0xFC00) != 0xDC00;
+    }
+  } else {
+    const uint32_t c = swap ? swap_bytes(static_cast<uint32_t>(u))
+                            : static_cast<uint32_t>(u);
+    if constexpr (sizeof(CharOut) == 1) {
+      return 1 + (c >= 0x80) + (c >= 0x800) + (c >= 0x10000);
+    } else {
+      return 1 + (c >= 0x10000);
+    }
+  }
+}
+
+// Number of units transcode_valid writes for [begin, end).  On valid input
+// it follows from each unit alone -- how many units start a code point,
+// and how many of those need two UTF-16 units or 2-4 UTF-8 bytes -- so
+// nothing is decoded.  The counting kernels take the bulk of the input
+// without validating it; what they leave, or all of it without SIMD, is
+// counted eight bytes at a time with bit tricks on a 64-bit word for
+// UTF-8 and UTF-16, and unit by unit after that.
+template <typename CharOut, typename CharIn>
+constexpr size_t valid_transcoded_length(const CharIn* begin,
+                                         const CharIn* end,
+                                         endian from) noexcept {
+  const bool swap = from != endian::native;
+  size_t n = 0;
+  const CharIn* p = begin;
+#if defined(UTFX_SIMD_X86_64)
+  if (!UTFX_IS_CONSTANT_EVALUATED()) {
+    using in_unit = typename kernel_unit<CharIn>::type;
+    using out_unit = typename kernel_unit<CharOut>::type;
+    const simd::kernel_result r = simd::output_length<out_unit, true>(
+        reinterpret_cast<const in_unit*>(begin),
+        static_cast<size_t>(end - begin), from);
+    p += r.read;
+    n += r.written;
+  }
+#endif
+  if constexpr (sizeof(CharIn) <= 2) {
+    if (!UTFX_IS_CONSTANT_EVALUATED()) {
+      // Each lane of acc counts for one unit position of the word, at most
+      // two or three per word, and is summed into n before it can overflow.
+      constexpr size_t block = 8 / sizeof(CharIn);
+      constexpr int shift = 8 * sizeof(CharIn) - 1;
+      constexpr uint64_t top = sizeof(CharIn) == 1
+                                   ? UINT64_C(0x8080808080808080)
+                                   : UINT64_C(0x8000800080008000);
+      while (static_cast<size_t>(end - p) >= block) {
+        size_t words = static_cast<size_t>(end - p) / block;
+        words = words < 64 ? words : 64;
+        uint64_t acc = 0;
+        for (size_t i = 0; i != words; ++i, p += block) {
+          uint64_t w;
+          std::memcpy(&w, p, 8);
+          if constexpr (sizeof(CharIn) == 1) {
+            // Bit 7 of each byte of w & ~(w << 1) is set for 10xxxxxx.
+            acc += ((w & ~(w << 1) & top) ^ top) >> shift;
+            if constexpr (sizeof(CharOut) == 2) {
+              acc += (w & (w << 1) & (w << 2) & (w << 3) & top) >> shift;
+            }
+          } else {
+            if (swap) {
+              w = ((w >> 8) & UINT64_C(0x00FF00FF00FF00FF)) |
+                  ((w << 8) & UINT64_C(0xFF00FF00FF00FF00));
+            }
+            if ((w & UINT64_C(0xFF80FF80FF80FF80)) == 0) {
+              // Four ASCII units, whatever the output.
+              acc += top >> shift;
+              continue;
+            }
+            // Bit 15 of each unit of any(x) is set when its unit is nonzero.
+            const auto any = [](uint64_t x) {
+              return (((x & ~top) + ~top) | x) & top;
+            };
+            constexpr uint64_t f800 = UINT64_C(0xF800F800F800F800);
+            if constexpr (sizeof(CharOut) == 1) {
+              const uint64_t surrogate =
+                  any((w & f800) ^ UINT64_C(0xD800D800D800D800)) ^ top;
+              acc += (top >> shift) +
+                     (any(w & UINT64_C(0xFF80FF80FF80FF80)) >> shift) +
+                     ((any(w & f800) & ~surrogate) >> shift);
+            } else {
+              acc += (any((w & UINT64_C(0xFC00FC00FC00FC00)) ^
+                          UINT64_C(0xDC00DC00DC00DC00)) >>
+                      shift);
+            }
+          }
+        }
+        if constexpr (sizeof(CharIn) == 1) {
+          acc = (acc & UINT64_C(0x00FF00FF00FF00FF)) +
+                ((acc >> 8) & UINT64_C(0x00FF00FF00FF00FF));
+        }
+        n += static_cast<size_t>((acc * UINT64_C(0x0001000100010001)) >> 48);
+      }
+    }
+  }
+  for (; p != end; ++p) {
+    n += valid_unit_length<CharOut>(*p, swap);
+  }
+  return n;
+}
+
+// The string overloads of transcode(), allocating the result from alloc.
+// Under on_error::stop the result is the conversion of the input before
+// the first error.  With SIMD kernels the exact length is counted first,
+// which costs little next to the conversion, and the result written in
+// place.  Without them a validating count would decode everything twice,
+// so the input is converted once, a block at a time, through a buffer on
+// the stack: appending from there is cheaper than resizing the result,
+// which zero-fills it before it is written.  Input longer than a block
+// reserves for the rest with valid_transcoded_length, which only looks at
+// lead units.
+template <typename CharOut, typename Policy, typename CharIn,
+          typename Alloc = std::allocator<CharOut>>
+std::basic_string<CharOut, std::char_traits<CharOut>, Alloc> transcode_string(
+    const CharIn* begin, const CharIn* end, endian from, endian to,
+    const Alloc& alloc = Alloc()) {
+  std::basic_string<CharOut, std::char_traits<CharOut>, Alloc> result(alloc);
+#if defined(UTFX_SIMD_X86_64)
+  if (simd::active_isa() != simd::isa::scalar) {
+    const CharIn* stop = begin;
+    utf_error error = utf_error::none;
+    const size_t n =
+        count_transcoded<CharOut, Policy>(stop, end, from, error);
+    throw_on_error<Policy>(error, static_cast<size_t>(stop - begin));
+    overwrite_string(result, n, [&](CharOut* out) {
+      // [begin, stop) holds no error that stops the conversion.
+      utf_error none = utf_error::none;
+      return transcode_to<CharOut, Policy>(begin, stop, end, out, from, to,
+                                           none);
+    });
+    return result;
+  }
+#endif
+  const CharIn* const first = begin;
+  constexpr size_t block = 512;
+  constexpr size_t span =
+      (block - static_cast<size_t>(utf_traits<CharOut>::max_width)) /
+      max_growth<CharOut, CharIn>();
+  CharOut buffer[block];
+  utf_error error = utf_error::none;
+  do {
+    const CharIn* stop =
+        static_cast<size_t>(end - begin) > span ? begin + span : end;
+    const CharOut* out = transcode_to<CharOut, Policy>(begin, stop, end,
+                                                       buffer, from, to,
+                                                       error);
+    const size_t n = static_cast<size_t>(out - buffer);
+    if (result.empty() && begin < end && error == utf_error::none) {
+      // More than a block of input: reserve for the rest once.
+      result.reserve(n + valid_transcoded_length<CharOut>(begin, end, from));
+    }
+    result.append(buffer, n);
+  } while (begin < end && error == utf_error::none);
+  throw_on_error<Policy>(error, static_cast<size_t>(begin - first));
+  return result;
+}
+
+// The transcoders for input known to be valid.  Code points are decoded
+// with decode_valid and the kernels run without validating, so nothing is
+// checked; ill-formed input is undefined behavior.  Like transcode_scalar
+// the scalar loop converts the code points that start before stop.
+template <typename CharOut, typename CharIn, typename OutputIt>
+constexpr OutputIt transcode_valid_scalar(const CharIn*& begin,
+                                          const CharIn* stop, OutputIt out,
+                                          endian from, endian to) noexcept {
+  while (begin < stop) {
+    if constexpr (sizeof(CharIn) == 1 && sizeof(CharOut) != 1) {
+      if (static_cast<unsigned char>(*begin) < 0x80) {
+        const CharIn* ascii_end = skip_ascii(begin, stop);
+        const bool swap = to != endian::native;
+        for (; begin != ascii_end; ++begin) {
+          const CharOut u = static_cast<CharOut>(
+              static_cast<unsigned char>(*begin));
+          *out++ = swap ? swap_bytes(u) : u;
+        }
+        if (begin == stop) {
+          break;
+        }
+      }
+    }
+    codepoint c{0};
+    if constexpr (sizeof(CharIn) != 1) {
+      c = utf_traits<CharIn>::decode_valid(begin, from);
+    } else {
+      c = utf_traits<CharIn>::decode_valid(begin);
+    }
+    out = encode_codepoint<CharOut>(c, out, to);
+  }
+  return out;
+}
+
+#if defined(UTFX_SIMD_X86_64)
+template <typename CharOut, typename CharIn>
+CharOut* transcode_valid_accelerated(const CharIn*& begin, const CharIn* end,
+                                     CharOut* out, endian from,
+                                     endian to) noexcept {
+  using in_unit = typename kernel_unit<CharIn>::type;
+  using out_unit = typename kernel_unit<CharOut>::type;
+  while (begin < end) {
+    const simd::kernel_result r =
+        simd::transcode_valid(reinterpret_cast<const in_unit*>(begin),
+                              static_cast<size_t>(end - begin),
+                              reinterpret_cast<out_unit*>(out), from, to);
+    begin += r.read;
+    out += r.written;
+    // The kernels stop at what they leave to scalar code, such as 4-byte
+    // UTF-8 sequences, and at the end of the input.
+    const CharIn* run = end - begin > 64 ? begin + 64 : end;
+    out = transcode_valid_scalar<CharOut>(begin, run, out, from, to);
+  }
+  return out;
+}
+#endif
+
+template <typename CharOut, typename CharIn>
+constexpr CharOut* transcode_valid_to(const CharIn* begin, const CharIn* end,
+                                      CharOut* out, endian from,
+                                      endian to) noexcept {
+#if defined(UTFX_SIMD_X86_64)
+  if (!UTFX_IS_CONSTANT_EVALUATED() &&
+      simd::active_isa() != simd::isa::scalar) {
+    return transcode_valid_accelerated<CharOut>(begin, end, out, from, to);
+  }
+#endif
+  return transcode_valid_scalar<CharOut>(begin, end, out, from, to);
+}
+
+// The pointer and string overloads of transcode_valid().
+template <typename CharOut, typename CharIn>
+constexpr size_t transcode_valid_into(const CharIn* begin, const CharIn* end,
+                                      CharOut* out, endian from,
+                                      endian to) noexcept {
+  if (out == nullptr) {
+    return valid_transcoded_length<CharOut>(begin, end, from);
+  }
+  return static_cast<size_t>(
+      transcode_valid_to<CharOut>(begin, end, out, from, to) - out);
+}
+
+template <typename CharOut, typename CharIn>
+std::basic_string<CharOut> transcode_valid_string(const CharIn* begin,
+                                                  const CharIn* end,
+                                                  endian from, endian to) {
+  std::basic_string<CharOut> result;
+  overwrite_string(result, valid_transcoded_length<CharOut>(begin, end, from),
+                   [&](CharOut* out) {
+                     return transcode_valid_to<CharOut>(begin, end, out, from,
+                                                        to);
+                   });
+  return result;
+}
+
+template <typename CharIn>
+inline bool valid_text(const CharIn* begin, const CharIn* end, endian from) {
+  const size_t len = static_cast<size_t>(end - begin);
+  if constexpr (sizeof(CharIn) == 1) {
+    return validate_utf8_fast(reinterpret_cast<const char*>(begin), len).valid;
+  } else if constexpr (sizeof(CharIn) == 2) {
+    const char16_t* p = reinterpret_cast<const char16_t*>(begin);
+    return validate_utf16_fast(p, p, p + len, from).valid;
+  } else {
+    const char32_t* p = reinterpret_cast<const char32_t*>(begin);
+    return validate_utf32_fast(p, p, p + len, from).valid;
+  }
+}
+
+// Where [p, end) ends with a code point cut short by end: the start of a
+// UTF-8 lead byte followed by fewer trail bytes than it announces, or of a
+// final high surrogate; end when there is none.  stream_transcoder holds
+// those units back until the next chunk.  UTF-8 tails that are already
+// ill-formed (F4 9F, E0 80) are held back too: under on_error::skip the
+// sequence goes on to take the next byte that is not a trail byte, which
+// only the next chunk can supply.
+template <typename CharIn>
+inline const CharIn* incomplete_tail(const CharIn* p, const CharIn* end,
+                                     endian from) noexcept {
+  if constexpr (sizeof(CharIn) == 1) {
+    for (const CharIn* q = end; q != p && end - q < 3;) {
+      --q;
+      const unsigned char u = static_cast<unsigned char>(*q);
+      if (!utf_traits<char>::is_trail(u)) {
+        if (static_cast<size_t>(end - q) < utf8_sequence_length(u)) {
+          return q;
+        }
+        break;
+      }
+    }
+  } else if constexpr (sizeof(CharIn) == 2) {
+    if (p != end) {
+      const CharIn u = from != endian::native ? swap_bytes(end[-1]) : end[-1];
+      if (utf_traits<CharIn>::is_first_surrogate(u)) {
+        return end - 1;
+      }
+    }
+  } else {
+    (void)p;
+    (void)from;
+  }
+  return end;
+}
+
+template <typename CharIn>
+constexpr bool starts_code_point(CharIn u, endian from) noexcept {
+  if constexpr (sizeof(CharIn) == 1) {
+    return !utf_traits<CharIn>::is_trail(u);
+  } else if constexpr (sizeof(CharIn) == 2) {
+    return !utf_traits<CharIn>::is_second_surrogate(
+        from != endian::native ? swap_bytes(u) : u);
+  } else {
+    return true;
+  }
+}
+
+// Batch conversion of the strings data[offsets[i], offsets[i + 1]), i <
+// count, in one pass over the input: the strings are taken a window of up
+// to batch_window units at a time.  When the strings of a window form one
+// valid text and each starts on a code point, they are exactly its pieces:
+// the window is converted in one go by transcode_valid, kernels running
+// straight across the string boundaries, and the output offsets inside it
+// are found while it is still in cache.  If it needs one output unit per
+// input unit, as ASCII does, they are the input offsets; otherwise they
+// are read off a running count of the window's units.  The rest, and a
+// string that fills a window on its own, are converted string by string
+// as transcode() would convert them alone, each offset being where the
+// output ends.  With a null out the offsets are counted the same way, and
+// with filled set they are already in out_offsets and left as they are.
+inline constexpr size_t batch_window = 4096;
+
+template <typename CharOut, typename CharIn, typename Offset>
+size_t transcode_batch(const CharIn* data, const Offset* offsets,
+                       size_t count, CharOut* out, Offset* out_offsets,
+                       endian from, endian to, bool filled = false) {
+  size_t n = 0;
+  out_offsets[0] = 0;
+  for (size_t i = 0, j = 0; i < count; i = j) {
+    const CharIn* const first = data + offsets[i];
+    for (j = i + 1; j < count && static_cast<size_t>(data + offsets[j + 1] -
+                                                     first) <= batch_window;
+         ++j) {
+    }
+    const CharIn* const last = data + offsets[j];
+    bool valid = j - i > 1 && valid_text(first, last, from);
+    for (size_t k = i + 1; valid && k < j; ++k) {
+      const CharIn* p = data + offsets[k];
+      valid = p == last || starts_code_point(*p, from);
+    }
+    if (valid) {
+      const size_t start = n;
+      if (out != nullptr) {
+        n = static_cast<size_t>(
+            transcode_valid_to<CharOut>(first, last, out + n, from, to) - out);
+      } else {
+        n += valid_transcoded_length<CharOut>(first, last, from);
+      }
+      if (filled) {
+        continue;
+      }
+      if (n - start == static_cast<size_t>(last - first)) {
+        for (size_t k = i + 1; k < j; ++k) {
+          out_offsets[k] =
+              static_cast<Offset>(start + (data + offsets[k] - first));
+        }
+      } else {
+        // At most three units out per unit in, so a window counts within
+        // 16 bits.
+        uint16_t running[batch_window + 1];
+        const bool swap = from != endian::native;
+        running[0] = 0;
+        for (size_t q = 0; q != static_cast<size_t>(last - first); ++q) {
+          running[q + 1] = static_cast<uint16_t>(
+              running[q] + valid_unit_length<CharOut>(first[q], swap));
+        }
+        for (size_t k = i + 1; k < j; ++k) {
+          out_offsets[k] =
+              static_cast<Offset>(start + running[data + offsets[k] - first]);
+        }
+      }
+      out_offsets[j] = static_cast<Offset>(n);
+      continue;
+    }
+    for (size_t k = i; k < j; ++k) {
+      const CharIn* b = data + offsets[k];
+      const CharIn* e = data + offsets[k + 1];
+      if (out == nullptr) {
+        n += transcoded_length<CharOut>(b, e, from);
+      } else {
+        utf_error error = utf_error::none;
+        n = static_cast<size_t>(transcode_to<CharOut, on_error::skip_t>(
+                                    b, e, e, out + n, from, to, error) -
+                                out);
+      }
+      out_offsets[k + 1] = static_cast<Offset>(n);
+    }
+  }
+  return n;
+}
+
+template <typename CharOut, typename Offset, typename CharIn>
+transcoded_batch<CharOut, Offset> transcode_batch(const CharIn* data,
+                                                  const Offset* offsets,
+                                                  size_t count, endian from,
+                                                  endian to) {
+  transcoded_batch<CharOut, Offset> result;
+  result.offsets.resize(count + 1);
+  Offset* out_offsets = result.offsets.data();
+  const size_t n = detail::transcode_batch(data, offsets, count,
+                                           static_cast<CharOut*>(nullptr),
+                                           out_offsets, from, to);
+  overwrite_string(result.data, n, [&](CharOut* out) {
+    return out + detail::transcode_batch(data, offsets, count, out,
+                                         out_offsets, from, to, true);
+  });
+  return result;
+}
+
+}  // namespace detail
+
+// ============================================================================
+// utf8_char — A single UTF-8 code point (1–4 bytes) within a larger string.
+// ============================================================================
+class utf8_char {
+ public:
+  using value_type = char;
+  using pointer = const char*;
+  using const_pointer = const char*;
+  using iterator = const char*;
+  using const_iterator = const char*;
+  using size_type = size_t;
+
+  constexpr utf8_char() noexcept : data_(nullptr), len_(0) {}
+  constexpr utf8_char(const char* data, size_type len) noexcept
+      : data_(data), len_(len) {}
+
+  /// Pointer to the raw UTF-8 bytes of this character.
+  constexpr const char* data() const noexcept { return data_; }
+  /// Number of bytes (1–4).
+  constexpr size_type size() const noexcept { return len_; }
+  /// Number of bytes (1–4).
+  constexpr size_type length() const noexcept { return len_; }
+  /// Number of bytes (1–4).
+  constexpr size_type byte_size() const noexcept { return len_; }
+
+  constexpr const char* begin() const noexcept { return data_; }
+  constexpr const char* end() const noexcept { return data_ + len_; }
+  constexpr const char* cbegin() const noexcept { return data_; }
+  constexpr const char* cend() const noexcept { return data_ + len_; }
+
+  /// The decoded Unicode code point (char32_t).
+  constexpr detail::codepoint code_point() const noexcept {
+    if (len_ == 0) {
+      return detail::illegal;
+    }
+    const char* p = data_;
+    return detail::utf_traits<char>::decode_valid(p);
+  }
+
+  constexpr char operator[](size_type i) const noexcept { return data_[i]; }
+  constexpr bool empty() const noexcept { return len_ == 0; }
+
+  friend constexpr bool operator==(utf8_char a, utf8_char b) noexcept {
+    return a.code_point() == b.code_point();
+  }
+  friend constexpr bool operator!=(utf8_char a, utf8_char b) noexcept {
+    return !(a == b);
+  }
+  friend constexpr bool operator<(utf8_char a, utf8_char b) noexcept {
+    return a.code_point() < b.code_point();
+  }
+  friend constexpr bool operator<=(utf8_char a, utf8_char b) noexcept {
+    return a.code_point() <= b.code_point();
+  }
+  friend constexpr bool operator>(utf8_char a, utf8_char b) noexcept {
+    return a.code_point() > b.code_point();
+  }
+  friend constexpr bool operator>=(utf8_char a, utf8_char b) noexcept {
+    return a.code_point() >= b.code_point();
+  }
+
+ private:
+  const char* data_;
+  size_type len_;
+};
+
+// ============================================================================
+// utf8_view — A lightweight, read-only view over UTF-8 encoded text.
+//
+// Provides an interface similar to std::string_view, but iterates over
+// Unicode code points (utf8_char) rather than raw bytes.
+//
+// Complexity notes:
+//   size(), operator[], substr(), and remove_prefix/remove_suffix are O(n)
+//   in the number of code points (they must scan UTF-8 boundaries).
+//   byte_size(), data(), empty(), begin(), end() are O(1).
+// ============================================================================
+class utf8_view {
+ public:
+  // --- Member types ---
+  using value_type = utf8_char;
+  using size_type = size_t;
+  using difference_type = ptrdiff_t;
+  using reference = utf8_char;
+  using const_reference = utf8_char;
+
+  /// Forward iterator that decodes UTF-8 on the fly.
+  class iterator {
+   public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = utf8_char;
+    using difference_type = ptrdiff_t;
+    using pointer = void;
+    using reference = utf8_char;
+
+    constexpr iterator() noexcept : pos_(nullptr) {}
+
+    constexpr reference operator*() const noexcept {
+      int trail = detail::utf_traits<char>::trail_length(*pos_);
+      size_type len = trail < 0 ? 1 : static_cast<size_type>(trail + 1);
+      return utf8_char(pos_, len);
+    }
+
+    constexpr iterator& operator++() noexcept {
+      int trail = detail::utf_traits<char>::trail_length(*pos_);
+      pos_ += trail < 0 ? 1 : static_cast<size_type>(trail + 1);
+      return *this;
+    }
+
+    constexpr iterator operator++(int) noexcept {
+      iterator tmp = *this;
+      ++(*this);
+      return tmp;
+    }
+
+    constexpr bool operator==(const iterator& other) const noexcept {
+      return pos_ == other.pos_;
+    }
+    constexpr bool operator!=(const iterator& other) const noexcept {
+      return !(*this == other);
+    }
+
+   private:
+    friend class utf8_view;
+    constexpr explicit iterator(const char* pos) noexcept : pos_(pos) {}
+    const char* pos_;
+  };
+
+  using const_iterator = iterator;
+
+  // --- Construction ---
+  constexpr utf8_view() noexcept : data_(nullptr), byte_size_(0) {}
+
+  /// Construct from a null-terminated C-string.
+  /*implicit*/ constexpr utf8_view(const char* str) noexcept
+      : data_(str), byte_size_(str ? std::char_traits<char>::length(str) : 0) {}
+
+  /// Construct from a pointer and byte length.
+  constexpr utf8_view(const char* str, size_type len) noexcept
+      : data_(str), byte_size_(len) {}
+
+  /// Construct from std::string.
+  /*implicit*/ utf8_view(const std::string& str) noexcept
+      : data_(str.data()), byte_size_(str.size()) {}
+
+  /// Construct from std::string_view.
+  /*implicit*/ constexpr utf8_view(std::string_view sv) noexcept
+      : data_(sv.data()), byte_size_(sv.size()) {}
+
+  // --- Iterators ---
+  constexpr iterator begin() const noexcept { return iterator(data_); }
+  constexpr iterator end() const noexcept {
+    return iterator(data_ + byte_size_);
+  }
+  constexpr const_iterator cbegin() const noexcept { return begin(); }
+  constexpr const_iterator cend() const noexcept { return end(); }
+
+  // --- Size / capacity ---
+  /// Number of code points. O(n) — scans the entire view.
+  constexpr size_type size() const noexcept {
+    size_type n = npos;
+    advance(data_, data_ + byte_size_, n);
+    return npos - n;
+  }
+  /// Number of code points. O(n).
+  constexpr size_type length() const noexcept { return size(); }
+  /// Number of raw bytes. O(1).
+  constexpr size_type byte_size() const noexcept { return byte_size_; }
+  /// True if the view contains no bytes. O(1).
+  constexpr bool empty() const noexcept { return byte_size_ == 0; }
+  /// Maximum possible size.
+  static constexpr size_type npos = ~size_type(0);
+  constexpr size_type max_size() const noexcept { return npos - 1; }
+
+  // --- Element access ---
+  /// Pointer to the raw underlying bytes. O(1).
+  constexpr const char* data() const noexcept { return data_; }
+
+  /// First code point. O(1). UB if empty.
+  constexpr utf8_char front() const noexcept {
+    int trail = detail::utf_traits<char>::trail_length(*data_);
+    size_type len = trail < 0 ? 1 : static_cast<size_type>(trail + 1);
+    return utf8_char(data_, len);
+  }
+
+  /// Last code point. O(last-character-length). UB if empty.
+  constexpr utf8_char back() const noexcept {
+    const char* p = data_ + byte_size_;
+    while (p > data_ && detail::utf_traits<char>::is_trail(*(p - 1))) {
+      --p;
+    }
+    --p;
+    return utf8_char(p, static_cast<size_type>(data_ + byte_size_ - p));
+  }
+
+  /// Nth code point. O(n). UB if n >= size().
+  constexpr utf8_char operator[](size_type n) const noexcept {
+    auto it = begin();
+    while (n-- > 0) {
+      ++it;
+    }
+    return *it;
+  }
+
+  // --- Modifiers (view-level) ---
+  /// Remove the first n code points from the view. O(n).
+  constexpr void remove_prefix(size_type n) noexcept {
+    const char* p = advance(data_, data_ + byte_size_, n);
+    byte_size_ -= static_cast<size_type>(p - data_);
+    data_ = p;
+  }
+
+  /// Remove the last n code points from the view. O(n).
+  constexpr void remove_suffix(size_type n) noexcept {
+    while (n-- > 0 && byte_size_ > 0) {
+      const char* p = data_ + byte_size_;
+      while (p > data_ && detail::utf_traits<char>::is_trail(*(p - 1))) {
+        --p;
+      }
+      --p;
+      byte_size_ = static_cast<size_type>(p - data_);
+    }
+  }
+
+  // --- Substring ---
+  /// Returns a view of the substring [pos, pos+count). O(pos+count).
+  constexpr utf8_view substr(size_type pos = 0,
+                             size_type count = npos) const noexcept {
+    const char* end_pos = data_ + byte_size_;
+    const char* start = advance(data_, end_pos, pos);
+    if (start >= end_pos) {
+      return utf8_view();
+    }
+    const char* sub_end = advance(start, end_pos, count);
+    return utf8_view(start, static_cast<size_type>(sub_end - start));
+  }
+
+  // --- Swap ---
+  constexpr void swap(utf8_view& other) noexcept {
+    const char* tmp_data = data_;
+    size_type tmp_size = byte_size_;
+    data_ = other.data_;
+    byte_size_ = other.byte_size_;
+    other.data_ = tmp_data;
+    other.byte_size_ = tmp_size;
+  }
+
+  // --- Conversion ---
+  /// Implicit conversion to std::string_view (raw bytes).
+  constexpr operator std::string_view() const noexcept {
+    return std::string_view(data_, byte_size_);
+  }
+
+  // --- Comparison (bytewise, consistent with code-point order for valid UTF-8)
+  friend constexpr bool operator==(utf8_view a, utf8_view b) noexcept {
+    return std::string_view(a.data_, a.byte_size_) ==
+           std::string_view(b.data_, b.byte_size_);
+  }
+  friend constexpr bool operator!=(utf8_view a, utf8_view b) noexcept {
+    return !(a == b);
+  }
+  friend constexpr bool operator<(utf8_view a, utf8_view b) noexcept {
+    return std::string_view(a.data_, a.byte_size_) <
+           std::string_view(b.data_, b.byte_size_);
+  }
+  friend constexpr bool operator<=(utf8_view a, utf8_view b) noexcept {
+    return std::string_view(a.data_, a.byte_size_) <=
+           std::string_view(b.data_, b.byte_size_);
+  }
+  friend constexpr bool operator>(utf8_view a, utf8_view b) noexcept {
+    return std::string_view(a.data_, a.byte_size_) >
+           std::string_view(b.data_, b.byte_size_);
+  }
+  friend constexpr bool operator>=(utf8_view a, utf8_view b) noexcept {
+    return std::string_view(a.data_, a.byte_size_) >=
+           std::string_view(b.data_, b.byte_size_);
+  }
+
+ private:
+  // Steps p over up to n code points, stopping at e (a truncated sequence at
+  // the end counts as one), and takes ASCII runs a word at a time.  On
+  // return n holds the number of steps not taken.
+  static constexpr const char* advance(const char* p, const char* e,
+                                       size_type& n) noexcept {
+    while (n > 0 && p < e) {
+      const char* run_end = detail::skip_ascii(
+          p, static_cast<size_type>(e - p) > n ? p + n : e);
+      if (run_end != p) {
+        n -= static_cast<size_type>(run_end - p);
+        p = run_end;
+        continue;
+      }
+      int trail = detail::utf_traits<char>::trail_length(*p);
+      size_type len = trail < 0 ? 1 : static_cast<size_type>(trail + 1);
+      p = static_cast<size_type>(e - p) > len ? p + len : e;
+      --n;
+    }
+    return p;
+  }
+
+  const char* data_;
+  size_type byte_size_;
+};
+
+// transcode — between UTF-8, UTF-16 and UTF-32.  Each overload takes an
+// optional error policy as its last argument (on_error::skip by default).
+template <typename CharOut, typename CharIn,
+          typename Policy = on_error::skip_t,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) == 1 || sizeof(CharOut) == 1) &&
+                  (sizeof(CharIn) != sizeof(CharOut)) &&
+                  detail::is_error_policy<Policy>,
+              void>::type>
+constexpr size_t transcode(const CharIn* begin, const CharIn* end, CharOut* out,
+                           utfx::endian from_or_to, Policy = Policy{}) {
+  return detail::transcode_into<CharOut, Policy>(begin, end, out, from_or_to,
+                                                 from_or_to);
+}
+
+template <typename CharOut, typename CharIn,
+          typename Policy = on_error::skip_t,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) == 1 || sizeof(CharOut) == 1) &&
+                  (sizeof(CharIn) != sizeof(CharOut)) &&
+                  detail::is_error_policy<Policy>,
+              void>::type>
+std::basic_string<CharOut> transcode(const CharIn* begin, const CharIn* end,
+                                     utfx::endian from_or_to,
+                                     Policy = Policy{}) {
+  return detail::transcode_string<CharOut, Policy>(begin, end, from_or_to,
+                                                   from_or_to);
+}
+
+template <typename CharOut, typename CharIn,
+          typename Policy = on_error::skip_t,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) != 1 && sizeof(CharOut) != 1) &&
+                  detail::is_error_policy<Policy>,
+              void>::type>
+size_t transcode(const CharIn* begin, const CharIn* end, CharOut* out,
+                 utfx::endian from, utfx::endian to, Policy = Policy{}) {
+  return detail::transcode_into<CharOut, Policy>(begin, end, out, from, to);
+}
+
+template <typename CharOut, typename CharIn,
+          typename Policy = on_error::skip_t,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) != 1 && sizeof(CharOut) != 1) &&
+                  detail::is_error_policy<Policy>,
+              void>::type>
+std::basic_string<CharOut> transcode(const CharIn* begin, const CharIn* end,
+                                     utfx::endian from, utfx::endian to,
+                                     Policy = Policy{}) {
+  return detail::transcode_string<CharOut, Policy>(begin, end, from, to);
+}
+
+/// The string overloads with an allocator: the result is a basic_string
+/// using alloc, such as a std::pmr::polymorphic_allocator over a
+/// request-scoped arena.
+template <typename CharOut, typename CharIn, typename Alloc,
+          typename Policy = on_error::skip_t,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) == 1 || sizeof(CharOut) == 1) &&
+                  (sizeof(CharIn) != sizeof(CharOut)) &&
+                  detail::is_allocator_of_v<Alloc, CharOut> &&
+                  detail::is_error_policy<Policy>,
+              void>::type>
+std::basic_string<CharOut, std::char_traits<CharOut>, Alloc> transcode(
+    const CharIn* begin, const CharIn* end, utfx::endian from_or_to,
+    const Alloc& alloc, Policy = Policy{}) {
+  return detail::transcode_string<CharOut, Policy>(begin, end, from_or_to,
+                                                   from_or_to, alloc);
+}
+
+template <typename CharOut, typename CharIn, typename Alloc,
+          typename Policy = on_error::skip_t,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) != 1 && sizeof(CharOut) != 1) &&
+                  detail::is_allocator_of_v<Alloc, CharOut> &&
+                  detail::is_error_policy<Policy>,
+              void>::type>
+std::basic_string<CharOut, std::char_traits<CharOut>, Alloc> transcode(
+    const CharIn* begin, const CharIn* end, utfx::endian from,
+    utfx::endian to, const Alloc& alloc, Policy = Policy{}) {
+  return detail::transcode_string<CharOut, Policy>(begin, end, from, to,
+                                                   alloc);
+}
+
+/// Bounded form of transcode(begin, end, out, from_or_to): writes at most
+/// capacity units to out and stops before the first code point that does
+/// not fit, with status output_full.  Under on_error::stop it also stops
+/// before the first ill-formed sequence, with status invalid_input.
+template <typename CharOut, typename CharIn,
+          typename Policy = on_error::skip_t,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) == 1 || sizeof(CharOut) == 1) &&
+                  (sizeof(CharIn) != sizeof(CharOut)) &&
+                  detail::is_error_policy<Policy>,
+              void>::type>
+constexpr transcode_result transcode(
+    const CharIn* begin, const CharIn* end, CharOut* out, size_t capacity,
+    utfx::endian from_or_to,
+    Policy = Policy{}) noexcept(!detail::throws_on_error<Policy>) {
+  const transcode_result r = detail::transcode_bounded<CharOut, Policy>(
+      begin, end, out, capacity, from_or_to, from_or_to);
+  detail::throw_on_error<Policy>(r.error, r.consumed);
+  return r;
+}
+
+/// Bounded form of transcode(begin, end, out, from, to).
+template <typename CharOut, typename CharIn,
+          typename Policy = on_error::skip_t,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) != 1 && sizeof(CharOut) != 1) &&
+                  detail::is_error_policy<Policy>,
+              void>::type>
+constexpr transcode_result transcode(
+    const CharIn* begin, const CharIn* end, CharOut* out, size_t capacity,
+    utfx::endian from, utfx::endian to,
+    Policy = Policy{}) noexcept(!detail::throws_on_error<Policy>) {
+  const transcode_result r = detail::transcode_bounded<CharOut, Policy>(
+      begin, end, out, capacity, from, to);
+  detail::throw_on_error<Policy>(r.error, r.consumed);
+  return r;
+}
+
+/// transcode_valid -- transcode() for input that is known to be valid,
+/// such as text that passed validate_utf8() when it was received.  Nothing
+/// is checked again, which makes these the fastest conversions; on
+/// ill-formed input the behavior is undefined.  With a null out the
+/// pointer overloads return the length of the output.
+template <typename CharOut, typename CharIn,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) == 1 || sizeof(CharOut) == 1) &&
+                  (sizeof(CharIn) != sizeof(CharOut)),
+              void>::type>
+constexpr size_t transcode_valid(const CharIn* begin, const CharIn* end,
+                                 CharOut* out,
+                                 utfx::endian from_or_to) noexcept {
+  return detail::transcode_valid_into(begin, end, out, from_or_to,
+                                      from_or_to);
+}
+
+template <typename CharOut, typename CharIn,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) == 1 || sizeof(CharOut) == 1) &&
+                  (sizeof(CharIn) != sizeof(CharOut)),
+              void>::type>
+std::basic_string<CharOut> transcode_valid(const CharIn* begin,
+                                           const CharIn* end,
+                                           utfx::endian from_or_to) {
+  return detail::transcode_valid_string<CharOut>(begin, end, from_or_to,
+                                                 from_or_to);
+}
+
+template <typename CharOut, typename CharIn,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) != 1 && sizeof(CharOut) != 1), void>::type>
+constexpr size_t transcode_valid(const CharIn* begin, const CharIn* end,
+                                 CharOut* out, utfx::endian from,
+                                 utfx::endian to) noexcept {
+  return detail::transcode_valid_into(begin, end, out, from, to);
+}
+
+template <typename CharOut, typename CharIn,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) != 1 && sizeof(CharOut) != 1), void>::type>
+std::basic_string<CharOut> transcode_valid(const CharIn* begin,
+                                           const CharIn* end,
+                                           utfx::endian from,
+                                           utfx::endian to) {
+  return detail::transcode_valid_string<CharOut>(begin, end, from, to);
+}
+
+/// transcode_batch -- converts count strings stored Arrow-style: string i
+/// is data[offsets[i], offsets[i + 1]).  The output is laid out the same
+/// way, starting at offset 0, and each string converts exactly as
+/// transcode() would convert it alone.  Valid strings are converted a few
+/// thousand units at a time as one text, in a single pass over the input,
+/// so the SIMD kernels run across string boundaries and nothing is set up
+/// or allocated per string.
+///
+/// The pointer overloads fill out_offsets[0, count] and return the total
+/// output length; out needs room for that many units, and with a null out
+/// only the offsets are computed.  Offset must be able to hold the output
+/// length.
+template <typename CharOut, typename CharIn, typename Offset,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) == 1 || sizeof(CharOut) == 1) &&
+                  (sizeof(CharIn) != sizeof(CharOut)) &&
+                  std::is_integral<Offset>::value,
+              void>::type>
+size_t transcode_batch(const CharIn* data, const Offset* offsets, size_t count,
+                       CharOut* out, Offset* out_offsets,
+                       utfx::endian from_or_to) {
+  return detail::transcode_batch(data, offsets, count, out, out_offsets,
+                                 from_or_to, from_or_to);
+}
+
+template <typename CharOut, typename CharIn, typename Offset,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) != 1 && sizeof(CharOut) != 1) &&
+                  std::is_integral<Offset>::value,
+              void>::type>
+size_t transcode_batch(const CharIn* data, const Offset* offsets, size_t count,
+                       CharOut* out, Offset* out_offsets, utfx::endian from,
+                       utfx::endian to) {
+  return detail::transcode_batch(data, offsets, count, out, out_offsets, from,
+                                 to);
+}
+
+template <typename CharOut, typename CharIn, typename Offset,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) == 1 || sizeof(CharOut) == 1) &&
+                  (sizeof(CharIn) != sizeof(CharOut)) &&
+                  std::is_integral<Offset>::value,
+              void>::type>
+transcoded_batch<CharOut, Offset> transcode_batch(const CharIn* data,
+                                                  const Offset* offsets,
+                                                  size_t count,
+                                                  utfx::endian from_or_to) {
+  return detail::transcode_batch<CharOut>(data, offsets, count, from_or_to,
+                                          from_or_to);
+}
+
+template <typename CharOut, typename CharIn, typename Offset,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) != 1 && sizeof(CharOut) != 1) &&
+                  std::is_integral<Offset>::value,
+              void>::type>
+transcoded_batch<CharOut, Offset> transcode_batch(const CharIn* data,
+                                                  const Offset* offsets,
+                                                  size_t count,
+                                                  utfx::endian from,
+                                                  utfx::endian to) {
+  return detail::transcode_batch<CharOut>(data, offsets, count, from, to);
+}
+
+#if defined(_WIN32)
+using default_utf16_char_t = wchar_t;
+#else
+using default_utf16_char_t = char16_t;
+#endif
+
+// utf8_to_utf16 — 3 template overloads
+template <typename ToCharT = default_utf16_char_t, typename CharT,
+          typename Policy = on_error::skip_t,
+          typename = std::enable_if_t<sizeof(CharT) == 1 &&
+                                      sizeof(ToCharT) == 2 &&
+                                      detail::is_error_policy<Policy>>>
+inline auto utf8_to_utf16(const CharT* cstr,
+                          utfx::endian e = utfx::endian::native,
+                          Policy policy = Policy{}) {
+  std::basic_string_view<CharT> s{cstr};
+  return transcode<ToCharT>(s.data(), s.data() + s.size(), e, policy);
+}
+
+template <typename ToCharT = default_utf16_char_t, typename CharT,
+          typename Traits, typename StrAlloc,
+          typename Policy = on_error::skip_t,
+          typename = std::enable_if_t<sizeof(CharT) == 1 &&
+                                      sizeof(ToCharT) == 2 &&
+                                      detail::is_error_policy<Policy>>>
+inline auto utf8_to_utf16(const std::basic_string<CharT, Traits, StrAlloc>& str,
+                          utfx::endian e = utfx::endian::native,
+                          Policy policy = Policy{}) {
+  return transcode<ToCharT>(str.data(), str.data() + str.size(), e, policy);
+}
+
+template <typename ToCharT = default_utf16_char_t, typename CharT,
+          typename Policy = on_error::skip_t,
+          typename = std::enable_if_t<sizeof(CharT) == 1 &&
+                                      sizeof(ToCharT) == 2 &&
+                                      detail::is_error_policy<Policy>>>
+inline auto utf8_to_utf16(const std::basic_string_view<CharT> str_view,
+                          utfx::endian e = utfx::endian::native,
+                          Policy policy = Policy{}) {
+  return transcode<ToCharT>(str_view.data(), str_view.data() + str_view.size(),
+                            e, policy);
+}
+
+// utf16_to_utf8 — 3 template overloads
+template <typename CharT, typename Policy = on_error::skip_t,
+          typename = std::enable_if_t<sizeof(CharT) == 2 &&
+                                      detail::is_error_policy<Policy>>>
+inline auto utf16_to_utf8(const CharT* cstr,
+                          utfx::endian e = utfx::endian::native,
+                          Policy policy = Policy{}) {
+  std::basic_string_view<CharT> s{cstr};
+  return transcode<char>(s.data(), s.data() + s.size(), e, policy);
+}
+
+template <typename CharT, typename Traits, typename StrAlloc,
+          typename Policy = on_error::skip_t,
+          typename = std::enable_if_t<sizeof(CharT) == 2 &&
+                                      detail::is_error_policy<Policy>>>
+inline auto utf16_to_utf8(const std::basic_string<CharT, Traits, StrAlloc>& str,
+                          utfx::endian e = utfx::endian::native,
+                          Policy policy = Policy{}) {
+  return transcode<char>(str.data(), str.data() + str.size(), e, policy);
+}
+
+template <typename CharT, typename Policy = on_error::skip_t,
+          typename = std::enable_if_t<sizeof(CharT) == 2 &&
+                                      detail::is_error_policy<Policy>>>
+inline auto utf16_to_utf8(const std::basic_string_view<CharT> str_view,
+                          utfx::endian e = utfx::endian::native,
+                          Policy policy = Policy{}) {
+  return transcode<char>(str_view.data(), str_view.data() + str_view.size(), e,
+                         policy);
+}
+
+// utf8_to_utf16, utf16_to_utf8 with an allocator — the result is a
+// basic_string using alloc, whose value_type is the output character type.
+template <typename CharT, typename Alloc, typename Policy = on_error::skip_t,
+          typename ToCharT = typename Alloc::value_type,
+          typename = std::enable_if_t<
+              sizeof(CharT) == 1 && sizeof(ToCharT) == 2 &&
+              detail::is_allocator_of_v<Alloc, ToCharT> &&
+              detail::is_error_policy<Policy>>>
+inline auto utf8_to_utf16(const CharT* cstr, utfx::endian e,
+                          const Alloc& alloc, Policy policy = Policy{}) {
+  std::basic_string_view<CharT> s{cstr};
+  return transcode<ToCharT>(s.data(), s.data() + s.size(), e, alloc, policy);
+}
+
+template <typename CharT, typename Traits, typename StrAlloc, typename Alloc,
+          typename Policy = on_error::skip_t,
+          typename ToCharT = typename Alloc::value_type,
+          typename = std::enable_if_t<
+              sizeof(CharT) == 1 && sizeof(ToCharT) == 2 &&
+              detail::is_allocator_of_v<Alloc, ToCharT> &&
+              detail::is_error_policy<Policy>>>
+inline auto utf8_to_utf16(const std::basic_string<CharT, Traits, StrAlloc>& str,
+                          utfx::endian e, const Alloc& alloc,
+                          Policy policy = Policy{}) {
+  return transcode<ToCharT>(str.data(), str.data() + str.size(), e, alloc,
+                            policy);
+}
+
+template <typename CharT, typename Alloc, typename Policy = on_error::skip_t,
+          typename ToCharT = typename Alloc::value_type,
+          typename = std::enable_if_t<
+              sizeof(CharT) == 1 && sizeof(ToCharT) == 2 &&
+              detail::is_allocator_of_v<Alloc, ToCharT> &&
+              detail::is_error_policy<Policy>>>
+inline auto utf8_to_utf16(const std::basic_string_view<CharT> str_view,
+                          utfx::endian e, const Alloc& alloc,
+                          Policy policy = Policy{}) {
+  return transcode<ToCharT>(str_view.data(), str_view.data() + str_view.size(),
+                            e, alloc, policy);
+}
+
+template <typename CharT, typename Alloc, typename Policy = on_error::skip_t,
+          typename = std::enable_if_t<sizeof(CharT) == 2 &&
+                                      detail::is_allocator_of_v<Alloc, char> &&
+                                      detail::is_error_policy<Policy>>>
+inline auto utf16_to_utf8(const CharT* cstr, utfx::endian e,
+                          const Alloc& alloc, Policy policy = Policy{}) {
+  std::basic_string_view<CharT> s{cstr};
+  return transcode<char>(s.data(), s.data() + s.size(), e, alloc, policy);
+}
+
+template <typename CharT, typename Traits, typename StrAlloc, typename Alloc,
+          typename Policy = on_error::skip_t,
+          typename = std::enable_if_t<sizeof(CharT) == 2 &&
+                                      detail::is_allocator_of_v<Alloc, char> &&
+                                      detail::is_error_policy<Policy>>>
+inline auto utf16_to_utf8(const std::basic_string<CharT, Traits, StrAlloc>& str,
+                          utfx::endian e, const Alloc& alloc,
+                          Policy policy = Policy{}) {
+  return transcode<char>(str.data(), str.data() + str.size(), e, alloc,
+                         policy);
+}
+
+template <typename CharT, typename Alloc, typename Policy = on_error::skip_t,
+          typename = std::enable_if_t<sizeof(CharT) == 2 &&
+                                      detail::is_allocator_of_v<Alloc, char> &&
+                                      detail::is_error_policy<Policy>>>
+inline auto utf16_to_utf8(const std::basic_string_view<CharT> str_view,
+                          utfx::endian e, const Alloc& alloc,
+                          Policy policy = Policy{}) {
+  return transcode<char>(str_view.data(), str_view.data() + str_view.size(), e,
+                         alloc, policy);
+}
+
+// utf8_to_utf16_valid, utf16_to_utf8_valid — the convenience functions on
+// transcode_valid(), for input known to be valid.
+template <typename ToCharT = default_utf16_char_t, typename CharT,
+          typename = std::enable_if_t<sizeof(CharT) == 1 &&
+                                      sizeof(ToCharT) == 2>>
+inline auto utf8_to_utf16_valid(const CharT* cstr,
+                                utfx::endian e = utfx::endian::native) {
+  std::basic_string_view<CharT> s{cstr};
+  return transcode_valid<ToCharT>(s.data(), s.data() + s.size(), e);
+}
+
+template <typename ToCharT = default_utf16_char_t, typename CharT,
+          typename Traits, typename StrAlloc,
+          typename = std::enable_if_t<sizeof(CharT) == 1 &&
+                                      sizeof(ToCharT) == 2>>
+inline auto utf8_to_utf16_valid(
+    const std::basic_string<CharT, Traits, StrAlloc>& str,
+    utfx::endian e = utfx::endian::native) {
+  return transcode_valid<ToCharT>(str.data(), str.data() + str.size(), e);
+}
+
+template <typename ToCharT = default_utf16_char_t, typename CharT,
+          typename = std::enable_if_t<sizeof(CharT) == 1 &&
+                                      sizeof(ToCharT) == 2>>
+inline auto utf8_to_utf16_valid(const std::basic_string_view<CharT> str_view,
+                                utfx::endian e = utfx::endian::native) {
+  return transcode_valid<ToCharT>(str_view.data(),
+                                  str_view.data() + str_view.size(), e);
+}
+
+template <typename CharT,
+          typename = std::enable_if_t<sizeof(CharT) == 2>>
+inline auto utf16_to_utf8_valid(const CharT* cstr,
+                                utfx::endian e = utfx::endian::native) {
+  std::basic_string_view<CharT> s{cstr};
+  return transcode_valid<char>(s.data(), s.data() + s.size(), e);
+}
+
+template <typename CharT, typename Traits, typename StrAlloc,
+          typename = std::enable_if_t<sizeof(CharT) == 2>>
+inline auto utf16_to_utf8_valid(
+    const std::basic_string<CharT, Traits, StrAlloc>& str,
+    utfx::endian e = utfx::endian::native) {
+  return transcode_valid<char>(str.data(), str.data() + str.size(), e);
+}
+
+template <typename CharT,
+          typename = std::enable_if_t<sizeof(CharT) == 2>>
+inline auto utf16_to_utf8_valid(const std::basic_string_view<CharT> str_view,
+                                utfx::endian e = utfx::endian::native) {
+  return transcode_valid<char>(str_view.data(),
+                               str_view.data() + str_view.size(), e);
+}
+
+/// Output lengths: the number of code units transcode() writes for the
+/// input, so that its result can be allocated at the exact size.  They
+/// match transcode() on any input, since ill-formed sequences are skipped
+/// in the count just as in the conversion; endian is the byte order of
+/// UTF-16 or UTF-32 input.
+constexpr size_t utf16_length_from_utf8(const char* data, size_t len) noexcept {
+  return detail::transcoded_length<char16_t>(data, data + len,
+                                             utfx::endian::native);
+}
+
+constexpr size_t utf32_length_from_utf8(const char* data, size_t len) noexcept {
+  return detail::transcoded_length<char32_t>(data, data + len,
+                                             utfx::endian::native);
+}
+
+constexpr size_t utf8_length_from_utf16(
+    const char16_t* data, size_t len,
+    utfx::endian endian = utfx::endian::native) noexcept {
+  return detail::transcoded_length<char>(data, data + len, endian);
+}
+
+constexpr size_t utf32_length_from_utf16(
+    const char16_t* data, size_t len,
+    utfx::endian endian = utfx::endian::native) noexcept {
+  return detail::transcoded_length<char32_t>(data, data + len, endian);
+}
+
+constexpr size_t utf8_length_from_utf32(
+    const char32_t* data, size_t len,
+    utfx::endian endian = utfx::endian::native) noexcept {
+  return detail::transcoded_length<char>(data, data + len, endian);
+}
+
+constexpr size_t utf16_length_from_utf32(
+    const char32_t* data, size_t len,
+    utfx::endian endian = utfx::endian::native) noexcept {
+  return detail::transcoded_length<char16_t>(data, data + len, endian);
+}
+
+/// Latin-1 (ISO-8859-1) conversions.  Each Latin-1 byte is the code point
+/// of the same value, so conversions from Latin-1 cannot fail.  Those to
+/// Latin-1 write at most one byte per input unit, so out needs room for len
+/// bytes; they stop before the first code point above U+00FF, with status
+/// invalid_input and utf_error::unrepresentable, or before the first
+/// ill-formed sequence, with its utf_error.
+
+/// Number of bytes latin1_to_utf8 writes: two for bytes above 0x7F.
+constexpr size_t utf8_length_from_latin1(const char* data,
+                                         size_t len) noexcept {
+  size_t n = len;
+  for (size_t i = 0; i < len; ++i) {
+    n += static_cast<unsigned char>(data[i]) >> 7;
+  }
+  return n;
+}
+
+/// Writes data[0, len) to out, which needs room for
+/// utf8_length_from_latin1(data, len) bytes, and returns the bytes written.
+inline size_t latin1_to_utf8(const char* data, size_t len, char* out) noexcept {
+  size_t i = 0;
+  char* o = out;
+#if defined(UTFX_SIMD_X86_64)
+  const detail::simd::kernel_result r =
+      detail::simd::latin1_to_utf8(data, len, out);
+  i = r.read;
+  o += r.written;
+#endif
+  for (; i < len; ++i) {
+    o = detail::utf_traits<char>::encode(static_cast<unsigned char>(data[i]),
+                                         o);
+  }
+  return static_cast<size_t>(o - out);
+}
+
+inline std::string latin1_to_utf8(std::string_view latin1) {
+  std::string result;
+  detail::overwrite_string(
+      result, utf8_length_from_latin1(latin1.data(), latin1.size()),
+      [&](char* out) {
+        return out + latin1_to_utf8(latin1.data(), latin1.size(), out);
+      });
+  return result;
+}
+
+/// Writes data[0, len) to out as len UTF-16 units in byte order endian.
+inline size_t latin1_to_utf16(
+    const char* data, size_t len, char16_t* out,
+    utfx::endian endian = utfx::endian::native) noexcept {
+  size_t i = 0;
+#if defined(UTFX_SIMD_X86_64)
+  i = detail::simd::latin1_to_utf16(data, len, out, endian).read;
+#endif
+  const bool swap = endian != utfx::endian::native;
+  for (; i < len; ++i) {
+    const char16_t u = static_cast<unsigned char>(data[i]);
+    out[i] = swap ? detail::swap_bytes(u) : u;
+  }
+  return len;
+}
+
+inline std::u16string latin1_to_utf16(
+    std::string_view latin1, utfx::endian endian = utfx::endian::native) {
+  std::u16string result;
+  detail::overwrite_string(result, latin1.size(), [&](char16_t* out) {
+    return out + latin1_to_utf16(latin1.data(), latin1.size(), out, endian);
+  });
+  return result;
+}
+
+inline transcode_result utf8_to_latin1(const char* data, size_t len,
+                                       char* out) noexcept {
+  size_t i = 0;
+  char* o = out;
+#if defined(UTFX_SIMD_X86_64)
+  const detail::simd::kernel_result r =
+      detail::simd::utf8_to_latin1(data, len, out);
+  i = r.read;
+  o += r.written;
+#endif
+  while (i < len) {
+    if (static_cast<unsigned char>(data[i]) < 0x80) {
+      *o++ = data[i++];
+      continue;
+    }
+    const char* p = data + i;
+    utf_error error = utf_error::none;
+    const detail::codepoint c =
+        detail::decode_subpart(p, data + len, utfx::endian::native, error);
+    if (error == utf_error::none && c > 0xFF) {
+      error = utf_error::unrepresentable;
+    }
+    if (error != utf_error::none) {
+      return transcode_result{i, static_cast<size_t>(o - out),
+                              transcode_status::invalid_input, error};
+    }
+    *o++ = static_cast<char>(c);
+    i = static_cast<size_t>(p - data);
+  }
+  return transcode_result{len, static_cast<size_t>(o - out),
+                          transcode_status::ok, utf_error::none};
+}
+
+inline transcode_result utf16_to_latin1(
+    const char16_t* data, size_t len, char* out,
+    utfx::endian endian = utfx::endian::native) noexcept {
+  size_t i = 0;
+#if defined(UTFX_SIMD_X86_64)
+  i = detail::simd::utf16_to_latin1(data, len, out, endian).read;
+#endif
+  const bool swap = endian != utfx::endian::native;
+  for (; i < len; ++i) {
+    const char16_t u = swap ? detail::swap_bytes(data[i]) : data[i];
+    if (u > 0xFF) {
+      const char16_t* p = data + i;
+      utf_error error = utf_error::none;
+      detail::decode_subpart(p, data + len, endian, error);
+      return transcode_result{
+          i, i, transcode_status::invalid_input,
+          error == utf_error::none ? utf_error::unrepresentable : error};
+    }
+    out[i] = static_cast<char>(u);
+  }
+  return transcode_result{len, len, transcode_status::ok, utf_error::none};
+}
+
+/// Byte order changes: every unit of in[0, len) is written to out with its
+/// bytes reversed, turning UTF-16LE into UTF-16BE and back, or the same for
+/// UTF-32.  out may be in itself, and the overloads without out swap data
+/// in place.  The overloads taking endian also validate the input, in byte
+/// order from, in the same pass: all of it is swapped either way, and the
+/// result is what validate_utf16/validate_utf32 report for the units,
+/// except that a leading BOM is an ordinary U+FEFF.
+inline void change_endianness_utf16(const char16_t* in, size_t len,
+                                    char16_t* out) noexcept {
+  detail::swap_units(in, len, out);
+}
+
+inline void change_endianness_utf16(char16_t* data, size_t len) noexcept {
+  detail::swap_units(data, len, data);
+}
+
+inline validation_result change_endianness_utf16(const char16_t* in,
+                                                 size_t len, char16_t* out,
+                                                 utfx::endian from) noexcept {
+  return detail::swap_units_checked(in, len, out, from);
+}
+
+inline validation_result change_endianness_utf16(char16_t* data, size_t len,
+                                                 utfx::endian from) noexcept {
+  return detail::swap_units_checked(data, len, data, from);
+}
+
+inline void change_endianness_utf32(const char32_t* in, size_t len,
+                                    char32_t* out) noexcept {
+  detail::swap_units(in, len, out);
+}
+
+inline void change_endianness_utf32(char32_t* data, size_t len) noexcept {
+  detail::swap_units(data, len, data);
+}
+
+inline validation_result change_endianness_utf32(const char32_t* in,
+                                                 size_t len, char32_t* out,
+                                                 utfx::endian from) noexcept {
+  return detail::swap_units_checked(in, len, out, from);
+}
+
+inline validation_result change_endianness_utf32(char32_t* data, size_t len,
+                                                 utfx::endian from) noexcept {
+  return detail::swap_units_checked(data, len, data, from);
+}
+
+inline bool is_utf8(const void* data, size_t len) {
+  const unsigned char* str = static_cast<const unsigned char*>(data);
+  const unsigned char* begin = str;
+  const unsigned char* end = str + len;
+  if (len >= 3) {
+    unsigned char bom[3] = {static_cast<unsigned char>(str[0]),
+                            static_cast<unsigned char>(str[1]),
+                            static_cast<unsigned char>(str[2])};
+    if (bom[0] == 0xEF && bom[1] == 0xBB && bom[2] == 0xBF) {
+      begin = str + 3;
+    }
+  }
+  return detail::is_utf8_fast(reinterpret_cast<const char*>(begin),
+                              static_cast<size_t>(end - begin));
+}
+
+/// Validates UTF-8 and locates the first error.  offset counts bytes from
+/// data; a leading BOM is valid UTF-8 and needs no special casing.
+inline validation_result validate_utf8(const void* data, size_t len) {
+  return detail::validate_utf8_fast(static_cast<const char*>(data), len);
+}
+
+#if !defined(UTFX_NO_THREADS)
+/// validate_utf8 on up to `threads` threads (0: one per hardware thread).
+/// The input is split at lead bytes, so the result, first error offset
+/// included, is exactly that of validate_utf8(data, len).  Each thread gets
+/// at least 1 MiB; smaller inputs use fewer threads.
+inline validation_result validate_utf8(const void* data, size_t len,
+                                       unsigned threads) {
+  return detail::validate_utf8_parallel(static_cast<const char*>(data), len,
+                                        threads, detail::parallel_min_chunk);
+}
+
+/// is_utf8 on up to `threads` threads (0: one per hardware thread).
+inline bool is_utf8(const void* data, size_t len, unsigned threads) {
+  return validate_utf8(data, len, threads).valid;
+}
+#endif
+
+/// Validates UTF-16 in byte order endian and locates the first error.
+/// offset counts 16-bit units from data.  A leading BOM is skipped, or
+/// rejected with utf_error::byte_order_mark when it contradicts endian; an
+/// odd trailing byte is reported as truncated.
+inline validation_result validate_utf16(
+    const void* data, size_t len, utfx::endian endian = utfx::endian::native) {
+  const unsigned char* str = static_cast<const unsigned char*>(data);
+  const char16_t* base = reinterpret_cast<const char16_t*>(str);
+  const char16_t* begin = base;
+  const char16_t* end = base + len / 2;
+
+  if (len >= 2) {
+    unsigned char bom[2] = {static_cast<unsigned char>(str[0]),
+                            static_cast<unsigned char>(str[1])};
+    if (((endian == utfx::endian::big) && (bom[0] == 0xFF && bom[1] == 0xFE)) ||
+        ((endian == utfx::endian::little) &&
+         (bom[0] == 0xFE && bom[1] == 0xFF))) {
+      return validation_result{false, 0, utf_error::byte_order_mark};
+    }
+    if ((bom[0] == 0xFF && bom[1] == 0xFE) ||
+        (bom[0] == 0xFE && bom[1] == 0xFF)) {
+      begin++;
+    }
+  }
+
+  validation_result r = detail::validate_utf16_fast(base, begin, end, endian);
+  if (r.valid && len % 2 != 0) {
+    r = validation_result{false, len / 2, utf_error::truncated};
+  }
+  return r;
+}
+
+/// Validates UTF-32 in byte order endian and locates the first error.
+/// offset counts 32-bit units from data.  A BOM in the requested byte
+/// order is an ordinary U+FEFF; one in the other order is rejected with
+/// utf_error::byte_order_mark.  A partial trailing unit is reported as
+/// truncated.
+inline validation_result validate_utf32(
+    const void* data, size_t len, utfx::endian endian = utfx::endian::native) {
+  const unsigned char* str = static_cast<const unsigned char*>(data);
+  const char32_t* base = reinterpret_cast<const char32_t*>(str);
+  if (len >= 4) {
+    const bool le_bom =
+        str[0] == 0xFF && str[1] == 0xFE && str[2] == 0 && str[3] == 0;
+    const bool be_bom =
+        str[0] == 0 && str[1] == 0 && str[2] == 0xFE && str[3] == 0xFF;
+    if ((endian == utfx::endian::big && le_bom) ||
+        (endian == utfx::endian::little && be_bom)) {
+      return validation_result{false, 0, utf_error::byte_order_mark};
+    }
+  }
+  validation_result r =
+      detail::validate_utf32_fast(base, base, base + len / 4, endian);
+  if (r.valid && len % 4 != 0) {
+    r = validation_result{false, len / 4, utf_error::truncated};
+  }
+  return r;
+}
+
+// ============================================================================
+// utf8_validator — Validates UTF-8 that arrives in chunks.
+//
+// A sequence split across chunks is carried over (at most 3 bytes), and
+// errors are reported with offsets from the start of the whole stream.
+// Each chunk goes through the same SIMD kernels as validate_utf8.
+//
+//   utfx::utf8_validator v;
+//   while (read(chunk)) {
+//     if (!v.feed(chunk.data(), chunk.size())) break;
+//   }
+//   utfx::validation_result r = v.finish();
+// ============================================================================
+class utf8_validator {
+ public:
+  utf8_validator() noexcept { reset(); }
+
+  /// Validates the next chunk.  Returns false once an error has been found,
+  /// in this chunk or an earlier one; further chunks are then ignored.
+  bool feed(const void* data, size_t len) noexcept {
+    if (!error_.valid) {
+      return false;
+    }
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    const unsigned char* end = p + len;
+    if (pending_len_ != 0) {
+      // Complete the carried sequence from the front of this chunk.
+      const size_t need =
+          detail::utf8_sequence_length(pending_[0]) - pending_len_;
+      const size_t take = need < len ? need : len;
+      if (take != 0) {
+        std::memcpy(pending_ + pending_len_, p, take);
+      }
+      const size_t have = pending_len_ + take;
+      utf_error error = utf_error::none;
+      if (take == need
+              ? detail::check_utf8_sequence(pending_, pending_ + have,
+                                            error) == 0
+              : !detail::is_utf8_prefix(pending_, have, error)) {
+        return fail(consumed_ - pending_len_, error);
+      }
+      p += take;
+      consumed_ += take;
+      pending_len_ = take == need ? 0 : have;
+      if (pending_len_ != 0) {
+        return true;
       }
-      --p;
-      byte_size_ = static_cast<size_type>(p - data_);
     }
-  }
-
-  // --- Substring ---
-  /// Returns a view of the substring [pos, pos+count). O(pos+count).
-  constexpr utf8_view substr(size_type pos = 0,
-                             size_type count = npos) const noexcept {
-    const char* start = data_;
-    const char* end_pos = data_ + byte_size_;
-    while (pos-- > 0 && start < end_pos) {
-      int trail = detail::utf_traits<char>::trail_length(*start);
-      start += trail < 0 ? 1 : static_cast<size_type>(trail + 1);
+    // Hold back a sequence cut by the end of the chunk.
+    const unsigned char* cut = end;
+    for (const unsigned char* q = end; q != p && end - q < 3;) {
+      --q;
+      if (!detail::utf_traits<char>::is_trail(*q)) {
+        if (static_cast<size_t>(end - q) <
+            detail::utf8_sequence_length(*q)) {
+          cut = q;
+        }
+        break;
+      }
     }
-    if (start >= end_pos) {
-      return utf8_view();
+    const validation_result r = detail::validate_utf8_fast(
+        reinterpret_cast<const char*>(p), static_cast<size_t>(cut - p));
+    if (!r.valid) {
+      return fail(consumed_ + r.offset, r.error);
     }
-    const char* sub_end = start;
-    while (count-- > 0 && sub_end < end_pos) {
-      int trail = detail::utf_traits<char>::trail_length(*sub_end);
-      sub_end += trail < 0 ? 1 : static_cast<size_type>(trail + 1);
+    consumed_ += static_cast<size_t>(cut - p);
+    if (cut != end) {
+      utf_error error = utf_error::none;
+      if (!detail::is_utf8_prefix(cut, static_cast<size_t>(end - cut),
+                                  error)) {
+        return fail(consumed_, error);
+      }
+      pending_len_ = static_cast<size_t>(end - cut);
+      std::memcpy(pending_, cut, pending_len_);
+      consumed_ += pending_len_;
     }
-    return utf8_view(start, static_cast<size_type>(sub_end - start));
+    return true;
   }
 
-  // --- Swap ---
-  constexpr void swap(utf8_view& other) noexcept {
-    const char* tmp_data = data_;
-    size_type tmp_size = byte_size_;
-    data_ = other.data_;
-    byte_size_ = other.byte_size_;
-    other.data_ = tmp_data;
-    other.byte_size_ = tmp_size;
+  /// Ends the stream.  A sequence still carried over is truncated; when
+  /// valid, offset is the total number of bytes fed.
+  validation_result finish() noexcept {
+    if (error_.valid && pending_len_ != 0) {
+      fail(consumed_ - pending_len_, utf_error::truncated);
+    }
+    return error_.valid ? validation_result{true, consumed_, utf_error::none}
+                        : error_;
   }
 
-  // --- Conversion ---
-  /// Implicit conversion to std::string_view (raw bytes).
-  constexpr operator std::string_view() const noexcept {
-    return std::string_view(data_, byte_size_);
+  /// Starts a new stream.
+  void reset() noexcept {
+    pending_len_ = 0;
+    consumed_ = 0;
+    error_ = validation_result{true, 0, utf_error::none};
   }
 
-  // --- Comparison (bytewise, consistent with code-point order for valid UTF-8)
-  friend constexpr bool operator==(utf8_view a, utf8_view b) noexcept {
-    return std::string_view(a.data_, a.byte_size_) ==
-           std::string_view(b.data_, b.byte_size_);
+  /// Bytes of a sequence cut by the end of the last chunk (0–3).
+  size_t pending() const noexcept { return pending_len_; }
+
+ private:
+  bool fail(size_t offset, utf_error error) noexcept {
+    error_ = validation_result{false, offset, error};
+    return false;
   }
-  friend constexpr bool operator!=(utf8_view a, utf8_view b) noexcept {
-    return !(a == b);
+
+  unsigned char pending_[4];
+  size_t pending_len_;
+  // Bytes fed so far, pending ones included.
+  size_t consumed_;
+  validation_result error_;
+};
+
+// ============================================================================
+// stream_transcoder — Transcodes text that arrives in chunks.
+//
+// Chunks may be cut anywhere: a code point split across them is carried
+// over (at most 3 units) and converted once the next chunk completes it.
+// The rest of each chunk goes through the same SIMD kernels as transcode(),
+// into an output buffer of the caller's; when that fills up, feed() returns
+// with the rest of the chunk to be fed again.  Ill-formed input is handled
+// by Policy as in transcode().
+//
+//   utfx::stream_transcoder<char, char16_t> t;
+//   char16_t buf[4096];
+//   while (read(chunk)) {
+//     for (size_t at = 0; at < chunk.size();) {
+//       utfx::transcode_result r =
+//           t.feed(chunk.data() + at, chunk.size() - at, buf, 4096);
+//       write(buf, r.written);
+//       at += r.consumed;
+//     }
+//   }
+//   write(buf, t.finish(buf, 4096).written);
+// ============================================================================
+template <typename From, typename To, typename Policy = on_error::skip_t>
+class stream_transcoder {
+  static_assert(sizeof(From) != sizeof(To),
+                "stream_transcoder converts between two encodings");
+  static_assert(detail::is_error_policy<Policy>,
+                "Policy must be one of the on_error tags");
+
+  static constexpr size_t max_width =
+      static_cast<size_t>(detail::utf_traits<From>::max_width);
+
+ public:
+  /// e is the byte order of the UTF-16 and UTF-32 sides; that of a UTF-8
+  /// side is ignored.
+  explicit stream_transcoder(utfx::endian e = utfx::endian::native) noexcept
+      : stream_transcoder(e, e) {}
+
+  stream_transcoder(utfx::endian from, utfx::endian to) noexcept
+      : from_(from), to_(to) {
+    reset();
   }
-  friend constexpr bool operator<(utf8_view a, utf8_view b) noexcept {
-    return std::string_view(a.data_, a.byte_size_) <
-           std::string_view(b.data_, b.byte_size_);
+
+  /// Output room that always suffices for feed() of len units, and for
+  /// finish() with len 0.
+  static constexpr size_t max_output(size_t len) noexcept {
+    return (len + max_width - 1) * detail::max_growth<To, From>();
   }
-  friend constexpr bool operator<=(utf8_view a, utf8_view b) noexcept {
-    return std::string_view(a.data_, a.byte_size_) <=
-           std::string_view(b.data_, b.byte_size_);
+
+  /// Converts the next len units of the stream into at most capacity units
+  /// at out.  consumed counts the units taken from in, those carried over
+  /// included.  The status is output_full when out fills up first; the
+  /// units of in past consumed are then to be fed again.  Under
+  /// on_error::stop an error gives invalid_input, and later calls return
+  /// it again until reset(); on_error::throw_exception throws
+  /// conversion_error with the offset of the error in the stream.
+  transcode_result feed(const From* in, size_t len, To* out,
+                        size_t capacity) {
+    if (error_ != utf_error::none) {
+      return transcode_result{0, 0, transcode_status::invalid_input, error_};
+    }
+    size_t used = 0;
+    size_t written = 0;
+    if (pending_len_ != 0) {
+      // Complete the carried code point from the front of this chunk.
+      const size_t room = max_width - pending_len_;
+      const size_t take = len < room ? len : room;
+      if (take != 0) {
+        std::memcpy(pending_ + pending_len_, in, take * sizeof(From));
+      }
+      const size_t have = pending_len_ + take;
+      if (detail::incomplete_tail(pending_, pending_ + have, from_) ==
+          pending_) {
+        pending_len_ = have;
+        return transcode_result{take, 0, transcode_status::ok,
+                                utf_error::none};
+      }
+      // The code points that start in the carried units; one that turns
+      // out ill-formed may take units past the one it started.
+      const transcode_result r = detail::transcode_bounded<To, Policy>(
+          pending_, pending_ + pending_len_, pending_ + have, out, capacity,
+          from_, to_);
+      written = r.written;
+      position_ += r.consumed;
+      if (r.status != transcode_status::ok) {
+        drop_pending(r.consumed);
+        return r.status == transcode_status::output_full
+                   ? transcode_result{0, written, r.status, utf_error::none}
+                   : fail(r.error, 0, written);
+      }
+      used = r.consumed - pending_len_;
+      pending_len_ = 0;
+    }
+    const From* p = in + used;
+    const From* end = in + len;
+    for (;;) {
+      // Hold back a code point cut by the end of the chunk.  Units past
+      // the cut are converted only when an ill-formed sequence before it
+      // takes them, as it would in one piece; the rest are then looked at
+      // again.
+      const From* cut = detail::incomplete_tail(p, end, from_);
+      const transcode_result r = detail::transcode_bounded<To, Policy>(
+          p, cut, end, out + written, capacity - written, from_, to_);
+      p += r.consumed;
+      used += r.consumed;
+      written += r.written;
+      position_ += r.consumed;
+      if (r.status == transcode_status::invalid_input) {
+        return fail(r.error, used, written);
+      }
+      if (r.status == transcode_status::output_full) {
+        return transcode_result{used, written, r.status, utf_error::none};
+      }
+      if (p == cut) {
+        break;
+      }
+    }
+    pending_len_ = static_cast<size_t>(end - p);
+    if (pending_len_ != 0) {
+      std::memcpy(pending_, p, pending_len_ * sizeof(From));
+    }
+    return transcode_result{len, written, transcode_status::ok,
+                            utf_error::none};
   }
-  friend constexpr bool operator>(utf8_view a, utf8_view b) noexcept {
-    return std::string_view(a.data_, a.byte_size_) >
-           std::string_view(b.data_, b.byte_size_);
+
+  /// Ends the stream.  Units still carried over are a truncated sequence,
+  /// handled by Policy; when out has no room for what they turn into the
+  /// status is output_full and finish() is to be called again.
+  transcode_result finish(To* out, size_t capacity) {
+    if (error_ != utf_error::none) {
+      return transcode_result{0, 0, transcode_status::invalid_input, error_};
+    }
+    const transcode_result r = detail::transcode_bounded<To, Policy>(
+        pending_, pending_ + pending_len_, out, capacity, from_, to_);
+    position_ += r.consumed;
+    drop_pending(r.consumed);
+    if (r.status == transcode_status::invalid_input) {
+      return fail(r.error, 0, r.written);
+    }
+    return transcode_result{0, r.written, r.status, utf_error::none};
   }
-  friend constexpr bool operator>=(utf8_view a, utf8_view b) noexcept {
-    return std::string_view(a.data_, a.byte_size_) >=
-           std::string_view(b.data_, b.byte_size_);
+
+  /// Starts a new stream.
+  void reset() noexcept {
+    pending_len_ = 0;
+    position_ = 0;
+    error_ = utf_error::none;
   }
 
+  /// Units of a code point cut by the end of the last chunk (0–3).
+  size_t pending() const noexcept { return pending_len_; }
+
+  /// Units of the stream converted so far, carried ones excluded; after an
+  /// error under on_error::stop, the offset of the error.
+  size_t position() const noexcept { return position_; }
+
  private:
-  const char* data_;
-  size_type byte_size_;
+  void drop_pending(size_t n) noexcept {
+    std::memmove(pending_, pending_ + n, (pending_len_ - n) * sizeof(From));
+    pending_len_ -= n;
+  }
+
+  transcode_result fail(utf_error error, size_t used, size_t written) {
+    error_ = error;
+    pending_len_ = 0;
+    detail::throw_on_error<Policy>(error, position_);
+    return transcode_result{used, written, transcode_status::invalid_input,
+                            error};
+  }
+
+  From pending_[max_width];
+  size_t pending_len_;
+  // Stream offset of the first unit not yet converted.
+  size_t position_;
+  utf_error error_;
+  utfx::endian from_;
+  utfx::endian to_;
 };
 
-template <typename CharOut, typename CharIn,
-          typename = typename std::enable_if<
-              (sizeof(CharIn) == 1 || sizeof(CharOut) == 1) &&
-                  (sizeof(CharIn) != sizeof(CharOut)),
-              void>::type>
-constexpr size_t transcode(const CharIn* begin, const CharIn* end, CharOut* out,
-                           utfx::endian from_or_to) {
-  CharOut* p = out;
-  size_t len = 0;
-  while (begin != end) {
-    detail::codepoint c{0};
-    if constexpr (sizeof(CharIn) != 1) {
-      c = detail::utf_traits<CharIn>::decode(begin, end, from_or_to);
-    } else {
-      c = detail::utf_traits<CharIn>::decode(begin, end);
+#if !defined(UTFX_NO_IOSTREAMS)
+// ============================================================================
+// transcoding_streambuf — A stream of CharT over a streambuf of UTF-8.
+//
+// Reading pulls bytes from the UTF-8 streambuf and writes UTF-16 or UTF-32
+// (by the size of CharT, in native byte order) to the get area; writing
+// converts the put area back to UTF-8.  Both go block by block through
+// stream_transcoder, so code points may fall across blocks, and replace
+// std::wstring_convert / std::codecvt_utf8_utf16.  Seeking is not
+// supported.
+//
+//   std::ifstream file("export.txt", std::ios::binary);
+//   utfx::transcoding_istream<wchar_t> in(file);
+//   std::wstring line;
+//   while (std::getline(in, line)) { ... }
+// ============================================================================
+template <typename CharT, typename Policy = on_error::skip_t>
+class transcoding_streambuf : public std::basic_streambuf<CharT> {
+  static_assert(sizeof(CharT) == 2 || sizeof(CharT) == 4,
+                "CharT holds UTF-16 or UTF-32 code units");
+
+ public:
+  using char_type = CharT;
+  using traits_type = typename std::basic_streambuf<CharT>::traits_type;
+  using int_type = typename traits_type::int_type;
+
+  /// utf8 is not owned.  buffer_size is the number of bytes read from or
+  /// written to it at a time, and of units in the get and put areas.
+  explicit transcoding_streambuf(std::streambuf* utf8,
+                                 size_t buffer_size = 8192)
+      : utf8_(utf8),
+        bytes_(buffer_size < 16 ? 16 : buffer_size),
+        units_(bytes_.size()),
+        put_(bytes_.size()),
+        out_bytes_(
+            stream_transcoder<CharT, char, Policy>::max_output(put_.size())),
+        in_pos_(0),
+        in_end_(0),
+        eof_(false) {
+    this->setg(units_.data(), units_.data(), units_.data());
+    this->setp(put_.data(), put_.data() + put_.size());
+  }
+
+  transcoding_streambuf(const transcoding_streambuf&) = delete;
+  transcoding_streambuf& operator=(const transcoding_streambuf&) = delete;
+
+  /// Writes out what is left of the output, a truncated sequence
+  /// included, as close() does for a std::basic_filebuf.
+  ~transcoding_streambuf() override {
+    try {
+      finish_output();
+    } catch (...) {
     }
-    len += detail::utf_traits<CharOut>::width(c);
-    if (c == detail::illegal || c == detail::incomplete) {
-      // throw conversion_error();
-    } else {
-      if (p != nullptr) {
-        if constexpr (sizeof(CharOut) != 1) {
-          p = detail::utf_traits<CharOut>::encode(c, p, from_or_to);
-        } else {
-          p = detail::utf_traits<CharOut>::encode(c, p);
-        }
+  }
+
+  /// Converts and writes the whole put area and ends the output: a high
+  /// surrogate still waiting for its pair is handled by Policy.  Returns
+  /// false when writing to the UTF-8 streambuf or the conversion failed.
+  bool finish_output() {
+    if (!write_put_area()) {
+      return false;
+    }
+    for (;;) {
+      const transcode_result r =
+          encoder_.finish(out_bytes_.data(), out_bytes_.size());
+      if (!write_bytes(r.written) ||
+          r.status == transcode_status::invalid_input) {
+        return false;
+      }
+      if (r.status == transcode_status::ok) {
+        return true;
       }
     }
   }
-  return p == nullptr ? len : p - out;
-}
 
-template <typename CharOut, typename CharIn,
-          typename = typename std::enable_if<
-              (sizeof(CharIn) == 1 || sizeof(CharOut) == 1) &&
-                  (sizeof(CharIn) != sizeof(CharOut)),
-              void>::type>
-std::basic_string<CharOut> transcode(const CharIn* begin, const CharIn* end,
-                                     utfx::endian from_or_to) {
-  std::basic_string<CharOut> result;
-  result.reserve((end - begin) * detail::utf_traits<CharOut>::max_width /
-                 detail::utf_traits<CharIn>::max_width);
-  std::back_insert_iterator<std::basic_string<CharOut>> inserter(result);
-  while (begin != end) {
-    detail::codepoint c;
-    if constexpr (sizeof(CharIn) != 1) {
-      c = detail::utf_traits<CharIn>::decode(begin, end, from_or_to);
-    } else {
-      c = detail::utf_traits<CharIn>::decode(begin, end);
+ protected:
+  int_type underflow() override {
+    if (this->gptr() < this->egptr()) {
+      return traits_type::to_int_type(*this->gptr());
     }
-    if (c == detail::illegal || c == detail::incomplete) {
-      // throw conversion_error();
-    } else {
-      if constexpr (sizeof(CharOut) != 1) {
-        detail::utf_traits<CharOut>::encode(c, inserter, from_or_to);
+    for (;;) {
+      if (in_pos_ == in_end_ && !eof_) {
+        const std::streamsize n = utf8_->sgetn(
+            bytes_.data(), static_cast<std::streamsize>(bytes_.size()));
+        in_pos_ = 0;
+        in_end_ = n > 0 ? static_cast<size_t>(n) : 0;
+        eof_ = n <= 0;
+      }
+      transcode_result r{};
+      if (in_pos_ != in_end_) {
+        r = decoder_.feed(bytes_.data() + in_pos_, in_end_ - in_pos_,
+                          units_.data(), units_.size());
+        in_pos_ += r.consumed;
       } else {
-        detail::utf_traits<CharOut>::encode(c, inserter);
+        r = decoder_.finish(units_.data(), units_.size());
+      }
+      if (r.written != 0) {
+        this->setg(units_.data(), units_.data(), units_.data() + r.written);
+        return traits_type::to_int_type(units_[0]);
+      }
+      if (r.status == transcode_status::invalid_input ||
+          (eof_ && in_pos_ == in_end_)) {
+        return traits_type::eof();
       }
     }
   }
-  return result;
-}
 
-template <typename CharOut, typename CharIn,
-          typename = typename std::enable_if<
-              (sizeof(CharIn) != 1 && sizeof(CharOut) != 1), void>::type>
-size_t transcode(const CharIn* begin, const CharIn* end, CharOut* out,
-                 utfx::endian from, utfx::endian to) {
-  CharOut* p = out;
-  size_t len = 0;
-  while (begin != end) {
-    detail::codepoint c = detail::utf_traits<CharIn>::decode(begin, end, from);
-    len += detail::utf_traits<CharOut>::width(c);
-    if (c == detail::illegal || c == detail::incomplete) {
-      // throw conversion_error();
-    } else {
-      if (p != nullptr) {
-        p = detail::utf_traits<CharOut>::encode(c, p, to);
-      }
+  int_type overflow(int_type c) override {
+    if (!write_put_area()) {
+      return traits_type::eof();
+    }
+    if (!traits_type::eq_int_type(c, traits_type::eof())) {
+      *this->pptr() = traits_type::to_char_type(c);
+      this->pbump(1);
     }
+    return traits_type::not_eof(c);
   }
-  return p == nullptr ? len : p - out;
-}
 
-template <typename CharOut, typename CharIn,
-          typename = typename std::enable_if<
-              (sizeof(CharIn) != 1 && sizeof(CharOut) != 1), void>::type>
-std::basic_string<CharOut> transcode(const CharIn* begin, const CharIn* end,
-                                     utfx::endian from, utfx::endian to) {
-  std::basic_string<CharOut> result;
-  result.reserve((end - begin) * detail::utf_traits<CharOut>::max_width /
-                 detail::utf_traits<CharIn>::max_width);
-  std::back_insert_iterator<std::basic_string<CharOut>> inserter(result);
-  while (begin != end) {
-    detail::codepoint c = detail::utf_traits<CharIn>::decode(begin, end, from);
-    if (c == detail::illegal || c == detail::incomplete) {
-      // throw conversion_error();
-    } else {
-      detail::utf_traits<CharOut>::encode(c, inserter, to);
+  int sync() override {
+    if (!write_put_area()) {
+      return -1;
     }
+    return utf8_->pubsync();
   }
-  return result;
-}
 
-#if defined(_WIN32)
-using default_utf16_char_t = wchar_t;
-#else
-using default_utf16_char_t = char16_t;
-#endif
+ private:
+  // Converts [pbase, pptr) and writes it out, then empties the put area.
+  // A high surrogate at the end waits in the encoder for the next write.
+  bool write_put_area() {
+    const CharT* p = this->pbase();
+    size_t n = static_cast<size_t>(this->pptr() - this->pbase());
+    while (n != 0) {
+      const transcode_result r =
+          encoder_.feed(p, n, out_bytes_.data(), out_bytes_.size());
+      if (!write_bytes(r.written) ||
+          r.status == transcode_status::invalid_input) {
+        return false;
+      }
+      p += r.consumed;
+      n -= r.consumed;
+    }
+    this->setp(put_.data(), put_.data() + put_.size());
+    return true;
+  }
 
-// utf8_to_utf16 — 3 template overloads
-template <
-    typename ToCharT = default_utf16_char_t, typename CharT,
-    typename = std::enable_if_t<sizeof(CharT) == 1 && sizeof(ToCharT) == 2>>
-inline auto utf8_to_utf16(const CharT* cstr,
-                          utfx::endian e = utfx::endian::native) {
-  std::basic_string_view<CharT> s{cstr};
-  return transcode<ToCharT>(s.data(), s.data() + s.size(), e);
-}
+  bool write_bytes(size_t n) {
+    return n == 0 || utf8_->sputn(out_bytes_.data(),
+                                  static_cast<std::streamsize>(n)) ==
+                         static_cast<std::streamsize>(n);
+  }
 
-template <
-    typename ToCharT = default_utf16_char_t, typename CharT,
-    typename = std::enable_if_t<sizeof(CharT) == 1 && sizeof(ToCharT) == 2>>
-inline auto utf8_to_utf16(const std::basic_string<CharT>& str,
-                          utfx::endian e = utfx::endian::native) {
-  return transcode<ToCharT>(str.data(), str.data() + str.size(), e);
-}
+  std::streambuf* utf8_;
+  stream_transcoder<char, CharT, Policy> decoder_;
+  stream_transcoder<CharT, char, Policy> encoder_;
+  // Bytes read from utf8_, [in_pos_, in_end_) not yet decoded.
+  std::vector<char> bytes_;
+  std::vector<CharT> units_;
+  std::vector<CharT> put_;
+  std::vector<char> out_bytes_;
+  size_t in_pos_;
+  size_t in_end_;
+  bool eof_;
+};
 
-template <
-    typename ToCharT = default_utf16_char_t, typename CharT,
-    typename = std::enable_if_t<sizeof(CharT) == 1 && sizeof(ToCharT) == 2>>
-inline auto utf8_to_utf16(const std::basic_string_view<CharT> str_view,
-                          utfx::endian e = utfx::endian::native) {
-  return transcode<ToCharT>(str_view.data(), str_view.data() + str_view.size(),
-                            e);
-}
+/// An input stream of CharT reading UTF-8 from another stream's buffer
+/// through a transcoding_streambuf.
+template <typename CharT, typename Policy = on_error::skip_t>
+class transcoding_istream : public std::basic_istream<CharT> {
+ public:
+  explicit transcoding_istream(std::streambuf* utf8,
+                               size_t buffer_size = 8192)
+      : std::basic_istream<CharT>(nullptr), buf_(utf8, buffer_size) {
+    this->init(&buf_);
+  }
 
-// utf16_to_utf8 — 3 template overloads
-template <typename CharT, typename = std::enable_if_t<sizeof(CharT) == 2>>
-inline auto utf16_to_utf8(const CharT* cstr,
-                          utfx::endian e = utfx::endian::native) {
-  std::basic_string_view<CharT> s{cstr};
-  return transcode<char>(s.data(), s.data() + s.size(), e);
-}
+  explicit transcoding_istream(std::istream& utf8, size_t buffer_size = 8192)
+      : transcoding_istream(utf8.rdbuf(), buffer_size) {}
 
-template <typename CharT, typename = std::enable_if_t<sizeof(CharT) == 2>>
-inline auto utf16_to_utf8(const std::basic_string<CharT>& str,
-                          utfx::endian e = utfx::endian::native) {
-  return transcode<char>(str.data(), str.data() + str.size(), e);
-}
+  transcoding_streambuf<CharT, Policy>* rdbuf() const noexcept {
+    return const_cast<transcoding_streambuf<CharT, Policy>*>(&buf_);
+  }
 
-template <typename CharT, typename = std::enable_if_t<sizeof(CharT) == 2>>
-inline auto utf16_to_utf8(const std::basic_string_view<CharT> str_view,
-                          utfx::endian e = utfx::endian::native) {
-  return transcode<char>(str_view.data(), str_view.data() + str_view.size(), e);
-}
+ private:
+  transcoding_streambuf<CharT, Policy> buf_;
+};
 
-inline bool is_utf8(const void* data, size_t len) {
-  const unsigned char* str = static_cast<const unsigned char*>(data);
-  const unsigned char* begin = str;
-  const unsigned char* end = str + len;
-  if (len >= 3) {
-    unsigned char bom[3] = {static_cast<unsigned char>(str[0]),
-                            static_cast<unsigned char>(str[1]),
-                            static_cast<unsigned char>(str[2])};
-    if (bom[0] == 0xEF && bom[1] == 0xBB && bom[2] == 0xBF) {
-      begin = str + 3;
-    }
+/// An output stream of CharT writing UTF-8 to another stream's buffer
+/// through a transcoding_streambuf.  The output is finished when the
+/// stream is destroyed, or by rdbuf()->finish_output().
+template <typename CharT, typename Policy = on_error::skip_t>
+class transcoding_ostream : public std::basic_ostream<CharT> {
+ public:
+  explicit transcoding_ostream(std::streambuf* utf8,
+                               size_t buffer_size = 8192)
+      : std::basic_ostream<CharT>(nullptr), buf_(utf8, buffer_size) {
+    this->init(&buf_);
   }
-  while (begin != end) {
-    const detail::codepoint c = detail::utf_traits<char>::decode(begin, end);
-    if (c == detail::incomplete || c == detail::illegal) {
-      return false;
-    }
+
+  explicit transcoding_ostream(std::ostream& utf8, size_t buffer_size = 8192)
+      : transcoding_ostream(utf8.rdbuf(), buffer_size) {}
+
+  transcoding_streambuf<CharT, Policy>* rdbuf() const noexcept {
+    return const_cast<transcoding_streambuf<CharT, Policy>*>(&buf_);
   }
-  return true;
-}
+
+ private:
+  transcoding_streambuf<CharT, Policy> buf_;
+};
+#endif  // UTFX_NO_IOSTREAMS
 
 inline bool is_utf16(const void* data, size_t len,
                      utfx::endian endian = utfx::endian::native) {
-  const unsigned char* str = static_cast<const unsigned char*>(data);
-  if (len % 2 != 0) {
-    return false;
+  return validate_utf16(data, len, endian).valid;
+}
+
+inline bool is_utf32(const void* data, size_t len,
+                     utfx::endian endian = utfx::endian::native) {
+  return validate_utf32(data, len, endian).valid;
+}
+
+/// A transcoded string constant: N code units and a terminating null in a
+/// std::array, built at compile time by static_transcode() so that it sits
+/// in read-only data with no runtime work or allocation.
+template <typename CharT, size_t N>
+struct static_string {
+  std::array<CharT, N + 1> units;
+
+  constexpr const CharT* data() const noexcept { return units.data(); }
+  constexpr const CharT* c_str() const noexcept { return units.data(); }
+  constexpr size_t size() const noexcept { return N; }
+  constexpr bool empty() const noexcept { return N == 0; }
+  constexpr const CharT* begin() const noexcept { return units.data(); }
+  constexpr const CharT* end() const noexcept { return units.data() + N; }
+  constexpr CharT operator[](size_t i) const noexcept { return units[i]; }
+  constexpr std::basic_string_view<CharT> view() const noexcept {
+    return std::basic_string_view<CharT>(units.data(), N);
   }
+  constexpr operator std::basic_string_view<CharT>() const noexcept {
+    return view();
+  }
+};
 
-  const char16_t* begin = reinterpret_cast<const char16_t*>(str);
-  const char16_t* end = begin + len / 2;
+/// Number of CharOut units in the string literal s transcoded, without the
+/// terminating null: the size to give static_transcode().  Ill-formed input
+/// throws conversion_error, which makes a constant expression ill-formed.
+template <typename CharOut, typename CharIn, size_t N>
+constexpr size_t static_length(const CharIn (&s)[N]) {
+  const CharIn* begin = s;
+  utf_error error = utf_error::none;
+  const size_t n =
+      detail::count_transcoded<CharOut, on_error::throw_exception_t>(
+          begin, s + N - 1, utfx::endian::native, error);
+  detail::throw_on_error<on_error::throw_exception_t>(
+      error, static_cast<size_t>(begin - s));
+  return n;
+}
 
-  if (len >= 2) {
-    unsigned char bom[2] = {static_cast<unsigned char>(str[0]),
-                            static_cast<unsigned char>(str[1])};
-    if ((endian == utfx::endian::big) && (bom[0] == 0xFF && bom[1] == 0xFE)) {
-      return false;
-    }
-    if ((endian == utfx::endian::little) &&
-        (bom[0] == 0xFE && bom[1] == 0xFF)) {
-      return false;
-    }
-    if ((bom[0] == 0xFF && bom[1] == 0xFE) ||
-        (bom[0] == 0xFE && bom[1] == 0xFF)) {
-      begin++;
-    }
+/// The string literal s transcoded to Len units of CharOut, in native byte
+/// order, where Len is static_length<CharOut>(s):
+///
+///   constexpr auto kName =
+///       utfx::static_transcode<char16_t, utfx::static_length<char16_t>(
+///                                            "caf\xC3\xA9")>("caf\xC3\xA9");
+///
+/// Under C++20, static_transcoded<CharOut, "..."> and the _utf8sv and
+/// _utf16sv literals spell the literal once.
+template <typename CharOut, size_t Len, typename CharIn, size_t N,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) != sizeof(CharOut)), void>::type>
+constexpr static_string<CharOut, Len> static_transcode(const CharIn (&s)[N]) {
+  if (static_length<CharOut>(s) != Len) {
+    throw std::length_error("utfx::static_transcode: wrong length");
   }
+  static_string<CharOut, Len> result{};
+  detail::transcode_into<CharOut, on_error::throw_exception_t>(
+      s, s + N - 1, result.units.data(), utfx::endian::native,
+      utfx::endian::native);
+  return result;
+}
 
-  while (begin != end) {
-    const detail::codepoint c =
-        detail::utf_traits<char16_t>::decode(begin, end, endian);
-    if (c == detail::incomplete || c == detail::illegal) {
-      return false;
+#if defined(__cpp_nontype_template_args) && \
+    __cpp_nontype_template_args >= 201911L
+/// A string literal as a template argument.
+template <typename CharT, size_t N>
+struct fixed_string {
+  CharT units[N];
+
+  constexpr fixed_string(const CharT (&s)[N]) noexcept {
+    for (size_t i = 0; i < N; ++i) {
+      units[i] = s[i];
     }
   }
-  return true;
+};
+
+/// The string literal S transcoded to CharOut, as a static_string constant.
+template <typename CharOut, fixed_string S>
+inline constexpr auto static_transcoded =
+    static_transcode<CharOut, static_length<CharOut>(S.units)>(S.units);
+#endif
+
+#if defined(__cpp_lib_memory_resource)
+/// The string-returning conversions with their result allocated from a
+/// std::pmr::memory_resource, the default resource unless mr is given.
+namespace pmr {
+template <typename CharOut, typename CharIn,
+          typename Policy = on_error::skip_t,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) == 1 || sizeof(CharOut) == 1) &&
+                  (sizeof(CharIn) != sizeof(CharOut)) &&
+                  detail::is_error_policy<Policy>,
+              void>::type>
+std::pmr::basic_string<CharOut> transcode(
+    const CharIn* begin, const CharIn* end, utfx::endian from_or_to,
+    std::pmr::memory_resource* mr = std::pmr::get_default_resource(),
+    Policy policy = Policy{}) {
+  return utfx::transcode<CharOut>(begin, end, from_or_to,
+                                  std::pmr::polymorphic_allocator<CharOut>(mr),
+                                  policy);
+}
+
+template <typename CharOut, typename CharIn,
+          typename Policy = on_error::skip_t,
+          typename = typename std::enable_if<
+              (sizeof(CharIn) != 1 && sizeof(CharOut) != 1) &&
+                  detail::is_error_policy<Policy>,
+              void>::type>
+std::pmr::basic_string<CharOut> transcode(
+    const CharIn* begin, const CharIn* end, utfx::endian from,
+    utfx::endian to,
+    std::pmr::memory_resource* mr = std::pmr::get_default_resource(),
+    Policy policy = Policy{}) {
+  return utfx::transcode<CharOut>(begin, end, from, to,
+                                  std::pmr::polymorphic_allocator<CharOut>(mr),
+                                  policy);
+}
+
+// The input is anything utfx::utf8_to_utf16() and utfx::utf16_to_utf8()
+// take: a null-terminated string, a basic_string or a basic_string_view.
+template <typename ToCharT = default_utf16_char_t, typename Str,
+          typename Policy = on_error::skip_t>
+inline auto utf8_to_utf16(
+    const Str& str, utfx::endian e = utfx::endian::native,
+    std::pmr::memory_resource* mr = std::pmr::get_default_resource(),
+    Policy policy = Policy{})
+    -> decltype(utfx::utf8_to_utf16(
+        str, e, std::pmr::polymorphic_allocator<ToCharT>(mr), policy)) {
+  return utfx::utf8_to_utf16(
+      str, e, std::pmr::polymorphic_allocator<ToCharT>(mr), policy);
 }
 
+template <typename Str, typename Policy = on_error::skip_t>
+inline auto utf16_to_utf8(
+    const Str& str, utfx::endian e = utfx::endian::native,
+    std::pmr::memory_resource* mr = std::pmr::get_default_resource(),
+    Policy policy = Policy{})
+    -> decltype(utfx::utf16_to_utf8(
+        str, e, std::pmr::polymorphic_allocator<char>(mr), policy)) {
+  return utfx::utf16_to_utf8(str, e, std::pmr::polymorphic_allocator<char>(mr),
+                             policy);
+}
+}  // namespace pmr
+#endif
+
 namespace literals {
 inline std::string operator""_utf8(const char16_t* s, std::size_t len) {
   return transcode<char>(s, s + len, utfx::endian::native);
@@ -930,6 +7070,21 @@ inline std::string operator""_utf8(const wchar_t* s, std::size_t len) {
 }
 #endif
 
+#if defined(__cpp_nontype_template_args) && \
+    __cpp_nontype_template_args >= 201911L
+// The constant forms: views of a static_transcoded string, so the literal
+// is converted at compile time and the view stays valid for the program.
+template <fixed_string S>
+constexpr std::string_view operator""_utf8sv() noexcept {
+  return static_transcoded<char, S>;
+}
+
+template <fixed_string S>
+constexpr std::u16string_view operator""_utf16sv() noexcept {
+  return static_transcoded<char16_t, S>;
+}
+#endif
+
 }  // namespace literals
 }  // namespace utfx
 
@@ -0,0 +1,233 @@
+#include <gtest/gtest.h>
+
+#include <cstdint>
+#include <random>
+#include <string>
+#include <utfx/utfx.hpp>
+#include <vector>
+
+namespace {
+
+// Strings packed Arrow-style: offsets has one more entry than there are
+// strings, and the first string may start past data[0].
+template <typename CharT, typename Offset = int32_t>
+struct packed {
+  std::basic_string<CharT> data;
+  std::vector<Offset> offsets;
+
+  size_t count() const { return offsets.size() - 1; }
+  std::basic_string<CharT> at(size_t i) const {
+    return data.substr(static_cast<size_t>(offsets[i]),
+                       static_cast<size_t>(offsets[i + 1] - offsets[i]));
+  }
+};
+
+template <typename CharT, typename Offset = int32_t>
+packed<CharT, Offset> pack(const std::vector<std::basic_string<CharT>>& strs,
+                           size_t skip = 0) {
+  packed<CharT, Offset> p;
+  p.data.assign(skip, CharT('#'));
+  p.offsets.push_back(static_cast<Offset>(skip));
+  for (const auto& s : strs) {
+    p.data += s;
+    p.offsets.push_back(static_cast<Offset>(p.data.size()));
+  }
+  return p;
+}
+
+// The overloads of transcode_batch and of transcode, whichever form the
+// pair of encodings takes, all in native byte order.
+template <typename CharOut, typename CharIn, typename Offset>
+size_t batch(const packed<CharIn, Offset>& in, CharOut* out,
+             Offset* out_offsets) {
+  const utfx::endian e = utfx::endian::native;
+  if constexpr (sizeof(CharIn) == 1 || sizeof(CharOut) == 1) {
+    return utfx::transcode_batch(in.data.data(), in.offsets.data(),
+                                 in.count(), out, out_offsets, e);
+  } else {
+    return utfx::transcode_batch(in.data.data(), in.offsets.data(),
+                                 in.count(), out, out_offsets, e, e);
+  }
+}
+
+template <typename CharOut, typename CharIn, typename Offset>
+utfx::transcoded_batch<CharOut, Offset> batch(
+    const packed<CharIn, Offset>& in) {
+  const utfx::endian e = utfx::endian::native;
+  if constexpr (sizeof(CharIn) == 1 || sizeof(CharOut) == 1) {
+    return utfx::transcode_batch<CharOut>(in.data.data(), in.offsets.data(),
+                                          in.count(), e);
+  } else {
+    return utfx::transcode_batch<CharOut>(in.data.data(), in.offsets.data(),
+                                          in.count(), e, e);
+  }
+}
+
+template <typename CharOut, typename CharIn>
+std::basic_string<CharOut> alone(const std::basic_string<CharIn>& s) {
+  const utfx::endian e = utfx::endian::native;
+  if constexpr (sizeof(CharIn) == 1 || sizeof(CharOut) == 1) {
+    return utfx::transcode<CharOut>(s.data(), s.data() + s.size(), e);
+  } else {
+    return utfx::transcode<CharOut>(s.data(), s.data() + s.size(), e, e);
+  }
+}
+
+// Checks both overloads of transcode_batch against transcode() of each
+// string on its own.
+template <typename CharOut, typename CharIn, typename Offset>
+void check_batch(const packed<CharIn, Offset>& in) {
+  const size_t count = in.count();
+  std::vector<Offset> out_offsets(count + 1);
+  const size_t n =
+      batch(in, static_cast<CharOut*>(nullptr), out_offsets.data());
+  std::basic_string<CharOut> out(n, CharOut('Z'));
+  std::vector<Offset> again(count + 1);
+  EXPECT_EQ(batch(in, &out[0], again.data()), n);
+  EXPECT_EQ(again, out_offsets);
+  const utfx::transcoded_batch<CharOut, Offset> whole = batch<CharOut>(in);
+  EXPECT_EQ(whole.data, out);
+  EXPECT_EQ(whole.offsets, out_offsets);
+  ASSERT_EQ(out_offsets.front(), Offset(0));
+  for (size_t i = 0; i < count; ++i) {
+    ASSERT_EQ(out.substr(static_cast<size_t>(out_offsets[i]),
+                         static_cast<size_t>(out_offsets[i + 1] -
+                                             out_offsets[i])),
+              alone<CharOut>(in.at(i)))
+        << "string " << i;
+  }
+}
+
+std::string random_utf8_string(std::mt19937& rng, size_t n) {
+  static const char* const pieces[] = {"a", "Z", " ", "\xC3\xA9",
+                                       "\xE2\x82\xAC", "\xF0\x9F\x98\x80"};
+  std::uniform_int_distribution<int> pick(0, 5);
+  std::string s;
+  for (size_t i = 0; i < n; ++i) {
+    s += pieces[pick(rng)];
+  }
+  return s;
+}
+
+}  // namespace
+
+TEST(BatchTest, Empty) {
+  const int32_t offsets[] = {0};
+  int32_t out_offsets[1] = {-1};
+  EXPECT_EQ(utfx::transcode_batch("", offsets, 0,
+                                  static_cast<char16_t*>(nullptr),
+                                  out_offsets, utfx::endian::native),
+            0u);
+  EXPECT_EQ(out_offsets[0], 0);
+  check_batch<char16_t>(pack<char>({}));
+  check_batch<char16_t>(pack<char>({"", "", ""}));
+}
+
+TEST(BatchTest, UTF8ToUTF16) {
+  auto in = pack<char>({"abc", "", "caf\xC3\xA9", "\xF0\x9F\x98\x80", "z"}, 3);
+  check_batch<char16_t>(in);
+  const auto batch =
+      utfx::transcode_batch<char16_t>(in.data.data(), in.offsets.data(),
+                                      in.count(), utfx::endian::native);
+  EXPECT_EQ(batch.data, u"abccafé\U0001F600z");
+  EXPECT_EQ(batch.offsets, (std::vector<int32_t>{0, 3, 3, 7, 9, 10}));
+}
+
+TEST(BatchTest, InvalidStringsConvertOnTheirOwn) {
+  // A sequence split across two strings is ill-formed in both; converted
+  // as one text it would be a valid code point.
+  check_batch<char16_t>(pack<char>({"ab\xE2\x82", "\xAC" "cd", "ok"}));
+  check_batch<char32_t>(pack<char>({"\xF0\x9F", "\x98\x80"}));
+  check_batch<char16_t>(pack<char>({"x\xFFy", "\xC0\x80", "fine"}));
+  const std::u16string pair = u"\U0001F600";
+  check_batch<char>(pack<char16_t>({pair.substr(0, 1), pair.substr(1)}));
+  check_batch<char32_t>(
+      pack<char16_t, int64_t>({u"a" + pair.substr(0, 1), pair.substr(1)}));
+}
+
+TEST(BatchTest, RandomStrings) {
+  std::mt19937 rng(20);
+  std::uniform_int_distribution<size_t> len(0, 40);
+  for (int iter = 0; iter < 50; ++iter) {
+    std::vector<std::string> strs;
+    for (int i = 0; i < iter * 7; ++i) {
+      strs.push_back(random_utf8_string(rng, len(rng)));
+    }
+    const auto in8 = pack<char>(strs, static_cast<size_t>(iter % 3));
+    check_batch<char16_t>(in8);
+    check_batch<char32_t>(in8);
+
+    std::vector<std::u16string> strs16;
+    std::vector<std::u32string> strs32;
+    for (const auto& s : strs) {
+      strs16.push_back(utfx::transcode<char16_t>(s.data(), s.data() + s.size(),
+                                                 utfx::endian::native));
+      strs32.push_back(utfx::transcode<char32_t>(s.data(), s.data() + s.size(),
+                                                 utfx::endian::native));
+    }
+    const auto in16 = pack<char16_t, int64_t>(strs16);
+    const auto in32 = pack<char32_t, uint32_t>(strs32);
+    check_batch<char>(in16);
+    check_batch<char>(in32);
+
+    // One bad byte sends the strings around it through the per-string
+    // path.
+    if (!in8.data.empty()) {
+      auto bad = in8;
+      std::uniform_int_distribution<size_t> pos(0, bad.data.size() - 1);
+      bad.data[pos(rng)] = '\x80';
+      check_batch<char16_t>(bad);
+    }
+  }
+}
+
+TEST(BatchTest, WindowsOfEveryKind) {
+  // Runs of ASCII strings, which map one unit to one, of mixed strings, a
+  // string longer than a window and an ill-formed one, one after another.
+  std::mt19937 rng(21);
+  std::uniform_int_distribution<size_t> len(0, 30);
+  std::vector<std::string> strs;
+  for (int run = 0; run < 12; ++run) {
+    for (int i = 0; i < 400; ++i) {
+      std::string s = random_utf8_string(rng, len(rng));
+      if (run % 2 == 0) {
+        for (auto& c : s) {
+          c = static_cast<char>(c & 0x7F);
+        }
+      }
+      strs.push_back(s);
+    }
+    if (run % 3 == 1) {
+      strs.push_back(random_utf8_string(rng, 5000));
+    }
+    if (run % 4 == 3) {
+      strs.push_back("bad\xC3");
+    }
+  }
+  const auto in8 = pack<char>(strs, 1);
+  check_batch<char16_t>(in8);
+  check_batch<char32_t>(in8);
+  std::vector<std::u16string> strs16;
+  for (const auto& s : strs) {
+    strs16.push_back(utfx::transcode<char16_t>(s.data(), s.data() + s.size(),
+                                               utfx::endian::native));
+  }
+  check_batch<char>(pack<char16_t>(strs16));
+}
+
+TEST(BatchTest, UTF16ToUTF32BothEndians) {
+  const std::u16string a = u"café";
+  const std::u16string b = u"\U0001F600!";
+  auto in = pack<char16_t>({a, b});
+  for (auto& c : in.data) {
+    c = utfx::detail::swap_bytes(c);
+  }
+  const utfx::endian other = utfx::endian::native == utfx::endian::little
+                                 ? utfx::endian::big
+                                 : utfx::endian::little;
+  const auto batch = utfx::transcode_batch<char32_t>(
+      in.data.data(), in.offsets.data(), in.count(), other,
+      utfx::endian::native);
+  EXPECT_EQ(batch.data, U"café\U0001F600!");
+  EXPECT_EQ(batch.offsets, (std::vector<int32_t>{0, 4, 6}));
+}
@@ -2,6 +2,7 @@
 
 #include <array>
 #include <cstdint>
+#include <string>
 #include <utfx/utfx.hpp>
 
 using namespace utfx::detail;
@@ -93,6 +94,32 @@ TEST(DetailTest, SwapBytes_Roundtrip) {
   }
 }
 
+TEST(DetailTest, SkipASCII_StopsAtFirstNonASCIIByte) {
+  // Every length up to a few words, with the non-ASCII byte at every
+  // position and also absent, from every alignment.
+  std::string buf(64 + 8, 'x');
+  for (size_t offset = 0; offset < 8; ++offset) {
+    for (size_t len = 0; len <= 64; ++len) {
+      const char* b = buf.data() + offset;
+      EXPECT_EQ(skip_ascii(b, b + len), b + len);
+      for (size_t pos = 0; pos < len; ++pos) {
+        buf[offset + pos] = '\x80';
+        EXPECT_EQ(skip_ascii(b, b + len), b + pos)
+            << "offset " << offset << " len " << len << " pos " << pos;
+        buf[offset + pos] = '\xFF';
+        EXPECT_EQ(skip_ascii(b, b + len), b + pos);
+        buf[offset + pos] = 'x';
+      }
+    }
+  }
+}
+
+TEST(DetailTest, SkipASCII_Constexpr) {
+  constexpr const char s[] = "0123456789abcdef\xC2\xA2";
+  static_assert(skip_ascii(s, s + sizeof(s) - 1) == s + 16, "");
+  EXPECT_TRUE(true);
+}
+
 // ============================================================================
 // utf_traits<char, 1> (UTF-8) tests
 // ============================================================================
@@ -306,7 +333,6 @@ TEST(DetailUTF8, Decode_IncompleteSequences) {
 
 TEST(DetailUTF8, Decode_InvalidTrailBytes) {
   // Lead byte followed by ASCII byte (not a valid trail byte)
-  // trail_length for ASCII (0x00-0x7F) returns 0, and !0 == true => illegal
   {
     const char input[] = "\xC2\x41";  // 0xC2 followed by 'A' (0x41)
     const char* p = input;
@@ -320,10 +346,23 @@ TEST(DetailUTF8, Decode_InvalidTrailBytes) {
     const char* e2 = input + 3;
     EXPECT_EQ(utf8_traits::decode(p2, e2), illegal);
   }
-  // Lead byte followed by a byte in 0x80-0xBF range IS a valid trail byte,
-  // but bytes like 0xC0 (which has trail_length == -1) still pass the
-  // !trail_length check since -1 is non-zero. The real invalid case is
-  // an ASCII byte (trail_length == 0).
+  // Only 0x80-0xBF may follow a lead byte; another lead byte or an invalid
+  // byte in trail position is illegal too.
+  {
+    const char input[] = "\xC3\xC3";  // decodes to U+00C3 if unchecked
+    const char* p3 = input;
+    EXPECT_EQ(utf8_traits::decode(p3, input + 2), illegal);
+  }
+  {
+    const char input[] = "\xE4\xC0\xBF";
+    const char* p4 = input;
+    EXPECT_EQ(utf8_traits::decode(p4, input + 3), illegal);
+  }
+  {
+    const char input[] = "\xF0\x9F\xF5\x80";
+    const char* p5 = input;
+    EXPECT_EQ(utf8_traits::decode(p5, input + 4), illegal);
+  }
 }
 
 TEST(DetailUTF8, Decode_OverlongSequences) {
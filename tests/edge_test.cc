@@ -1,6 +1,7 @@
 #include <gtest/gtest.h>
 
 #include <cstring>
+#include <memory>
 #include <string_view>
 #include <utfx/utfx.hpp>
 
@@ -175,6 +176,211 @@ TEST(TranscodeTest, UTF32ToUTF8_Basic) {
   EXPECT_EQ(result, "Hello");
 }
 
+// ============================================================================
+// transcode: bounded output
+// ============================================================================
+
+TEST(TranscodeTest, Bounded_FitsExactly) {
+  const char input[] = "A\xC3\xA9";  // "Aé"
+  char16_t output[2] = {};
+  utfx::transcode_result r =
+      utfx::transcode(input, input + 3, output, 2, utfx::endian::native);
+  EXPECT_TRUE(r);
+  EXPECT_EQ(r.consumed, 3u);
+  EXPECT_EQ(r.written, 2u);
+  EXPECT_EQ(output[0], u'A');
+  EXPECT_EQ(output[1], u'\u00E9');
+}
+
+TEST(TranscodeTest, Bounded_DoesNotSplitSurrogatePair) {
+  // "A" U+1F600 "B": the pair needs two units but only one is left.
+  const char input[] = "A\xF0\x9F\x98\x80" "B";
+  char16_t output[2] = {};
+  utfx::transcode_result r =
+      utfx::transcode(input, input + 6, output, 2, utfx::endian::native);
+  EXPECT_EQ(r.status, utfx::transcode_status::output_full);
+  EXPECT_EQ(r.consumed, 1u);
+  EXPECT_EQ(r.written, 1u);
+  EXPECT_EQ(output[0], u'A');
+}
+
+TEST(TranscodeTest, Bounded_DoesNotSplitUTF8Sequence) {
+  const char16_t input[] = u"a\u4E2D";
+  char output[3] = {};
+  utfx::transcode_result r =
+      utfx::transcode(input, input + 2, output, 3, utfx::endian::native);
+  EXPECT_FALSE(r);
+  EXPECT_EQ(r.consumed, 1u);
+  EXPECT_EQ(r.written, 1u);
+  r = utfx::transcode(input + r.consumed, input + 2, output, 3,
+                      utfx::endian::native);
+  EXPECT_TRUE(r);
+  EXPECT_EQ(std::string(output, r.written), "\xE4\xB8\xAD");
+}
+
+TEST(TranscodeTest, Bounded_ZeroCapacity) {
+  const char32_t input[] = U"xy";
+  char16_t output[1] = {};
+  utfx::transcode_result r = utfx::transcode(
+      input, input + 2, output, 0, utfx::endian::native, utfx::endian::native);
+  EXPECT_EQ(r.status, utfx::transcode_status::output_full);
+  EXPECT_EQ(r.consumed, 0u);
+  EXPECT_EQ(r.written, 0u);
+  r = utfx::transcode(input, input, output, 0, utfx::endian::native,
+                      utfx::endian::native);
+  EXPECT_TRUE(r);
+}
+
+TEST(TranscodeTest, Bounded_InvalidSequencesConsumed) {
+  const char input[] =
+      "A\xFF"
+      "B";
+  char32_t output[2] = {};
+  utfx::transcode_result r =
+      utfx::transcode(input, input + 3, output, 2, utfx::endian::native);
+  EXPECT_TRUE(r);
+  EXPECT_EQ(r.consumed, 3u);
+  EXPECT_EQ(r.written, 2u);
+  EXPECT_EQ(output[1], U'B');
+}
+
+// ============================================================================
+// transcode: error policies
+// ============================================================================
+
+TEST(TranscodeTest, Replace_MaximalSubparts) {
+  // Unicode Standard, Table 3-8.
+  const char input[] =
+      "\x61\xF1\x80\x80\xE1\x80\xC2\x62\x80\x63\x80\xBF\x64";
+  auto result = utfx::transcode<char16_t>(input, input + 13,
+                                          utfx::endian::native,
+                                          utfx::on_error::replace);
+  EXPECT_EQ(result, u"a\uFFFD\uFFFD\uFFFDb\uFFFDc\uFFFD\uFFFDd");
+  EXPECT_EQ(utfx::transcode(input, input + 13,
+                            static_cast<char16_t*>(nullptr),
+                            utfx::endian::native, utfx::on_error::replace),
+            result.size());
+}
+
+TEST(TranscodeTest, Replace_EncodedSurrogate) {
+  // ED A0 80 is no prefix of a well-formed sequence beyond ED itself.
+  const char input[] = "\xED\xA0\x80z";
+  auto result = utfx::transcode<char32_t>(input, input + 4,
+                                          utfx::endian::native,
+                                          utfx::on_error::replace);
+  EXPECT_EQ(result, U"\uFFFD\uFFFD\uFFFDz");
+}
+
+TEST(TranscodeTest, Replace_LeadBytesAtRangeEdges) {
+  // Overlongs, surrogates and code points past U+10FFFF next to the
+  // sequences around them that are well formed.
+  const char input[] =
+      "\xC1\xBF\xC2\x80\xE0\x9F\xBF\xE0\xA0\x80\xED\x9F\xBF\xED\xA0\x80"
+      "\xEE\x80\x80\xF0\x8F\xBF\xBF\xF0\x90\x80\x80\xF4\x8F\xBF\xBF"
+      "\xF4\x90\x80\x80\xE1\x80";
+  auto result = utfx::transcode<char32_t>(input, input + sizeof(input) - 1,
+                                          utfx::endian::native,
+                                          utfx::on_error::replace);
+  EXPECT_EQ(result, U"\uFFFD\uFFFD\u0080"
+                    U"\uFFFD\uFFFD\uFFFD\u0800"
+                    U"\uD7FF\uFFFD\uFFFD\uFFFD\uE000"
+                    U"\uFFFD\uFFFD\uFFFD\uFFFD\U00010000\U0010FFFF"
+                    U"\uFFFD\uFFFD\uFFFD\uFFFD\uFFFD");
+}
+
+TEST(TranscodeTest, Replace_UnpairedSurrogateKeepsNextUnit) {
+  const char16_t input[] = {0xD83D, u'A', 0xDE00, 0x0000};
+  EXPECT_EQ(utfx::utf16_to_utf8(std::u16string(input, 3),
+                                utfx::endian::native,
+                                utfx::on_error::replace),
+            "\xEF\xBF\xBD" "A" "\xEF\xBF\xBD");
+  // Skipping drops the unit that broke the pair along with it.
+  EXPECT_EQ(utfx::utf16_to_utf8(std::u16string(input, 3)), "");
+}
+
+TEST(TranscodeTest, Replace_UTF32OutOfRange) {
+  const char32_t input[] = {U'a', 0x110000, 0xDC00, U'b'};
+  auto result =
+      utfx::transcode<char16_t>(input, input + 4, utfx::endian::native,
+                                utfx::endian::native, utfx::on_error::replace);
+  EXPECT_EQ(result, u"a\uFFFD\uFFFDb");
+}
+
+TEST(TranscodeTest, Stop_ReportsFirstError) {
+  const char input[] = "ab\xE2\x82z";
+  char16_t output[8] = {};
+  utfx::transcode_result r =
+      utfx::transcode(input, input + 5, output, 8, utfx::endian::native,
+                      utfx::on_error::stop);
+  EXPECT_EQ(r.status, utfx::transcode_status::invalid_input);
+  EXPECT_EQ(r.error, utfx::utf_error::truncated);
+  EXPECT_EQ(r.consumed, 2u);
+  EXPECT_EQ(r.written, 2u);
+  EXPECT_EQ(utfx::transcode<char16_t>(input, input + 5, utfx::endian::native,
+                                      utfx::on_error::stop),
+            u"ab");
+  EXPECT_EQ(utfx::transcode(input, input + 5, static_cast<char16_t*>(nullptr),
+                            utfx::endian::native, utfx::on_error::stop),
+            2u);
+}
+
+TEST(TranscodeTest, Stop_ValidInputIsComplete) {
+  const char16_t input[] = u"caf\u00E9 \U0001F600";
+  char output[16] = {};
+  utfx::transcode_result r =
+      utfx::transcode(input, input + 7, output, 16, utfx::endian::native,
+                      utfx::on_error::stop);
+  EXPECT_TRUE(r);
+  EXPECT_EQ(r.consumed, 7u);
+  EXPECT_EQ(std::string(output, r.written),
+            "caf\xC3\xA9 \xF0\x9F\x98\x80");
+}
+
+TEST(TranscodeTest, Valid_Convenience) {
+  const std::string utf8 = "caf\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80";
+  const std::u16string utf16 = u"caf\u00E9 \u20AC \U0001F600";
+  EXPECT_EQ(utfx::utf8_to_utf16_valid<char16_t>(utf8), utf16);
+  EXPECT_EQ(utfx::utf8_to_utf16_valid<char16_t>(std::string_view(utf8)),
+            utf16);
+  EXPECT_EQ(utfx::utf16_to_utf8_valid(utf16), utf8);
+  EXPECT_EQ(utfx::utf16_to_utf8_valid(utf16.c_str()), utf8);
+  EXPECT_EQ(utfx::utf8_to_utf16_valid<char16_t>(""), u"");
+}
+
+TEST(TranscodeTest, Valid_SwappedSurrogatePair) {
+  // A byte-swapped pair decodes both halves in the input byte order.
+  const utfx::endian other = utfx::endian::native == utfx::endian::little
+                                 ? utfx::endian::big
+                                 : utfx::endian::little;
+  const char16_t pair[] = {utfx::detail::swap_bytes(char16_t(0xD83D)),
+                           utfx::detail::swap_bytes(char16_t(0xDE00))};
+  EXPECT_EQ(utfx::transcode_valid<char32_t>(pair, pair + 2, other,
+                                            utfx::endian::native),
+            U"\U0001F600");
+  EXPECT_EQ(utfx::transcode_valid<char>(pair, pair + 2, other),
+            "\xF0\x9F\x98\x80");
+}
+
+TEST(TranscodeTest, Throw_CarriesOffsetAndError) {
+  const char input[] = "abc\xF5";
+  try {
+    utfx::utf8_to_utf16(std::string(input, 4), utfx::endian::native,
+                        utfx::on_error::throw_exception);
+    FAIL() << "expected conversion_error";
+  } catch (const utfx::conversion_error& e) {
+    EXPECT_EQ(e.offset(), 3u);
+    EXPECT_EQ(e.error(), utfx::utf_error::out_of_range);
+  }
+  char32_t output[4] = {};
+  EXPECT_THROW(utfx::transcode(input, input + 4, output, 4,
+                               utfx::endian::native,
+                               utfx::on_error::throw_exception),
+               utfx::conversion_error);
+  EXPECT_EQ(utfx::transcode(input, input + 3, output, utfx::endian::native,
+                            utfx::on_error::throw_exception),
+            3u);
+}
+
 // ============================================================================
 // is_utf8 edge cases
 // ============================================================================
@@ -821,6 +1027,102 @@ TEST(TranscodeStringTest, UTF8ToUTF16_NullChar) {
   EXPECT_EQ(result[2], u'B');
 }
 
+namespace {
+
+// An allocator that counts the bytes it hands out.
+template <typename T>
+struct counting_allocator {
+  using value_type = T;
+
+  explicit counting_allocator(size_t* bytes) : bytes(bytes) {}
+  template <typename U>
+  counting_allocator(const counting_allocator<U>& other)
+      : bytes(other.bytes) {}
+
+  T* allocate(size_t n) {
+    *bytes += n * sizeof(T);
+    return std::allocator<T>().allocate(n);
+  }
+  void deallocate(T* p, size_t n) { std::allocator<T>().deallocate(p, n); }
+
+  bool operator==(const counting_allocator& other) const {
+    return bytes == other.bytes;
+  }
+  bool operator!=(const counting_allocator& other) const {
+    return bytes != other.bytes;
+  }
+
+  size_t* bytes;
+};
+
+}  // namespace
+
+TEST(TranscodeStringTest, CustomAllocator) {
+  // Long enough not to fit in the small-string buffer.
+  const std::string input(100, 'a');
+  size_t bytes = 0;
+  const counting_allocator<char16_t> alloc(&bytes);
+  auto wide = utfx::transcode<char16_t>(
+      input.data(), input.data() + input.size(), utfx::endian::native, alloc);
+  using counted_u16string =
+      std::basic_string<char16_t, std::char_traits<char16_t>,
+                        counting_allocator<char16_t>>;
+  static_assert(std::is_same<decltype(wide), counted_u16string>::value);
+  EXPECT_EQ(wide, std::u16string(100, u'a').c_str());
+  EXPECT_GE(bytes, 200u);
+
+  const size_t before = bytes;
+  auto utf32 = utfx::transcode<char32_t>(
+      wide.data(), wide.data() + wide.size(), utfx::endian::native,
+      utfx::endian::native, counting_allocator<char32_t>(&bytes));
+  EXPECT_EQ(utf32.size(), 100u);
+  EXPECT_GE(bytes - before, 400u);
+
+  auto narrow = utfx::utf16_to_utf8(wide, utfx::endian::native,
+                                    counting_allocator<char>(&bytes),
+                                    utfx::on_error::stop);
+  EXPECT_EQ(narrow, input.c_str());
+  auto back = utfx::utf8_to_utf16(input, utfx::endian::native, alloc);
+  EXPECT_EQ(back, wide);
+}
+
+#if defined(__cpp_lib_memory_resource)
+TEST(TranscodeStringTest, PmrResource) {
+  char buffer[4096];
+  std::pmr::monotonic_buffer_resource arena(buffer, sizeof(buffer),
+                                            std::pmr::null_memory_resource());
+  const std::pmr::string input("caf\xC3\xA9 \xF0\x9F\x98\x80 and more text",
+                               &arena);
+  std::pmr::u16string wide = utfx::pmr::utf8_to_utf16<char16_t>(
+      input, utfx::endian::native, &arena);
+  EXPECT_EQ(wide, u"café \U0001F600 and more text");
+  EXPECT_EQ(wide.get_allocator().resource(), &arena);
+
+  std::pmr::string narrow =
+      utfx::pmr::utf16_to_utf8(wide, utfx::endian::native, &arena);
+  EXPECT_EQ(narrow, input);
+  EXPECT_EQ(utfx::pmr::utf16_to_utf8(u"x\xD800y", utfx::endian::native,
+                                     &arena, utfx::on_error::replace),
+            "x\xEF\xBF\xBDy");
+
+  std::pmr::u32string utf32 = utfx::pmr::transcode<char32_t>(
+      wide.data(), wide.data() + wide.size(), utfx::endian::native,
+      utfx::endian::native, &arena);
+  EXPECT_EQ(utf32, U"café \U0001F600 and more text");
+  EXPECT_EQ(utfx::pmr::transcode<char16_t>(input.data(),
+                                           input.data() + input.size(),
+                                           utfx::endian::native),
+            wide);
+
+  // Plain std::string input works too, and mr defaults to the default
+  // resource.
+  const std::string plain = "abc";
+  EXPECT_EQ(utfx::pmr::utf8_to_utf16<char16_t>(plain).get_allocator()
+                .resource(),
+            std::pmr::get_default_resource());
+}
+#endif
+
 // ============================================================================
 // cross-type transcode
 // ============================================================================
@@ -0,0 +1,309 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <utfx/utfx.hpp>
+#include <vector>
+
+namespace {
+
+// Random Latin-1 text; |ascii_percent| of the bytes are below 0x80.
+std::string random_latin1(std::mt19937& rng, size_t n, int ascii_percent) {
+  std::uniform_int_distribution<int> pick(0, 99);
+  std::uniform_int_distribution<int> ascii(0x00, 0x7F);
+  std::uniform_int_distribution<int> high(0x80, 0xFF);
+  std::string s;
+  for (size_t i = 0; i < n; ++i) {
+    s += static_cast<char>(pick(rng) < ascii_percent ? ascii(rng) : high(rng));
+  }
+  return s;
+}
+
+// Reference conversions, one code point at a time.
+std::string reference_utf8(const std::string& latin1) {
+  std::string out;
+  for (char c : latin1) {
+    utfx::detail::utf_traits<char>::encode(static_cast<unsigned char>(c),
+                                           std::back_inserter(out));
+  }
+  return out;
+}
+
+std::u16string reference_utf16(const std::string& latin1, bool swap) {
+  std::u16string out;
+  for (char c : latin1) {
+    const char16_t u = static_cast<unsigned char>(c);
+    out += swap ? utfx::detail::swap_bytes(u) : u;
+  }
+  return out;
+}
+
+const utfx::endian other_endian = utfx::endian::native == utfx::endian::little
+                                      ? utfx::endian::big
+                                      : utfx::endian::little;
+
+}  // namespace
+
+TEST(Latin1Test, ToUTF8_Basic) {
+  EXPECT_EQ(utfx::latin1_to_utf8(""), "");
+  EXPECT_EQ(utfx::latin1_to_utf8("caf\xE9"), "caf\xC3\xA9");
+  EXPECT_EQ(utfx::latin1_to_utf8("\x80\xFF"), "\xC2\x80\xC3\xBF");
+  EXPECT_EQ(utfx::utf8_length_from_latin1("caf\xE9", 4), 5u);
+}
+
+TEST(Latin1Test, ToUTF16_Basic) {
+  EXPECT_EQ(utfx::latin1_to_utf16("A\xE9\xFF"), u"Aéÿ");
+  const std::u16string big = utfx::latin1_to_utf16("A", other_endian);
+  ASSERT_EQ(big.size(), 1u);
+  EXPECT_EQ(utfx::detail::swap_bytes(big[0]), u'A');
+}
+
+TEST(Latin1Test, FromUTF8_Basic) {
+  const char input[] = "caf\xC3\xA9 \xC2\xA0!";
+  char out[sizeof(input)] = {};
+  utfx::transcode_result r = utfx::utf8_to_latin1(input, 9, out);
+  EXPECT_TRUE(r);
+  EXPECT_EQ(r.consumed, 9u);
+  EXPECT_EQ(std::string(out, r.written), "caf\xE9 \xA0!");
+}
+
+TEST(Latin1Test, FromUTF8_Unrepresentable) {
+  // U+0100 is the first code point Latin-1 cannot hold.
+  const char input[] = "ab\xC4\x80z";
+  char out[sizeof(input)] = {};
+  utfx::transcode_result r = utfx::utf8_to_latin1(input, 5, out);
+  EXPECT_EQ(r.status, utfx::transcode_status::invalid_input);
+  EXPECT_EQ(r.error, utfx::utf_error::unrepresentable);
+  EXPECT_EQ(r.consumed, 2u);
+  EXPECT_EQ(std::string(out, r.written), "ab");
+}
+
+TEST(Latin1Test, FromUTF8_IllFormed) {
+  char out[8] = {};
+  utfx::transcode_result r = utfx::utf8_to_latin1("a\x80", 2, out);
+  EXPECT_EQ(r.error, utfx::utf_error::stray_continuation);
+  EXPECT_EQ(r.consumed, 1u);
+  r = utfx::utf8_to_latin1("a\xC3", 2, out);
+  EXPECT_EQ(r.error, utfx::utf_error::truncated);
+  EXPECT_EQ(r.consumed, 1u);
+  r = utfx::utf8_to_latin1("\xC1\x81", 2, out);
+  EXPECT_EQ(r.error, utfx::utf_error::overlong);
+  EXPECT_EQ(r.consumed, 0u);
+}
+
+TEST(Latin1Test, FromUTF16_Errors) {
+  char out[8] = {};
+  const char16_t wide[] = u"abĀ";
+  utfx::transcode_result r = utfx::utf16_to_latin1(wide, 3, out);
+  EXPECT_EQ(r.error, utfx::utf_error::unrepresentable);
+  EXPECT_EQ(r.consumed, 2u);
+  EXPECT_EQ(r.written, 2u);
+  const char16_t pair[] = u"\U0001F600";
+  r = utfx::utf16_to_latin1(pair, 2, out);
+  EXPECT_EQ(r.error, utfx::utf_error::unrepresentable);
+  const char16_t lone[] = {u'a', 0xDC00};
+  r = utfx::utf16_to_latin1(lone, 2, out);
+  EXPECT_EQ(r.error, utfx::utf_error::surrogate);
+  EXPECT_EQ(r.consumed, 1u);
+}
+
+TEST(Latin1Test, RandomRoundTrips) {
+  std::mt19937 rng(17);
+  for (size_t n = 0; n < 600; n += 11) {
+    for (int ascii : {0, 50, 97, 100}) {
+      const std::string latin1 = random_latin1(rng, n, ascii);
+      const std::string utf8 = reference_utf8(latin1);
+      ASSERT_EQ(utfx::utf8_length_from_latin1(latin1.data(), n), utf8.size());
+
+      // Exact-size output followed by canaries.
+      std::vector<char> buf(utf8.size() + 64, 'Z');
+      ASSERT_EQ(utfx::latin1_to_utf8(latin1.data(), n, buf.data()),
+                utf8.size());
+      ASSERT_EQ(std::string(buf.data(), utf8.size()), utf8);
+      ASSERT_TRUE(std::all_of(buf.begin() + static_cast<ptrdiff_t>(utf8.size()),
+                              buf.end(), [](char c) { return c == 'Z'; }));
+
+      // Output to Latin-1 may use the whole len bytes as scratch space.
+      std::vector<char> back(utf8.size() + 64, 'Z');
+      utfx::transcode_result r =
+          utfx::utf8_to_latin1(utf8.data(), utf8.size(), back.data());
+      ASSERT_TRUE(r);
+      ASSERT_EQ(std::string(back.data(), r.written), latin1);
+      ASSERT_TRUE(
+          std::all_of(back.begin() + static_cast<ptrdiff_t>(utf8.size()),
+                      back.end(), [](char c) { return c == 'Z'; }));
+
+      for (auto e : {utfx::endian::native, other_endian}) {
+        const std::u16string utf16 =
+            reference_utf16(latin1, e != utfx::endian::native);
+        ASSERT_EQ(utfx::latin1_to_utf16(latin1, e), utf16);
+        std::vector<char> narrow(n + 1);
+        r = utfx::utf16_to_latin1(utf16.data(), n, narrow.data(), e);
+        ASSERT_TRUE(r);
+        ASSERT_EQ(std::string(narrow.data(), r.written), latin1);
+      }
+    }
+  }
+}
+
+TEST(Latin1Test, RandomErrorPositions) {
+  std::mt19937 rng(18);
+  for (size_t n = 1; n < 300; n += 7) {
+    const std::string latin1 = random_latin1(rng, n, 60);
+    const std::string utf8 = reference_utf8(latin1);
+    std::uniform_int_distribution<size_t> pos(0, n - 1);
+    const size_t k = pos(rng);
+    const std::string prefix = reference_utf8(latin1.substr(0, k));
+    const std::string suffix = reference_utf8(latin1.substr(k));
+    std::vector<char> out(utf8.size() + 4);
+
+    // A code point above U+00FF, then a stray continuation byte.
+    std::string bad = prefix + "\xE2\x82\xAC" + suffix;
+    utfx::transcode_result r =
+        utfx::utf8_to_latin1(bad.data(), bad.size(), out.data());
+    ASSERT_EQ(r.error, utfx::utf_error::unrepresentable) << n << " " << k;
+    ASSERT_EQ(r.consumed, prefix.size());
+    ASSERT_EQ(std::string(out.data(), r.written), latin1.substr(0, k));
+    bad = prefix + "\x80" + suffix;
+    r = utfx::utf8_to_latin1(bad.data(), bad.size(), out.data());
+    ASSERT_EQ(r.error, utfx::utf_error::stray_continuation);
+    ASSERT_EQ(r.consumed, prefix.size());
+
+    std::u16string wide = reference_utf16(latin1, false);
+    wide[k] = u'€';
+    r = utfx::utf16_to_latin1(wide.data(), wide.size(), out.data());
+    ASSERT_EQ(r.error, utfx::utf_error::unrepresentable);
+    ASSERT_EQ(r.consumed, k);
+    ASSERT_EQ(std::string(out.data(), r.written), latin1.substr(0, k));
+  }
+}
+
+// On error the output past written is unspecified, but nothing past len
+// bytes is touched.
+TEST(Latin1Test, FromUTF8_ErrorWritesNothingPastWritten) {
+  std::mt19937 rng(21);
+  for (size_t n = 1; n < 300; n += 13) {
+    const std::string utf8 = reference_utf8(random_latin1(rng, n, 50));
+    for (size_t k = 0; k <= utf8.size(); k += 5) {
+      const std::string bad = utf8.substr(0, k) + "\xFF" + utf8.substr(k);
+      std::vector<char> out(bad.size() + 64, 'Z');
+      const utfx::transcode_result r =
+          utfx::utf8_to_latin1(bad.data(), bad.size(), out.data());
+      ASSERT_FALSE(r) << n << " " << k;
+      ASSERT_TRUE(
+          std::all_of(out.begin() + static_cast<ptrdiff_t>(r.written),
+                      out.end(), [](char c) { return c == 'Z'; }))
+          << n << " " << k;
+    }
+  }
+}
+
+#if defined(UTFX_SIMD_X86_64)
+namespace {
+
+namespace simd = utfx::detail::simd;
+
+// Every Latin-1 kernel set the running CPU can execute.
+struct latin1_kernels {
+  const char* name;
+  simd::kernel_result (*to_utf8)(const char*, size_t, char*);
+  simd::kernel_result (*from_utf8)(const char*, size_t, char*);
+  simd::kernel_result (*to_utf16)(const char*, size_t, char16_t*, bool);
+  simd::kernel_result (*from_utf16)(const char16_t*, size_t, char*, bool);
+};
+
+std::vector<latin1_kernels> available_latin1_kernels() {
+  std::vector<latin1_kernels> v;
+  if (simd::cpu_supports(simd::isa::sse42)) {
+    v.push_back({"sse42", &simd::latin1_to_utf8_sse42,
+                 &simd::utf8_to_latin1_sse42, &simd::latin1_to_utf16_sse42,
+                 &simd::utf16_to_latin1_sse42});
+  }
+  if (simd::cpu_supports(simd::isa::avx2)) {
+    v.push_back({"avx2", &simd::latin1_to_utf8_avx2,
+                 &simd::utf8_to_latin1_avx2, &simd::latin1_to_utf16_avx2,
+                 &simd::utf16_to_latin1_avx2});
+  }
+  return v;
+}
+
+}  // namespace
+
+// The kernels stop on a code point boundary, and what they wrote matches
+// the reference for the part they read.
+TEST(Latin1Test, Kernels_MatchReference) {
+  std::mt19937 rng(19);
+  for (const latin1_kernels& k : available_latin1_kernels()) {
+    for (size_t n = 0; n < 300; n += 5) {
+      for (int ascii : {0, 50, 97, 100}) {
+        const std::string latin1 = random_latin1(rng, n, ascii);
+        const std::string utf8 = reference_utf8(latin1);
+
+        std::vector<char> buf(utf8.size() + 64, 'Z');
+        simd::kernel_result r = k.to_utf8(latin1.data(), n, buf.data());
+        ASSERT_LE(r.read, n) << k.name;
+        ASSERT_EQ(std::string(buf.data(), r.written),
+                  reference_utf8(latin1.substr(0, r.read)))
+            << k.name;
+
+        std::fill(buf.begin(), buf.end(), 'Z');
+        r = k.from_utf8(utf8.data(), utf8.size(), buf.data());
+        const std::string head = reference_utf8(latin1.substr(0, r.written));
+        ASSERT_EQ(r.read, head.size()) << k.name;
+        ASSERT_EQ(std::string(buf.data(), r.written),
+                  latin1.substr(0, r.written))
+            << k.name;
+
+        ASSERT_TRUE(std::all_of(buf.begin() + static_cast<ptrdiff_t>(r.written),
+                                buf.end(), [](char c) { return c == 'Z'; }))
+            << k.name;
+
+        for (bool swap : {false, true}) {
+          const std::u16string utf16 = reference_utf16(latin1, swap);
+          std::vector<char16_t> wide(n + 1, u'Z');
+          r = k.to_utf16(latin1.data(), n, wide.data(), swap);
+          ASSERT_EQ(r.read, r.written) << k.name;
+          ASSERT_EQ(std::u16string(wide.data(), r.written),
+                    utf16.substr(0, r.written))
+              << k.name;
+          r = k.from_utf16(utf16.data(), n, buf.data(), swap);
+          ASSERT_EQ(r.read, r.written) << k.name;
+          ASSERT_EQ(std::string(buf.data(), r.written),
+                    latin1.substr(0, r.written))
+              << k.name;
+        }
+      }
+    }
+  }
+}
+
+// A kernel that stops at a block it cannot convert leaves the bytes past
+// what it wrote alone, after blocks of 2-byte sequences too.
+TEST(Latin1Test, Kernels_FromUTF8WriteNothingPastWritten) {
+  std::mt19937 rng(23);
+  for (const latin1_kernels& k : available_latin1_kernels()) {
+    for (size_t n = 16; n < 200; n += 7) {
+      for (int ascii : {0, 50, 97}) {
+        const std::string utf8 = reference_utf8(random_latin1(rng, n, ascii));
+        for (size_t at = 0; at <= utf8.size(); at += 3) {
+          if (at != utf8.size() && (utf8[at] & 0xC0) == 0x80) {
+            continue;
+          }
+          // U+0100 has no Latin-1 byte.
+          const std::string in =
+              utf8.substr(0, at) + "\xC4\x80" + utf8.substr(at);
+          std::vector<char> buf(in.size() + 64, 'Z');
+          const simd::kernel_result r =
+              k.from_utf8(in.data(), in.size(), buf.data());
+          ASSERT_LE(r.read, at) << k.name;
+          ASSERT_TRUE(
+              std::all_of(buf.begin() + static_cast<ptrdiff_t>(r.written),
+                          buf.end(), [](char c) { return c == 'Z'; }))
+              << k.name << " " << n << " " << at;
+        }
+      }
+    }
+  }
+}
+#endif
@@ -0,0 +1,1748 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <utfx/utfx.hpp>
+#include <vector>
+
+using namespace utfx::detail;
+
+namespace {
+
+// Random valid UTF-8 mixing all four sequence lengths.  |ascii_percent|
+// controls how much of the output is plain ASCII.
+std::string random_utf8(std::mt19937& rng, size_t codepoints,
+                        int ascii_percent = 25) {
+  std::uniform_int_distribution<int> pick(0, 99);
+  std::uniform_int_distribution<uint32_t> ascii(0x00, 0x7F);
+  std::uniform_int_distribution<uint32_t> two(0x80, 0x7FF);
+  std::uniform_int_distribution<uint32_t> three(0x800, 0xFFFF);
+  std::uniform_int_distribution<uint32_t> four(0x10000, 0x10FFFF);
+  std::string out;
+  while (codepoints-- > 0) {
+    uint32_t c;
+    int r = pick(rng);
+    if (r < ascii_percent) {
+      c = ascii(rng);
+    } else if (r < ascii_percent + (100 - ascii_percent) / 3) {
+      c = two(rng);
+    } else if (r < ascii_percent + 2 * (100 - ascii_percent) / 3) {
+      do {
+        c = three(rng);
+      } while (0xD800 <= c && c <= 0xDFFF);
+    } else {
+      c = four(rng);
+    }
+    utf_traits<char>::encode(c, std::back_inserter(out));
+  }
+  return out;
+}
+
+std::u16string random_utf16(std::mt19937& rng, size_t codepoints,
+                            int ascii_percent = 25) {
+  std::u16string out;
+  std::string utf8 = random_utf8(rng, codepoints, ascii_percent);
+  const char* p = utf8.data();
+  const char* e = p + utf8.size();
+  while (p != e) {
+    utf_traits<char16_t>::encode(utf_traits<char>::decode(p, e),
+                                 std::back_inserter(out));
+  }
+  return out;
+}
+
+std::u32string random_utf32(std::mt19937& rng, size_t codepoints,
+                            int ascii_percent = 25) {
+  std::u32string out;
+  std::string utf8 = random_utf8(rng, codepoints, ascii_percent);
+  const char* p = utf8.data();
+  const char* e = p + utf8.size();
+  while (p != e) {
+    out += static_cast<char32_t>(utf_traits<char>::decode(p, e));
+  }
+  return out;
+}
+
+template <typename CharT>
+std::basic_string<CharT> swapped(std::basic_string<CharT> s) {
+  for (auto& c : s) {
+    c = swap_bytes(c);
+  }
+  return s;
+}
+
+// Reference result: the scalar loop alone.
+template <typename Out, typename In>
+std::basic_string<Out> scalar_transcode(const std::basic_string<In>& in,
+                                        utfx::endian from, utfx::endian to) {
+  std::basic_string<Out> out(in.size() * 4, Out(0));
+  const In* b = in.data();
+  Out* o = &out[0];
+  while (b != in.data() + in.size()) {
+    o = transcode_one<Out>(b, in.data() + in.size(), o, from, to);
+  }
+  out.resize(static_cast<size_t>(o - out.data()));
+  return out;
+}
+
+template <typename Out, typename In>
+std::basic_string<Out> scalar_transcode(const std::basic_string<In>& in,
+                                        utfx::endian e) {
+  return scalar_transcode<Out>(in, e, e);
+}
+
+// The public pointer API, writing into a buffer of exactly the expected size
+// followed by canaries that must survive.
+template <typename Out, typename In>
+std::basic_string<Out> pointer_transcode(const std::basic_string<In>& in,
+                                         size_t expected, utfx::endian e) {
+  const Out canary = static_cast<Out>(0x5A);
+  std::vector<Out> buf(expected + 64, canary);
+  size_t n = utfx::transcode(in.data(), in.data() + in.size(), buf.data(), e);
+  EXPECT_TRUE(std::all_of(buf.begin() + static_cast<ptrdiff_t>(n), buf.end(),
+                          [&](Out c) { return c == canary; }))
+      << "wrote past the end of the output";
+  return std::basic_string<Out>(buf.data(), n);
+}
+
+bool scalar_is_utf8(const std::string& s) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(s.data());
+  return is_utf8_scalar(p, p + s.size());
+}
+
+// Every validator the running CPU can execute, scalar included.
+std::vector<std::pair<const char*, bool (*)(const char*, size_t)>>
+utf8_validators() {
+  std::vector<std::pair<const char*, bool (*)(const char*, size_t)>> v;
+  v.emplace_back("dispatch", [](const char* p, size_t n) {
+    return is_utf8_fast(p, n);
+  });
+#if defined(UTFX_SIMD_X86_64)
+  if (simd::cpu_supports(simd::isa::sse42)) {
+    v.emplace_back("sse42", &simd::validate_utf8_sse42);
+  }
+  if (simd::cpu_supports(simd::isa::avx2)) {
+    v.emplace_back("avx2", &simd::validate_utf8_avx2);
+  }
+  if (simd::cpu_supports(simd::isa::avx512)) {
+    v.emplace_back("avx512", &simd::validate_utf8_avx512);
+  }
+#endif
+  return v;
+}
+
+// Every first-error locator the running CPU can execute: a kernel flags the
+// block and utf8_error_after_block pinpoints the error.
+std::vector<
+    std::pair<const char*, utfx::validation_result (*)(const char*, size_t)>>
+utf8_locators() {
+  std::vector<std::pair<const char*,
+                        utfx::validation_result (*)(const char*, size_t)>>
+      v;
+  v.emplace_back("scalar", [](const char* p, size_t n) {
+    const unsigned char* u = reinterpret_cast<const unsigned char*>(p);
+    return validate_utf8_scalar(u, u, u + n);
+  });
+  v.emplace_back("dispatch", [](const char* p, size_t n) {
+    return utfx::validate_utf8(p, n);
+  });
+#if defined(UTFX_SIMD_X86_64)
+  if (simd::cpu_supports(simd::isa::sse42)) {
+    v.emplace_back("sse42", [](const char* p, size_t n) {
+      return utf8_error_after_block(p, n, simd::utf8_error_block_sse42(p, n));
+    });
+  }
+  if (simd::cpu_supports(simd::isa::avx2)) {
+    v.emplace_back("avx2", [](const char* p, size_t n) {
+      return utf8_error_after_block(p, n, simd::utf8_error_block_avx2(p, n));
+    });
+  }
+  if (simd::cpu_supports(simd::isa::avx512)) {
+    v.emplace_back("avx512", [](const char* p, size_t n) {
+      return utf8_error_after_block(p, n,
+                                    simd::utf8_error_block_avx512(p, n));
+    });
+  }
+#endif
+  return v;
+}
+
+using utf16_validator = utfx::validation_result (*)(const char16_t*, size_t,
+                                                   utfx::endian);
+
+// Every UTF-16 validator the running CPU can execute: a kernel's valid
+// prefix followed by the scalar loop.
+std::vector<std::pair<const char*, utf16_validator>> utf16_validators() {
+  std::vector<std::pair<const char*, utf16_validator>> v;
+  v.emplace_back("scalar", [](const char16_t* p, size_t n, utfx::endian e) {
+    return validate_utf16_scalar(p, p, p + n, e);
+  });
+  v.emplace_back("dispatch", [](const char16_t* p, size_t n, utfx::endian e) {
+    return validate_utf16_fast(p, p, p + n, e);
+  });
+#if defined(UTFX_SIMD_X86_64)
+  if (simd::cpu_supports(simd::isa::sse42)) {
+    v.emplace_back("sse42", [](const char16_t* p, size_t n, utfx::endian e) {
+      const size_t k =
+          simd::utf16_valid_prefix_sse42(p, n, e != utfx::endian::native);
+      return validate_utf16_scalar(p, p + k, p + n, e);
+    });
+  }
+  if (simd::cpu_supports(simd::isa::avx2)) {
+    v.emplace_back("avx2", [](const char16_t* p, size_t n, utfx::endian e) {
+      const size_t k =
+          simd::utf16_valid_prefix_avx2(p, n, e != utfx::endian::native);
+      return validate_utf16_scalar(p, p + k, p + n, e);
+    });
+  }
+  if (simd::cpu_supports(simd::isa::avx512)) {
+    v.emplace_back("avx512", [](const char16_t* p, size_t n, utfx::endian e) {
+      const size_t k =
+          simd::utf16_valid_prefix_avx512(p, n, e != utfx::endian::native);
+      return validate_utf16_scalar(p, p + k, p + n, e);
+    });
+  }
+#endif
+  return v;
+}
+
+using utf32_validator = utfx::validation_result (*)(const char32_t*, size_t,
+                                                   utfx::endian);
+
+// Every UTF-32 validator the running CPU can execute.
+std::vector<std::pair<const char*, utf32_validator>> utf32_validators() {
+  std::vector<std::pair<const char*, utf32_validator>> v;
+  v.emplace_back("scalar", [](const char32_t* p, size_t n, utfx::endian e) {
+    return validate_utf32_scalar(p, p, p + n, e);
+  });
+  v.emplace_back("dispatch", [](const char32_t* p, size_t n, utfx::endian e) {
+    return validate_utf32_fast(p, p, p + n, e);
+  });
+#if defined(UTFX_SIMD_X86_64)
+  if (simd::cpu_supports(simd::isa::sse42)) {
+    v.emplace_back("sse42", [](const char32_t* p, size_t n, utfx::endian e) {
+      const size_t k =
+          simd::utf32_valid_prefix_sse42(p, n, e != utfx::endian::native);
+      return validate_utf32_scalar(p, p + k, p + n, e);
+    });
+  }
+  if (simd::cpu_supports(simd::isa::avx2)) {
+    v.emplace_back("avx2", [](const char32_t* p, size_t n, utfx::endian e) {
+      const size_t k =
+          simd::utf32_valid_prefix_avx2(p, n, e != utfx::endian::native);
+      return validate_utf32_scalar(p, p + k, p + n, e);
+    });
+  }
+  if (simd::cpu_supports(simd::isa::avx512)) {
+    v.emplace_back("avx512", [](const char32_t* p, size_t n, utfx::endian e) {
+      const size_t k =
+          simd::utf32_valid_prefix_avx512(p, n, e != utfx::endian::native);
+      return validate_utf32_scalar(p, p + k, p + n, e);
+    });
+  }
+#endif
+  return v;
+}
+
+utfx::endian non_native() {
+  return utfx::endian::native == utfx::endian::big ? utfx::endian::little
+                                                   : utfx::endian::big;
+}
+
+}  // namespace
+
+// ============================================================================
+// UTF-8 validation kernels agree with the scalar reference
+// ============================================================================
+
+TEST(SimdValidateUTF8, EmptyAndAscii) {
+  for (auto& [name, fn] : utf8_validators()) {
+    SCOPED_TRACE(name);
+    EXPECT_TRUE(fn("", 0));
+    std::string ascii(1000, 'a');
+    EXPECT_TRUE(fn(ascii.data(), ascii.size()));
+  }
+}
+
+TEST(SimdValidateUTF8, RandomValidInput) {
+  std::mt19937 rng(42);
+  for (auto& [name, fn] : utf8_validators()) {
+    SCOPED_TRACE(name);
+    for (size_t n = 0; n < 300; ++n) {
+      std::string s = random_utf8(rng, n);
+      ASSERT_TRUE(fn(s.data(), s.size())) << "length " << s.size();
+    }
+  }
+}
+
+TEST(SimdValidateUTF8, RandomCorruptionMatchesScalar) {
+  std::mt19937 rng(7);
+  std::uniform_int_distribution<int> byte(0, 255);
+  for (auto& [name, fn] : utf8_validators()) {
+    SCOPED_TRACE(name);
+    for (int iter = 0; iter < 3000; ++iter) {
+      std::string s = random_utf8(rng, 10 + iter % 90, iter % 100);
+      std::uniform_int_distribution<size_t> pos(0, s.size() - 1);
+      s[pos(rng)] = static_cast<char>(byte(rng));
+      ASSERT_EQ(fn(s.data(), s.size()), scalar_is_utf8(s)) << "iter " << iter;
+    }
+  }
+}
+
+TEST(SimdValidateUTF8, TruncationAtEveryLength) {
+  std::mt19937 rng(3);
+  std::string s = random_utf8(rng, 100, 10);
+  for (auto& [name, fn] : utf8_validators()) {
+    SCOPED_TRACE(name);
+    for (size_t n = 0; n <= s.size(); ++n) {
+      ASSERT_EQ(fn(s.data(), n), scalar_is_utf8(s.substr(0, n)))
+          << "length " << n;
+    }
+  }
+}
+
+TEST(SimdValidateUTF8, InvalidSequencesAtEveryOffset) {
+  const std::vector<std::string> bad = {
+      "\x80",                  // stray continuation
+      "\xBF",                  // stray continuation
+      "\xC0\x80",              // overlong NUL
+      "\xC1\xBF",              // overlong 2-byte
+      "\xE0\x80\x80",          // overlong 3-byte
+      "\xE0\x9F\xBF",          // overlong 3-byte
+      "\xED\xA0\x80",          // surrogate D800
+      "\xED\xBF\xBF",          // surrogate DFFF
+      "\xF0\x80\x80\x80",      // overlong 4-byte
+      "\xF0\x8F\xBF\xBF",      // overlong 4-byte
+      "\xF4\x90\x80\x80",      // > U+10FFFF
+      "\xF5\x80\x80\x80",      // invalid lead
+      "\xFF",                  // invalid byte
+      "\xC3",                  // truncated 2-byte
+      "\xE4\xBD",              // truncated 3-byte
+      "\xF0\x9F\x98",          // truncated 4-byte
+      "\xC3\xC3\xA9",          // lead in continuation position
+      "\xE4\xBD\xA0\xA0",      // too many continuations
+      "\xF0\x9F\x98\x80\x80",  // too many continuations
+  };
+  for (auto& [name, fn] : utf8_validators()) {
+    SCOPED_TRACE(name);
+    for (const auto& b : bad) {
+      for (size_t off = 0; off < 140; ++off) {
+        std::string s(off, 'x');
+        s += b;
+        s += std::string(off % 7, 'y');
+        ASSERT_FALSE(fn(s.data(), s.size()))
+            << "offset " << off << " sequence size " << b.size();
+        ASSERT_FALSE(scalar_is_utf8(s));
+      }
+    }
+  }
+}
+
+TEST(SimdValidateUTF8, ValidBoundarySequencesAtEveryOffset) {
+  const std::vector<std::string> good = {
+      "\xC2\x80",          "\xDF\xBF",          "\xE0\xA0\x80",
+      "\xED\x9F\xBF",      "\xEE\x80\x80",      "\xEF\xBF\xBF",
+      "\xF0\x90\x80\x80",  "\xF4\x8F\xBF\xBF",  "\xEF\xBB\xBF",
+  };
+  for (auto& [name, fn] : utf8_validators()) {
+    SCOPED_TRACE(name);
+    for (const auto& g : good) {
+      for (size_t off = 0; off < 140; ++off) {
+        std::string s(off, 'x');
+        s += g;
+        ASSERT_TRUE(fn(s.data(), s.size())) << "offset " << off;
+      }
+    }
+  }
+}
+
+TEST(SimdValidateUTF8, FirstErrorAtEveryOffset) {
+  struct bad_sequence {
+    const char* bytes;
+    size_t error_at;
+    utfx::utf_error error;
+  };
+  using utfx::utf_error;
+  const bad_sequence bad[] = {
+      {"\x80", 0, utf_error::stray_continuation},
+      {"\xC0\x80", 0, utf_error::overlong},
+      {"\xE0\x9F\xBF", 0, utf_error::overlong},
+      {"\xED\xA0\x80", 0, utf_error::surrogate},
+      {"\xF0\x8F\xBF\xBF", 0, utf_error::overlong},
+      {"\xF4\x90\x80\x80", 0, utf_error::out_of_range},
+      {"\xF5\x80\x80\x80", 0, utf_error::out_of_range},
+      {"\xFF", 0, utf_error::out_of_range},
+      {"\xC3", 0, utf_error::truncated},
+      {"\xE4\xBD", 0, utf_error::truncated},
+      {"\xF0\x9F\x98", 0, utf_error::truncated},
+      {"\xC3\xC3\xA9", 0, utf_error::truncated},
+      {"\xE4\xBD\xA0\xA0", 3, utf_error::stray_continuation},
+      {"\xF0\x9F\x98\x80\x80", 4, utf_error::stray_continuation},
+  };
+  for (auto& [name, fn] : utf8_locators()) {
+    SCOPED_TRACE(name);
+    for (const auto& b : bad) {
+      for (size_t off = 0; off < 140; ++off) {
+        // Valid multi-byte text before the error, so the kernels do not
+        // take their ASCII shortcut, and a second error after it.
+        std::string s;
+        while (s.size() + 2 <= off) {
+          s += "\xC3\xA9";
+        }
+        s.resize(off, 'x');
+        s += b.bytes;
+        s += std::string(off % 7, 'y');
+        s += "\xFF";
+        const utfx::validation_result r = fn(s.data(), s.size());
+        ASSERT_FALSE(r.valid) << "offset " << off;
+        ASSERT_EQ(r.offset, off + b.error_at) << "offset " << off;
+        ASSERT_EQ(r.error, b.error) << "offset " << off;
+      }
+    }
+  }
+}
+
+TEST(SimdValidateUTF8, RandomCorruptionFirstErrorMatchesScalar) {
+  std::mt19937 rng(8);
+  std::uniform_int_distribution<int> byte(0, 255);
+  const auto locators = utf8_locators();
+  for (int iter = 0; iter < 3000; ++iter) {
+    std::string s = random_utf8(rng, 10 + iter % 200, iter % 100);
+    std::uniform_int_distribution<size_t> pos(0, s.size() - 1);
+    for (int k = 0; k <= iter % 3; ++k) {
+      s[pos(rng)] = static_cast<char>(byte(rng));
+    }
+    const utfx::validation_result expected = locators[0].second(
+        s.data(), s.size());
+    ASSERT_EQ(expected.valid, scalar_is_utf8(s));
+    for (auto& [name, fn] : locators) {
+      const utfx::validation_result r = fn(s.data(), s.size());
+      ASSERT_EQ(r.valid, expected.valid) << name << " iter " << iter;
+      ASSERT_EQ(r.offset, expected.offset) << name << " iter " << iter;
+      ASSERT_EQ(r.error, expected.error) << name << " iter " << iter;
+    }
+  }
+}
+
+// ============================================================================
+// UTF-16 validation kernels agree with the scalar reference
+// ============================================================================
+
+TEST(SimdValidateUTF16, RandomValidBothEndians) {
+  std::mt19937 rng(21);
+  for (auto& [name, fn] : utf16_validators()) {
+    SCOPED_TRACE(name);
+    for (size_t n = 0; n < 300; ++n) {
+      const std::u16string s = random_utf16(rng, n, static_cast<int>(n % 50));
+      const std::u16string t = swapped(s);
+      const utfx::endian other = utfx::endian::native == utfx::endian::little
+                                     ? utfx::endian::big
+                                     : utfx::endian::little;
+      auto r = fn(s.data(), s.size(), utfx::endian::native);
+      ASSERT_TRUE(r.valid) << "length " << s.size();
+      ASSERT_EQ(r.offset, s.size());
+      r = fn(t.data(), t.size(), other);
+      ASSERT_TRUE(r.valid) << "swapped, length " << t.size();
+    }
+  }
+}
+
+TEST(SimdValidateUTF16, BadSurrogatesAtEveryOffset) {
+  using utfx::utf_error;
+  struct bad_units {
+    std::u16string units;
+    bool at_end;
+    utf_error error;
+  };
+  const bad_units bad[] = {
+      {u"\xDC00", false, utf_error::surrogate},        // lone low
+      {u"\xDBFFx", false, utf_error::surrogate},       // high, no low
+      {u"\xD800\xD800", false, utf_error::surrogate},  // high, high
+      {u"\xDFFF\xD800", false, utf_error::surrogate},  // reversed pair
+      {u"\xD800", true, utf_error::truncated},         // high at the end
+  };
+  const utfx::endian other = utfx::endian::native == utfx::endian::little
+                                 ? utfx::endian::big
+                                 : utfx::endian::little;
+  for (auto& [name, fn] : utf16_validators()) {
+    SCOPED_TRACE(name);
+    for (const auto& b : bad) {
+      for (size_t off = 0; off < 140; ++off) {
+        // Valid pairs before the error straddle every block boundary.
+        std::u16string s;
+        while (s.size() + 2 <= off) {
+          s += u"\xD83D\xDE00";
+        }
+        s.resize(off, u'x');
+        s += b.units;
+        if (!b.at_end) {
+          s += std::u16string(off % 7, u'y');
+          s += u"\xDC00";
+        }
+        auto r = fn(s.data(), s.size(), utfx::endian::native);
+        ASSERT_FALSE(r.valid) << "offset " << off;
+        ASSERT_EQ(r.offset, off) << "offset " << off;
+        ASSERT_EQ(r.error, b.error) << "offset " << off;
+        const std::u16string t = swapped(s);
+        r = fn(t.data(), t.size(), other);
+        ASSERT_EQ(r.offset, off) << "swapped, offset " << off;
+        ASSERT_EQ(r.error, b.error) << "swapped, offset " << off;
+      }
+    }
+  }
+}
+
+TEST(SimdValidateUTF16, RandomCorruptionMatchesScalar) {
+  std::mt19937 rng(22);
+  std::uniform_int_distribution<int> unit(0xD700, 0xE0FF);
+  const auto validators = utf16_validators();
+  for (int iter = 0; iter < 3000; ++iter) {
+    std::u16string s = random_utf16(rng, 10 + iter % 200, iter % 100);
+    std::uniform_int_distribution<size_t> pos(0, s.size() - 1);
+    for (int k = 0; k <= iter % 3; ++k) {
+      s[pos(rng)] = static_cast<char16_t>(unit(rng));
+    }
+    for (bool swap : {false, true}) {
+      const std::u16string in = swap ? swapped(s) : s;
+      const utfx::endian in_endian = !swap ? utfx::endian::native
+                                     : utfx::endian::native == utfx::endian::big
+                                         ? utfx::endian::little
+                                         : utfx::endian::big;
+      const auto expected = validators[0].second(in.data(), in.size(),
+                                                 in_endian);
+      for (auto& [name, fn] : validators) {
+        const auto r = fn(in.data(), in.size(), in_endian);
+        ASSERT_EQ(r.valid, expected.valid) << name << " iter " << iter;
+        ASSERT_EQ(r.offset, expected.offset) << name << " iter " << iter;
+        ASSERT_EQ(r.error, expected.error) << name << " iter " << iter;
+      }
+    }
+  }
+}
+
+// ============================================================================
+// UTF-32 validation kernels agree with the scalar reference
+// ============================================================================
+
+TEST(SimdValidateUTF32, BadValuesAtEveryOffset) {
+  using utfx::utf_error;
+  const std::pair<char32_t, utf_error> bad[] = {
+      {0xD800, utf_error::surrogate},
+      {0xDFFF, utf_error::surrogate},
+      {0x110000, utf_error::out_of_range},
+      {0x7FFFFFFF, utf_error::out_of_range},
+      {0x80000000, utf_error::out_of_range},
+      {0xFFFFFFFF, utf_error::out_of_range},
+  };
+  for (auto& [name, fn] : utf32_validators()) {
+    SCOPED_TRACE(name);
+    for (const auto& [value, error] : bad) {
+      for (size_t off = 0; off < 140; ++off) {
+        std::u32string s;
+        for (size_t i = 0; i < off; ++i) {
+          s += static_cast<char32_t>(i % 3 == 0 ? 0x10FFFF : 0xD7FF - i % 2);
+        }
+        s += value;
+        s += std::u32string(off % 7, U'y');
+        s += char32_t(0x110000);
+        auto r = fn(s.data(), s.size(), utfx::endian::native);
+        ASSERT_FALSE(r.valid) << "offset " << off;
+        ASSERT_EQ(r.offset, off) << "offset " << off;
+        ASSERT_EQ(r.error, error) << "offset " << off;
+        const std::u32string t = swapped(s);
+        r = fn(t.data(), t.size(), non_native());
+        ASSERT_EQ(r.offset, off) << "swapped, offset " << off;
+        ASSERT_EQ(r.error, error) << "swapped, offset " << off;
+      }
+    }
+  }
+}
+
+TEST(SimdValidateUTF32, ValidEveryLength) {
+  for (auto& [name, fn] : utf32_validators()) {
+    SCOPED_TRACE(name);
+    std::u32string s;
+    for (size_t n = 0; n < 200; ++n) {
+      const std::u32string t = swapped(s);
+      auto r = fn(s.data(), s.size(), utfx::endian::native);
+      ASSERT_TRUE(r.valid) << "length " << n;
+      ASSERT_EQ(r.offset, n);
+      ASSERT_TRUE(fn(t.data(), t.size(), non_native()).valid)
+          << "swapped, length " << n;
+      s += static_cast<char32_t>(n % 2 ? 0xE000 + n : 0x10FFFF - n);
+    }
+  }
+}
+
+// ============================================================================
+// transcoding kernels produce exactly what the scalar loop produces
+// ============================================================================
+
+TEST(SimdTranscode, UTF8ToUTF16_RandomValid) {
+  std::mt19937 rng(11);
+  for (auto e : {utfx::endian::little, utfx::endian::big}) {
+    for (size_t n = 0; n < 400; n += 3) {
+      std::string in = random_utf8(rng, n, static_cast<int>(n % 100));
+      auto expected = scalar_transcode<char16_t>(in, e);
+      ASSERT_EQ(pointer_transcode<char16_t>(in, expected.size(), e), expected)
+          << "length " << in.size();
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF8ToUTF16_RandomCorruption) {
+  std::mt19937 rng(12);
+  std::uniform_int_distribution<int> byte(0, 255);
+  for (int iter = 0; iter < 2000; ++iter) {
+    std::string in = random_utf8(rng, 20 + iter % 200, iter % 100);
+    std::uniform_int_distribution<size_t> pos(0, in.size() - 1);
+    for (int k = 0; k <= iter % 3; ++k) {
+      in[pos(rng)] = static_cast<char>(byte(rng));
+    }
+    auto expected = scalar_transcode<char16_t>(in, utfx::endian::native);
+    ASSERT_EQ(pointer_transcode<char16_t>(in, expected.size(),
+                                          utfx::endian::native),
+              expected)
+        << "iter " << iter;
+  }
+}
+
+TEST(SimdTranscode, UTF8ASCIIRuns_AllOverloads) {
+  // Mostly-ASCII input exercises the word-at-a-time ASCII path of the
+  // scalar loop, which the length-only overload always uses.
+  std::mt19937 rng(15);
+  std::uniform_int_distribution<int> byte(0, 255);
+  for (auto e : {utfx::endian::little, utfx::endian::big}) {
+    for (int iter = 0; iter < 500; ++iter) {
+      std::string in = random_utf8(rng, iter, 90 + iter % 10);
+      auto expected = scalar_transcode<char16_t>(in, e);
+      const char* b = in.data();
+      const char* end = in.data() + in.size();
+      ASSERT_EQ(utfx::transcode<char16_t>(b, end, e), expected);
+      ASSERT_EQ(utfx::transcode(b, end, static_cast<char16_t*>(nullptr), e),
+                expected.size());
+      ASSERT_EQ(utfx::transcode<char32_t>(b, end, e),
+                scalar_transcode<char32_t>(in, e));
+      if (!in.empty()) {
+        std::uniform_int_distribution<size_t> pos(0, in.size() - 1);
+        in[pos(rng)] = static_cast<char>(byte(rng));
+        ASSERT_EQ(utfx::transcode<char16_t>(in.data(), in.data() + in.size(),
+                                            e),
+                  scalar_transcode<char16_t>(in, e))
+            << "iter " << iter;
+      }
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF16ToUTF8_RandomValid) {
+  std::mt19937 rng(13);
+  for (auto e : {utfx::endian::little, utfx::endian::big}) {
+    for (size_t n = 0; n < 400; n += 3) {
+      std::u16string in = random_utf16(rng, n, static_cast<int>(n % 100));
+      if (e != utfx::endian::native) {
+        in = swapped(in);
+      }
+      auto expected = scalar_transcode<char>(in, e);
+      ASSERT_EQ(pointer_transcode<char>(in, expected.size(), e), expected)
+          << "length " << in.size();
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF16ToUTF8_RandomCorruption) {
+  std::mt19937 rng(14);
+  std::uniform_int_distribution<int> unit(0xD7F0, 0xE010);
+  for (int iter = 0; iter < 2000; ++iter) {
+    std::u16string in = random_utf16(rng, 20 + iter % 200, iter % 100);
+    std::uniform_int_distribution<size_t> pos(0, in.size() - 1);
+    for (int k = 0; k <= iter % 3; ++k) {
+      in[pos(rng)] = static_cast<char16_t>(unit(rng));
+    }
+    auto expected = scalar_transcode<char>(in, utfx::endian::native);
+    ASSERT_EQ(pointer_transcode<char>(in, expected.size(),
+                                      utfx::endian::native),
+              expected)
+        << "iter " << iter;
+  }
+}
+
+TEST(SimdTranscode, SurrogatePairsAcrossBlockBoundaries) {
+  for (size_t off = 0; off < 80; ++off) {
+    std::u16string in(off, u'a');
+    in += u"\U0001F600\u00E9\U0001F525";
+    in += std::u16string(off % 5, u'\u4F60');
+    auto expected = scalar_transcode<char>(in, utfx::endian::native);
+    ASSERT_EQ(pointer_transcode<char>(in, expected.size(),
+                                      utfx::endian::native),
+              expected)
+        << "offset " << off;
+    // A high surrogate cut off by the end of the input is dropped.
+    std::u16string cut = in.substr(0, off + 1);
+    expected = scalar_transcode<char>(cut, utfx::endian::native);
+    ASSERT_EQ(pointer_transcode<char>(cut, expected.size(),
+                                      utfx::endian::native),
+              expected);
+  }
+}
+
+#if defined(UTFX_SIMD_X86_64)
+template <typename In, typename Out>
+using kernel_fn = simd::kernel_result (*)(const In*, size_t, Out*, bool);
+
+// Kernels between UTF-16 and UTF-32 take both byte orders.
+template <typename In, typename Out>
+using swap_kernel_fn = simd::kernel_result (*)(const In*, size_t, Out*, bool,
+                                               bool);
+
+// Every kernel for one direction that the running CPU can execute.
+template <typename Fn>
+std::vector<std::pair<const char*, Fn>> kernels(Fn sse42, Fn avx2,
+                                                Fn avx512) {
+  std::vector<std::pair<const char*, Fn>> v;
+  if (simd::cpu_supports(simd::isa::sse42)) {
+    v.emplace_back("sse42", sse42);
+  }
+  if (simd::cpu_supports(simd::isa::avx2)) {
+    v.emplace_back("avx2", avx2);
+  }
+  if (avx512 != nullptr && simd::cpu_supports(simd::isa::avx512)) {
+    v.emplace_back("avx512", avx512);
+  }
+  return v;
+}
+
+std::vector<std::pair<const char*, kernel_fn<char, char16_t>>>
+utf8_to_utf16_kernels() {
+  return kernels<kernel_fn<char, char16_t>>(&simd::utf8_to_utf16_sse42,
+                                 &simd::utf8_to_utf16_avx2,
+                                 &simd::utf8_to_utf16_avx512);
+}
+
+std::vector<std::pair<const char*, kernel_fn<char16_t, char>>>
+utf16_to_utf8_kernels() {
+  return kernels<kernel_fn<char16_t, char>>(&simd::utf16_to_utf8_sse42,
+                                 &simd::utf16_to_utf8_avx2,
+                                 &simd::utf16_to_utf8_avx512);
+}
+
+std::vector<std::pair<const char*, kernel_fn<char, char32_t>>>
+utf8_to_utf32_kernels() {
+  return kernels<kernel_fn<char, char32_t>>(&simd::utf8_to_utf32_sse42,
+                                 &simd::utf8_to_utf32_avx2, nullptr);
+}
+
+std::vector<std::pair<const char*, kernel_fn<char32_t, char>>>
+utf32_to_utf8_kernels() {
+  return kernels<kernel_fn<char32_t, char>>(&simd::utf32_to_utf8_sse42,
+                                 &simd::utf32_to_utf8_avx2, nullptr);
+}
+
+std::vector<std::pair<const char*, swap_kernel_fn<char16_t, char32_t>>>
+utf16_to_utf32_kernels() {
+  return kernels<swap_kernel_fn<char16_t, char32_t>>(
+      &simd::utf16_to_utf32_sse42, &simd::utf16_to_utf32_avx2, nullptr);
+}
+
+std::vector<std::pair<const char*, swap_kernel_fn<char32_t, char16_t>>>
+utf32_to_utf16_kernels() {
+  return kernels<swap_kernel_fn<char32_t, char16_t>>(
+      &simd::utf32_to_utf16_sse42, &simd::utf32_to_utf16_avx2, nullptr);
+}
+
+// Runs a kernel alone and checks that it stopped where the scalar loop can
+// take over, wrote what the scalar loop writes for the part it read, and
+// nothing past that.  run(in, len, out) calls the kernel.
+template <typename In, typename Out, typename Run>
+void check_kernel_run(const char* name, Run run,
+                      const std::basic_string<In>& in, utfx::endian from,
+                      utfx::endian to) {
+  const Out canary = static_cast<Out>(0x5A);
+  std::vector<Out> buf(in.size() * 4 + 64, canary);
+  simd::kernel_result r = run(in.data(), in.size(), buf.data());
+  ASSERT_LE(r.read, in.size()) << name;
+  const std::basic_string<Out> head(buf.data(), r.written);
+  EXPECT_EQ(head, scalar_transcode<Out>(in.substr(0, r.read), from, to))
+      << name << ", length " << in.size();
+  EXPECT_EQ(head + scalar_transcode<Out>(in.substr(r.read), from, to),
+            scalar_transcode<Out>(in, from, to))
+      << name << " stopped inside a sequence at " << r.read;
+  EXPECT_TRUE(std::all_of(buf.begin() + static_cast<ptrdiff_t>(r.written),
+                          buf.end(), [&](Out c) { return c == canary; }))
+      << name << " wrote past its output";
+}
+
+template <typename In, typename Out>
+void check_kernel(const char* name, kernel_fn<In, Out> kernel,
+                  const std::basic_string<In>& in, utfx::endian e) {
+  const bool swap = e != utfx::endian::native;
+  check_kernel_run<In, Out>(
+      name,
+      [&](const In* p, size_t n, Out* o) { return kernel(p, n, o, swap); },
+      in, e, e);
+}
+
+TEST(SimdTranscode, UTF8ToUTF16Kernels_RandomValid) {
+  std::mt19937 rng(16);
+  for (const auto& k : utf8_to_utf16_kernels()) {
+    for (auto e : {utfx::endian::little, utfx::endian::big}) {
+      for (size_t n = 0; n < 300; n += 7) {
+        for (int ascii : {0, 50, 95, 100}) {
+          std::string in = random_utf8(rng, n, ascii);
+          check_kernel(k.first, k.second, in, e);
+        }
+      }
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF8ToUTF16Kernels_NoFourByteSequences) {
+  // Text without supplementary characters should go through the kernels
+  // in one call.
+  std::mt19937 rng(17);
+  std::uniform_int_distribution<uint32_t> bmp(0, 0xFFFF);
+  for (const auto& k : utf8_to_utf16_kernels()) {
+    for (size_t n = 0; n < 200; ++n) {
+      std::string in;
+      while (in.size() < n) {
+        uint32_t c = bmp(rng) >> (n % 3 * 4);
+        if (0xD800 <= c && c <= 0xDFFF) {
+          continue;
+        }
+        utf_traits<char>::encode(c, std::back_inserter(in));
+      }
+      check_kernel(k.first, k.second, in, utfx::endian::native);
+      simd::kernel_result r(
+          k.second(in.data(), in.size(),
+                   std::vector<char16_t>(in.size()).data(), false));
+      EXPECT_EQ(r.read, in.size()) << k.first;
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF8ToUTF16Kernels_RandomCorruption) {
+  std::mt19937 rng(18);
+  std::uniform_int_distribution<int> byte(0, 255);
+  for (const auto& k : utf8_to_utf16_kernels()) {
+    for (int iter = 0; iter < 1000; ++iter) {
+      std::string in = random_utf8(rng, 20 + iter % 200, iter % 100);
+      std::uniform_int_distribution<size_t> pos(0, in.size() - 1);
+      for (int j = 0; j <= iter % 3; ++j) {
+        in[pos(rng)] = static_cast<char>(byte(rng));
+      }
+      check_kernel(k.first, k.second, in,
+                                 iter % 2 ? utfx::endian::big
+                                          : utfx::endian::little);
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF16ToUTF8Kernels_RandomValid) {
+  std::mt19937 rng(19);
+  for (const auto& k : utf16_to_utf8_kernels()) {
+    for (auto e : {utfx::endian::little, utfx::endian::big}) {
+      for (size_t n = 0; n < 300; n += 7) {
+        for (int ascii : {0, 50, 95, 100}) {
+          std::u16string in = random_utf16(rng, n, ascii);
+          if (e != utfx::endian::native) {
+            in = swapped(in);
+          }
+          check_kernel(k.first, k.second, in, e);
+        }
+      }
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF16ToUTF8Kernels_BelowU0800) {
+  // Text made only of 1- and 2-byte code points takes the 16-bit lane path.
+  std::mt19937 rng(22);
+  std::uniform_int_distribution<int> unit(0, 0x7FF);
+  for (const auto& k : utf16_to_utf8_kernels()) {
+    for (size_t n = 0; n < 300; n += 5) {
+      std::u16string in;
+      for (size_t j = 0; j < n; ++j) {
+        in += static_cast<char16_t>(unit(rng) >> (j % 5));
+      }
+      check_kernel(k.first, k.second, in, utfx::endian::native);
+      check_kernel(k.first, k.second, swapped(in), non_native());
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF16ToUTF8Kernels_RandomCorruption) {
+  std::mt19937 rng(20);
+  std::uniform_int_distribution<int> unit(0xD7F0, 0xE010);
+  for (const auto& k : utf16_to_utf8_kernels()) {
+    for (int iter = 0; iter < 1000; ++iter) {
+      std::u16string in = random_utf16(rng, 20 + iter % 200, iter % 100);
+      std::uniform_int_distribution<size_t> pos(0, in.size() - 1);
+      for (int j = 0; j <= iter % 3; ++j) {
+        in[pos(rng)] = static_cast<char16_t>(unit(rng));
+      }
+      check_kernel(k.first, k.second, in, utfx::endian::native);
+      check_kernel(k.first, k.second, swapped(in), non_native());
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF16ToUTF8Kernels_CoverValidInput) {
+  // Valid text is converted in one call up to the last, partly validated
+  // block and step.
+  std::mt19937 rng(21);
+  for (const auto& k : utf16_to_utf8_kernels()) {
+    for (size_t n = 64; n < 600; n += 37) {
+      std::u16string in = random_utf16(rng, n, static_cast<int>(n % 100));
+      std::string out(in.size() * 3, '\0');
+      simd::kernel_result r = k.second(in.data(), in.size(), &out[0], false);
+      EXPECT_GE(r.read + 96, in.size()) << k.first;
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF8ToUTF32Kernels_RandomValid) {
+  std::mt19937 rng(23);
+  for (const auto& k : utf8_to_utf32_kernels()) {
+    for (auto e : {utfx::endian::little, utfx::endian::big}) {
+      for (size_t n = 0; n < 300; n += 7) {
+        for (int ascii : {0, 50, 95, 100}) {
+          std::string in = random_utf8(rng, n, ascii);
+          check_kernel(k.first, k.second, in, e);
+        }
+      }
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF8ToUTF32Kernels_RandomCorruption) {
+  std::mt19937 rng(24);
+  std::uniform_int_distribution<int> byte(0, 255);
+  for (const auto& k : utf8_to_utf32_kernels()) {
+    for (int iter = 0; iter < 1000; ++iter) {
+      std::string in = random_utf8(rng, 20 + iter % 200, iter % 100);
+      std::uniform_int_distribution<size_t> pos(0, in.size() - 1);
+      for (int j = 0; j <= iter % 3; ++j) {
+        in[pos(rng)] = static_cast<char>(byte(rng));
+      }
+      check_kernel(k.first, k.second, in,
+                   iter % 2 ? utfx::endian::big : utfx::endian::little);
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF32ToUTF8Kernels_RandomValid) {
+  std::mt19937 rng(25);
+  for (const auto& k : utf32_to_utf8_kernels()) {
+    for (auto e : {utfx::endian::little, utfx::endian::big}) {
+      for (size_t n = 0; n < 300; n += 7) {
+        for (int ascii : {0, 50, 95, 100}) {
+          std::u32string in = random_utf32(rng, n, ascii);
+          if (e != utfx::endian::native) {
+            in = swapped(in);
+          }
+          check_kernel(k.first, k.second, in, e);
+        }
+      }
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF32ToUTF8Kernels_BMPOnly) {
+  // Without supplementary characters every step stays in the vector path.
+  std::mt19937 rng(26);
+  std::uniform_int_distribution<uint32_t> bmp(0, 0xFFFF);
+  for (const auto& k : utf32_to_utf8_kernels()) {
+    for (size_t n = 0; n < 300; n += 5) {
+      std::u32string in;
+      while (in.size() < n) {
+        uint32_t c = bmp(rng) >> (n % 3 * 4);
+        if (c < 0xD800 || c > 0xDFFF) {
+          in += static_cast<char32_t>(c);
+        }
+      }
+      check_kernel(k.first, k.second, in, utfx::endian::native);
+      check_kernel(k.first, k.second, swapped(in), non_native());
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF32ToUTF8Kernels_RandomCorruption) {
+  std::mt19937 rng(27);
+  std::uniform_int_distribution<uint32_t> bad(0, 3);
+  for (const auto& k : utf32_to_utf8_kernels()) {
+    for (int iter = 0; iter < 1000; ++iter) {
+      std::u32string in = random_utf32(rng, 20 + iter % 200, iter % 100);
+      std::uniform_int_distribution<size_t> pos(0, in.size() - 1);
+      for (int j = 0; j <= iter % 3; ++j) {
+        const char32_t values[] = {0xD800, 0xDFFF, 0x110000, 0xFFFFFFFF};
+        in[pos(rng)] = values[bad(rng)];
+      }
+      check_kernel(k.first, k.second, in, utfx::endian::native);
+      check_kernel(k.first, k.second, swapped(in), non_native());
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF32ToUTF8_RandomValid) {
+  std::mt19937 rng(28);
+  for (auto e : {utfx::endian::little, utfx::endian::big}) {
+    for (size_t n = 0; n < 400; n += 3) {
+      std::u32string in = random_utf32(rng, n, static_cast<int>(n % 100));
+      if (e != utfx::endian::native) {
+        in = swapped(in);
+      }
+      auto expected = scalar_transcode<char>(in, e);
+      ASSERT_EQ(pointer_transcode<char>(in, expected.size(), e), expected)
+          << "length " << in.size();
+      auto back = scalar_transcode<char32_t>(expected, e);
+      ASSERT_EQ(pointer_transcode<char32_t>(expected, back.size(), e), back);
+    }
+  }
+}
+
+// Runs a UTF-16 <-> UTF-32 kernel in every combination of byte orders.
+template <typename In, typename Out>
+void check_swap_kernel(const char* name, swap_kernel_fn<In, Out> kernel,
+                       const std::basic_string<In>& native_in) {
+  for (auto from : {utfx::endian::little, utfx::endian::big}) {
+    for (auto to : {utfx::endian::little, utfx::endian::big}) {
+      const bool swap_in = from != utfx::endian::native;
+      const bool swap_out = to != utfx::endian::native;
+      check_kernel_run<In, Out>(
+          name,
+          [&](const In* p, size_t n, Out* o) {
+            return kernel(p, n, o, swap_in, swap_out);
+          },
+          swap_in ? swapped(native_in) : native_in, from, to);
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF16ToUTF32Kernels_RandomValid) {
+  std::mt19937 rng(29);
+  for (const auto& k : utf16_to_utf32_kernels()) {
+    for (size_t n = 0; n < 300; n += 7) {
+      for (int ascii : {0, 50, 95, 100}) {
+        check_swap_kernel(k.first, k.second, random_utf16(rng, n, ascii));
+      }
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF16ToUTF32Kernels_RandomCorruption) {
+  std::mt19937 rng(30);
+  std::uniform_int_distribution<int> unit(0xD7F0, 0xE010);
+  for (const auto& k : utf16_to_utf32_kernels()) {
+    for (int iter = 0; iter < 500; ++iter) {
+      std::u16string in = random_utf16(rng, 20 + iter % 200, iter % 100);
+      std::uniform_int_distribution<size_t> pos(0, in.size() - 1);
+      for (int j = 0; j <= iter % 3; ++j) {
+        in[pos(rng)] = static_cast<char16_t>(unit(rng));
+      }
+      check_swap_kernel(k.first, k.second, in);
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF32ToUTF16Kernels_RandomValid) {
+  std::mt19937 rng(31);
+  for (const auto& k : utf32_to_utf16_kernels()) {
+    for (size_t n = 0; n < 300; n += 7) {
+      for (int ascii : {0, 50, 95, 100}) {
+        check_swap_kernel(k.first, k.second, random_utf32(rng, n, ascii));
+      }
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF32ToUTF16Kernels_RandomCorruption) {
+  std::mt19937 rng(32);
+  std::uniform_int_distribution<uint32_t> bad(0, 3);
+  for (const auto& k : utf32_to_utf16_kernels()) {
+    for (int iter = 0; iter < 500; ++iter) {
+      std::u32string in = random_utf32(rng, 20 + iter % 200, iter % 100);
+      std::uniform_int_distribution<size_t> pos(0, in.size() - 1);
+      for (int j = 0; j <= iter % 3; ++j) {
+        const char32_t values[] = {0xD800, 0xDFFF, 0x110000, 0xFFFFFFFF};
+        in[pos(rng)] = values[bad(rng)];
+      }
+      check_swap_kernel(k.first, k.second, in);
+    }
+  }
+}
+
+TEST(SimdTranscode, UTF16UTF32_FromToOverloads) {
+  std::mt19937 rng(33);
+  for (size_t n = 0; n < 300; n += 11) {
+    const std::u16string in16 = random_utf16(rng, n, static_cast<int>(n % 100));
+    for (auto from : {utfx::endian::little, utfx::endian::big}) {
+      for (auto to : {utfx::endian::little, utfx::endian::big}) {
+        const std::u16string src =
+            from == utfx::endian::native ? in16 : swapped(in16);
+        const std::u32string expected =
+            scalar_transcode<char32_t>(src, from, to);
+        std::vector<char32_t> buf(expected.size() + 16, U'\x5A');
+        ASSERT_EQ(utfx::transcode(src.data(), src.data() + src.size(),
+                                  buf.data(), from, to),
+                  expected.size());
+        EXPECT_EQ(std::u32string(buf.data(), expected.size()), expected);
+        EXPECT_EQ(buf[expected.size()], U'\x5A');
+        EXPECT_EQ(utfx::transcode<char32_t>(src.data(),
+                                            src.data() + src.size(), from, to),
+                  expected);
+        // And back from the UTF-32 just produced.
+        const std::u16string back =
+            scalar_transcode<char16_t>(expected, to, from);
+        EXPECT_EQ(back, src);
+        EXPECT_EQ(utfx::transcode<char16_t>(expected.data(),
+                                            expected.data() + expected.size(),
+                                            to, from),
+                  back);
+      }
+    }
+  }
+}
+
+// The kernels as the _valid transcoders run them, without validation, give
+// the same output on valid input.
+TEST(SimdTranscode, ValidKernels_RandomValid) {
+  std::mt19937 rng(34);
+  const auto utf8_to_utf16 = kernels<kernel_fn<char, char16_t>>(
+      &simd::utf8_to_units_sse42<char16_t, true>,
+      &simd::utf8_to_units_avx2<char16_t, true>, nullptr);
+  const auto utf8_to_utf32 = kernels<kernel_fn<char, char32_t>>(
+      &simd::utf8_to_units_sse42<char32_t, true>,
+      &simd::utf8_to_units_avx2<char32_t, true>, nullptr);
+  const auto utf16_to_utf8 = kernels<kernel_fn<char16_t, char>>(
+      &simd::utf16_to_utf8_sse42<true>, &simd::utf16_to_utf8_avx2<true>,
+      nullptr);
+  const auto utf32_to_utf8 = kernels<kernel_fn<char32_t, char>>(
+      &simd::utf32_to_utf8_sse42<true>, &simd::utf32_to_utf8_avx2<true>,
+      nullptr);
+  const auto utf16_to_utf32 = kernels<swap_kernel_fn<char16_t, char32_t>>(
+      &simd::utf16_to_utf32_sse42<true>, &simd::utf16_to_utf32_avx2<true>,
+      nullptr);
+  const auto utf32_to_utf16 = kernels<swap_kernel_fn<char32_t, char16_t>>(
+      &simd::utf32_to_utf16_sse42<true>, &simd::utf32_to_utf16_avx2<true>,
+      nullptr);
+  for (size_t n = 0; n < 1500; n += n < 100 ? 3 : 97) {
+    for (int ascii : {0, 50, 95, 100}) {
+      const std::string in8 = random_utf8(rng, n, ascii);
+      const std::u16string in16 = random_utf16(rng, n, ascii);
+      const std::u32string in32 = random_utf32(rng, n, ascii);
+      for (auto e : {utfx::endian::little, utfx::endian::big}) {
+        const bool swap = e != utfx::endian::native;
+        for (const auto& k : utf8_to_utf16) {
+          check_kernel(k.first, k.second, in8, e);
+        }
+        for (const auto& k : utf8_to_utf32) {
+          check_kernel(k.first, k.second, in8, e);
+        }
+        for (const auto& k : utf16_to_utf8) {
+          check_kernel(k.first, k.second, swap ? swapped(in16) : in16, e);
+        }
+        for (const auto& k : utf32_to_utf8) {
+          check_kernel(k.first, k.second, swap ? swapped(in32) : in32, e);
+        }
+      }
+      for (const auto& k : utf16_to_utf32) {
+        check_swap_kernel(k.first, k.second, in16);
+      }
+      for (const auto& k : utf32_to_utf16) {
+        check_swap_kernel(k.first, k.second, in32);
+      }
+    }
+  }
+}
+
+TEST(SimdTranscode, AVX512KernelsStopOnCodePointBoundaries) {
+  if (!simd::cpu_supports(simd::isa::avx512)) {
+    GTEST_SKIP() << "AVX-512 VBMI2 not available";
+  }
+  std::mt19937 rng(15);
+  std::string in = random_utf8(rng, 500);
+  in[300] = '\xFF';
+  std::u16string out(in.size(), u'\0');
+  simd::kernel_result r =
+      simd::utf8_to_utf16_avx512(in.data(), in.size(), &out[0], false);
+  EXPECT_LE(r.read, 300u);
+  EXPECT_FALSE(utf_traits<char>::is_trail(in[r.read]));
+  out.resize(r.written);
+  EXPECT_EQ(out, scalar_transcode<char16_t>(in.substr(0, r.read),
+                                            utfx::endian::native));
+
+  std::u16string in16 = random_utf16(rng, 500);
+  in16[200] = u'\xDC00';
+  std::string out8(in16.size() * 3, '\0');
+  r = simd::utf16_to_utf8_avx512(in16.data(), in16.size(), &out8[0], false);
+  EXPECT_LE(r.read, 200u);
+  out8.resize(r.written);
+  EXPECT_EQ(out8, scalar_transcode<char>(in16.substr(0, r.read),
+                                         utfx::endian::native));
+}
+#endif
+
+// ============================================================================
+// output lengths match what transcode writes
+// ============================================================================
+
+// Random input for each source encoding, in native byte order, with a few
+// units corrupted when |corrupt| is set.
+template <typename In>
+std::basic_string<In> random_input(std::mt19937& rng, size_t n, int ascii,
+                                   bool corrupt) {
+  std::basic_string<In> in;
+  if constexpr (sizeof(In) == 1) {
+    in = random_utf8(rng, n, ascii);
+  } else if constexpr (sizeof(In) == 2) {
+    in = random_utf16(rng, n, ascii);
+  } else {
+    in = random_utf32(rng, n, ascii);
+  }
+  if (corrupt && !in.empty()) {
+    std::uniform_int_distribution<size_t> pos(0, in.size() - 1);
+    std::uniform_int_distribution<uint32_t> bad(0, 3);
+    const uint32_t values[] = {0x80, 0xF4, 0xD800, 0xDFFF};
+    for (int k = 0; k < 3; ++k) {
+      in[pos(rng)] = static_cast<In>(values[bad(rng)]);
+    }
+  }
+  return in;
+}
+
+template <typename Out, typename In>
+void check_output_lengths(
+    size_t (*length)(const In*, size_t, utfx::endian)) {
+  std::mt19937 rng(40 + sizeof(In) * 4 + sizeof(Out));
+  for (auto e : {utfx::endian::little, utfx::endian::big}) {
+    for (size_t n = 0; n < 700; n += 13) {
+      for (int ascii : {0, 50, 100}) {
+        for (bool corrupt : {false, true}) {
+          std::basic_string<In> in = random_input<In>(rng, n, ascii, corrupt);
+          if constexpr (sizeof(In) != 1) {
+            if (e != utfx::endian::native) {
+              in = swapped(in);
+            }
+          }
+          ASSERT_EQ(length(in.data(), in.size(), e),
+                    scalar_transcode<Out>(in, e).size())
+              << "length " << in.size() << (corrupt ? ", corrupted" : "");
+        }
+      }
+    }
+  }
+}
+
+TEST(SimdOutputLength, FromUTF8) {
+  check_output_lengths<char16_t, char>(
+      [](const char* p, size_t n, utfx::endian) {
+        return utfx::utf16_length_from_utf8(p, n);
+      });
+  check_output_lengths<char32_t, char>(
+      [](const char* p, size_t n, utfx::endian) {
+        return utfx::utf32_length_from_utf8(p, n);
+      });
+}
+
+TEST(SimdOutputLength, FromUTF16) {
+  check_output_lengths<char, char16_t>(&utfx::utf8_length_from_utf16);
+  check_output_lengths<char32_t, char16_t>(&utfx::utf32_length_from_utf16);
+}
+
+TEST(SimdOutputLength, FromUTF32) {
+  check_output_lengths<char, char32_t>(&utfx::utf8_length_from_utf32);
+  check_output_lengths<char16_t, char32_t>(&utfx::utf16_length_from_utf32);
+}
+
+TEST(SimdOutputLength, StringTranscodersAllocateExactly) {
+  std::mt19937 rng(47);
+  for (size_t n = 0; n < 300; n += 17) {
+    const std::string in = random_utf8(rng, n, 90);
+    const std::u16string out = utfx::transcode<char16_t>(
+        in.data(), in.data() + in.size(), utfx::endian::native);
+    EXPECT_EQ(out.size(), utfx::utf16_length_from_utf8(in.data(), in.size()));
+    EXPECT_EQ(utfx::transcode(in.data(), in.data() + in.size(),
+                              static_cast<char16_t*>(nullptr),
+                              utfx::endian::native),
+              out.size());
+    const std::string back = utfx::transcode<char>(
+        out.data(), out.data() + out.size(), utfx::endian::native);
+    EXPECT_EQ(back, in);
+    const std::u32string wide = utfx::transcode<char32_t>(
+        out.data(), out.data() + out.size(), utfx::endian::native,
+        utfx::endian::native);
+    EXPECT_EQ(utfx::transcode(out.data(), out.data() + out.size(),
+                              static_cast<char32_t*>(nullptr),
+                              utfx::endian::native, utfx::endian::native),
+              wide.size());
+  }
+}
+
+// Feeds in to the bounded transcode in pieces of at most capacity units
+// and checks that the pieces add up to the unbounded result.
+template <typename Out, typename In>
+void check_bounded(const std::basic_string<In>& in, size_t capacity,
+                   utfx::endian from, utfx::endian to) {
+  std::basic_string<Out> expected;
+  if constexpr (sizeof(In) == 1 || sizeof(Out) == 1) {
+    expected = utfx::transcode<Out>(in.data(), in.data() + in.size(), to);
+  } else {
+    expected =
+        utfx::transcode<Out>(in.data(), in.data() + in.size(), from, to);
+  }
+  std::basic_string<Out> joined;
+  std::vector<Out> buf(capacity);
+  size_t pos = 0;
+  for (;;) {
+    utfx::transcode_result r;
+    if constexpr (sizeof(In) == 1 || sizeof(Out) == 1) {
+      r = utfx::transcode(in.data() + pos, in.data() + in.size(), buf.data(),
+                          capacity, to);
+    } else {
+      r = utfx::transcode(in.data() + pos, in.data() + in.size(), buf.data(),
+                          capacity, from, to);
+    }
+    ASSERT_LE(r.written, capacity);
+    joined.append(buf.data(), r.written);
+    pos += r.consumed;
+    if (r) {
+      ASSERT_EQ(pos, in.size());
+      break;
+    }
+    ASSERT_EQ(r.status, utfx::transcode_status::output_full);
+    // Nothing narrower than a whole code point may be left unused.
+    ASSERT_GT(r.written + 4, capacity);
+    ASSERT_GT(r.consumed, 0u);
+  }
+  ASSERT_EQ(joined, expected) << "capacity " << capacity;
+}
+
+template <typename Out, typename In>
+void check_bounded_random(utfx::endian from, utfx::endian to) {
+  std::mt19937 rng(50 + sizeof(In) * 4 + sizeof(Out));
+  for (size_t n : {0, 1, 40, 500, 3000}) {
+    for (int ascii : {0, 50, 100}) {
+      for (bool corrupt : {false, true}) {
+        const std::basic_string<In> in =
+            random_input<In>(rng, n, ascii, corrupt);
+        for (size_t capacity : {4, 5, 7, 64, 333, 5000}) {
+          check_bounded<Out>(in, capacity, from, to);
+        }
+      }
+    }
+  }
+}
+
+TEST(SimdBoundedTranscode, PiecesAddUpToUnbounded) {
+  const auto native = utfx::endian::native;
+  const auto swapped_endian = native == utfx::endian::little
+                                  ? utfx::endian::big
+                                  : utfx::endian::little;
+  check_bounded_random<char16_t, char>(native, native);
+  check_bounded_random<char16_t, char>(native, swapped_endian);
+  check_bounded_random<char32_t, char>(native, native);
+  check_bounded_random<char, char16_t>(native, native);
+  check_bounded_random<char, char32_t>(native, native);
+  check_bounded_random<char32_t, char16_t>(native, native);
+  check_bounded_random<char16_t, char32_t>(native, swapped_endian);
+}
+
+// The scalar loop alone under Policy, and the first error it stopped at.
+template <typename Out, typename Policy, typename In>
+std::basic_string<Out> scalar_transcode_policy(const std::basic_string<In>& in,
+                                               utfx::endian e,
+                                               utfx::utf_error& error) {
+  std::basic_string<Out> out;
+  const In* b = in.data();
+  transcode_scalar<Out, Policy>(b, in.data() + in.size(),
+                                in.data() + in.size(), std::back_inserter(out),
+                                e, e, error);
+  return out;
+}
+
+template <typename In>
+utfx::validation_result scalar_validate(const std::basic_string<In>& in,
+                                        utfx::endian e) {
+  if constexpr (sizeof(In) == 1) {
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(in.data());
+    return validate_utf8_scalar(p, p, p + in.size());
+  } else if constexpr (sizeof(In) == 2) {
+    return validate_utf16_scalar(in.data(), in.data(), in.data() + in.size(),
+                                 e);
+  } else {
+    return validate_utf32_scalar(in.data(), in.data(), in.data() + in.size(),
+                                 e);
+  }
+}
+
+template <typename Out, typename In>
+void check_error_policies() {
+  std::mt19937 rng(60 + sizeof(In) * 4 + sizeof(Out));
+  const utfx::endian e = utfx::endian::native;
+  for (size_t n : {0, 3, 100, 2000}) {
+    for (int ascii : {0, 50, 100}) {
+      for (bool corrupt : {false, true}) {
+        const std::basic_string<In> in =
+            random_input<In>(rng, n, ascii, corrupt);
+        const In* b = in.data();
+        const In* end = in.data() + in.size();
+        utfx::utf_error error = utfx::utf_error::none;
+        const auto replaced =
+            scalar_transcode_policy<Out, utfx::on_error::replace_t>(in, e,
+                                                                    error);
+        ASSERT_EQ(utfx::transcode<Out>(b, end, e, utfx::on_error::replace),
+                  replaced);
+        ASSERT_EQ(utfx::transcode(b, end, static_cast<Out*>(nullptr), e,
+                                  utfx::on_error::replace),
+                  replaced.size());
+
+        const auto stopped =
+            scalar_transcode_policy<Out, utfx::on_error::stop_t>(in, e, error);
+        const utfx::validation_result v = scalar_validate(in, e);
+        ASSERT_EQ(error, v.error);
+        ASSERT_EQ(utfx::transcode<Out>(b, end, e, utfx::on_error::stop),
+                  stopped);
+        std::vector<Out> buf(in.size() * 4 + 4);
+        const utfx::transcode_result r = utfx::transcode(
+            b, end, buf.data(), buf.size(), e, utfx::on_error::stop);
+        ASSERT_EQ(r.consumed, v.offset);
+        ASSERT_EQ(r.error, v.error);
+        ASSERT_EQ(std::basic_string<Out>(buf.data(), r.written), stopped);
+        if (!v.valid) {
+          try {
+            utfx::transcode<Out>(b, end, e, utfx::on_error::throw_exception);
+            FAIL() << "no conversion_error";
+          } catch (const utfx::conversion_error& x) {
+            ASSERT_EQ(x.offset(), v.offset);
+            ASSERT_EQ(x.error(), v.error);
+          }
+        }
+      }
+    }
+  }
+}
+
+TEST(SimdErrorPolicies, MatchScalarAndValidators) {
+  check_error_policies<char16_t, char>();
+  check_error_policies<char32_t, char>();
+  check_error_policies<char, char16_t>();
+  check_error_policies<char, char32_t>();
+}
+
+#if defined(UTFX_SIMD_X86_64)
+// Runs one counting kernel and checks its count for the part it read,
+// on valid input only for the kernels that do not validate.
+template <typename Out, typename In, typename Run>
+void check_length_kernel(const char* name, Run run, bool validates = true) {
+  std::mt19937 rng(48);
+  for (auto e : {utfx::endian::little, utfx::endian::big}) {
+    for (size_t n = 0; n < 1500; n += 61) {
+      for (bool corrupt : {false, true}) {
+        if (corrupt && !validates) {
+          continue;
+        }
+        std::basic_string<In> in = random_input<In>(rng, n, 40, corrupt);
+        if constexpr (sizeof(In) != 1) {
+          if (e != utfx::endian::native) {
+            in = swapped(in);
+          }
+        }
+        const simd::kernel_result r =
+            run(in.data(), in.size(), e != utfx::endian::native);
+        ASSERT_LE(r.read, in.size()) << name;
+        EXPECT_EQ(r.written, scalar_transcode<Out>(in.substr(0, r.read), e)
+                                 .size())
+            << name << ", length " << in.size();
+        if (!corrupt) {
+          EXPECT_GE(r.read + 192, in.size()) << name;
+        }
+      }
+    }
+  }
+}
+
+TEST(SimdOutputLength, Kernels) {
+  if (simd::cpu_supports(simd::isa::sse42)) {
+    check_length_kernel<char16_t, char>(
+        "sse42 utf8->utf16", [](const char* p, size_t n, bool) {
+          return simd::utf8_output_length_sse42<char16_t>(p, n);
+        });
+    check_length_kernel<char32_t, char>(
+        "sse42 utf8->utf32", [](const char* p, size_t n, bool) {
+          return simd::utf8_output_length_sse42<char32_t>(p, n);
+        });
+    check_length_kernel<char, char16_t>(
+        "sse42 utf16->utf8", &simd::utf16_output_length_sse42<char>);
+    check_length_kernel<char32_t, char16_t>(
+        "sse42 utf16->utf32", &simd::utf16_output_length_sse42<char32_t>);
+    check_length_kernel<char, char32_t>(
+        "sse42 utf32->utf8", &simd::utf32_output_length_sse42<char>);
+    check_length_kernel<char16_t, char32_t>(
+        "sse42 utf32->utf16", &simd::utf32_output_length_sse42<char16_t>);
+  }
+  if (simd::cpu_supports(simd::isa::avx2)) {
+    check_length_kernel<char16_t, char>(
+        "avx2 utf8->utf16", [](const char* p, size_t n, bool) {
+          return simd::utf8_output_length_avx2<char16_t>(p, n);
+        });
+    check_length_kernel<char32_t, char>(
+        "avx2 utf8->utf32", [](const char* p, size_t n, bool) {
+          return simd::utf8_output_length_avx2<char32_t>(p, n);
+        });
+    check_length_kernel<char, char16_t>(
+        "avx2 utf16->utf8", &simd::utf16_output_length_avx2<char>);
+    check_length_kernel<char32_t, char16_t>(
+        "avx2 utf16->utf32", &simd::utf16_output_length_avx2<char32_t>);
+    check_length_kernel<char, char32_t>(
+        "avx2 utf32->utf8", &simd::utf32_output_length_avx2<char>);
+    check_length_kernel<char16_t, char32_t>(
+        "avx2 utf32->utf16", &simd::utf32_output_length_avx2<char16_t>);
+  }
+}
+
+TEST(SimdOutputLength, ValidKernels) {
+  if (simd::cpu_supports(simd::isa::sse42)) {
+    check_length_kernel<char16_t, char>(
+        "sse42 valid utf8->utf16",
+        [](const char* p, size_t n, bool) {
+          return simd::utf8_output_length_sse42<char16_t, true>(p, n);
+        },
+        false);
+    check_length_kernel<char32_t, char>(
+        "sse42 valid utf8->utf32",
+        [](const char* p, size_t n, bool) {
+          return simd::utf8_output_length_sse42<char32_t, true>(p, n);
+        },
+        false);
+    check_length_kernel<char, char16_t>(
+        "sse42 valid utf16->utf8",
+        &simd::utf16_output_length_sse42<char, true>, false);
+    check_length_kernel<char32_t, char16_t>(
+        "sse42 valid utf16->utf32",
+        &simd::utf16_output_length_sse42<char32_t, true>, false);
+    check_length_kernel<char, char32_t>(
+        "sse42 valid utf32->utf8",
+        &simd::utf32_output_length_sse42<char, true>, false);
+    check_length_kernel<char16_t, char32_t>(
+        "sse42 valid utf32->utf16",
+        &simd::utf32_output_length_sse42<char16_t, true>, false);
+  }
+  if (simd::cpu_supports(simd::isa::avx2)) {
+    check_length_kernel<char16_t, char>(
+        "avx2 valid utf8->utf16",
+        [](const char* p, size_t n, bool) {
+          return simd::utf8_output_length_avx2<char16_t, true>(p, n);
+        },
+        false);
+    check_length_kernel<char32_t, char>(
+        "avx2 valid utf8->utf32",
+        [](const char* p, size_t n, bool) {
+          return simd::utf8_output_length_avx2<char32_t, true>(p, n);
+        },
+        false);
+    check_length_kernel<char, char16_t>(
+        "avx2 valid utf16->utf8", &simd::utf16_output_length_avx2<char, true>,
+        false);
+    check_length_kernel<char32_t, char16_t>(
+        "avx2 valid utf16->utf32",
+        &simd::utf16_output_length_avx2<char32_t, true>, false);
+    check_length_kernel<char, char32_t>(
+        "avx2 valid utf32->utf8", &simd::utf32_output_length_avx2<char, true>,
+        false);
+    check_length_kernel<char16_t, char32_t>(
+        "avx2 valid utf32->utf16",
+        &simd::utf32_output_length_avx2<char16_t, true>, false);
+  }
+}
+#endif
+
+// ============================================================================
+// transcode_valid gives what transcode gives on valid input
+// ============================================================================
+
+namespace {
+
+// Converts native-order valid input through every transcode_valid overload
+// and compares with the scalar loop.
+template <typename Out, typename In>
+void check_transcode_valid(const std::basic_string<In>& native_in,
+                           utfx::endian from, utfx::endian to) {
+  std::basic_string<In> in = native_in;
+  if constexpr (sizeof(In) != 1) {
+    if (from != utfx::endian::native) {
+      in = swapped(native_in);
+    }
+  }
+  const std::basic_string<Out> expected = scalar_transcode<Out>(in, from, to);
+  const In* b = in.data();
+  const In* e = in.data() + in.size();
+  const Out canary = static_cast<Out>(0x5A);
+  std::vector<Out> buf(expected.size() + 64, canary);
+  if constexpr (sizeof(In) == 1 || sizeof(Out) == 1) {
+    const utfx::endian wide = sizeof(In) == 1 ? to : from;
+    ASSERT_EQ(utfx::transcode_valid(b, e, static_cast<Out*>(nullptr), wide),
+              expected.size());
+    ASSERT_EQ(utfx::transcode_valid(b, e, buf.data(), wide), expected.size());
+    ASSERT_EQ(utfx::transcode_valid<Out>(b, e, wide), expected);
+  } else {
+    ASSERT_EQ(utfx::transcode_valid(b, e, static_cast<Out*>(nullptr), from,
+                                    to),
+              expected.size());
+    ASSERT_EQ(utfx::transcode_valid(b, e, buf.data(), from, to),
+              expected.size());
+    ASSERT_EQ(utfx::transcode_valid<Out>(b, e, from, to), expected);
+  }
+  ASSERT_EQ(std::basic_string<Out>(buf.data(), expected.size()), expected);
+  ASSERT_TRUE(std::all_of(buf.begin() + static_cast<ptrdiff_t>(expected.size()),
+                          buf.end(), [&](Out c) { return c == canary; }))
+      << "wrote past the end of the output";
+}
+
+}  // namespace
+
+TEST(SimdTranscodeValid, MatchesTranscode) {
+  std::mt19937 rng(35);
+  for (size_t n = 0; n < 1500; n += n < 100 ? 1 : 89) {
+    const int ascii = static_cast<int>(n % 101);
+    const std::string in8 = random_utf8(rng, n, ascii);
+    const std::u16string in16 = random_utf16(rng, n, ascii);
+    const std::u32string in32 = random_utf32(rng, n, ascii);
+    for (auto from : {utfx::endian::little, utfx::endian::big}) {
+      check_transcode_valid<char16_t>(in8, from, from);
+      check_transcode_valid<char32_t>(in8, from, from);
+      check_transcode_valid<char>(in16, from, from);
+      check_transcode_valid<char>(in32, from, from);
+      for (auto to : {utfx::endian::little, utfx::endian::big}) {
+        check_transcode_valid<char32_t>(in16, from, to);
+        check_transcode_valid<char16_t>(in32, from, to);
+      }
+    }
+  }
+}
+
+// ============================================================================
+// byte order changes
+// ============================================================================
+
+namespace {
+
+template <typename CharT>
+void check_change_endianness(const std::basic_string<CharT>& in) {
+  const std::basic_string<CharT> expected = swapped(in);
+  const CharT canary = static_cast<CharT>(0x5A);
+  std::vector<CharT> out(in.size() + 16, canary);
+  std::basic_string<CharT> inplace = in;
+  if constexpr (sizeof(CharT) == 2) {
+    utfx::change_endianness_utf16(in.data(), in.size(), out.data());
+    utfx::change_endianness_utf16(&inplace[0], inplace.size());
+  } else {
+    utfx::change_endianness_utf32(in.data(), in.size(), out.data());
+    utfx::change_endianness_utf32(&inplace[0], inplace.size());
+  }
+  ASSERT_EQ(std::basic_string<CharT>(out.data(), in.size()), expected);
+  ASSERT_TRUE(std::all_of(out.begin() + static_cast<ptrdiff_t>(in.size()),
+                          out.end(), [&](CharT c) { return c == canary; }));
+  ASSERT_EQ(inplace, expected);
+
+  for (auto from : {utfx::endian::little, utfx::endian::big}) {
+    utfx::validation_result want{};
+    utfx::validation_result got{};
+    inplace = in;
+    if constexpr (sizeof(CharT) == 2) {
+      want = validate_utf16_scalar(in.data(), in.data(),
+                                   in.data() + in.size(), from);
+      got = utfx::change_endianness_utf16(in.data(), in.size(), out.data(),
+                                          from);
+      ASSERT_EQ(got.offset, want.offset);
+      got = utfx::change_endianness_utf16(&inplace[0], inplace.size(), from);
+    } else {
+      want = validate_utf32_scalar(in.data(), in.data(),
+                                   in.data() + in.size(), from);
+      got = utfx::change_endianness_utf32(in.data(), in.size(), out.data(),
+                                          from);
+      ASSERT_EQ(got.offset, want.offset);
+      got = utfx::change_endianness_utf32(&inplace[0], inplace.size(), from);
+    }
+    ASSERT_EQ(got.valid, want.valid) << "length " << in.size();
+    ASSERT_EQ(got.offset, want.offset);
+    ASSERT_EQ(got.error, want.error);
+    ASSERT_EQ(std::basic_string<CharT>(out.data(), in.size()), expected);
+    ASSERT_EQ(inplace, expected);
+  }
+}
+
+}  // namespace
+
+TEST(SimdChangeEndianness, MatchesScalar) {
+  std::mt19937 rng(36);
+  for (size_t n = 0; n < 10000; n += n < 200 ? 1 : 997) {
+    const std::u16string in16 = random_utf16(rng, n, 50);
+    const std::u32string in32 = random_utf32(rng, n, 50);
+    check_change_endianness(in16);
+    check_change_endianness(swapped(in16));
+    check_change_endianness(in32);
+    check_change_endianness(swapped(in32));
+  }
+}
+
+TEST(SimdChangeEndianness, ErrorsAtEveryOffset) {
+  std::mt19937 rng(37);
+  const std::u16string in16 = random_utf16(rng, 300, 50);
+  const std::u32string in32 = random_utf32(rng, 300, 50);
+  for (size_t k = 0; k < in16.size(); k += 3) {
+    std::u16string bad = in16;
+    bad[k] = static_cast<char16_t>(k % 2 ? 0xDC00 : 0xD800);
+    check_change_endianness(bad);
+  }
+  for (size_t k = 0; k < in32.size(); k += 3) {
+    std::u32string bad = in32;
+    bad[k] = k % 2 ? 0xDFFF : 0x110000;
+    check_change_endianness(bad);
+  }
+}
+
+TEST(SimdChangeEndianness, SurrogatePairAcrossChunks) {
+  // A pair that straddles the validation chunks is still one code point.
+  for (size_t k : {4094, 4095, 4096, 8191}) {
+    std::u16string in(9000, u'a');
+    in[k] = static_cast<char16_t>(0xD83D);
+    in[k + 1] = static_cast<char16_t>(0xDE00);
+    check_change_endianness(in);
+    in[k + 1] = u'b';
+    check_change_endianness(in);
+  }
+}
+
+#if defined(UTFX_SIMD_X86_64)
+TEST(SimdChangeEndianness, Kernels) {
+  std::mt19937 rng(38);
+  const auto utf16 = kernels<size_t (*)(const char16_t*, size_t, char16_t*)>(
+      &simd::swap_units_sse42<char16_t>, &simd::swap_units_avx2<char16_t>,
+      &simd::swap_units_avx512<char16_t>);
+  const auto utf32 = kernels<size_t (*)(const char32_t*, size_t, char32_t*)>(
+      &simd::swap_units_sse42<char32_t>, &simd::swap_units_avx2<char32_t>,
+      &simd::swap_units_avx512<char32_t>);
+  for (size_t n = 0; n < 200; ++n) {
+    const std::u16string in16 = random_utf16(rng, n, 50);
+    for (const auto& k : utf16) {
+      std::u16string out(in16.size() + 8, u'Z');
+      const size_t done = k.second(in16.data(), in16.size(), &out[0]);
+      ASSERT_LE(done, in16.size()) << k.first;
+      EXPECT_EQ(out.substr(0, done), swapped(in16.substr(0, done))) << k.first;
+      EXPECT_EQ(out.substr(done), std::u16string(in16.size() + 8 - done, u'Z'))
+          << k.first;
+    }
+    const std::u32string in32 = random_utf32(rng, n, 50);
+    for (const auto& k : utf32) {
+      std::u32string out(in32.size() + 8, U'Z');
+      const size_t done = k.second(in32.data(), in32.size(), &out[0]);
+      ASSERT_LE(done, in32.size()) << k.first;
+      EXPECT_EQ(out.substr(0, done), swapped(in32.substr(0, done))) << k.first;
+      EXPECT_EQ(out.substr(done), std::u32string(in32.size() + 8 - done, U'Z'))
+          << k.first;
+    }
+  }
+}
+#endif
@@ -0,0 +1,65 @@
+#include <gtest/gtest.h>
+
+#include <string_view>
+#include <utfx/utfx.hpp>
+
+namespace {
+
+constexpr auto kCafe =
+    utfx::static_transcode<char16_t,
+                           utfx::static_length<char16_t>("caf\xC3\xA9!")>(
+        "caf\xC3\xA9!");
+static_assert(kCafe.size() == 5);
+static_assert(kCafe[3] == u'é');
+static_assert(kCafe.c_str()[5] == u'\0');
+
+constexpr auto kEmoji =
+    utfx::static_transcode<char, utfx::static_length<char>(u"\U0001F600x")>(
+        u"\U0001F600x");
+static_assert(kEmoji.view() == "\xF0\x9F\x98\x80x");
+
+constexpr auto kWide = utfx::static_transcode<
+    char32_t, utfx::static_length<char32_t>(u"a\U00010000")>(u"a\U00010000");
+static_assert(kWide.size() == 2 && kWide[1] == U'\U00010000');
+
+constexpr auto kEmpty =
+    utfx::static_transcode<char16_t, utfx::static_length<char16_t>("")>("");
+static_assert(kEmpty.empty() && kEmpty.c_str()[0] == u'\0');
+
+}  // namespace
+
+TEST(StaticTranscodeTest, MatchesTranscode) {
+  const std::string utf8 = "caf\xC3\xA9!";
+  EXPECT_EQ(std::u16string_view(kCafe),
+            utfx::transcode<char16_t>(utf8.data(), utf8.data() + utf8.size(),
+                                      utfx::endian::native));
+  EXPECT_EQ(std::u16string(kCafe.begin(), kCafe.end()), u"café!");
+  EXPECT_EQ(std::string(kEmoji.c_str()), "\xF0\x9F\x98\x80x");
+  EXPECT_EQ(kWide.view(), U"a\U00010000");
+}
+
+// In a constant expression these make the program ill-formed instead.
+TEST(StaticTranscodeTest, IllFormedInputThrowsAtRuntime) {
+  EXPECT_THROW(utfx::static_length<char16_t>("a\xFF"), utfx::conversion_error);
+  EXPECT_THROW((utfx::static_transcode<char16_t, 3>("abc\xC3\xA9")),
+               std::length_error);
+}
+
+#if defined(__cpp_nontype_template_args) && \
+    __cpp_nontype_template_args >= 201911L
+TEST(StaticTranscodeTest, Literals) {
+  using namespace utfx::literals;
+  constexpr std::u16string_view a = "caf\xC3\xA9"_utf16sv;
+  static_assert(a == u"café");
+  constexpr std::string_view b = u"\U0001F600"_utf8sv;
+  static_assert(b == "\xF0\x9F\x98\x80");
+  // The view points at one static constant, terminated by a null.
+  EXPECT_EQ(a.data(), ("caf\xC3\xA9"_utf16sv).data());
+  EXPECT_EQ(a.data()[a.size()], u'\0');
+  static_assert(u8"été"_utf16sv == u"été");
+
+  constexpr const auto& c = utfx::static_transcoded<char32_t, u"x\U00010000">;
+  static_assert(c.size() == 2 && c[1] == U'\U00010000');
+  EXPECT_EQ(c.view(), U"x\U00010000");
+}
+#endif
@@ -0,0 +1,295 @@
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <utfx/utfx.hpp>
+#include <vector>
+
+namespace {
+
+const utfx::endian other_endian = utfx::endian::native == utfx::endian::little
+                                      ? utfx::endian::big
+                                      : utfx::endian::little;
+
+// What the stream should turn into: the whole input converted at once,
+// up to the first error under a stopping policy.
+template <typename To, typename Policy, typename From>
+utfx::transcode_result whole(const std::basic_string<From>& in,
+                             std::basic_string<To>& out, utfx::endian from,
+                             utfx::endian to) {
+  out.assign(in.size() * 4 + 4, To('Z'));
+  const utfx::transcode_result r =
+      utfx::detail::transcode_bounded<To, Policy>(
+          in.data(), in.data() + in.size(), &out[0], out.size(), from, to);
+  out.resize(r.written);
+  return r;
+}
+
+// Feeds in to t in chunks cut at the given sizes, with capacity units of
+// output room per call, and finishes the stream.
+template <typename From, typename To, typename Policy>
+std::basic_string<To> stream(utfx::stream_transcoder<From, To, Policy>& t,
+                             const std::basic_string<From>& in,
+                             const std::vector<size_t>& cuts,
+                             size_t capacity, bool& failed) {
+  std::basic_string<To> out;
+  std::vector<To> buf(capacity);
+  failed = false;
+  size_t at = 0;
+  for (size_t c = 0; at < in.size() || c == 0; ++c) {
+    size_t n = c < cuts.size() ? cuts[c] : in.size() - at;
+    if (n > in.size() - at) {
+      n = in.size() - at;
+    }
+    const size_t stop = at + n;
+    do {
+      const utfx::transcode_result r =
+          t.feed(in.data() + at, stop - at, buf.data(), capacity);
+      out.append(buf.data(), r.written);
+      at += r.consumed;
+      if (r.status == utfx::transcode_status::invalid_input) {
+        failed = true;
+        return out;
+      }
+      EXPECT_TRUE(r.status == utfx::transcode_status::ok || r.written != 0 ||
+                  r.consumed != 0)
+          << "no progress";
+    } while (at < stop);
+  }
+  for (;;) {
+    const utfx::transcode_result r = t.finish(buf.data(), capacity);
+    out.append(buf.data(), r.written);
+    if (r.status == utfx::transcode_status::invalid_input) {
+      failed = true;
+    }
+    if (r.status != utfx::transcode_status::output_full) {
+      break;
+    }
+  }
+  return out;
+}
+
+std::string random_utf8(std::mt19937& rng, size_t n, bool errors) {
+  static const char* const pieces[] = {
+      "a", "Z", "\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80",
+      "\x80", "\xE2\x82", "\xF0\x9F", "\xC0\xAF", "\xED\xA0\x80",
+      "\xF4\x9F", "\xE0\x80"};
+  std::uniform_int_distribution<int> pick(0, errors ? 11 : 4);
+  std::string s;
+  for (size_t i = 0; i < n; ++i) {
+    s += pieces[pick(rng)];
+  }
+  return s;
+}
+
+template <typename From, typename To, typename Policy>
+void check_random_chunks(std::mt19937& rng, const std::basic_string<From>& in,
+                         utfx::endian from, utfx::endian to) {
+  std::basic_string<To> expected;
+  const utfx::transcode_result r = whole<To, Policy>(in, expected, from, to);
+  std::uniform_int_distribution<size_t> chunk(0, 9);
+  for (size_t capacity : {size_t(4), size_t(7), size_t(64),
+                          utfx::stream_transcoder<From, To>::max_output(9)}) {
+    std::vector<size_t> cuts;
+    for (size_t i = 0; i < in.size(); ++i) {
+      cuts.push_back(chunk(rng));
+    }
+    utfx::stream_transcoder<From, To, Policy> t(from, to);
+    bool failed = false;
+    ASSERT_EQ(stream(t, in, cuts, capacity, failed), expected)
+        << "capacity " << capacity;
+    ASSERT_EQ(failed, !r);
+    if (failed) {
+      ASSERT_EQ(t.position(), r.consumed);
+    } else {
+      ASSERT_EQ(t.position(), in.size());
+    }
+  }
+}
+
+}  // namespace
+
+TEST(StreamTranscoderTest, EmptyStream) {
+  utfx::stream_transcoder<char, char16_t> t;
+  char16_t out[4];
+  const utfx::transcode_result r = t.feed("", 0, out, 4);
+  EXPECT_TRUE(r);
+  EXPECT_EQ(r.written, 0u);
+  EXPECT_EQ(t.finish(out, 4).written, 0u);
+}
+
+TEST(StreamTranscoderTest, CodePointSplitAtEveryByte) {
+  const std::string in = "a\xF0\x9F\x98\x80\xE2\x82\xAC";
+  for (size_t i = 0; i <= in.size(); ++i) {
+    for (size_t j = i; j <= in.size(); ++j) {
+      utfx::stream_transcoder<char, char16_t> t;
+      bool failed = false;
+      EXPECT_EQ(stream(t, in, {i, j - i}, 8, failed), u"a\U0001F600€")
+          << i << " " << j;
+      EXPECT_FALSE(failed);
+    }
+  }
+}
+
+TEST(StreamTranscoderTest, CarriesUnitsBetweenChunks) {
+  utfx::stream_transcoder<char, char32_t> t;
+  char32_t out[8];
+  utfx::transcode_result r = t.feed("ab\xF0\x9F", 4, out, 8);
+  EXPECT_EQ(r.consumed, 4u);
+  EXPECT_EQ(r.written, 2u);
+  EXPECT_EQ(t.pending(), 2u);
+  EXPECT_EQ(t.position(), 2u);
+  r = t.feed("\x98", 1, out, 8);
+  EXPECT_EQ(r.written, 0u);
+  EXPECT_EQ(t.pending(), 3u);
+  r = t.feed("\x80!", 2, out, 8);
+  EXPECT_EQ(r.consumed, 2u);
+  ASSERT_EQ(r.written, 2u);
+  EXPECT_EQ(out[0], U'\U0001F600');
+  EXPECT_EQ(out[1], U'!');
+  EXPECT_EQ(t.pending(), 0u);
+  EXPECT_EQ(t.position(), 7u);
+}
+
+TEST(StreamTranscoderTest, TruncatedAtFinish) {
+  utfx::stream_transcoder<char, char16_t, utfx::on_error::replace_t> t;
+  char16_t out[8];
+  EXPECT_EQ(t.feed("x\xE2\x82", 3, out, 8).written, 1u);
+  const utfx::transcode_result r = t.finish(out, 8);
+  ASSERT_EQ(r.written, 1u);
+  EXPECT_EQ(out[0], u'\xFFFD');
+
+  utfx::stream_transcoder<char, char16_t, utfx::on_error::stop_t> stop;
+  stop.feed("x\xE2\x82", 3, out, 8);
+  EXPECT_EQ(stop.finish(out, 8).error, utfx::utf_error::truncated);
+  EXPECT_EQ(stop.position(), 1u);
+  EXPECT_EQ(stop.feed("y", 1, out, 8).status,
+            utfx::transcode_status::invalid_input);
+  stop.reset();
+  EXPECT_TRUE(stop.feed("y", 1, out, 8));
+}
+
+// A lead byte followed by trail bytes that cannot continue it is not a
+// valid prefix, but under skip it still takes the next byte that is not a
+// trail byte, wherever the chunk ends.
+TEST(StreamTranscoderTest, IllFormedSequenceSplitAcrossChunks) {
+  for (const char* text :
+       {"\xF4\x9F\x41", "\xF4\xA0\x80\x41", "\xE0\x80\x41z"}) {
+    const std::string in = text;
+    std::u16string expected;
+    whole<char16_t, utfx::on_error::skip_t>(in, expected,
+                                            utfx::endian::native,
+                                            utfx::endian::native);
+    for (size_t i = 0; i <= in.size(); ++i) {
+      for (size_t j = i; j <= in.size(); ++j) {
+        utfx::stream_transcoder<char, char16_t> t;
+        bool failed = false;
+        EXPECT_EQ(stream(t, in, {i, j - i}, 8, failed), expected)
+            << i << " " << j;
+      }
+    }
+    utfx::stream_transcoder<char, char16_t> t;
+    bool failed = false;
+    EXPECT_EQ(stream(t, in, std::vector<size_t>(in.size(), 1), 8, failed),
+              expected);
+  }
+  std::u16string out;
+  whole<char16_t, utfx::on_error::skip_t>(std::string("\xF4\x9F\x41"), out,
+                                          utfx::endian::native,
+                                          utfx::endian::native);
+  EXPECT_EQ(out, u"");
+}
+
+TEST(StreamTranscoderTest, ThrowsWithStreamOffset) {
+  utfx::stream_transcoder<char, char16_t, utfx::on_error::throw_exception_t>
+      t;
+  char16_t out[16];
+  t.feed("hello \xE2", 7, out, 16);
+  try {
+    t.feed("\x28 world", 7, out, 16);
+    FAIL() << "no exception";
+  } catch (const utfx::conversion_error& e) {
+    EXPECT_EQ(e.offset(), 6u);
+  }
+}
+
+TEST(StreamTranscoderTest, OutputFullInsideCarriedCodePoint) {
+  utfx::stream_transcoder<char, char16_t> t;
+  char16_t out[2];
+  t.feed("\xF0\x9F", 2, out, 2);
+  utfx::transcode_result r = t.feed("\x98\x80z", 3, out, 1);
+  EXPECT_EQ(r.status, utfx::transcode_status::output_full);
+  EXPECT_EQ(r.consumed, 0u);
+  EXPECT_EQ(r.written, 0u);
+  r = t.feed("\x98\x80z", 3, out, 2);
+  EXPECT_EQ(r.status, utfx::transcode_status::output_full);
+  EXPECT_EQ(r.consumed, 2u);
+  EXPECT_EQ(std::u16string(out, r.written), u"\U0001F600");
+  r = t.feed("z", 1, out, 2);
+  EXPECT_TRUE(r);
+  EXPECT_EQ(std::u16string(out, r.written), u"z");
+}
+
+TEST(StreamTranscoderTest, UTF16SurrogatePairsBothEndians) {
+  for (auto e : {utfx::endian::native, other_endian}) {
+    std::u16string in = u"x\U0001F600y\U00010000";
+    if (e != utfx::endian::native) {
+      for (auto& c : in) {
+        c = utfx::detail::swap_bytes(c);
+      }
+    }
+    for (size_t i = 0; i <= in.size(); ++i) {
+      utfx::stream_transcoder<char16_t, char> t(e);
+      bool failed = false;
+      EXPECT_EQ(stream(t, in, {i}, 8, failed),
+                "x\xF0\x9F\x98\x80y\xF0\x90\x80\x80")
+          << i;
+    }
+  }
+}
+
+TEST(StreamTranscoderTest, RandomChunksMatchWholeConversion) {
+  std::mt19937 rng(23);
+  for (int iter = 0; iter < 200; ++iter) {
+    const bool errors = iter % 2 == 1;
+    const std::string utf8 =
+        random_utf8(rng, static_cast<size_t>(iter), errors);
+    check_random_chunks<char, char16_t, utfx::on_error::skip_t>(
+        rng, utf8, utfx::endian::native, utfx::endian::native);
+    check_random_chunks<char, char16_t, utfx::on_error::replace_t>(
+        rng, utf8, other_endian, other_endian);
+    check_random_chunks<char, char32_t, utfx::on_error::stop_t>(
+        rng, utf8, utfx::endian::native, utfx::endian::native);
+
+    std::u16string utf16;
+    whole<char16_t, utfx::on_error::replace_t>(utf8, utf16,
+                                               utfx::endian::native,
+                                               utfx::endian::native);
+    if (errors && !utf16.empty()) {
+      utf16[utf16.size() / 2] = 0xD800;
+    }
+    check_random_chunks<char16_t, char, utfx::on_error::replace_t>(
+        rng, utf16, utfx::endian::native, utfx::endian::native);
+    check_random_chunks<char16_t, char32_t, utfx::on_error::stop_t>(
+        rng, utf16, utfx::endian::native, other_endian);
+    std::u32string utf32;
+    whole<char32_t, utfx::on_error::skip_t>(utf16, utf32, utfx::endian::native,
+                                            utfx::endian::native);
+    check_random_chunks<char32_t, char, utfx::on_error::skip_t>(
+        rng, utf32, utfx::endian::native, utfx::endian::native);
+  }
+}
+
+// Chunks long enough for the kernels, with code points cut at the ends.
+TEST(StreamTranscoderTest, LongChunks) {
+  std::mt19937 rng(24);
+  const std::string utf8 = random_utf8(rng, 20000, false);
+  std::u16string expected;
+  whole<char16_t, utfx::on_error::skip_t>(utf8, expected, utfx::endian::native,
+                                          utfx::endian::native);
+  utfx::stream_transcoder<char, char16_t> t;
+  bool failed = false;
+  EXPECT_EQ(stream(t, utf8, std::vector<size_t>(100, 997), 5000, failed),
+            expected);
+  EXPECT_FALSE(failed);
+}
@@ -0,0 +1,149 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utfx/utfx.hpp>
+
+namespace {
+
+std::string random_utf8(std::mt19937& rng, size_t n) {
+  static const char* const pieces[] = {"a", "Z", "\n", "\xC3\xA9",
+                                       "\xE2\x82\xAC", "\xF0\x9F\x98\x80"};
+  std::uniform_int_distribution<int> pick(0, 5);
+  std::string s;
+  for (size_t i = 0; i < n; ++i) {
+    s += pieces[pick(rng)];
+  }
+  return s;
+}
+
+template <typename CharT>
+std::basic_string<CharT> convert(const std::string& utf8) {
+  return utfx::transcode<CharT>(utf8.data(), utf8.data() + utf8.size(),
+                                utfx::endian::native);
+}
+
+// Everything the stream yields, read a unit at a time through the
+// streambuf.
+template <typename CharT>
+std::basic_string<CharT> read_all(std::basic_istream<CharT>& in) {
+  std::basic_string<CharT> s;
+  for (auto c = in.rdbuf()->sbumpc();
+       !std::char_traits<CharT>::eq_int_type(c, std::char_traits<CharT>::eof());
+       c = in.rdbuf()->sbumpc()) {
+    s += std::char_traits<CharT>::to_char_type(c);
+  }
+  return s;
+}
+
+}  // namespace
+
+TEST(TranscodingStreamTest, GetlineFromUTF8) {
+  std::istringstream file("caf\xC3\xA9\n\xF0\x9F\x98\x80 ok\n");
+  utfx::transcoding_istream<wchar_t> in(file);
+  std::wstring line;
+  ASSERT_TRUE(std::getline(in, line));
+  EXPECT_EQ(line, L"café");
+  ASSERT_TRUE(std::getline(in, line));
+  EXPECT_EQ(line, L"\U0001F600 ok");
+  EXPECT_FALSE(std::getline(in, line));
+}
+
+TEST(TranscodingStreamTest, ReadsInSmallBlocks) {
+  std::mt19937 rng(24);
+  for (size_t n : {0, 1, 5, 100, 3000}) {
+    const std::string utf8 = random_utf8(rng, n);
+    for (size_t block : {1, 16, 17, 8192}) {
+      std::istringstream file16(utf8);
+      utfx::transcoding_istream<char16_t> in16(file16, block);
+      EXPECT_EQ(read_all(in16), convert<char16_t>(utf8)) << n << " " << block;
+      std::istringstream file32(utf8);
+      utfx::transcoding_istream<char32_t> in32(file32, block);
+      EXPECT_EQ(read_all(in32), convert<char32_t>(utf8)) << n << " " << block;
+    }
+  }
+}
+
+TEST(TranscodingStreamTest, ReadIllFormedInput) {
+  std::istringstream skip("a\xFF" "b\xE2\x82");
+  utfx::transcoding_istream<char16_t> in(skip);
+  EXPECT_EQ(read_all(in), u"ab");
+
+  std::istringstream replace("a\xFF" "b\xE2\x82");
+  utfx::transcoding_istream<char16_t, utfx::on_error::replace_t> in2(replace);
+  EXPECT_EQ(read_all(in2), u"a\xFFFD" u"b\xFFFD");
+
+  std::istringstream stop("ab\xFF" "cd");
+  utfx::transcoding_istream<char16_t, utfx::on_error::stop_t> in3(stop);
+  EXPECT_EQ(read_all(in3), u"ab");
+}
+
+// An ill-formed sequence cut by the end of a block takes the same bytes
+// under skip as it would in one piece: F4 9F takes the 'A' after it.
+TEST(TranscodingStreamTest, IllFormedSequenceAcrossBlocks) {
+  for (const char* bad : {"\xF4\x9F", "\xF4\xA0\x80", "\xE0\x80"}) {
+    for (size_t k = 12; k <= 17; ++k) {
+      const std::string utf8 = std::string(k, 'a') + bad + "A b";
+      std::istringstream file(utf8);
+      utfx::transcoding_istream<char16_t> in(file, 16);
+      EXPECT_EQ(read_all(in), convert<char16_t>(utf8)) << k;
+    }
+  }
+}
+
+TEST(TranscodingStreamTest, WritesUTF8) {
+  std::ostringstream file;
+  {
+    utfx::transcoding_ostream<wchar_t> out(file);
+    out << L"café " << 42 << L'\n';
+    out.flush();
+    EXPECT_EQ(file.str(), "caf\xC3\xA9 42\n");
+    out << L"\U0001F600";
+  }
+  EXPECT_EQ(file.str(), "caf\xC3\xA9 42\n\xF0\x9F\x98\x80");
+}
+
+TEST(TranscodingStreamTest, SurrogatePairAcrossFlushes) {
+  std::ostringstream file;
+  utfx::transcoding_ostream<char16_t> out(file, 16);
+  const std::u16string pair = u"\U0001F600";
+  out.write(pair.data(), 1);
+  out.flush();
+  EXPECT_EQ(file.str(), "");
+  out.write(pair.data() + 1, 1);
+  out.flush();
+  EXPECT_EQ(file.str(), "\xF0\x9F\x98\x80");
+
+  // A high surrogate left at the end is dropped, or replaced, on finish.
+  const char16_t high = pair[0];
+  std::ostringstream file2;
+  {
+    utfx::transcoding_ostream<char16_t, utfx::on_error::replace_t> out2(
+        file2);
+    out2.write(&high, 1);
+  }
+  EXPECT_EQ(file2.str(), "\xEF\xBF\xBD");
+}
+
+TEST(TranscodingStreamTest, WritesInSmallBlocks) {
+  std::mt19937 rng(25);
+  for (size_t n : {0, 1, 5, 100, 3000}) {
+    const std::string utf8 = random_utf8(rng, n);
+    const std::u16string utf16 = convert<char16_t>(utf8);
+    for (size_t block : {1, 16, 17, 8192}) {
+      std::ostringstream file;
+      {
+        utfx::transcoding_ostream<char16_t> out(file, block);
+        // Pieces of varying length, some ending inside a surrogate pair.
+        for (size_t at = 0; at < utf16.size();) {
+          const size_t k = std::min(utf16.size() - at, 1 + at % 37);
+          out.write(utf16.data() + at, static_cast<std::streamsize>(k));
+          at += k;
+        }
+      }
+      EXPECT_EQ(file.str(), utf8) << n << " " << block;
+    }
+  }
+}
@@ -754,6 +754,36 @@ TEST(UTF8ViewTest, Substr_EmptyView) {
   EXPECT_TRUE(sub.empty());
 }
 
+TEST(UTF8ViewTest, LongASCIIRuns) {
+  // ASCII runs longer than a word, broken up by multi-byte characters, so
+  // size/substr/remove_prefix stop both inside and at the end of a run.
+  std::string text;
+  for (int i = 0; i < 5; ++i) {
+    text += std::string(19 + i, 'a' + i);
+    text += "\xE4\xBD\xA0";
+  }
+  text += "tail";
+  utfx::utf8_view view(text);
+  EXPECT_EQ(view.size(), 19u + 20 + 21 + 22 + 23 + 5 + 4);
+
+  auto sub = view.substr(10, 12);  // 9 'a', U+4F60, 2 'b'
+  EXPECT_EQ(sub.byte_size(), 9u + 3 + 2);
+  EXPECT_EQ(sub[9].code_point(), 0x4F60u);
+  EXPECT_EQ(sub.back().code_point(), 'b');
+
+  view.remove_prefix(19 + 1 + 20 + 1 + 3);
+  EXPECT_EQ(view.front().code_point(), 'c');
+  EXPECT_EQ(view.size(), 18u + 1 + 22 + 1 + 23 + 1 + 4);
+}
+
+TEST(UTF8ViewTest, TruncatedSequenceAtEnd) {
+  utfx::utf8_view view("abc\xE4\xBD");
+  EXPECT_EQ(view.size(), 4u);
+  EXPECT_EQ(view.substr(3).byte_size(), 2u);
+  view.remove_prefix(4);
+  EXPECT_TRUE(view.empty());
+}
+
 // ============================================================================
 // utf8_view swap tests
 // ============================================================================
@@ -1020,6 +1050,19 @@ TEST(UTF8ViewTest, ConstexprComparisons) {
   EXPECT_TRUE(true);
 }
 
+TEST(UTF8ViewTest, ConstexprSizeAndSubstr) {
+  constexpr utfx::utf8_view view("Hello, \xE4\xBD\xA0\xE5\xA5\xBD world");
+  static_assert(view.size() == 15, "7 + 2 + 6 code points");
+  static_assert(view.substr(7, 2).byte_size() == 6, "two 3-byte characters");
+  constexpr utfx::utf8_view tail = [] {
+    utfx::utf8_view v("Hello, \xE4\xBD\xA0\xE5\xA5\xBD world");
+    v.remove_prefix(9);
+    return v;
+  }();
+  static_assert(tail == utfx::utf8_view(" world"), "prefix removed");
+  EXPECT_TRUE(true);
+}
+
 // ============================================================================
 // Complete workflow tests combining all three types
 // ============================================================================
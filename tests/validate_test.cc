@@ -0,0 +1,357 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <utfx/utfx.hpp>
+#include <vector>
+
+using utfx::utf_error;
+using utfx::validation_result;
+
+namespace {
+
+void expect_error(const validation_result& r, size_t offset, utf_error error) {
+  EXPECT_FALSE(r.valid);
+  EXPECT_FALSE(static_cast<bool>(r));
+  EXPECT_EQ(r.offset, offset);
+  EXPECT_EQ(r.error, error);
+}
+
+void expect_valid(const validation_result& r, size_t length) {
+  EXPECT_TRUE(r.valid);
+  EXPECT_TRUE(static_cast<bool>(r));
+  EXPECT_EQ(r.offset, length);
+  EXPECT_EQ(r.error, utf_error::none);
+}
+
+// Serializes UTF-16 units in the given byte order.
+std::string utf16_bytes(const std::vector<uint16_t>& units, utfx::endian e) {
+  std::string s;
+  for (uint16_t u : units) {
+    const char hi = static_cast<char>(u >> 8);
+    const char lo = static_cast<char>(u & 0xFF);
+    if (e == utfx::endian::big) {
+      s += hi;
+      s += lo;
+    } else {
+      s += lo;
+      s += hi;
+    }
+  }
+  return s;
+}
+
+// Serializes UTF-32 units in the given byte order.
+std::string utf32_bytes(const std::vector<uint32_t>& units, utfx::endian e) {
+  std::string s;
+  for (uint32_t u : units) {
+    for (int i = 0; i < 4; ++i) {
+      const int shift = e == utfx::endian::big ? 24 - 8 * i : 8 * i;
+      s += static_cast<char>((u >> shift) & 0xFF);
+    }
+  }
+  return s;
+}
+
+}  // namespace
+
+// ============================================================================
+// validate_utf8
+// ============================================================================
+
+TEST(ValidateUTF8Test, Valid) {
+  expect_valid(utfx::validate_utf8("", 0), 0);
+  const std::string s = "Hello, \xE4\xB8\x96\xE7\x95\x8C \xF0\x9F\x8C\x8D";
+  expect_valid(utfx::validate_utf8(s.data(), s.size()), s.size());
+}
+
+TEST(ValidateUTF8Test, BOMIsValid) {
+  const std::string s = "\xEF\xBB\xBF" "abc";
+  expect_valid(utfx::validate_utf8(s.data(), s.size()), s.size());
+  EXPECT_TRUE(utfx::is_utf8(s.data(), s.size()));
+}
+
+TEST(ValidateUTF8Test, ErrorKinds) {
+  expect_error(utfx::validate_utf8("ab\x80", 3), 2,
+               utf_error::stray_continuation);
+  expect_error(utfx::validate_utf8("a\xC0\xAF", 3), 1, utf_error::overlong);
+  expect_error(utfx::validate_utf8("a\xE0\x80\xAF", 4), 1,
+               utf_error::overlong);
+  expect_error(utfx::validate_utf8("\xF0\x80\x80\xAF", 4), 0,
+               utf_error::overlong);
+  expect_error(utfx::validate_utf8("a\xED\xA0\x80", 4), 1,
+               utf_error::surrogate);
+  expect_error(utfx::validate_utf8("\xF4\x90\x80\x80", 4), 0,
+               utf_error::out_of_range);
+  expect_error(utfx::validate_utf8("abc\xF8", 4), 3, utf_error::out_of_range);
+  expect_error(utfx::validate_utf8("abc\xE4\xBD", 5), 3,
+               utf_error::truncated);
+  expect_error(utfx::validate_utf8("abc\xE4\xBD" "d", 6), 3,
+               utf_error::truncated);
+}
+
+TEST(ValidateUTF8Test, ReportsFirstOfSeveralErrors) {
+  const std::string s = std::string(100, 'a') + "\xC3\xA9\x80" +
+                        std::string(100, 'b') + "\xFF";
+  expect_error(utfx::validate_utf8(s.data(), s.size()), 102,
+               utf_error::stray_continuation);
+}
+
+TEST(ValidateUTF8Test, AgreesWithIsUTF8) {
+  const char* samples[] = {"", "abc", "\xC3\xA9", "\xC3", "\xED\xA0\x80",
+                           "\xEF\xBB\xBF\xC3"};
+  for (const char* s : samples) {
+    const size_t n = std::char_traits<char>::length(s);
+    EXPECT_EQ(utfx::validate_utf8(s, n).valid, utfx::is_utf8(s, n)) << s;
+  }
+}
+
+// ============================================================================
+// validate_utf8 / is_utf8 on several threads
+// ============================================================================
+
+#if !defined(UTFX_NO_THREADS)
+TEST(ParallelValidateUTF8Test, MatchesSingleThreadedAtEveryErrorOffset) {
+  // Every sequence length, so chunk boundaries land inside sequences.
+  std::string text;
+  while (text.size() < 300) {
+    text += "a\xC3\xA9\xE4\xBD\xA0\xF0\x9F\x98\x80";
+  }
+  const char* bad[] = {"\x80", "\xC3", "\xF0\x9F\x98", "\xED\xA0\x80",
+                       "\x80\x80\x80\x80\x80"};
+  for (const char* b : bad) {
+    for (size_t off = 0; off <= text.size(); off += 7) {
+      std::string s = text;
+      s.insert(off, b);
+      const validation_result expected =
+          utfx::validate_utf8(s.data(), s.size());
+      ASSERT_FALSE(expected.valid);
+      for (unsigned threads = 1; threads <= 9; ++threads) {
+        const validation_result r = utfx::detail::validate_utf8_parallel(
+            s.data(), s.size(), threads, 1);
+        ASSERT_FALSE(r.valid) << "threads " << threads << " offset " << off;
+        ASSERT_EQ(r.offset, expected.offset)
+            << "threads " << threads << " offset " << off;
+        ASSERT_EQ(r.error, expected.error)
+            << "threads " << threads << " offset " << off;
+      }
+    }
+  }
+  for (unsigned threads = 1; threads <= 9; ++threads) {
+    expect_valid(utfx::detail::validate_utf8_parallel(text.data(), text.size(),
+                                                      threads, 1),
+                 text.size());
+  }
+}
+
+TEST(ParallelValidateUTF8Test, LargeBuffer) {
+  std::string s;
+  while (s.size() < (size_t(5) << 20)) {
+    s += "plain ascii text, then \xE4\xB8\x96\xE7\x95\x8C ";
+  }
+  EXPECT_TRUE(utfx::is_utf8(s.data(), s.size(), 4));
+  EXPECT_TRUE(utfx::is_utf8(s.data(), s.size(), 0));
+  expect_valid(utfx::validate_utf8(s.data(), s.size(), 4), s.size());
+
+  const size_t at = s.size() - 1000;
+  s[at] = '\xFF';
+  s[s.size() - 10] = '\x80';
+  EXPECT_FALSE(utfx::is_utf8(s.data(), s.size(), 4));
+  expect_error(utfx::validate_utf8(s.data(), s.size(), 4), at,
+               utf_error::out_of_range);
+}
+#endif
+
+// ============================================================================
+// utf8_validator
+// ============================================================================
+
+namespace {
+
+// Feeds s in chunks of the given sizes (cycled) and returns finish().
+validation_result feed_in_chunks(const std::string& s,
+                                 const std::vector<size_t>& sizes) {
+  utfx::utf8_validator v;
+  size_t pos = 0;
+  for (size_t i = 0; pos < s.size(); ++i) {
+    const size_t n = std::min(sizes[i % sizes.size()], s.size() - pos);
+    const bool ok = v.feed(s.data() + pos, n);
+    pos += n;
+    if (!ok) {
+      break;
+    }
+  }
+  return v.finish();
+}
+
+}  // namespace
+
+TEST(UTF8ValidatorTest, EmptyStream) {
+  utfx::utf8_validator v;
+  EXPECT_TRUE(v.feed(nullptr, 0));
+  expect_valid(v.finish(), 0);
+}
+
+TEST(UTF8ValidatorTest, SequenceSplitAcrossChunks) {
+  utfx::utf8_validator v;
+  EXPECT_TRUE(v.feed("ab\xF0", 3));
+  EXPECT_EQ(v.pending(), 1u);
+  EXPECT_TRUE(v.feed("\x9F", 1));
+  EXPECT_EQ(v.pending(), 2u);
+  EXPECT_TRUE(v.feed("", 0));
+  EXPECT_TRUE(v.feed("\x98\x80" "cd", 4));
+  EXPECT_EQ(v.pending(), 0u);
+  expect_valid(v.finish(), 8);
+}
+
+TEST(UTF8ValidatorTest, ErrorsUseStreamOffsets) {
+  utfx::utf8_validator v;
+  EXPECT_TRUE(v.feed("abcd", 4));
+  EXPECT_TRUE(v.feed("ef\xE4", 3));
+  EXPECT_FALSE(v.feed("g", 1));  // E4 cut short by 'g'
+  EXPECT_FALSE(v.feed("h", 1));
+  expect_error(v.finish(), 6, utf_error::truncated);
+
+  v.reset();
+  EXPECT_TRUE(v.feed("abcd", 4));
+  EXPECT_FALSE(v.feed("e\xE0\x80", 3));  // overlong, seen before it ends
+  expect_error(v.finish(), 5, utf_error::overlong);
+}
+
+TEST(UTF8ValidatorTest, TruncatedAtFinish) {
+  utfx::utf8_validator v;
+  EXPECT_TRUE(v.feed("abc\xE4\xBD", 5));
+  expect_error(v.finish(), 3, utf_error::truncated);
+}
+
+TEST(UTF8ValidatorTest, MatchesWholeBufferValidation) {
+  std::string text;
+  while (text.size() < 200) {
+    text += "a\xC3\xA9\xE4\xBD\xA0\xF0\x9F\x98\x80";
+  }
+  const char* bad[] = {"",
+                       "\x80",
+                       "\xC3",
+                       "\xC0\x80",
+                       "\xE0\x9F\xBF",
+                       "\xED\xA0\x80",
+                       "\xF0\x9F\x98",
+                       "\xF4\x90\x80\x80",
+                       "\xFF"};
+  const std::vector<std::vector<size_t>> splits = {
+      {1}, {2}, {3}, {5}, {64}, {1, 2, 3, 0, 7}, {100, 1}};
+  for (const char* b : bad) {
+    for (size_t off = 0; off <= text.size(); off += 5) {
+      std::string s = text;
+      s.insert(off, b);
+      const validation_result expected =
+          utfx::validate_utf8(s.data(), s.size());
+      for (const auto& sizes : splits) {
+        const validation_result r = feed_in_chunks(s, sizes);
+        ASSERT_EQ(r.valid, expected.valid) << "offset " << off;
+        ASSERT_EQ(r.offset, expected.offset) << "offset " << off;
+        ASSERT_EQ(r.error, expected.error) << "offset " << off;
+      }
+    }
+  }
+}
+
+// ============================================================================
+// validate_utf16
+// ============================================================================
+
+TEST(ValidateUTF16Test, ValidBothEndians) {
+  for (auto e : {utfx::endian::little, utfx::endian::big}) {
+    const std::string s = utf16_bytes({0x0041, 0x4E16, 0xD83C, 0xDF0D}, e);
+    expect_valid(utfx::validate_utf16(s.data(), s.size(), e), 4);
+  }
+}
+
+TEST(ValidateUTF16Test, ErrorKinds) {
+  for (auto e : {utfx::endian::little, utfx::endian::big}) {
+    std::string s = utf16_bytes({0x0041, 0xDC00, 0x0042}, e);
+    expect_error(utfx::validate_utf16(s.data(), s.size(), e), 1,
+                 utf_error::surrogate);
+    s = utf16_bytes({0x0041, 0x0042, 0xD800, 0x0043}, e);
+    expect_error(utfx::validate_utf16(s.data(), s.size(), e), 2,
+                 utf_error::surrogate);
+    s = utf16_bytes({0x0041, 0xD800}, e);
+    expect_error(utfx::validate_utf16(s.data(), s.size(), e), 1,
+                 utf_error::truncated);
+  }
+}
+
+TEST(ValidateUTF16Test, OddLength) {
+  const std::string s = utf16_bytes({0x0041, 0x0042}, utfx::endian::little);
+  expect_error(utfx::validate_utf16(s.data(), 3, utfx::endian::little), 1,
+               utf_error::truncated);
+  // An error in the whole units comes first.
+  const std::string t = utf16_bytes({0xDC00, 0x0042}, utfx::endian::little);
+  expect_error(utfx::validate_utf16(t.data(), 3, utfx::endian::little), 0,
+               utf_error::surrogate);
+}
+
+TEST(ValidateUTF16Test, ByteOrderMark) {
+  const std::string le =
+      utf16_bytes({0xFEFF, 0x0041, 0xDC00}, utfx::endian::little);
+  // The BOM is skipped but offsets still count it.
+  expect_error(utfx::validate_utf16(le.data(), le.size(), utfx::endian::little),
+               2, utf_error::surrogate);
+  expect_error(utfx::validate_utf16(le.data(), le.size(), utfx::endian::big),
+               0, utf_error::byte_order_mark);
+  const std::string be = utf16_bytes({0xFEFF, 0x0041}, utfx::endian::big);
+  expect_valid(utfx::validate_utf16(be.data(), be.size(), utfx::endian::big),
+               2);
+  expect_error(utfx::validate_utf16(be.data(), be.size(), utfx::endian::little),
+               0, utf_error::byte_order_mark);
+}
+
+// ============================================================================
+// validate_utf32
+// ============================================================================
+
+TEST(ValidateUTF32Test, ValidBothEndians) {
+  for (auto e : {utfx::endian::little, utfx::endian::big}) {
+    const std::string s = utf32_bytes({0x41, 0xD7FF, 0xE000, 0x10FFFF}, e);
+    expect_valid(utfx::validate_utf32(s.data(), s.size(), e), 4);
+  }
+}
+
+TEST(ValidateUTF32Test, ErrorKinds) {
+  for (auto e : {utfx::endian::little, utfx::endian::big}) {
+    std::string s = utf32_bytes({0x41, 0xD800}, e);
+    expect_error(utfx::validate_utf32(s.data(), s.size(), e), 1,
+                 utf_error::surrogate);
+    s = utf32_bytes({0x41, 0x42, 0x110000}, e);
+    expect_error(utfx::validate_utf32(s.data(), s.size(), e), 2,
+                 utf_error::out_of_range);
+    s = utf32_bytes({0x41, 0x42}, e);
+    expect_error(utfx::validate_utf32(s.data(), 7, e), 1,
+                 utf_error::truncated);
+  }
+}
+
+TEST(ValidateUTF32Test, ByteOrderMark) {
+  const std::string le = utf32_bytes({0xFEFF, 0x41}, utfx::endian::little);
+  expect_valid(utfx::validate_utf32(le.data(), le.size(), utfx::endian::little),
+               2);
+  expect_error(utfx::validate_utf32(le.data(), le.size(), utfx::endian::big),
+               0, utf_error::byte_order_mark);
+  const std::string be = utf32_bytes({0xFEFF, 0x41}, utfx::endian::big);
+  expect_error(utfx::validate_utf32(be.data(), be.size(), utfx::endian::little),
+               0, utf_error::byte_order_mark);
+}
+
+TEST(IsUTF32Test, Basic) {
+  for (auto e : {utfx::endian::little, utfx::endian::big}) {
+    std::string s = utf32_bytes({0x41, 0x4E16, 0x1F30D}, e);
+    EXPECT_TRUE(utfx::is_utf32(s.data(), s.size(), e));
+    EXPECT_FALSE(utfx::is_utf32(s.data(), s.size() - 1, e));
+    s = utf32_bytes({0x41, 0xDC00}, e);
+    EXPECT_FALSE(utfx::is_utf32(s.data(), s.size(), e));
+  }
+  EXPECT_TRUE(utfx::is_utf32("", 0));
+  const char32_t native[] = U"utf-32 \U0001F30D";
+  EXPECT_TRUE(utfx::is_utf32(native, sizeof(native) - sizeof(char32_t)));
+}
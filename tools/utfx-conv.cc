@@ -0,0 +1,541 @@
+// utfx-conv — converts a file between UTF-8, UTF-16 and UTF-32 on all
+// cores.
+//
+//   utfx-conv -f utf-16le -t utf-8 [-j threads] [--on-error=stop] in out
+//
+// The input is memory-mapped and split at code point boundaries.  Each
+// thread first counts the exact output length of its chunk; a prefix sum
+// of the counts places every chunk in the output file, which is created at
+// its final size and mapped, so the threads then convert straight into it.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utfx/utfx.hpp>
+#include <vector>
+
+namespace {
+
+// Chunks are not made smaller than this many bytes of input.
+constexpr size_t min_chunk = size_t(1) << 16;
+
+enum class error_mode { stop, replace, skip };
+
+struct encoding {
+  const char* name;
+  size_t unit;
+  utfx::endian endian;
+};
+
+constexpr encoding encodings[] = {
+    {"UTF-8", 1, utfx::endian::native},
+    {"UTF-16LE", 2, utfx::endian::little},
+    {"UTF-16BE", 2, utfx::endian::big},
+    {"UTF-32LE", 4, utfx::endian::little},
+    {"UTF-32BE", 4, utfx::endian::big},
+};
+
+struct options {
+  const encoding* from = nullptr;
+  const encoding* to = nullptr;
+  unsigned threads = 0;
+  error_mode mode = error_mode::stop;
+  const char* input = nullptr;
+  const char* output = nullptr;
+};
+
+void usage(FILE* f) {
+  std::fputs(
+      "usage: utfx-conv -f FROM -t TO [-j THREADS] [--on-error=MODE] "
+      "INPUT OUTPUT\n"
+      "\n"
+      "  FROM, TO   utf-8, utf-16le, utf-16be, utf-32le or utf-32be\n"
+      "  THREADS    worker threads (default: one per hardware thread)\n"
+      "  MODE       stop (default): fail on ill-formed input\n"
+      "             replace: write U+FFFD for it\n"
+      "             skip: drop it\n"
+      "\n"
+      "FROM and TO must differ; UTF-16 and UTF-32 may differ in byte order\n"
+      "only.\n",
+      f);
+}
+
+// Matches names case-insensitively, with or without '-' and '_'.
+const encoding* find_encoding(const char* name) {
+  std::string key;
+  for (const char* p = name; *p != '\0'; ++p) {
+    if (*p != '-' && *p != '_') {
+      key += static_cast<char>(std::toupper(static_cast<unsigned char>(*p)));
+    }
+  }
+  for (const encoding& e : encodings) {
+    std::string candidate;
+    for (const char* p = e.name; *p != '\0'; ++p) {
+      if (*p != '-') {
+        candidate += *p;
+      }
+    }
+    if (candidate == key) {
+      return &e;
+    }
+  }
+  return nullptr;
+}
+
+const char* describe(utfx::utf_error error) {
+  switch (error) {
+    case utfx::utf_error::truncated:
+      return "truncated sequence";
+    case utfx::utf_error::overlong:
+      return "overlong encoding";
+    case utfx::utf_error::surrogate:
+      return "surrogate";
+    case utfx::utf_error::out_of_range:
+      return "code point above U+10FFFF";
+    case utfx::utf_error::stray_continuation:
+      return "stray continuation byte";
+    case utfx::utf_error::byte_order_mark:
+      return "byte order mark";
+    default:
+      return "ill-formed input";
+  }
+}
+
+// A file mapped whole, for reading or, once created at its final size,
+// for writing.
+class mapped_file {
+ public:
+  mapped_file() = default;
+  mapped_file(const mapped_file&) = delete;
+  mapped_file& operator=(const mapped_file&) = delete;
+
+  ~mapped_file() {
+    if (data_ != nullptr) {
+      munmap(data_, size_);
+    }
+    if (fd_ >= 0) {
+      close(fd_);
+    }
+  }
+
+  bool open_read(const char* path) {
+    fd_ = open(path, O_RDONLY);
+    struct stat st;
+    if (fd_ < 0 || fstat(fd_, &st) != 0) {
+      return false;
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    return map(PROT_READ, MAP_PRIVATE);
+  }
+
+  bool create(const char* path, size_t size) {
+    fd_ = open(path, O_RDWR | O_CREAT | O_TRUNC, 0666);
+    size_ = size;
+    if (fd_ < 0 || ftruncate(fd_, static_cast<off_t>(size)) != 0) {
+      return false;
+    }
+    return map(PROT_READ | PROT_WRITE, MAP_SHARED);
+  }
+
+  // Cuts a created file down to size bytes; the mapping stays as it is.
+  bool shrink(size_t size) {
+    return ftruncate(fd_, static_cast<off_t>(size)) == 0;
+  }
+
+  unsigned char* data() const { return static_cast<unsigned char*>(data_); }
+  size_t size() const { return size_; }
+
+ private:
+  bool map(int prot, int flags) {
+    if (size_ == 0) {
+      return true;
+    }
+    void* p = mmap(nullptr, size_, prot, flags, fd_, 0);
+    if (p == MAP_FAILED) {
+      return false;
+    }
+    data_ = p;
+    return true;
+  }
+
+  int fd_ = -1;
+  void* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+// Whether a code point starts at data[b] whatever came before it: no unit
+// before b can begin a sequence that reaches b.  Under on_error::skip an
+// ill-formed sequence runs on through the next unit that cannot continue
+// it, so a UTF-8 lead byte followed by fewer trail bytes than it announces
+// takes data[b] with it, and so does a UTF-16 high surrogate.  Where code
+// points start in a run of such units (E2 E2 E2 ...) depends on where the
+// run begins, so a boundary moves back past the whole run.
+template <typename In>
+bool starts_code_point(const In* data, size_t b, utfx::endian e) {
+  if (b == 0) {
+    return true;
+  }
+  if constexpr (sizeof(In) == 1) {
+    for (size_t q = b; q > 0 && b - q < 3;) {
+      const unsigned char c = static_cast<unsigned char>(data[--q]);
+      if ((c & 0xC0) != 0x80) {
+        const size_t len = c < 0xC2 || c > 0xF4 ? 1
+                           : c < 0xE0           ? 2
+                           : c < 0xF0           ? 3
+                                                : 4;
+        return len <= b - q;
+      }
+    }
+    return true;
+  } else if constexpr (sizeof(In) == 2) {
+    uint16_t v = static_cast<uint16_t>(data[b - 1]);
+    if (e != utfx::endian::native) {
+      v = static_cast<uint16_t>((v >> 8) | (v << 8));
+    }
+    return v < 0xD800 || v > 0xDBFF;
+  } else {
+    (void)data;
+    (void)e;
+    return true;
+  }
+}
+
+// Chunk boundaries over n units, each moved back to where a code point
+// starts in a conversion of the whole input, so that every error policy
+// gives the same output at any thread count.  On ill-formed input that
+// never resynchronizes a boundary may fall back onto the one before it,
+// leaving a chunk empty.
+template <typename In>
+std::vector<size_t> split(const In* data, size_t n, utfx::endian e,
+                          unsigned threads) {
+  size_t chunks = n * sizeof(In) / min_chunk;
+  if (chunks > threads) {
+    chunks = threads;
+  }
+  if (chunks == 0) {
+    chunks = 1;
+  }
+  std::vector<size_t> bounds(chunks + 1, n);
+  bounds[0] = 0;
+  for (size_t i = 1; i < chunks; ++i) {
+    size_t b = n / chunks * i;
+    while (b > bounds[i - 1] && !starts_code_point(data, b, e)) {
+      --b;
+    }
+    bounds[i] = b;
+  }
+  return bounds;
+}
+
+// Runs f(i) for every chunk i, one thread each.
+template <typename F>
+void for_each_chunk(size_t chunks, F f) {
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < chunks; ++i) {
+    threads.emplace_back(f, i);
+  }
+  f(0);
+  for (std::thread& t : threads) {
+    t.join();
+  }
+}
+
+// The transcode overloads, whichever form the pair of encodings takes.
+template <typename Out, typename In, typename Policy>
+size_t convert_chunk(const In* begin, const In* end, Out* out,
+                     utfx::endian from, utfx::endian to, Policy policy) {
+  if constexpr (sizeof(In) == 1) {
+    return utfx::transcode(begin, end, out, to, policy);
+  } else if constexpr (sizeof(Out) == 1) {
+    return utfx::transcode(begin, end, out, from, policy);
+  } else {
+    return utfx::transcode(begin, end, out, from, to, policy);
+  }
+}
+
+template <typename Out, typename In>
+size_t convert_valid_chunk(const In* begin, const In* end, Out* out,
+                           utfx::endian from, utfx::endian to) {
+  if constexpr (sizeof(In) == 1) {
+    return utfx::transcode_valid(begin, end, out, to);
+  } else if constexpr (sizeof(Out) == 1) {
+    return utfx::transcode_valid(begin, end, out, from);
+  } else {
+    return utfx::transcode_valid(begin, end, out, from, to);
+  }
+}
+
+// The first error found by any chunk, as an input offset in units.
+struct first_error {
+  size_t offset = SIZE_MAX;
+  utfx::utf_error error = utfx::utf_error::none;
+
+  void merge(const std::vector<first_error>& chunks) {
+    for (const first_error& e : chunks) {
+      if (e.offset < offset) {
+        *this = e;
+      }
+    }
+  }
+};
+
+int fail_input(const options& o, const first_error& e, size_t unit) {
+  std::fprintf(stderr, "utfx-conv: %s: ill-formed %s at byte %zu: %s\n",
+               o.input, o.from->name, e.offset * unit, describe(e.error));
+  return 1;
+}
+
+int fail_system(const char* path) {
+  std::fprintf(stderr, "utfx-conv: %s: %s\n", path, std::strerror(errno));
+  return 2;
+}
+
+// Converts between encodings of different unit sizes: counts, sums, then
+// converts into the mapped output.
+template <typename In, typename Out, typename Policy>
+int convert(const options& o, const In* data, size_t n, Policy policy) {
+  const utfx::endian from = o.from->endian;
+  const utfx::endian to = o.to->endian;
+  const std::vector<size_t> bounds = split(data, n, from, o.threads);
+  const size_t chunks = bounds.size() - 1;
+  constexpr bool stop = std::is_same<Policy, utfx::on_error::stop_t>::value;
+
+  std::vector<size_t> offsets(chunks + 1, 0);
+  std::vector<first_error> errors(chunks);
+  for_each_chunk(chunks, [&](size_t i) {
+    const In* begin = data + bounds[i];
+    const In* end = data + bounds[i + 1];
+    if constexpr (stop) {
+      try {
+        offsets[i + 1] =
+            convert_chunk(begin, end, static_cast<Out*>(nullptr), from, to,
+                          utfx::on_error::throw_exception);
+      } catch (const utfx::conversion_error& e) {
+        errors[i] = first_error{bounds[i] + e.offset(), e.error()};
+      }
+    } else {
+      offsets[i + 1] = convert_chunk(begin, end, static_cast<Out*>(nullptr),
+                                     from, to, policy);
+    }
+  });
+  first_error error;
+  error.merge(errors);
+  if (error.offset != SIZE_MAX) {
+    return fail_input(o, error, sizeof(In));
+  }
+  for (size_t i = 0; i < chunks; ++i) {
+    offsets[i + 1] += offsets[i];
+  }
+
+  mapped_file output;
+  if (!output.create(o.output, offsets[chunks] * sizeof(Out))) {
+    return fail_system(o.output);
+  }
+  Out* out = reinterpret_cast<Out*>(output.data());
+  for_each_chunk(chunks, [&](size_t i) {
+    const In* begin = data + bounds[i];
+    const In* end = data + bounds[i + 1];
+    if constexpr (stop) {
+      // Counting found no error, so nothing is checked again.
+      convert_valid_chunk(begin, end, out + offsets[i], from, to);
+    } else {
+      convert_chunk(begin, end, out + offsets[i], from, to, policy);
+    }
+  });
+  return 0;
+}
+
+// UTF-16 or UTF-32 to the other byte order.  Each chunk is swapped and
+// validated in one pass straight into the output, created at the size of
+// the input.  A chunk that turns out to be ill-formed is converted again
+// in place under the policy, which writes at most a unit per unit: under
+// skip the chunks are then moved down over what was dropped and the file
+// cut to its length.
+template <typename Unit, typename Policy>
+int swap(const options& o, const Unit* data, size_t n, Policy policy) {
+  const utfx::endian from = o.from->endian;
+  const utfx::endian to = o.to->endian;
+  const std::vector<size_t> bounds = split(data, n, from, o.threads);
+  const size_t chunks = bounds.size() - 1;
+  constexpr bool stop = std::is_same<Policy, utfx::on_error::stop_t>::value;
+  mapped_file output;
+  if (!output.create(o.output, n * sizeof(Unit))) {
+    return fail_system(o.output);
+  }
+  Unit* out = reinterpret_cast<Unit*>(output.data());
+  std::vector<size_t> lengths(chunks);
+  std::vector<first_error> errors(chunks);
+  for_each_chunk(chunks, [&](size_t i) {
+    const size_t len = bounds[i + 1] - bounds[i];
+    const Unit* in = data + bounds[i];
+    utfx::validation_result r{};
+    if constexpr (sizeof(Unit) == 2) {
+      r = utfx::change_endianness_utf16(in, len, out + bounds[i], from);
+    } else {
+      r = utfx::change_endianness_utf32(in, len, out + bounds[i], from);
+    }
+    lengths[i] = len;
+    if (r.valid) {
+      return;
+    }
+    if constexpr (stop) {
+      errors[i] = first_error{bounds[i] + r.offset, r.error};
+    } else {
+      lengths[i] =
+          convert_chunk(in, in + len, out + bounds[i], from, to, policy);
+    }
+  });
+  first_error error;
+  error.merge(errors);
+  if (error.offset != SIZE_MAX) {
+    unlink(o.output);
+    return fail_input(o, error, sizeof(Unit));
+  }
+  size_t written = 0;
+  for (size_t i = 0; i < chunks; ++i) {
+    if (written != bounds[i]) {
+      std::memmove(out + written, out + bounds[i], lengths[i] * sizeof(Unit));
+    }
+    written += lengths[i];
+  }
+  if (written != n && !output.shrink(written * sizeof(Unit))) {
+    return fail_system(o.output);
+  }
+  return 0;
+}
+
+template <typename In, typename Out>
+int run(const options& o, const unsigned char* bytes, size_t len) {
+  const In* data = reinterpret_cast<const In*>(bytes);
+  const size_t n = len / sizeof(In);
+  if constexpr (std::is_same<In, char>::value &&
+                std::is_same<Out, char>::value) {
+    return 2;  // parse() turns down UTF-8 to UTF-8.
+  } else if constexpr (sizeof(In) == sizeof(Out)) {
+    switch (o.mode) {
+      case error_mode::stop:
+        return swap(o, data, n, utfx::on_error::stop);
+      case error_mode::replace:
+        return swap(o, data, n, utfx::on_error::replace);
+      default:
+        return swap(o, data, n, utfx::on_error::skip);
+    }
+  } else {
+    switch (o.mode) {
+      case error_mode::stop:
+        return convert<In, Out>(o, data, n, utfx::on_error::stop);
+      case error_mode::replace:
+        return convert<In, Out>(o, data, n, utfx::on_error::replace);
+      default:
+        return convert<In, Out>(o, data, n, utfx::on_error::skip);
+    }
+  }
+}
+
+template <typename In>
+int run_from(const options& o, const unsigned char* bytes, size_t len) {
+  switch (o.to->unit) {
+    case 1:
+      return run<In, char>(o, bytes, len);
+    case 2:
+      return run<In, char16_t>(o, bytes, len);
+    default:
+      return run<In, char32_t>(o, bytes, len);
+  }
+}
+
+bool parse(int argc, char** argv, options& o) {
+  std::vector<const char*> files;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    const bool has_value = i + 1 < argc;
+    if ((arg == "-f" || arg == "-t" || arg == "-j") && !has_value) {
+      return false;
+    }
+    if (arg == "-f") {
+      o.from = find_encoding(argv[++i]);
+      if (o.from == nullptr) {
+        std::fprintf(stderr, "utfx-conv: unknown encoding %s\n", argv[i]);
+        return false;
+      }
+    } else if (arg == "-t") {
+      o.to = find_encoding(argv[++i]);
+      if (o.to == nullptr) {
+        std::fprintf(stderr, "utfx-conv: unknown encoding %s\n", argv[i]);
+        return false;
+      }
+    } else if (arg == "-j") {
+      o.threads = static_cast<unsigned>(std::strtoul(argv[++i], nullptr, 10));
+    } else if (arg == "--on-error=stop") {
+      o.mode = error_mode::stop;
+    } else if (arg == "--on-error=replace") {
+      o.mode = error_mode::replace;
+    } else if (arg == "--on-error=skip") {
+      o.mode = error_mode::skip;
+    } else if (!arg.empty() && arg[0] == '-') {
+      return false;
+    } else {
+      files.push_back(argv[i]);
+    }
+  }
+  if (o.from == nullptr || o.to == nullptr || o.from == o.to ||
+      files.size() != 2) {
+    return false;
+  }
+  o.input = files[0];
+  o.output = files[1];
+  return true;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  if (argc == 2 && (std::strcmp(argv[1], "-h") == 0 ||
+                    std::strcmp(argv[1], "--help") == 0)) {
+    usage(stdout);
+    return 0;
+  }
+  options o;
+  if (!parse(argc, argv, o)) {
+    usage(stderr);
+    return 2;
+  }
+  if (o.threads == 0) {
+    o.threads = std::thread::hardware_concurrency();
+    if (o.threads == 0) {
+      o.threads = 1;
+    }
+  }
+
+  mapped_file input;
+  if (!input.open_read(o.input)) {
+    return fail_system(o.input);
+  }
+  const size_t len = input.size();
+  if (len % o.from->unit != 0) {
+    const first_error e{len / o.from->unit, utfx::utf_error::truncated};
+    return fail_input(o, e, o.from->unit);
+  }
+  if (len != 0) {
+    madvise(input.data(), len, MADV_SEQUENTIAL);
+  }
+  switch (o.from->unit) {
+    case 1:
+      return run_from<char>(o, input.data(), len);
+    case 2:
+      return run_from<char16_t>(o, input.data(), len);
+    default:
+      return run_from<char32_t>(o, input.data(), len);
+  }
+}
@@ -0,0 +1,116 @@
+# Round-trips a file through every encoding with utfx-conv, on several
+# threads, and checks the handling of ill-formed input.
+#
+#   cmake -DUTFX_CONV=<utfx-conv> -DWORK_DIR=<dir> -P utfx_conv_test.cmake
+
+file(REMOVE_RECURSE "${WORK_DIR}")
+file(MAKE_DIRECTORY "${WORK_DIR}")
+
+function(conv expected_result)
+  execute_process(
+    COMMAND "${UTFX_CONV}" ${ARGN}
+    WORKING_DIRECTORY "${WORK_DIR}"
+    RESULT_VARIABLE result
+    ERROR_VARIABLE error)
+  if(NOT result EQUAL expected_result)
+    message(FATAL_ERROR "utfx-conv ${ARGN}: exit ${result}, "
+                        "expected ${expected_result}\n${error}")
+  endif()
+endfunction()
+
+function(expect_same a b)
+  execute_process(
+    COMMAND ${CMAKE_COMMAND} -E compare_files "${WORK_DIR}/${a}"
+            "${WORK_DIR}/${b}" RESULT_VARIABLE result)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${a} and ${b} differ")
+  endif()
+endfunction()
+
+function(expect_hex file expected)
+  file(READ "${WORK_DIR}/${file}" hex HEX)
+  if(NOT hex STREQUAL expected)
+    message(FATAL_ERROR "${file}: ${hex}, expected ${expected}")
+  endif()
+endfunction()
+
+# About 900 KiB, so that the input is split between threads.
+string(REPEAT "café € 😀 plain ascii text\n" 25000 text)
+file(WRITE "${WORK_DIR}/in.txt" "${text}")
+
+conv(0 -j 4 -f utf-8 -t utf-16le in.txt a.16le)
+conv(0 -j 4 -f UTF-16LE -t utf-32be a.16le b.32be)
+conv(0 -j 4 -f utf32be -t utf-16be b.32be c.16be)
+conv(0 -j 4 -f utf-16be -t utf-16le c.16be d.16le)
+expect_same(a.16le d.16le)
+conv(0 -j 3 -f utf-16le -t utf-32le d.16le e.32le)
+conv(0 -j 3 -f utf-32le -t utf-8 e.32le out.txt)
+expect_same(in.txt out.txt)
+
+file(WRITE "${WORK_DIR}/empty.txt" "")
+conv(0 -f utf-8 -t utf-16le empty.txt empty.16le)
+expect_hex(empty.16le "")
+
+# "a", a stray continuation byte, "b".
+file(WRITE "${WORK_DIR}/bad.txt" "a")
+string(ASCII 128 stray)
+file(APPEND "${WORK_DIR}/bad.txt" "${stray}b")
+conv(1 -f utf-8 -t utf-16le bad.txt bad.16le)
+if(EXISTS "${WORK_DIR}/bad.16le")
+  message(FATAL_ERROR "output written for ill-formed input")
+endif()
+conv(0 --on-error=replace -f utf-8 -t utf-16le bad.txt replaced.16le)
+expect_hex(replaced.16le "6100fdff6200")
+conv(0 --on-error=skip -f utf-8 -t utf-16be bad.txt skipped.16be)
+expect_hex(skipped.16be "00610062")
+
+# Four 64 KiB slices, each ending in a sequence that takes the 'A'
+# starting the next one under skip: the output must not depend on -j.
+string(ASCII 226 e2)
+string(ASCII 244 f4)
+string(ASCII 159 x9f)
+string(REPEAT "a" 65535 a65535)
+string(REPEAT "a" 65532 a65532)
+string(REPEAT "a" 65533 a65533)
+file(WRITE "${WORK_DIR}/cut.txt"
+     "${a65535}${e2}A${a65532}${e2}${e2}${e2}A${a65533}${f4}${x9f}A${a65535}")
+foreach(mode skip replace)
+  conv(0 -j 1 --on-error=${mode} -f utf-8 -t utf-16le cut.txt ${mode}1.16le)
+  conv(0 -j 4 --on-error=${mode} -f utf-8 -t utf-16le cut.txt ${mode}4.16le)
+  expect_same(${mode}1.16le ${mode}4.16le)
+endforeach()
+
+# Changing only the byte order applies the policy too.  In UTF-16LE
+# 4242 D841 4141 holds a lone high surrogate, which under skip takes the
+# unit after it along, and in UTF-32LE 41414141 is above U+10FFFF.
+string(ASCII 216 d8)
+file(WRITE "${WORK_DIR}/lone.16le" "BBA${d8}AA")
+conv(1 -f utf-16le -t utf-16be lone.16le lone.16be)
+conv(0 --on-error=replace -f utf-16le -t utf-16be lone.16le replaced.16be)
+expect_hex(replaced.16be "4242fffd4141")
+conv(0 --on-error=skip -f utf-16le -t utf-16be lone.16le skipped.16be)
+expect_hex(skipped.16be "4242")
+file(WRITE "${WORK_DIR}/big.32le" "AAAA")
+conv(0 --on-error=replace -f utf-32le -t utf-32be big.32le replaced.32be)
+expect_hex(replaced.32be "0000fffd")
+conv(0 --on-error=skip -f utf-32le -t utf-32be big.32le skipped.32be)
+expect_hex(skipped.32be "")
+
+# The same across threads, where skip leaves every chunk shorter.
+string(REPEAT "BBA${d8}AA" 60000 lones)
+file(WRITE "${WORK_DIR}/lones.16le" "${lones}")
+foreach(mode skip replace)
+  conv(0 -j 1 --on-error=${mode} -f utf-16le -t utf-16be lones.16le
+       ${mode}1.16be)
+  conv(0 -j 4 --on-error=${mode} -f utf-16le -t utf-16be lones.16le
+       ${mode}4.16be)
+  expect_same(${mode}1.16be ${mode}4.16be)
+endforeach()
+file(SIZE "${WORK_DIR}/skip4.16be" size)
+if(NOT size EQUAL 120000)
+  message(FATAL_ERROR "skip4.16be: ${size} bytes, expected 120000")
+endif()
+
+# An odd number of bytes is not UTF-16.
+conv(1 -f utf-16le -t utf-8 bad.txt odd.txt)
+conv(2 -f utf-8 -t utf-8 in.txt same.txt)